@@ -28,9 +28,16 @@ parameters = [
     Parameter('current.step', int, 0, None, '%d'),
     Parameter('iterations.real', int, 1, None, '%d'),
     Parameter('random.seed', int, -1, None, '%d'),
+    Parameter('random.generator', str, 'mt19937', None, '%s'),
+    Parameter('random.counter', bool, False, None, '%s'),
+    Parameter('parallel.step', bool, False, None, '%s'),
+    Parameter('rejection.free', bool, False, None, '%s'),
+    Parameter('carriers.sort', int, 0, None, '%d'),
+    Parameter('carriers.batched', bool, False, None, '%s'),
     Parameter('grid.z', int, 1, None, '%d'),
     Parameter('grid.y', int, 1, None, '%d'),
     Parameter('grid.x', int, 1, None, '%d'),
+    Parameter('grid.sparse', bool, False, None, '%s'),
     Parameter('hopping.range', int, 1, None, '%d'),
     Parameter('output.is.on', bool, True, None, '%s'),
     Parameter('iterations.print', int, 1, None, '%d'),
@@ -60,11 +67,19 @@ parameters = [
     Parameter('trap.potential', float, 0.0, None, '%.15e'),
     Parameter('gaussian.stdev', float, 0.0, None, '%.15e'),
     Parameter('seed.percentage', float, 1.0, None, '%.15e'),
+    Parameter('trap.escape', int, 0, None, '%d'),
     Parameter('voltage.right', float, 0.0, None, '%.15e'),
     Parameter('voltage.left', float, 0.0, None, '%.15e'),
     Parameter('slope.z', float, 0.0, None, '%.15e'),
     Parameter('coulomb.carriers', bool, False, None, '%s'),
     Parameter('coulomb.gaussian.sigma', float, 0.0, None, '%.15e'),
+    Parameter('coulomb.incremental', bool, False, None, '%s'),
+    Parameter('coulomb.lazy', bool, False, None, '%s'),
+    Parameter('coulomb.mesh', str, 'off', None, '%s'),
+    Parameter('coulomb.mesh.cutoff', int, 8, None, '%d'),
+    Parameter('poisson.multigrid', bool, False, None, '%s'),
+    Parameter('poisson.update', int, 10, None, '%d'),
+    Parameter('poisson.tolerance', float, 1e-6, None, '%.15e'),
     Parameter('defects.charge', int, 0, None, '%d'),
     Parameter('exciton.binding', float, 0.0, None, '%.15e'),
     Parameter('temperature.kelvin', float, 300.0, None, '%.15e'),
@@ -12,6 +12,7 @@
 #include "nodefileparser.h"
 #include "parameters.h"
 #include "clparser.h"
+#include "mpihelper.h"
 
 #include <QApplication>
 
@@ -24,6 +25,9 @@ using namespace LangmuirCore;
  */
 int main (int argc, char *argv[])
 {
+    // Start MPI (does nothing without LANGMUIR_MPI)
+    MpiHelper::initialize(&argc, &argv);
+
     // Get the current time
     QDateTime begin = QDateTime::currentDateTime();
     QString dateFMT = "MM/dd/yyyy";
@@ -59,8 +63,11 @@ int main (int argc, char *argv[])
     // Get the simulation Parameters
     SimulationParameters &par = world.parameters();
 
-    // Save the parameters
-    world.keyValueParser().save("%stub.parm");
+    // Save the parameters (once, for MPI runs)
+    if (world.mpi().isRoot())
+    {
+        world.keyValueParser().save("%stub.parm");
+    }
 
     // Create the simulation
     Simulation sim(world);
@@ -74,6 +81,15 @@ int main (int argc, char *argv[])
         sim.performIterations (par.iterationsPrint);
     }
 
+    // Report how far trapped carriers skipped ahead
+    if (par.trapEscape > 0)
+    {
+        qDebug("langmuir: trap.escape skipped %lld carrier steps in %lld sampled escapes",
+               sim.acceleratedSteps(), sim.trapEscapes());
+        qDebug("langmuir: trap.escape skipped %lld whole steps, when every carrier was trapped",
+               sim.skippedSteps());
+    }
+
     // The time this simulation stops
     QDateTime stop = QDateTime::currentDateTime();
 
@@ -120,5 +136,8 @@ int main (int argc, char *argv[])
                     << flush;
     }
 
+    // Stop MPI
+    MpiHelper::finalize();
+
     qDebug("langmuir: exited successfully");
 }
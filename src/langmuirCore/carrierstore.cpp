@@ -0,0 +1,215 @@
+#include "carrierstore.h"
+#include "chargeagent.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include <QPair>
+
+namespace LangmuirCore
+{
+
+// Spread the low 21 bits of v so there are two zero bits between each of them
+static quint64 spreadBits(quint64 v)
+{
+    v &= Q_UINT64_C(0x1fffff);
+    v = (v | (v << 32)) & Q_UINT64_C(0x001f00000000ffff);
+    v = (v | (v << 16)) & Q_UINT64_C(0x001f0000ff0000ff);
+    v = (v | (v << 8))  & Q_UINT64_C(0x100f00f00f00f00f);
+    v = (v | (v << 4))  & Q_UINT64_C(0x10c30c30c30c30c3);
+    v = (v | (v << 2))  & Q_UINT64_C(0x1249249249249249);
+    return v;
+}
+
+CarrierStore::CarrierStore(Agent::Type type, World &world, QObject *parent)
+    : QObject(parent), m_type(type), m_world(world)
+{
+    if (m_type != Agent::Electron && m_type != Agent::Hole)
+    {
+        qFatal("langmuir: can not create CarrierStore for %s",
+               qPrintable(Agent::toQString(m_type)));
+    }
+}
+
+CarrierStore::~CarrierStore()
+{
+    for (int i = 0; i < m_pool.size(); i++)
+    {
+        delete m_pool[i];
+    }
+    m_pool.clear();
+    m_active.clear();
+    m_activeSlots.clear();
+    m_activeX.clear();
+    m_activeY.clear();
+    m_activeZ.clear();
+    m_index.clear();
+    m_free.clear();
+}
+
+ChargeAgent* CarrierStore::create(SiteID site)
+{
+    int slot = 0;
+    if (m_free.isEmpty())
+    {
+        // Grow every array by one slot
+        slot = m_pool.size();
+        m_site.push_back(-1);
+        m_futureSite.push_back(-1);
+        m_charge.push_back(0);
+        m_lifetime.push_back(0);
+        m_pathlength.push_back(0);
+        m_de.push_back(0);
+        m_poissonSite.push_back(-1);
+        m_pool.push_back(0);
+        m_index.push_back(-1);
+    }
+    else
+    {
+        // Reuse the most recently freed slot
+        slot = m_free.back();
+        m_free.pop_back();
+    }
+
+    m_site[slot] = site;
+    m_futureSite[slot] = site;
+    m_charge[slot] = unitCharge();
+    m_lifetime[slot] = 0;
+    m_pathlength[slot] = 0;
+    m_de[slot] = 0;
+    m_poissonSite[slot] = -1;
+
+    // The ChargeAgent stays with its slot, so it is only constructed once
+    if (m_pool[slot] == 0)
+    {
+        if (m_type == Agent::Electron)
+        {
+            m_pool[slot] = new ElectronAgent(m_world, *this, slot);
+        }
+        else
+        {
+            m_pool[slot] = new HoleAgent(m_world, *this, slot);
+        }
+    }
+
+    ChargeAgent *charge = m_pool[slot];
+
+    m_index[slot] = m_active.size();
+    m_active.push_back(charge);
+    m_activeSlots.push_back(slot);
+    m_activeX.push_back(0);
+    m_activeY.push_back(0);
+    m_activeZ.push_back(0);
+
+    // Sets the coordinates too
+    charge->place(site);
+
+    return charge;
+}
+
+void CarrierStore::setSite(int slot, SiteID site)
+{
+    m_site[slot] = site;
+
+    int index = m_index[slot];
+    if (index >= 0)
+    {
+        Grid &grid = m_world.electronGrid();
+        m_activeX[index] = grid.getIndexX(site);
+        m_activeY[index] = grid.getIndexY(site);
+        m_activeZ[index] = grid.getIndexZ(site);
+    }
+}
+
+void CarrierStore::remove(int index)
+{
+    int slot = m_activeSlots[index];
+
+    // Keep the creation order of the remaining carriers
+    m_active.remove(index);
+    m_activeSlots.remove(index);
+    m_activeX.remove(index);
+    m_activeY.remove(index);
+    m_activeZ.remove(index);
+    for (int i = index; i < m_activeSlots.size(); i++)
+    {
+        m_index[m_activeSlots[i]] = i;
+    }
+
+    m_index[slot] = -1;
+    m_site[slot] = -1;
+    m_futureSite[slot] = -1;
+    m_free.push_back(slot);
+}
+
+void CarrierStore::compact()
+{
+    // Slide the kept carriers down over the removed ones
+    int kept = 0;
+    for (int i = 0; i < m_active.size(); i++)
+    {
+        int slot = m_activeSlots[i];
+        if (m_active[i]->removed())
+        {
+            m_index[slot] = -1;
+            m_site[slot] = -1;
+            m_futureSite[slot] = -1;
+            m_free.push_back(slot);
+            continue;
+        }
+        if (kept != i)
+        {
+            m_active[kept] = m_active[i];
+            m_activeSlots[kept] = slot;
+            m_activeX[kept] = m_activeX[i];
+            m_activeY[kept] = m_activeY[i];
+            m_activeZ[kept] = m_activeZ[i];
+            m_index[slot] = kept;
+        }
+        kept++;
+    }
+
+    m_active.resize(kept);
+    m_activeSlots.resize(kept);
+    m_activeX.resize(kept);
+    m_activeY.resize(kept);
+    m_activeZ.resize(kept);
+}
+
+void CarrierStore::sort()
+{
+    int count = m_active.size();
+
+    // The index breaks ties, so equal codes keep their order
+    QVector< QPair<quint64, int> > keys(count);
+    for (int i = 0; i < count; i++)
+    {
+        quint64 code = spreadBits(m_activeX[i]) |
+                      (spreadBits(m_activeY[i]) << 1) |
+                      (spreadBits(m_activeZ[i]) << 2);
+        keys[i] = qMakePair(code, i);
+    }
+    qSort(keys);
+
+    QVector<ChargeAgent*> active(count);
+    QVector<int> activeSlots(count);
+    QVector<int> activeX(count);
+    QVector<int> activeY(count);
+    QVector<int> activeZ(count);
+    for (int i = 0; i < count; i++)
+    {
+        int j = keys[i].second;
+        active[i] = m_active[j];
+        activeSlots[i] = m_activeSlots[j];
+        activeX[i] = m_activeX[j];
+        activeY[i] = m_activeY[j];
+        activeZ[i] = m_activeZ[j];
+        m_index[activeSlots[i]] = i;
+    }
+
+    m_active = active;
+    m_activeSlots = activeSlots;
+    m_activeX = activeX;
+    m_activeY = activeY;
+    m_activeZ = activeZ;
+}
+
+}
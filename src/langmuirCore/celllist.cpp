@@ -0,0 +1,122 @@
+#include "celllist.h"
+#include "coulombkernel.h"
+
+namespace LangmuirCore
+{
+
+CellList::CellList()
+{
+    for (int i = 0; i < 3; i++)
+    {
+        m_size[i] = 0;
+        m_count[i] = 0;
+        m_periodic[i] = false;
+    }
+}
+
+void CellList::initialize(int xSize, int ySize, int zSize, int cellSize,
+                          bool xPeriodic, bool yPeriodic, bool zPeriodic)
+{
+    m_size[0] = xSize;
+    m_size[1] = ySize;
+    m_size[2] = zSize;
+    m_periodic[0] = xPeriodic;
+    m_periodic[1] = yPeriodic;
+    m_periodic[2] = zPeriodic;
+
+    // Rounding the count down makes every cell at least cellSize sites wide
+    for (int i = 0; i < 3; i++)
+    {
+        m_count[i] = qMax(1, m_size[i] / qMax(1, cellSize));
+    }
+
+    m_cells.clear();
+    m_cells.resize(m_count[0] * m_count[1] * m_count[2]);
+}
+
+void CellList::insert(int x, int y, int z)
+{
+    Cell &cell = m_cells[cellIndex(0, x) + m_count[0] * (cellIndex(1, y) + m_count[1] * cellIndex(2, z))];
+    cell.x.push_back(x);
+    cell.y.push_back(y);
+    cell.z.push_back(z);
+}
+
+void CellList::remove(int x, int y, int z)
+{
+    Cell &cell = m_cells[cellIndex(0, x) + m_count[0] * (cellIndex(1, y) + m_count[1] * cellIndex(2, z))];
+    for (int i = 0; i < cell.x.size(); i++)
+    {
+        if (cell.x[i] == x && cell.y[i] == y && cell.z[i] == z)
+        {
+            int last = cell.x.size() - 1;
+            cell.x[i] = cell.x[last];
+            cell.y[i] = cell.y[last];
+            cell.z[i] = cell.z[last];
+            cell.x.resize(last);
+            cell.y.resize(last);
+            cell.z.resize(last);
+            return;
+        }
+    }
+    qFatal("langmuir: can not remove carrier at (%d, %d, %d) from cell list", x, y, z);
+}
+
+int CellList::neighborCells(int axis, int c, int *cells) const
+{
+    int count = m_count[axis];
+
+    // Every cell is a neighbor; listing them once avoids visiting a wrapped cell twice
+    if (count <= 3)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            cells[i] = i;
+        }
+        return count;
+    }
+
+    int n = 0;
+    for (int i = c - 1; i <= c + 1; i++)
+    {
+        if (m_periodic[axis])
+        {
+            cells[n++] = (i + count) % count;
+        }
+        else if (i >= 0 && i < count)
+        {
+            cells[n++] = i;
+        }
+    }
+    return n;
+}
+
+qint64 CellList::sum(const CoulombKernel &kernel, int xi, int yi, int zi) const
+{
+    int cx[3];
+    int cy[3];
+    int cz[3];
+    int nx = neighborCells(0, cellIndex(0, xi), cx);
+    int ny = neighborCells(1, cellIndex(1, yi), cy);
+    int nz = neighborCells(2, cellIndex(2, zi), cz);
+
+    qint64 sum = 0;
+    for (int k = 0; k < nz; k++)
+    {
+        for (int j = 0; j < ny; j++)
+        {
+            for (int i = 0; i < nx; i++)
+            {
+                const Cell &cell = m_cells[cx[i] + m_count[0] * (cy[j] + m_count[1] * cz[k])];
+                if (!cell.x.isEmpty())
+                {
+                    sum += kernel.sum(cell.x.constData(), cell.y.constData(), cell.z.constData(),
+                                      cell.x.size(), xi, yi, zi);
+                }
+            }
+        }
+    }
+    return sum;
+}
+
+}
@@ -1,5 +1,6 @@
 #include "openclhelper.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "drainagent.h"
 #include "parameters.h"
 #include "simulation.h"
@@ -10,39 +11,62 @@
 
 namespace LangmuirCore
 {
-ChargeAgent::ChargeAgent(Agent::Type type, World &world, Grid &grid, int site,QObject *parent)
-    : Agent(type, world, site, parent), m_grid(grid)
+ChargeAgent::ChargeAgent(Agent::Type type, World &world, Grid &grid, CarrierStore &store, int slot,
+                         QObject *parent)
+    : Agent(type, world, -1, parent), m_grid(grid), m_store(store), m_slot(slot), m_fIndex(-1), m_uniform(-1)
 {
-    m_site = m_fSite;
-    m_charge = 0;
     m_removed = false;
-    m_lifetime = 0;
-    m_pathlength = 0;
+    m_trapped = false;
     m_openClID = 0;
-    m_de = 0;
 }
 
-ElectronAgent::ElectronAgent(World &world, int site, QObject *parent)
-    : ChargeAgent(Agent::Electron, world, world.electronGrid(), site, parent)
+ElectronAgent::ElectronAgent(World &world, CarrierStore &store, int slot, QObject *parent)
+    : ChargeAgent(Agent::Electron, world, world.electronGrid(), store, slot, parent)
 {
-    m_charge = -1;
-    m_grid.registerAgent(this);
 }
 
-HoleAgent::HoleAgent(World &world, int site, QObject *parent)
-    : ChargeAgent(Agent::Hole, world, world.holeGrid(), site, parent)
+HoleAgent::HoleAgent(World &world, CarrierStore &store, int slot, QObject *parent)
+    : ChargeAgent(Agent::Hole, world, world.holeGrid(), store, slot, parent)
 {
-    m_charge = +1;
-    m_grid.registerAgent(this);
 }
 
 ChargeAgent::~ChargeAgent()
 {
 }
 
+inline void ChargeAgent::setSite(SiteID site)
+{
+    m_site = site;
+    m_store.setSite(m_slot, site);
+}
+
+inline void ChargeAgent::setFuture(SiteID site)
+{
+    m_fSite = site;
+    m_fIndex = -1;
+    m_uniform = -1;
+    m_store.futureSite(m_slot) = site;
+}
+
+void ChargeAgent::place(SiteID site)
+{
+    setSite(site);
+    setFuture(site);
+    m_removed = false;
+    m_trapped = false;
+    m_openClID = 0;
+    m_grid.registerAgent(this);
+    m_world.potential().addToCarrierField(m_site, charge());
+}
+
+int ChargeAgent::slot()
+{
+    return m_slot;
+}
+
 int ChargeAgent::charge()
 {
-    return m_charge;
+    return m_store.charge(m_slot);
 }
 
 bool ChargeAgent::removed()
@@ -52,12 +76,12 @@ bool ChargeAgent::removed()
 
 int ChargeAgent::lifetime()
 {
-    return m_lifetime;
+    return m_store.lifetime(m_slot);
 }
 
 int ChargeAgent::pathlength()
 {
-    return m_pathlength;
+    return m_store.pathlength(m_slot);
 }
 
 void ChargeAgent::setOpenCLID(int id)
@@ -70,11 +94,142 @@ int ChargeAgent::getOpenCLID()
     return m_openClID;
 }
 
-void ChargeAgent::chooseFuture()
+void ChargeAgent::chooseFuture(int id)
 {
+    // TrapEscape picks the moves of trapped charges
+    if (m_trapped)
+    {
+        return;
+    }
+
     // Select a proposed transport site at random
-    m_fSite = m_neighbors[m_world.randomNumberGenerator().integer(0, m_neighbors.size()-1)];
-    m_de = 0;
+    int range = m_world.parameters().hoppingRange;
+    int count = m_grid.neighborCount(m_neighborClass, range);
+    int index = 0;
+    if (m_world.parameters().randomCounter)
+    {
+        // Draw from a stream that only depends on the seed, step and carrier
+        m_random = m_world.randomNumberGenerator().stream(
+                    m_world.parameters().currentStep, m_type, id);
+        index = m_random.integer(0, count - 1);
+    }
+    else
+    {
+        index = m_world.randomNumberGenerator().integer(0, count - 1);
+    }
+    setFuture(m_grid.neighbor(m_site, m_neighborClass, index, range));
+    m_fIndex = index;
+    m_store.de(m_slot) = 0;
+
+    // Draw the Metropolis uniform now, so the Coulomb kernels can skip the moves it decides
+    if (m_world.parameters().coulombLazy && m_grid.agentType(m_fSite) == Agent::Empty)
+    {
+        if (m_world.parameters().randomCounter)
+        {
+            m_uniform = m_random.random();
+        }
+        else
+        {
+            m_uniform = m_world.randomNumberGenerator().random();
+        }
+    }
+}
+
+bool ChargeAgent::needsCoulomb()
+{
+    if (!m_world.parameters().coulombLazy)
+    {
+        return true;
+    }
+
+    // Only moves to empty sites use it, and no move is accepted with a uniform above the coupling
+    return m_uniform >= 0 && m_uniform < futureCoupling();
+}
+
+double ChargeAgent::futureCoupling()
+{
+    // Look it up in the neighbor stencil if chooseFuture() picked the site
+    if (m_fIndex >= 0)
+    {
+        return m_grid.neighborCoupling(m_neighborClass, m_fIndex, m_world.parameters().hoppingRange);
+    }
+    int dx = m_grid.xDistancei(m_site, m_fSite);
+    int dy = m_grid.yDistancei(m_site, m_fSite);
+    int dz = m_grid.zDistancei(m_site, m_fSite);
+    return m_world.couplingConstants()[dx][dy][dz];
+}
+
+void ChargeAgent::rejectFuture()
+{
+    setFuture(m_site);
+}
+
+void ChargeAgent::acceptFuture(SiteID site)
+{
+    setFuture(site);
+    m_store.pathlength(m_slot) += 1;
+}
+
+double ChargeAgent::acceptanceProbability(SiteID site)
+{
+    switch(m_grid.agentType(site))
+    {
+    case Agent::Empty:
+    {
+        // Potential difference between sites
+        double pd = m_grid.potential(site)- m_grid.potential(m_site);
+        pd *= charge();
+
+        // Coulomb interactions, the same as coulombCPU()
+        if (m_world.potential().carrierFieldIsOn())
+        {
+            double p1 = m_world.potential().carrierFieldE(m_site) +
+                        m_world.potential().carrierFieldH(m_site) +
+                        m_world.potential().defectPotential(m_site) +
+                        bindingPotential(m_site);
+            double p2 = m_world.potential().carrierFieldE(site) +
+                        m_world.potential().carrierFieldH(site) +
+                        m_world.potential().defectPotential(site) +
+                        bindingPotential(site) -
+                        m_world.sI()[1][0][0] * charge();
+            pd += charge() * (p2 - p1);
+        }
+
+        // The space-charge potential includes this carrier
+        if (m_world.parameters().poissonMultigrid)
+        {
+            pd -= m_world.potential().poissonSelfEnergy(m_store, m_slot, site);
+        }
+
+        int dx = m_grid.xDistancei(m_site, site);
+        int dy = m_grid.yDistancei(m_site, site);
+        int dz = m_grid.zDistancei(m_site, site);
+        double coupling = m_world.couplingConstants()[dx][dy][dz];
+
+        // Metropolis criterion, as in Random::metropolisWithCoupling()
+        if (pd > 0.0)
+        {
+            return coupling * exp(-pd * m_world.parameters().inverseKT);
+        }
+        return coupling;
+    }
+
+    case Agent::Drain:
+    {
+        DrainAgent *drain = dynamic_cast<DrainAgent*>(m_grid.agentAddress(site));
+        if(!drain)
+        {
+            qFatal("langmuir: can not cast pointer to DrainAgent");
+        }
+        return drain->rate();
+    }
+
+    default:
+    {
+        return 0.0;
+    }
+
+    }
 }
 
 Grid& ChargeAgent::getGrid()
@@ -82,15 +237,65 @@ Grid& ChargeAgent::getGrid()
     return m_grid;
 }
 
+RandomStream& ChargeAgent::randomStream()
+{
+    return m_random;
+}
+
 void ChargeAgent::setRemoved(const bool &status)
 {
     m_removed = status;
 }
 
+bool ChargeAgent::trapped()
+{
+    return m_trapped;
+}
+
+void ChargeAgent::setTrapped(bool status)
+{
+    m_trapped = status;
+}
+
+void ChargeAgent::jumpTo(SiteID site)
+{
+    if (site == m_site)
+    {
+        return;
+    }
+
+    // Leave old site
+    m_grid.unregisterAgent(this);
+    m_world.potential().removeFromCarrierField(m_site, charge());
+
+    // Enter new site
+    setSite(site);
+    setFuture(site);
+    m_grid.registerAgent(this);
+    m_world.potential().addToCarrierField(m_site, charge());
+}
+
+void ChargeAgent::hopTo(SiteID site)
+{
+    // Leave the old site and enter the new one in a single Grid update
+    m_grid.moveCarrier(m_site, site);
+    m_world.potential().removeFromCarrierField(m_site, charge());
+    setSite(site);
+    setFuture(site);
+    setNeighborClass(m_grid.neighborClass(site, m_world.parameters().hoppingRange));
+    m_world.potential().addToCarrierField(m_site, charge());
+}
+
 void ChargeAgent::decideFuture()
 {
     // Increase lifetime in existance
-    m_lifetime += 1;
+    m_store.lifetime(m_slot) += 1;
+
+    // TrapEscape decides the moves of trapped charges
+    if (m_trapped)
+    {
+        return;
+    }
 
     switch(m_grid.agentType(m_fSite))
     {
@@ -98,32 +303,57 @@ void ChargeAgent::decideFuture()
     {
         // Potential difference between sites
         double pd = m_grid.potential(m_fSite)- m_grid.potential(m_site);
-        pd *= m_charge;
+        pd *= charge();
 
         // Coulomb interactions
         // Don't worry, it's zero if coulomb interactions are off
-        pd += m_de;
+        pd += m_store.de(m_slot);
+
+        // The space-charge potential includes this carrier
+        if (m_world.parameters().poissonMultigrid)
+        {
+            pd -= m_world.potential().poissonSelfEnergy(m_store, m_slot, m_fSite);
+        }
 
         // Calculate the coupling constant...
-        int dx = m_grid.xDistancei(m_site, m_fSite);
-        int dy = m_grid.yDistancei(m_site, m_fSite);
-        int dz = m_grid.zDistancei(m_site, m_fSite);
-        double coupling = m_world.couplingConstants()[dx][dy][dz];
+        double coupling = futureCoupling();
 
         // Metropolis criterion
-        if(m_world.randomNumberGenerator().metropolisWithCoupling(
-                 pd,
-                 m_world.parameters().inverseKT,
-                 coupling))
+        bool accept = false;
+        if (m_uniform >= 0)
+        {
+            // Drawn by chooseFuture() (coulomb.lazy)
+            accept = Random::metropolisWithCoupling(
+                        pd,
+                        m_world.parameters().inverseKT,
+                        coupling,
+                        m_uniform);
+        }
+        else if (m_world.parameters().randomCounter)
+        {
+            accept = m_random.metropolisWithCoupling(
+                        pd,
+                        m_world.parameters().inverseKT,
+                        coupling);
+        }
+        else
+        {
+            accept = m_world.randomNumberGenerator().metropolisWithCoupling(
+                        pd,
+                        m_world.parameters().inverseKT,
+                        coupling);
+        }
+
+        if(accept)
         {
             // Accept move - increase distance traveled
-            m_pathlength += 1;
+            m_store.pathlength(m_slot) += 1;
             return;
         }
         else
         {
             // Reject move
-            m_fSite = m_site;
+            setFuture(m_site);
         }
         return;
         break;
@@ -136,7 +366,7 @@ void ChargeAgent::decideFuture()
         {
             if(drain->tryToAccept(this))
             {
-                m_pathlength += 1;
+                m_store.pathlength(m_slot) += 1;
                 break;
             }
         }
@@ -145,14 +375,14 @@ void ChargeAgent::decideFuture()
             qFatal("langmuir: can not cast pointer to DrainAgent");
         }
         // Reject the move
-        m_fSite = m_site;
+        setFuture(m_site);
         break;
     }
 
     default:
     {
         // Invalid site proposed(Defect, Electron, Hole, Source)
-        m_fSite = m_site;
+        setFuture(m_site);
         break;
     }
 
@@ -166,6 +396,7 @@ void ChargeAgent::completeTick()
     if (m_removed)
     {
         m_grid.unregisterAgent(this);
+        m_world.potential().removeFromCarrierField(m_site, charge());
         return;
     }
 
@@ -177,10 +408,12 @@ void ChargeAgent::completeTick()
         {            
             // Leave old site
             m_grid.unregisterAgent(this);
+            m_world.potential().removeFromCarrierField(m_site, charge());
 
             // Enter new site
-            m_site = m_fSite;
+            setSite(m_fSite);
             m_grid.registerAgent(this);
+            m_world.potential().addToCarrierField(m_site, charge());
             return;
         }
 
@@ -188,12 +421,13 @@ void ChargeAgent::completeTick()
         if(m_grid.agentType(m_fSite)== Agent::Drain)
         {
             m_grid.unregisterAgent(this);
+            m_world.potential().removeFromCarrierField(m_site, charge());
             m_removed = true;
             return;
         }
 
         // Abort the move - the site was not empty
-        m_fSite = m_site;
+        setFuture(m_site);
         return;
     }
 }
@@ -203,17 +437,57 @@ double ChargeAgent::coulombInteraction()
     if(m_world.parameters().useOpenCL)
     {
         coulombGPU();
-        return m_de;
+        return m_store.de(m_slot);
     }
     else
     {
         coulombCPU();
-        return m_de;
+        return m_store.de(m_slot);
     }
 }
 
+ChargeAgent::CoulombMode ChargeAgent::coulombMode(World &world)
+{
+    if (!world.parameters().coulombCarriers)
+    {
+        return NoCoulomb;
+    }
+    if (world.potential().carrierFieldIsOn())
+    {
+        return CarrierFieldCoulomb;
+    }
+    if (world.parameters().coulombGaussianSigma > 0)
+    {
+        return GaussianCoulomb;
+    }
+    return PointCoulomb;
+}
+
 void ChargeAgent::coulombCPU()
 {
+    switch (coulombMode(m_world))
+    {
+    case CarrierFieldCoulomb:
+        coulombKernel<CarrierFieldCoulomb>();
+        break;
+    case GaussianCoulomb:
+        coulombKernel<GaussianCoulomb>();
+        break;
+    default:
+        coulombKernel<PointCoulomb>();
+        break;
+    }
+}
+
+template <ChargeAgent::CoulombMode Mode>
+void ChargeAgent::coulombKernel()
+{
+    if (Mode == NoCoulomb || !needsCoulomb())
+    {
+        m_store.de(m_slot) = 0;
+        return;
+    }
+
     double p1 = 0;
     double p2 = 0;
 
@@ -221,10 +495,19 @@ void ChargeAgent::coulombCPU()
     //int dx = m_grid.xDistancei(m_site, m_fSite);
     //int dy = m_grid.yDistancei(m_site, m_fSite);
     //int dz = m_grid.zDistancei(m_site, m_fSite);
-    double self = m_world.sI()[1][0][0] * m_charge;
+    double self = m_world.sI()[1][0][0] * charge();
 
+    // Per-site carrier potential (already includes the gaussian smearing)
+    if (Mode == CarrierFieldCoulomb)
+    {
+        // Electrons and Holes
+        p1 += m_world.potential().carrierFieldE(m_site);
+        p2 += m_world.potential().carrierFieldE(m_fSite);
+        p1 += m_world.potential().carrierFieldH(m_site);
+        p2 += m_world.potential().carrierFieldH(m_fSite);
+    }
     // Gaussian charges
-    if (m_world.parameters().coulombGaussianSigma > 0)
+    else if (Mode == GaussianCoulomb)
     {
         // Electrons
         p1 += m_world.potential().gaussE(m_site);
@@ -233,13 +516,6 @@ void ChargeAgent::coulombCPU()
         // Holes
         p1 += m_world.potential().gaussH(m_site);
         p2 += m_world.potential().gaussH(m_fSite);
-
-        // Charged defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            p1 += m_world.potential().gaussD(m_site);
-            p2 += m_world.potential().gaussD(m_fSite);
-        }
     }
     // Normal charges
     else
@@ -251,15 +527,12 @@ void ChargeAgent::coulombCPU()
         // Holes
         p1 += m_world.potential().coulombH(m_site);
         p2 += m_world.potential().coulombH(m_fSite);
-
-        // Charged defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            p1 += m_world.potential().coulombD(m_site);
-            p2 += m_world.potential().coulombD(m_fSite);
-        }
     }
 
+    // Charged defects (precalculated, zero if defects are not charged)
+    p1 += m_world.potential().defectPotential(m_site);
+    p2 += m_world.potential().defectPotential(m_fSite);
+
     // Remove self interaction
     p2 -= self;
 
@@ -267,11 +540,23 @@ void ChargeAgent::coulombCPU()
     p2 += bindingPotential(m_fSite);
     p1 += bindingPotential(m_site);
 
-    m_de = m_charge * (p2 - p1);
+    m_store.de(m_slot) = charge() * (p2 - p1);
 }
 
+// The kernels Simulation selects from
+template void ChargeAgent::coulombKernel<ChargeAgent::NoCoulomb>();
+template void ChargeAgent::coulombKernel<ChargeAgent::PointCoulomb>();
+template void ChargeAgent::coulombKernel<ChargeAgent::GaussianCoulomb>();
+template void ChargeAgent::coulombKernel<ChargeAgent::CarrierFieldCoulomb>();
+
 void ChargeAgent::coulombGPU()
 {
+    if (!needsCoulomb())
+    {
+        m_store.de(m_slot) = 0;
+        return;
+    }
+
     double p1 = 0;
     double p2 = 0;
 
@@ -279,11 +564,15 @@ void ChargeAgent::coulombGPU()
     p1 += m_world.opencl().getOutputHost(m_openClID);
     p2 += m_world.opencl().getOutputHostFuture(m_openClID);
 
+    // Charged defects are not sent to the GPU (precalculated, zero if defects are not charged)
+    p1 += m_world.potential().defectPotential(m_site);
+    p2 += m_world.potential().defectPotential(m_fSite);
+
     // Compute self interaction
     //int dx = m_grid.xDistancei(m_site, m_fSite);
     //int dy = m_grid.yDistancei(m_site, m_fSite);
     //int dz = m_grid.zDistancei(m_site, m_fSite);
-    double self = m_world.sI()[1][0][0] * m_charge;
+    double self = m_world.sI()[1][0][0] * charge();
 
     // Remove self interaction
     p2 -= self;
@@ -292,18 +581,20 @@ void ChargeAgent::coulombGPU()
     p2 += bindingPotential(m_fSite);
     p1 += bindingPotential(m_site);
 
-    m_de = m_charge *(p2 - p1);
+    m_store.de(m_slot) = charge() * (p2 - p1);
 }
 
 void ChargeAgent::compareCoulomb()
 {
-    double SELF = m_world.iR()[1][0][0] * m_charge *
+    double SELF = m_world.iR()[1][0][0] * charge() *
                   m_world.parameters().electrostaticPrefactor;
 
     // GPU
-    double GPU1 = m_world.opencl().getOutputHost(m_openClID);
-    double GPU2 = m_world.opencl().getOutputHostFuture(m_openClID) - SELF;
-    double GPU  = m_charge * (GPU2 - GPU1);
+    double GPU1 = m_world.opencl().getOutputHost(m_openClID) +
+                  m_world.potential().defectPotential(m_site);
+    double GPU2 = m_world.opencl().getOutputHostFuture(m_openClID) +
+                  m_world.potential().defectPotential(m_fSite) - SELF;
+    double GPU  = charge() * (GPU2 - GPU1);
 
     // Electrons
     double CPU1_E = 0.0;
@@ -355,7 +646,7 @@ void ChargeAgent::compareCoulomb()
     // CPU
     double CPU1 = CPU1_E + CPU1_H + CPU1_D;
     double CPU2 = CPU2_E + CPU2_H + CPU2_D - SELF;
-    double CPU  = m_charge * (CPU2 - CPU1);
+    double CPU  = charge() * (CPU2 - CPU1);
 
     // CHANGE
     double DIFF   = GPU  - CPU;
@@ -460,7 +751,7 @@ void ChargeAgent::compareCoulomb()
     qDebug() << "--------------------------------------------------------------------------------";
 }
 
-double HoleAgent::bindingPotential(int site)
+double HoleAgent::bindingPotential(SiteID site)
 {
     if(m_world.electronGrid().agentType(site)== Agent::Electron)
     {
@@ -470,7 +761,7 @@ double HoleAgent::bindingPotential(int site)
     return 0.0;
 }
 
-double ElectronAgent::bindingPotential(int site)
+double ElectronAgent::bindingPotential(SiteID site)
 {
     if(m_world.holeGrid().agentType(site)== Agent::Hole)
     {
@@ -1,5 +1,7 @@
 #include "checkpointer.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
+#include "mpihelper.h"
 #include "output.h"
 #include "world.h"
 #include "rand.h"
@@ -243,10 +245,10 @@ std::istream& CheckPointer::loadElectrons(std::istream &stream, ConfigurationInf
     {
         stream >> token;
         checkStream(stream, QString("expected electron %1 of %2").arg(i+1).arg(size));
-        unsigned int value = token.toUInt(&ok);
-        if (!ok)
+        qint64 value = token.toLongLong(&ok);
+        if (!ok || value < 0 || value > std::numeric_limits<SiteID>::max())
         {
-            qFatal("langmuir: stream error: can not convert %s to unsigned int\n\t"
+            qFatal("langmuir: stream error: can not convert %s to a site ID\n\t"
                    "expected electron %d of %d", qPrintable(token),i+1,size);
         }
         configInfo.electrons.push_back(value);
@@ -279,10 +281,10 @@ std::istream& CheckPointer::loadHoles(std::istream &stream, ConfigurationInfo &c
     {
         stream >> token;
         checkStream(stream, QString("expected hole %1 of %2").arg(i+1).arg(size));
-        unsigned int value = token.toUInt(&ok);
-        if (!ok)
+        qint64 value = token.toLongLong(&ok);
+        if (!ok || value < 0 || value > std::numeric_limits<SiteID>::max())
         {
-            qFatal("langmuir: stream error: can not convert %s to unsigned int\n\t"
+            qFatal("langmuir: stream error: can not convert %s to a site ID\n\t"
                    "expected hole %d of %d", qPrintable(token),i+1,size);
         }
         configInfo.holes.push_back(value);
@@ -315,10 +317,10 @@ std::istream& CheckPointer::loadDefects(std::istream &stream, ConfigurationInfo
     {
         stream >> token;
         checkStream(stream, QString("expected defect %1 of %2").arg(i+1).arg(size));
-        unsigned int value = token.toUInt(&ok);
-        if (!ok)
+        qint64 value = token.toLongLong(&ok);
+        if (!ok || value < 0 || value > std::numeric_limits<SiteID>::max())
         {
-            qFatal("langmuir: stream error: can not convert %s to unsigned int\n\t"
+            qFatal("langmuir: stream error: can not convert %s to a site ID\n\t"
                    "expected defect %d of %d", qPrintable(token),i+1,size);
         }
         configInfo.defects.push_back(value);
@@ -351,10 +353,10 @@ std::istream& CheckPointer::loadTraps(std::istream &stream, ConfigurationInfo &c
     {
         stream >> token;
         checkStream(stream, QString("expected trap %1 of %2").arg(i+1).arg(size));
-        unsigned int value = token.toUInt(&ok);
-        if (!ok)
+        qint64 value = token.toLongLong(&ok);
+        if (!ok || value < 0 || value > std::numeric_limits<SiteID>::max())
         {
-            qFatal("langmuir: stream error: can not convert %s to unsigned int\n\t"
+            qFatal("langmuir: stream error: can not convert %s to a site ID\n\t"
                    "expected trap %d of %d", qPrintable(token),i+1,size);
         }
         configInfo.traps.push_back(value);
@@ -481,10 +483,18 @@ std::ostream& CheckPointer::saveElectrons(std::ostream &stream)
 
     // Output info
     stream << '[' << name << ']';
-    stream << '\n' << m_world.electrons().size();
-    foreach(ChargeAgent* charge, m_world.electrons())
+    CarrierStore &electrons = m_world.electrons();
+    const QList<SiteID> &remote = m_world.mpi().remoteElectronSites();
+    stream << '\n' << electrons.size() + remote.size();
+    for (int i = 0; i < electrons.size(); i++)
     {
-        stream << '\n' << charge->getCurrentSite();
+        stream << '\n' << electrons.site(electrons.slot(i));
+    }
+
+    // The electrons on the other MPI ranks (empty without MPI)
+    foreach (SiteID site, remote)
+    {
+        stream << '\n' << site;
     }
 
     // Return the stream
@@ -500,10 +510,18 @@ std::ostream& CheckPointer::saveHoles(std::ostream &stream)
 
     // Output info
     stream << '[' << name << ']';
-    stream << '\n' << m_world.holes().size();
-    foreach(ChargeAgent* charge, m_world.holes())
+    CarrierStore &holes = m_world.holes();
+    const QList<SiteID> &remote = m_world.mpi().remoteHoleSites();
+    stream << '\n' << holes.size() + remote.size();
+    for (int i = 0; i < holes.size(); i++)
     {
-        stream << '\n' << charge->getCurrentSite();
+        stream << '\n' << holes.site(holes.slot(i));
+    }
+
+    // The holes on the other MPI ranks (empty without MPI)
+    foreach (SiteID site, remote)
+    {
+        stream << '\n' << site;
     }
 
     // Return the stream
@@ -520,7 +538,7 @@ std::ostream& CheckPointer::saveDefects(std::ostream &stream)
     // Output info
     stream << '[' << name << ']';
     stream << '\n' << m_world.defectSiteIDs().size();
-    foreach(int site, m_world.defectSiteIDs())
+    foreach(SiteID site, m_world.defectSiteIDs())
     {
         stream << '\n' << site;
     }
@@ -539,7 +557,7 @@ std::ostream& CheckPointer::saveTraps(std::ostream &stream)
     // Output info
     stream << '[' << name << ']';
     stream << '\n' << m_world.trapSiteIDs().size();
-    foreach(int site, m_world.trapSiteIDs())
+    foreach(SiteID site, m_world.trapSiteIDs())
     {
         stream << '\n' << site;
     }
@@ -593,6 +611,8 @@ std::ostream& CheckPointer::saveRandomState(std::ostream &stream)
     QString name = QME.key(RandomState);
 
     // Output info
+    // The seed is also the key of the counter-based streams (random.counter); the rest of
+    // their counter is the step and the carrier order, which are saved elsewhere
     stream << '[' << name << ']';
     stream << '\n' << m_world.randomNumberGenerator();
 
@@ -0,0 +1,239 @@
+#include "coulombkernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LANGMUIR_COULOMB_AVX2
+#if __GNUC__ >= 5 || defined(__clang__)
+#define LANGMUIR_COULOMB_AVX512
+#endif
+#include <immintrin.h>
+#endif
+
+#include <QtGlobal>
+#include <cstdlib>
+
+namespace LangmuirCore
+{
+
+static qint64 sumScalar(const qint64 *table, int cutoff,
+                        const int *period,
+                        const int *x, const int *y, const int *z, int count,
+                        int xi, int yi, int zi)
+{
+    qint64 sum = 0;
+    for (int j = 0; j < count; j++)
+    {
+        // Nearest image along periodic directions
+        int dx = abs(x[j] - xi);
+        int dy = abs(y[j] - yi);
+        int dz = abs(z[j] - zi);
+        dx = qMin(dx, period[0] - dx);
+        dy = qMin(dy, period[1] - dy);
+        dz = qMin(dz, period[2] - dz);
+        if (dx < cutoff && dy < cutoff && dz < cutoff)
+        {
+            sum += table[(dx * cutoff + dy) * cutoff + dz];
+        }
+    }
+    return sum;
+}
+
+#ifdef LANGMUIR_COULOMB_AVX2
+__attribute__((target("avx2")))
+static qint64 sumAVX2(const qint64 *table, int cutoff,
+                      const int *period,
+                      const int *x, const int *y, const int *z, int count,
+                      int xi, int yi, int zi)
+{
+    const __m256i vc = _mm256_set1_epi32(cutoff);
+    const __m256i vx = _mm256_set1_epi32(xi);
+    const __m256i vy = _mm256_set1_epi32(yi);
+    const __m256i vz = _mm256_set1_epi32(zi);
+    const __m256i px = _mm256_set1_epi32(period[0]);
+    const __m256i py = _mm256_set1_epi32(period[1]);
+    const __m256i pz = _mm256_set1_epi32(period[2]);
+    const long long *base = reinterpret_cast<const long long*>(table);
+
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+
+    int j = 0;
+    for (; j + 8 <= count; j += 8)
+    {
+        __m256i dx = _mm256_abs_epi32(_mm256_sub_epi32(
+                         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + j)), vx));
+        __m256i dy = _mm256_abs_epi32(_mm256_sub_epi32(
+                         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + j)), vy));
+        __m256i dz = _mm256_abs_epi32(_mm256_sub_epi32(
+                         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(z + j)), vz));
+        dx = _mm256_min_epi32(dx, _mm256_sub_epi32(px, dx));
+        dy = _mm256_min_epi32(dy, _mm256_sub_epi32(py, dy));
+        dz = _mm256_min_epi32(dz, _mm256_sub_epi32(pz, dz));
+
+        __m256i inside = _mm256_and_si256(_mm256_cmpgt_epi32(vc, dx),
+                         _mm256_and_si256(_mm256_cmpgt_epi32(vc, dy),
+                                          _mm256_cmpgt_epi32(vc, dz)));
+
+        // Lanes outside of the cutoff are masked out of the gather
+        __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(
+                        _mm256_add_epi32(_mm256_mullo_epi32(dx, vc), dy), vc), dz);
+        index = _mm256_and_si256(index, inside);
+
+        __m256i mask0 = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(inside));
+        __m256i mask1 = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(inside, 1));
+
+        sum0 = _mm256_add_epi64(sum0, _mm256_mask_i32gather_epi64(
+                   _mm256_setzero_si256(), base, _mm256_castsi256_si128(index), mask0, 8));
+        sum1 = _mm256_add_epi64(sum1, _mm256_mask_i32gather_epi64(
+                   _mm256_setzero_si256(), base, _mm256_extracti128_si256(index, 1), mask1, 8));
+    }
+
+    long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(sum0, sum1));
+    qint64 sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    // The last few carriers
+    return sum + sumScalar(table, cutoff, period, x + j, y + j, z + j, count - j, xi, yi, zi);
+}
+#endif
+
+#ifdef LANGMUIR_COULOMB_AVX512
+__attribute__((target("avx512f")))
+static qint64 sumAVX512(const qint64 *table, int cutoff,
+                        const int *period,
+                        const int *x, const int *y, const int *z, int count,
+                        int xi, int yi, int zi)
+{
+    const __m512i vc = _mm512_set1_epi32(cutoff);
+    const __m512i vx = _mm512_set1_epi32(xi);
+    const __m512i vy = _mm512_set1_epi32(yi);
+    const __m512i vz = _mm512_set1_epi32(zi);
+    const __m512i px = _mm512_set1_epi32(period[0]);
+    const __m512i py = _mm512_set1_epi32(period[1]);
+    const __m512i pz = _mm512_set1_epi32(period[2]);
+
+    __m512i sum0 = _mm512_setzero_si512();
+    __m512i sum1 = _mm512_setzero_si512();
+
+    int j = 0;
+    for (; j + 16 <= count; j += 16)
+    {
+        __m512i dx = _mm512_abs_epi32(_mm512_sub_epi32(_mm512_loadu_si512(x + j), vx));
+        __m512i dy = _mm512_abs_epi32(_mm512_sub_epi32(_mm512_loadu_si512(y + j), vy));
+        __m512i dz = _mm512_abs_epi32(_mm512_sub_epi32(_mm512_loadu_si512(z + j), vz));
+        dx = _mm512_min_epi32(dx, _mm512_sub_epi32(px, dx));
+        dy = _mm512_min_epi32(dy, _mm512_sub_epi32(py, dy));
+        dz = _mm512_min_epi32(dz, _mm512_sub_epi32(pz, dz));
+
+        __mmask16 inside = _mm512_cmplt_epi32_mask(dx, vc) &
+                           _mm512_cmplt_epi32_mask(dy, vc) &
+                           _mm512_cmplt_epi32_mask(dz, vc);
+
+        __m512i index = _mm512_add_epi32(_mm512_mullo_epi32(
+                        _mm512_add_epi32(_mm512_mullo_epi32(dx, vc), dy), vc), dz);
+
+        sum0 = _mm512_add_epi64(sum0, _mm512_mask_i32gather_epi64(
+                   _mm512_setzero_si512(), __mmask8(inside), _mm512_castsi512_si256(index), table, 8));
+        sum1 = _mm512_add_epi64(sum1, _mm512_mask_i32gather_epi64(
+                   _mm512_setzero_si512(), __mmask8(inside >> 8), _mm512_extracti64x4_epi64(index, 1), table, 8));
+    }
+
+    long long lanes[8];
+    _mm512_storeu_si512(lanes, _mm512_add_epi64(sum0, sum1));
+    qint64 sum = 0;
+    for (int k = 0; k < 8; k++)
+    {
+        sum += lanes[k];
+    }
+
+    // The last few carriers
+    return sum + sumScalar(table, cutoff, period, x + j, y + j, z + j, count - j, xi, yi, zi);
+}
+#endif
+
+const int CoulombKernel::NotPeriodic;
+
+CoulombKernel::CoulombKernel() : m_cutoff(0), m_instructionSet(Scalar), m_sum(sumScalar)
+{
+    setPeriods(0, 0, 0);
+    setInstructionSet(detectInstructionSet());
+}
+
+void CoulombKernel::setPeriods(int x, int y, int z)
+{
+    // A period far larger than any offset never picks the image
+    m_period[0] = (x > 0) ? x : NotPeriodic;
+    m_period[1] = (y > 0) ? y : NotPeriodic;
+    m_period[2] = (z > 0) ? z : NotPeriodic;
+}
+
+void CoulombKernel::setTable(const QVector<qint64> &table, int cutoff)
+{
+    if (table.size() != cutoff * cutoff * cutoff)
+    {
+        qFatal("langmuir: Coulomb table has %d entries, expected %d",
+               table.size(), cutoff * cutoff * cutoff);
+    }
+    m_table = table;
+    m_cutoff = cutoff;
+}
+
+void CoulombKernel::setInstructionSet(InstructionSet instructionSet)
+{
+    InstructionSet best = detectInstructionSet();
+    if (instructionSet > best)
+    {
+        instructionSet = Scalar;
+    }
+
+    m_instructionSet = instructionSet;
+    switch (m_instructionSet)
+    {
+#ifdef LANGMUIR_COULOMB_AVX512
+    case AVX512:
+        m_sum = sumAVX512;
+        break;
+#endif
+#ifdef LANGMUIR_COULOMB_AVX2
+    case AVX2:
+        m_sum = sumAVX2;
+        break;
+#endif
+    default:
+        m_instructionSet = Scalar;
+        m_sum = sumScalar;
+        break;
+    }
+}
+
+CoulombKernel::InstructionSet CoulombKernel::detectInstructionSet()
+{
+#ifdef LANGMUIR_COULOMB_AVX2
+    __builtin_cpu_init();
+#ifdef LANGMUIR_COULOMB_AVX512
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return AVX512;
+    }
+#endif
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return AVX2;
+    }
+#endif
+    return Scalar;
+}
+
+QString CoulombKernel::toQString(InstructionSet instructionSet)
+{
+    switch (instructionSet)
+    {
+    case AVX2:
+        return "AVX2";
+    case AVX512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+}
@@ -1,12 +1,30 @@
 #include "cubicgrid.h"
 #include <cmath>
+#include <QPair>
 #include "world.h"
+#include "potential.h"
 #include "parameters.h"
 #include "drainagent.h"
+#include "chargeagent.h"
+#include "carrierstore.h"
+#include "rand.h"
+#include <climits>
 
 namespace LangmuirCore
 {
-Grid::Grid(World &world, QObject *parent)
+// The number of bits needed to store values up to n
+static int bitWidth(quint64 n)
+{
+    int bits = 0;
+    while (n > 0)
+    {
+        n >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+Grid::Grid(World &world, Grid *shared, QObject *parent)
     : QObject(parent), m_world(world)
 {
     m_xSize = m_world.parameters().gridX;
@@ -15,27 +33,111 @@ Grid::Grid(World &world, QObject *parent)
     m_xyPlaneArea = m_world.parameters().gridY * m_world.parameters().gridX;
     m_yzPlaneArea = m_world.parameters().gridY * m_world.parameters().gridZ;
     m_xzPlaneArea = m_world.parameters().gridX * m_world.parameters().gridZ;
-    m_volume = m_world.parameters().gridY *
+    m_volume = SiteID(m_world.parameters().gridY) *
                m_world.parameters().gridX *
                m_world.parameters().gridZ;
     m_specialAgentCount = 0;
     m_specialAgentReserve = 5*7;
-    m_agents.fill(0, m_volume+m_specialAgentReserve);
-    m_potentials.fill(0.0, m_volume+m_specialAgentReserve);
-    m_agentType.fill(Agent::Empty, m_volume+m_specialAgentReserve);
+    m_sparse = m_world.parameters().gridSparse;
+    m_occupied = 0;
+    m_freeSitesDeferred = false;
+    m_ownSparsePotential.offset = 0;
+    m_ownSparsePotential.slopeX = 0;
+    m_ownSparsePotential.slopeZ = 0;
+    m_sparsePotential = &m_ownSparsePotential;
+    m_potentials = 0;
+    m_packedSites = 0;
+    if (shared && (shared->m_volume != m_volume ||
+                   shared->m_specialAgentReserve != m_specialAgentReserve ||
+                   shared->m_sparse != m_sparse))
+    {
+        qFatal("langmuir: can not share the potential of a grid with a different size");
+    }
     m_specialAgents.reserve(m_specialAgentReserve);
+
+    if (m_sparse)
+    {
+        // Only occupied sites and sites off the ramp are stored (see sparseAgentType and sparsePotential)
+        if (shared)
+        {
+            m_sparsePotential = shared->m_sparsePotential;
+        }
+    }
+    else
+    {
+        m_agentIndex.assign(m_volume+m_specialAgentReserve, -1);
+        m_agentType.assign(m_volume+m_specialAgentReserve, Agent::Empty);
+        if (shared)
+        {
+            m_potentials = shared->m_potentials;
+        }
+        else
+        {
+            m_ownPotentials.assign(m_volume+m_specialAgentReserve, 0);
+            m_potentials = &m_ownPotentials[0];
+        }
+
+        // Every site starts out free; each Fenwick entry adds its blocks to its parent
+        SiteID blocks = (m_volume + FreeBlockSize - 1) / FreeBlockSize;
+        m_freeBlocks.assign(blocks + 1, 0);
+        for (SiteID i = 1; i <= blocks; i++)
+        {
+            m_freeBlocks[i] += qMin(SiteID(FreeBlockSize), m_volume - (i - 1) * FreeBlockSize);
+            SiteID parent = i + (i & -i);
+            if (parent <= blocks)
+            {
+                m_freeBlocks[parent] += m_freeBlocks[i];
+            }
+        }
+
+        // Pack the site IDs of every site into one word, so the lookups never divide; the special
+        // sites past the volume continue the numbering.  Grids too big for 32 bits divide instead.
+        SiteID sites = m_volume + m_specialAgentReserve;
+        m_shiftY = bitWidth(m_xSize - 1);
+        m_shiftZ = m_shiftY + bitWidth(m_ySize - 1);
+        m_maskX = (quint32(1) << m_shiftY) - 1;
+        m_maskY = (quint32(1) << (m_shiftZ - m_shiftY)) - 1;
+        if (shared)
+        {
+            m_packedSites = shared->m_packedSites;
+        }
+        else if (m_shiftZ + bitWidth(quint64((sites - 1) / m_xyPlaneArea)) <= 32)
+        {
+            m_ownPackedSites.resize(sites);
+            for (SiteID site = 0; site < sites; site++)
+            {
+                quint32 x = quint32(site % m_xSize);
+                quint32 y = quint32((site / m_xSize) % m_ySize);
+                quint32 z = quint32(site / m_xyPlaneArea);
+                m_ownPackedSites[site] = x | (y << m_shiftY) | (z << m_shiftZ);
+            }
+            m_packedSites = &m_ownPackedSites[0];
+        }
+    }
+
     for(int i = 0; i < 7; i++)
     {
         QList<Agent*> qlist;
         m_specialAgents.push_back(qlist);
         m_specialAgents[i].reserve(5);
     }
+
+    buildNeighborStencil(m_world.parameters().hoppingRange);
+    if (m_world.parameters().recombinationRange > 0)
+    {
+        buildNeighborStencil(m_world.parameters().recombinationRange);
+    }
 }
 
 Grid::~Grid()
 {
 }
 
+bool Grid::isSparse()
+{
+    return m_sparse;
+}
+
 int Grid::xSize()
 {
     return m_xSize;
@@ -56,12 +158,12 @@ int Grid::xyPlaneArea()
     return m_xyPlaneArea;
 }
 
-int Grid::volume()
+SiteID Grid::volume()
 {
     return m_volume;
 }
 
-double Grid::totalDistance(int site1, int site2)
+double Grid::totalDistance(SiteID site1, SiteID site2)
 {
     return sqrt((    getIndexY(site1)-    getIndexY(site2)) *(getIndexY(site1)-    getIndexY(site2)) +
 (getIndexX(site1)- getIndexX(site2)) *(getIndexX(site1)- getIndexX(site2)) +
@@ -69,102 +171,87 @@ double Grid::totalDistance(int site1, int site2)
 );
 }
 
-double Grid::xDistance(int site1, int site2)
+double Grid::xDistance(SiteID site1, SiteID site2)
 {
     return fabs(int(getIndexX(site1)) - int(getIndexX(site2)));
 }
 
-double Grid::yDistance(int site1, int site2)
+double Grid::yDistance(SiteID site1, SiteID site2)
 {
     return fabs(int(getIndexY(site1)) - int(getIndexY(site2)));
 }
 
-double Grid::zDistance(int site1, int site2)
+double Grid::zDistance(SiteID site1, SiteID site2)
 {
     return fabs(int(getIndexZ(site1)) - int(getIndexZ(site2)));
 }
 
-double Grid::xImageDistance(int site1, int site2)
+double Grid::xImageDistance(SiteID site1, SiteID site2)
 {
     return fabs(int(getIndexX(site1)) + int(getIndexX(site2)))+1;
 }
 
-double Grid::yImageDistance(int site1, int site2)
+double Grid::yImageDistance(SiteID site1, SiteID site2)
 {
     return fabs(int(getIndexY(site1)) + int(getIndexY(site2)))+1;
 }
 
-double Grid::zImageDistance(int site1, int site2)
+double Grid::zImageDistance(SiteID site1, SiteID site2)
 {
     return fabs(int(getIndexZ(site1)) + int(getIndexZ(site2)))+1;
 }
 
-int Grid::xDistancei(int site1, int site2)
+int Grid::xDistancei(SiteID site1, SiteID site2)
 {
     return abs(int(getIndexX(site1)) - int(getIndexX(site2)));
 }
 
-int Grid::yDistancei(int site1, int site2)
+int Grid::yDistancei(SiteID site1, SiteID site2)
 {
     return abs(int(getIndexY(site1)) - int(getIndexY(site2)));
 }
 
-int Grid::zDistancei(int site1, int site2)
+int Grid::zDistancei(SiteID site1, SiteID site2)
 {
     return abs(int(getIndexZ(site1)) - int(getIndexZ(site2)));
 }
 
-int Grid::xImageDistancei(int site1, int site2)
+int Grid::xImageDistancei(SiteID site1, SiteID site2)
 {
     return abs(int(getIndexX(site1)) + int(getIndexX(site2)))+1;
 }
 
-int Grid::yImageDistancei(int site1, int site2)
+int Grid::yImageDistancei(SiteID site1, SiteID site2)
 {
     return abs(int(getIndexY(site1)) + int(getIndexY(site2)))+1;
 }
 
-int Grid::zImageDistancei(int site1, int site2)
+int Grid::zImageDistancei(SiteID site1, SiteID site2)
 {
     return abs(int(getIndexZ(site1)) + int(getIndexZ(site2)))+1;
 }
 
-int Grid::getIndexX(int site)
-{
-    return site % m_xSize;
-}
-
-int Grid::getIndexY(int site)
-{
-    return(site / m_xSize -(site / m_xyPlaneArea)* m_ySize);
-}
-
-int Grid::getIndexZ(int site)
-{
-    return site /(m_xyPlaneArea);
-}
-
-double Grid::getPositionX(int site)
+double Grid::getPositionX(SiteID site)
 {
     return getIndexX(site)+ 0.5;
 }
 
-double Grid::getPositionY(int site)
+double Grid::getPositionY(SiteID site)
 {
     return getIndexY(site)+ 0.5;
 }
 
-double Grid::getPositionZ(int site)
+double Grid::getPositionZ(SiteID site)
 {
     return getIndexZ(site)+ 0.5;
 }
 
-int Grid::getIndexS(int xIndex, int yIndex, int zIndex)
+SiteID Grid::getIndexS(int xIndex, int yIndex, int zIndex)
 {
-    return(m_xSize *(yIndex + zIndex*m_ySize)+ xIndex);
+    return(m_xSize *(yIndex + SiteID(zIndex)*m_ySize)+ xIndex);
 }
 
-QVector<int> Grid::sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf)
+QVector<SiteID> Grid::sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf)
 {
     int ndx_rev = 0;
     if(xf < xi)
@@ -192,7 +279,7 @@ QVector<int> Grid::sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf)
     {
         qFatal("langmuir: invalid slice index range:(%d, %d, %d)->(%d, %d, %d)", xi, yi, zi, xf, yf, zf);
     }
-    QVector<int> ndx;
+    QVector<SiteID> ndx;
     for(int i = xi; i < xf; i++){
         for(int j = yi; j < yf; j++){
             for(int k = zi; k < zf; k++){
@@ -204,10 +291,10 @@ QVector<int> Grid::sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf)
     return ndx;
 }
 
-QVector<int> Grid::neighborsSite(int site, int hoppingRange)
+QVector<SiteID> Grid::neighborsSite(SiteID site, int hoppingRange)
 {
     // Return the indexes of all nearest neighbours
-    QVector<int>   nList(0);
+    QVector<SiteID>   nList(0);
     int x = getIndexX(site);
     int y = getIndexY(site);
     int z = getIndexZ(site);
@@ -439,7 +526,30 @@ QVector<int> Grid::neighborsSite(int site, int hoppingRange)
         }
         default:
         {
-            qFatal("langmuir: invalid neighbor list size parameter : (%d)", hoppingRange);
+            if (hoppingRange < 1)
+            {
+                qFatal("langmuir: invalid neighbor list size parameter : (%d)", hoppingRange);
+            }
+
+            // Every site within a sphere of radius hoppingRange
+            int r2 = hoppingRange * hoppingRange;
+            for (int dx = -hoppingRange; dx <= hoppingRange; dx++)
+            {
+                if (x + dx < 0 || x + dx >= m_xSize) continue;
+                for (int dy = -hoppingRange; dy <= hoppingRange; dy++)
+                {
+                    if (y + dy < 0 || y + dy >= m_ySize) continue;
+                    for (int dz = -hoppingRange; dz <= hoppingRange; dz++)
+                    {
+                        if (z + dz < 0 || z + dz >= m_zSize) continue;
+                        int d2 = dx * dx + dy * dy + dz * dz;
+                        if (d2 > 0 && d2 <= r2)
+                        {
+                            nList.push_back(getIndexS(x + dx, y + dy, z + dz));
+                        }
+                    }
+                }
+            }
             break;
         }
     }
@@ -470,7 +580,167 @@ QVector<int> Grid::neighborsSite(int site, int hoppingRange)
     return nList;
 }
 
-QVector<int> Grid::neighborsFace(Grid::CubeFace cubeFace)
+int Grid::neighborClass(SiteID site, int hoppingRange)
+{
+    const NeighborStencil &stencil = m_neighborStencils[hoppingRange];
+    return stencil.xClass[getIndexX(site)] + stencil.xClasses *
+          (stencil.yClass[getIndexY(site)] + stencil.yClasses *
+           stencil.zClass[getIndexZ(site)]);
+}
+
+int Grid::neighborClassCount(int hoppingRange)
+{
+    return m_neighborStencils[hoppingRange].offsets.size();
+}
+
+int Grid::neighborCount(int neighborClass, int hoppingRange)
+{
+    const NeighborStencil &stencil = m_neighborStencils[hoppingRange];
+    return stencil.offsets[neighborClass].size() + stencil.drains[neighborClass].size();
+}
+
+SiteID Grid::neighbor(SiteID site, int neighborClass, int index, int hoppingRange)
+{
+    const NeighborStencil &stencil = m_neighborStencils[hoppingRange];
+    const QVector<int> &offsets = stencil.offsets[neighborClass];
+    if (index < offsets.size())
+    {
+        return site + offsets[index];
+    }
+    return stencil.drains[neighborClass][index - offsets.size()];
+}
+
+double Grid::neighborCoupling(int neighborClass, int index, int hoppingRange)
+{
+    const NeighborStencil &stencil = m_neighborStencils[hoppingRange];
+    return m_world.couplingConstants().data()[stencil.couplings[neighborClass][index]];
+}
+
+void Grid::buildNeighborStencil(int hoppingRange)
+{
+    if (hoppingRange < 1)
+    {
+        qFatal("langmuir: invalid neighbor list size parameter : (%d)", hoppingRange);
+    }
+
+    if (m_neighborStencils.size() <= hoppingRange)
+    {
+        m_neighborStencils.resize(hoppingRange + 1);
+    }
+    NeighborStencil &stencil = m_neighborStencils[hoppingRange];
+
+    // Classify each index by its distance to both edges (up to the hopping range)
+    QVector<int> sizes;
+    sizes << m_xSize << m_ySize << m_zSize;
+    QVector<int> representatives[3];
+    QVector<int> *classes[3] = { &stencil.xClass, &stencil.yClass, &stencil.zClass };
+    for (int d = 0; d < 3; d++)
+    {
+        QVector<int> &indexClass = *classes[d];
+        QList< QPair<int, int> > keys;
+        indexClass.fill(0, sizes[d]);
+        for (int i = 0; i < sizes[d]; i++)
+        {
+            QPair<int, int> key(qMin(i, hoppingRange), qMin(sizes[d] - 1 - i, hoppingRange));
+            int c = keys.indexOf(key);
+            if (c < 0)
+            {
+                c = keys.size();
+                keys.push_back(key);
+                representatives[d].push_back(i);
+            }
+            indexClass[i] = c;
+        }
+    }
+    stencil.xClasses = representatives[0].size();
+    stencil.yClasses = representatives[1].size();
+
+    // Each class has the same neighbors as its representative site, shifted
+    int classCount = representatives[0].size() *
+                     representatives[1].size() *
+                     representatives[2].size();
+    stencil.offsets.clear();
+    stencil.offsets.resize(classCount);
+    stencil.couplings.clear();
+    stencil.couplings.resize(classCount);
+    int width = hoppingRange + 1;
+    for (int cz = 0; cz < representatives[2].size(); cz++)
+    {
+        for (int cy = 0; cy < representatives[1].size(); cy++)
+        {
+            for (int cx = 0; cx < representatives[0].size(); cx++)
+            {
+                int c = cx + stencil.xClasses * (cy + stencil.yClasses * cz);
+                SiteID site = getIndexS(representatives[0][cx],
+                                        representatives[1][cy],
+                                        representatives[2][cz]);
+                QVector<SiteID> neighbors = neighborsSite(site, hoppingRange);
+                foreach (SiteID other, neighbors)
+                {
+                    // Drains are added by updateNeighborStencilDrains
+                    if (other < m_volume)
+                    {
+                        stencil.offsets[c].push_back(int(other - site));
+                        stencil.couplings[c].push_back(
+                            (xDistancei(site, other) * width + yDistancei(site, other)) * width +
+                             zDistancei(site, other));
+                    }
+                }
+            }
+        }
+    }
+    updateNeighborStencilDrains();
+}
+
+void Grid::updateNeighborStencilDrains()
+{
+    QVector<SiteID> left;
+    foreach (Agent *agent, getSpecialAgentList(Left))
+    {
+        if (agent->getType() == Agent::Drain)
+        {
+            left.push_back(agent->getCurrentSite());
+        }
+    }
+
+    QVector<SiteID> right;
+    foreach (Agent *agent, getSpecialAgentList(Right))
+    {
+        if (agent->getType() == Agent::Drain)
+        {
+            right.push_back(agent->getCurrentSite());
+        }
+    }
+
+    for (int r = 0; r < m_neighborStencils.size(); r++)
+    {
+        NeighborStencil &stencil = m_neighborStencils[r];
+        stencil.drains.clear();
+        stencil.drains.resize(stencil.offsets.size());
+        if (stencil.offsets.isEmpty())
+        {
+            continue;
+        }
+
+        // Same order as neighborsSite: left drains, then right drains
+        int xLeft = stencil.xClass[0];
+        int xRight = stencil.xClass[m_xSize - 1];
+        for (int c = 0; c < stencil.offsets.size(); c++)
+        {
+            int cx = c % stencil.xClasses;
+            if (cx == xLeft)
+            {
+                stencil.drains[c] += left;
+            }
+            if (cx == xRight)
+            {
+                stencil.drains[c] += right;
+            }
+        }
+    }
+}
+
+QVector<SiteID> Grid::neighborsFace(Grid::CubeFace cubeFace)
 {
     switch(cubeFace)
     {
@@ -512,42 +782,283 @@ QVector<int> Grid::neighborsFace(Grid::CubeFace cubeFace)
 
     case Grid::NoFace:
     {
-        return QVector<int>();
+        return QVector<SiteID>();
         break;
     }
 
     default:
     {
         qFatal("langmuir: can not generate neightbors for face; unknown face");
-        return QVector<int>();
+        return QVector<SiteID>();
         break;
     }
     }
 }
 
-Agent * Grid::agentAddress(int site)
+Agent * Grid::agentAddress(SiteID site)
 {
-    return m_agents[site];
+    int index = siteIndex(site);
+    if (index < 0)
+    {
+        return 0;
+    }
+    switch (agentType(site))
+    {
+    case Agent::Electron:
+        return m_world.electrons().agent(index);
+    case Agent::Hole:
+        return m_world.holes().agent(index);
+    default:
+        return m_otherAgents[index];
+    }
 }
 
-Agent::Type Grid::agentType(int site)
+Agent::Type Grid::sparseAgentType(SiteID site)
 {
-    return m_agentType[site];
+    QHash<SiteID, SparseSite>::const_iterator it = m_sparseSites.constFind(site);
+    if (it == m_sparseSites.constEnd())
+    {
+        return Agent::Empty;
+    }
+    return Agent::Type(it.value().type);
+}
+
+qint32 Grid::siteIndex(SiteID site)
+{
+    if (!m_sparse)
+    {
+        return m_agentIndex[site];
+    }
+    QHash<SiteID, SparseSite>::const_iterator it = m_sparseSites.constFind(site);
+    if (it == m_sparseSites.constEnd())
+    {
+        return -1;
+    }
+    return it.value().index;
+}
+
+void Grid::storeSite(SiteID site, Agent::Type type, qint32 index)
+{
+    if (!m_sparse)
+    {
+        m_agentIndex[site] = index;
+        m_agentType[site] = type;
+        return;
+    }
+    if (type == Agent::Empty)
+    {
+        m_sparseSites.remove(site);
+        return;
+    }
+    SparseSite &entry = m_sparseSites[site];
+    entry.type = type;
+    entry.index = index;
+}
+
+void Grid::setAgent(SiteID site, Agent *agent)
+{
+    Agent::Type type = agent->getType();
+    if (type == Agent::Electron || type == Agent::Hole)
+    {
+        storeSite(site, type, static_cast<ChargeAgent*>(agent)->slot());
+    }
+    else
+    {
+        // There are only a few sources and drains, so unregistered ones just leave a NULL behind
+        storeSite(site, type, m_otherAgents.size());
+        m_otherAgents.push_back(agent);
+    }
+}
+
+void Grid::clearAgent(SiteID site)
+{
+    Agent::Type type = agentType(site);
+    qint32 index = siteIndex(site);
+    if (type != Agent::Electron && type != Agent::Hole && index >= 0)
+    {
+        m_otherAgents[index] = 0;
+    }
+    storeSite(site, Agent::Empty, -1);
+}
+
+SiteID Grid::freeSiteCount()
+{
+    return m_volume - m_occupied;
+}
+
+SiteID Grid::randomFreeSite(Random &random)
+{
+    SiteID count = freeSiteCount();
+    if (count == 0)
+    {
+        return -1;
+    }
+
+    if (m_sparse)
+    {
+        // Rejection sampling; the grid is mostly empty
+        while (true)
+        {
+            SiteID site = (m_volume > SiteID(INT_MAX))
+                ? qMin(m_volume - 1, SiteID(random.random() * m_volume))
+                : SiteID(random.integer(0, int(m_volume - 1)));
+            if (sparseAgentType(site) == Agent::Empty)
+            {
+                return site;
+            }
+        }
+    }
+
+    // Too many for a 32-bit draw only with LANGMUIR_64BIT_SITES
+    SiteID n = (count > SiteID(INT_MAX))
+        ? qMin(count - 1, SiteID(random.random() * count))
+        : SiteID(random.integer(0, int(count - 1)));
+
+    // Walk down the Fenwick tree to the block holding the n-th free site
+    SiteID blocks = SiteID(m_freeBlocks.size()) - 1;
+    SiteID step = 1;
+    while (step * 2 <= blocks)
+    {
+        step *= 2;
+    }
+    SiteID block = 0;
+    for (; step > 0; step /= 2)
+    {
+        if (block + step <= blocks && m_freeBlocks[block + step] <= n)
+        {
+            block += step;
+            n -= m_freeBlocks[block];
+        }
+    }
+
+    // Then along the block to the site
+    SiteID last = qMin(m_volume, (block + 1) * FreeBlockSize);
+    for (SiteID site = block * FreeBlockSize; site < last; site++)
+    {
+        if (m_agentType[site] == Agent::Empty)
+        {
+            if (n == 0)
+            {
+                return site;
+            }
+            --n;
+        }
+    }
+    qFatal("langmuir: the free-site counts of the grid do not match its sites");
+    return -1;
+}
+
+void Grid::addFreeSite(SiteID site)
+{
+    if (site >= m_volume)
+    {
+        return;
+    }
+
+    --m_occupied;
+    if (m_sparse)
+    {
+        return;
+    }
+    for (SiteID i = site / FreeBlockSize + 1; i < SiteID(m_freeBlocks.size()); i += i & -i)
+    {
+        ++m_freeBlocks[i];
+    }
+}
+
+void Grid::removeFreeSite(SiteID site)
+{
+    if (site >= m_volume)
+    {
+        return;
+    }
+
+    ++m_occupied;
+    if (m_sparse)
+    {
+        return;
+    }
+    for (SiteID i = site / FreeBlockSize + 1; i < SiteID(m_freeBlocks.size()); i += i & -i)
+    {
+        --m_freeBlocks[i];
+    }
+}
+
+void Grid::setFreeSitesDeferred(bool deferred)
+{
+    m_freeSitesDeferred = deferred;
 }
 
-void Grid::setPotential(int site, double potential)
+void Grid::setPotential(SiteID site, double potential)
 {
+    if (m_sparse)
+    {
+        // Store the difference from the ramp
+        SitePotential &delta = m_sparsePotential->sites[site];
+        delta = 0;
+        delta = potential - sparsePotential(site);
+        return;
+    }
     m_potentials[site] = potential;
 }
 
-void Grid::addToPotential(int site, double potential)
+void Grid::addToPotential(SiteID site, double potential)
 {
+    if (m_sparse)
+    {
+        SitePotential &delta = m_sparsePotential->sites[site];
+        delta = delta + potential;
+        return;
+    }
     m_potentials[site] = m_potentials[site] + potential;
 }
 
-double Grid::potential(int site)
+double Grid::sparsePotential(SiteID site)
 {
-    return m_potentials[site];
+    double v = 0;
+    if (site < m_volume)
+    {
+        v = m_sparsePotential->offset + m_sparsePotential->slopeX * (getIndexX(site) + 0.5)
+                                      + m_sparsePotential->slopeZ * (getIndexZ(site) + 0.5);
+    }
+    QHash<SiteID, SitePotential>::const_iterator it = m_sparsePotential->sites.constFind(site);
+    if (it != m_sparsePotential->sites.constEnd())
+    {
+        v += it.value();
+    }
+    return v;
+}
+
+void Grid::clearPotential()
+{
+    if (m_sparse)
+    {
+        m_sparsePotential->offset = 0;
+        m_sparsePotential->slopeX = 0;
+        m_sparsePotential->slopeZ = 0;
+        m_sparsePotential->sites.clear();
+        return;
+    }
+    for (SiteID site = 0; site < m_volume; site++)
+    {
+        m_potentials[site] = 0;
+    }
+}
+
+void Grid::addRampPotential(double offset, double slopeX, double slopeZ)
+{
+    if (m_sparse)
+    {
+        m_sparsePotential->offset += offset;
+        m_sparsePotential->slopeX += slopeX;
+        m_sparsePotential->slopeZ += slopeZ;
+        return;
+    }
+    for (SiteID site = 0; site < m_volume; site++)
+    {
+        m_potentials[site] = m_potentials[site] +
+            (offset + slopeX * (getIndexX(site) + 0.5) + slopeZ * (getIndexZ(site) + 0.5));
+    }
 }
 
 QList<Agent *>& Grid::getSpecialAgentList(Grid::CubeFace cubeFace)
@@ -570,22 +1081,23 @@ void Grid::registerSpecialAgent(Agent *agent, Grid::CubeFace cubeFace)
     }
     specialAgents.push_back(agent);
 
-    int site = m_volume+m_specialAgentCount;
-    if(m_agents[site] == 0 && m_agentType[site] == Agent::Empty)
+    SiteID site = m_volume+m_specialAgentCount;
+    if(agentType(site) == Agent::Empty)
     {
-        m_agents[site] = agent;
-        m_agentType[site] = agent->getType();
+        setAgent(site, agent);
     }
     else
     {
         qFatal("langmuir: can not register special agent: site is already occupied");
     }
 
-    QVector<int> neighbors = neighborsFace(cubeFace);
+    QVector<SiteID> neighbors = neighborsFace(cubeFace);
     agent->setNeighbors(neighbors);
     agent->setCurrentSite(site);
     agent->setFutureSite(site);
     ++m_specialAgentCount;
+
+    updateNeighborStencilDrains();
 }
 
 void Grid::unregisterSpecialAgent(Agent *agent, Grid::CubeFace cubeFace)
@@ -597,50 +1109,90 @@ void Grid::unregisterSpecialAgent(Agent *agent, Grid::CubeFace cubeFace)
     }
     specialAgents.removeOne(agent);
 
-    int site = agent->getCurrentSite();
-    if(!(m_agents[site] == agent))
+    SiteID site = agent->getCurrentSite();
+    if(!(agentAddress(site) == agent))
     {
         qFatal("langmuir: can not unregister special agent! pointers do not match");
     }
 
-    m_agentType[site] = Agent::Empty;
-    m_agents[site] = 0;
+    clearAgent(site);
     --m_specialAgentCount;
+
+    updateNeighborStencilDrains();
 }
 
 void Grid::registerAgent(Agent *agent)
 {
-    int site = agent->getCurrentSite();
-    if((m_agents[site] == 0) && (m_agentType[site] == Agent::Empty))
+    SiteID site = agent->getCurrentSite();
+    if(agentType(site) == Agent::Empty)
     {
-        m_agents[site] = agent;
-        m_agentType[site] = agent->getType();
+        setAgent(site, agent);
+        if (!m_freeSitesDeferred)
+        {
+            removeFreeSite(site);
+        }
     }
     else
     {
         qFatal("langmuir: can not register agent: site %d is invalid", site);
     }
-    QVector<int> neighbors = neighborsSite(site, m_world.parameters().hoppingRange);
-    agent->setNeighbors(neighbors);
+    if (agent->getType() == Agent::Electron || agent->getType() == Agent::Hole)
+    {
+        agent->setNeighborClass(neighborClass(site, m_world.parameters().hoppingRange));
+        m_world.potential().registerCarrier(site, agent->getType());
+    }
+    else
+    {
+        QVector<SiteID> neighbors = neighborsSite(site, m_world.parameters().hoppingRange);
+        agent->setNeighbors(neighbors);
+    }
 }
 
 void Grid::unregisterAgent(Agent *agent)
 {
-    int site = agent->getCurrentSite();
-    if(!(m_agents[site] == agent))
+    SiteID site = agent->getCurrentSite();
+    if(!(agentAddress(site) == agent))
     {
         qFatal("langmuir: can not unregister agent! pointers do not match");
     }
-    m_agentType[site] = Agent::Empty;
-    m_agents[site] = 0;
+    clearAgent(site);
+    if (!m_freeSitesDeferred)
+    {
+        addFreeSite(site);
+    }
+    if (agent->getType() == Agent::Electron || agent->getType() == Agent::Hole)
+    {
+        m_world.potential().unregisterCarrier(site, agent->getType());
+    }
+}
+
+void Grid::moveCarrier(SiteID from, SiteID to)
+{
+    Agent::Type type = agentType(from);
+    if (agentType(to) != Agent::Empty || (type != Agent::Electron && type != Agent::Hole))
+    {
+        qFatal("langmuir: can not move carrier: site %lld is invalid", qint64(to));
+    }
+    storeSite(to, type, siteIndex(from));
+    storeSite(from, Agent::Empty, -1);
+
+    // Moves inside a block leave the free-site counts as they are
+    if (!m_freeSitesDeferred && from / FreeBlockSize != to / FreeBlockSize)
+    {
+        addFreeSite(from);
+        removeFreeSite(to);
+    }
+
+    m_world.potential().unregisterCarrier(from, type);
+    m_world.potential().registerCarrier(to, type);
 }
 
-void Grid::registerDefect(int site)
+void Grid::registerDefect(SiteID site)
 {
-    if(m_agents[site] == 0 && m_agentType[site] == Agent::Empty)
+    if(agentType(site) == Agent::Empty)
     {
-        m_agents[site] = 0;
-        m_agentType[site] = Agent::Defect;
+        storeSite(site, Agent::Defect, -1);
+        removeFreeSite(site);
     }
     else
     {
@@ -648,14 +1200,14 @@ void Grid::registerDefect(int site)
     }
 }
 
-void Grid::unregisterDefect(int site)
+void Grid::unregisterDefect(SiteID site)
 {
-    if(m_agentType[site] != Agent::Defect || m_agents[site] != 0)
+    if(agentType(site) != Agent::Defect)
     {
         qFatal("langmuir: can not unregister defect! type does not match");
     }
-    m_agentType[site] = Agent::Empty;
-    m_agents[site] = 0;
+    storeSite(site, Agent::Empty, -1);
+    addFreeSite(site);
 }
 
 int Grid::specialAgentCount()
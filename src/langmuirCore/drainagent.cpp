@@ -3,6 +3,7 @@
 #include "parameters.h"
 #include "writer.h"
 #include "world.h"
+#include "cubicgrid.h"
 #include "rand.h"
 
 namespace LangmuirCore
@@ -13,7 +14,7 @@ DrainAgent::DrainAgent(World &world, Grid &grid, QObject *parent)
 {
 }
 
-ElectronDrainAgent::ElectronDrainAgent(World &world, int site, QObject *parent)
+ElectronDrainAgent::ElectronDrainAgent(World &world, SiteID site, QObject *parent)
     : DrainAgent(world, world.electronGrid(), parent)
 {
     initializeSite(site);
@@ -35,7 +36,7 @@ ElectronDrainAgent::ElectronDrainAgent(World &world, Grid::CubeFace cubeFace, QO
     setObjectName(name);
 }
 
-HoleDrainAgent::HoleDrainAgent(World &world, int site, QObject *parent)
+HoleDrainAgent::HoleDrainAgent(World &world, SiteID site, QObject *parent)
     : DrainAgent(world, world.holeGrid(), parent)
 {
     initializeSite(site);
@@ -83,7 +84,19 @@ void RecombinationAgent::guessProbability()
 bool DrainAgent::tryToAccept(ChargeAgent *charge)
 {
     m_attempts += 1;
-    if(shouldTransport(charge->getCurrentSite()))
+
+    // Use the charge's own stream so the result does not depend on the order charges are visited
+    bool transport = false;
+    if (m_world.parameters().randomCounter)
+    {
+        transport = charge->randomStream().chooseYes(m_probability);
+    }
+    else
+    {
+        transport = shouldTransport(charge->getCurrentSite());
+    }
+
+    if(transport)
     {
         m_successes += 1;
         return true;
@@ -91,21 +104,27 @@ bool DrainAgent::tryToAccept(ChargeAgent *charge)
     return false;
 }
 
-double ElectronDrainAgent::energyChange(int site)
+void DrainAgent::countAccepted()
+{
+    m_attempts += 1;
+    m_successes += 1;
+}
+
+double ElectronDrainAgent::energyChange(SiteID site)
 {
     double p1 = m_potential;
     double p2 = m_grid.potential(site);
     return p1-p2; // its backwards because q=-1 and dE = q*(p2-p1)= p1-p2
 }
 
-double HoleDrainAgent::energyChange(int site)
+double HoleDrainAgent::energyChange(SiteID site)
 {
     double p1 = m_potential;
     double p2 = m_grid.potential(site);
     return p2-p1;
 }
 
-double RecombinationAgent::energyChange(int site)
+double RecombinationAgent::energyChange(SiteID site)
 {
     return 0.0;
 }
@@ -113,10 +132,10 @@ double RecombinationAgent::energyChange(int site)
 bool RecombinationAgent::tryToAccept(ChargeAgent *charge)
 {
     // The current site
-    int site = charge->getCurrentSite();
+    SiteID site = charge->getCurrentSite();
 
     // A list of neighboring sites WITH carriers
-    QVector<int> neighbors;
+    QVector<SiteID> neighbors;
 
     // Consider same-site neighbors
     if (charge->otherGrid().agentType(site) == charge->otherType())
@@ -136,32 +155,22 @@ bool RecombinationAgent::tryToAccept(ChargeAgent *charge)
         // Consider more neighbors
         default:
         {
-            // Don't construct a neighbor list if one already exists
-            if (m_world.parameters().hoppingRange == m_world.parameters().recombinationRange)
+            // Reuse the carrier's neighbor class if the ranges agree
+            int range = m_world.parameters().recombinationRange;
+            int neighborClass = charge->getNeighborClass();
+            if (m_world.parameters().hoppingRange != range)
             {
-                // Loop over the neighbors and check if charges are there
-                foreach (int otherSite, charge->getNeighbors())
-                {
-                    if (charge->otherGrid().agentType(otherSite) == charge->otherType())
-                    {
-                        neighbors.push_back(otherSite);
-                    }
-                }
+                neighborClass = charge->getGrid().neighborClass(site, range);
             }
-            else
-            {
-                // We need to make a new neighborlist
-                QVector<int> constructed_neighbors = m_grid.neighborsSite(
-                            charge->getCurrentSite(),
-                            m_world.parameters().recombinationRange);
 
-                // Loop over the neighbors and check if charges are there
-                foreach (int otherSite, constructed_neighbors)
+            // Loop over the neighbors and check if charges are there
+            int count = charge->getGrid().neighborCount(neighborClass, range);
+            for (int i = 0; i < count; i++)
+            {
+                SiteID otherSite = charge->getGrid().neighbor(site, neighborClass, i, range);
+                if (charge->otherGrid().agentType(otherSite) == charge->otherType())
                 {
-                    if (charge->otherGrid().agentType(otherSite) == charge->otherType())
-                    {
-                        neighbors.push_back(otherSite);
-                    }
+                    neighbors.push_back(otherSite);
                 }
             }
             break;
@@ -172,8 +181,16 @@ bool RecombinationAgent::tryToAccept(ChargeAgent *charge)
     if (neighbors.size() > 0)
     {
         // Randomly choose which neighboring site to recombine with
-        int recombiningSite = neighbors[m_world.randomNumberGenerator().integer(
-                    0, neighbors.size()-1)];
+        int choice = 0;
+        if (m_world.parameters().randomCounter)
+        {
+            choice = charge->randomStream().integer(0, neighbors.size()-1);
+        }
+        else
+        {
+            choice = m_world.randomNumberGenerator().integer(0, neighbors.size()-1);
+        }
+        SiteID recombiningSite = neighbors[choice];
 
         // Get the other ChargeAgent
         ChargeAgent *other = dynamic_cast<ChargeAgent*>(
@@ -194,7 +211,17 @@ bool RecombinationAgent::tryToAccept(ChargeAgent *charge)
         // Try to recombine
         m_attempts += 1;
 
-        if(shouldTransport(recombiningSite))
+        bool transport = false;
+        if (m_world.parameters().randomCounter)
+        {
+            transport = charge->randomStream().chooseYes(m_probability);
+        }
+        else
+        {
+            transport = shouldTransport(recombiningSite);
+        }
+
+        if(transport)
         {
             // RecombinationAgent has succeeded
             m_successes += 1;
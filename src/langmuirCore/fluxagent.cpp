@@ -17,7 +17,7 @@ FluxAgent::FluxAgent(Agent::Type type, World &world, Grid &grid, QObject *parent
     storeLast();
 }
 
-void FluxAgent::initializeSite(int site)
+void FluxAgent::initializeSite(SiteID site)
 {
     m_site = site;
     m_fSite = site;
@@ -122,14 +122,14 @@ void FluxAgent::resetCounters()
     storeLast();
 }
 
-bool FluxAgent::shouldTransport(int site)
+bool FluxAgent::shouldTransport(SiteID site)
 {
     return m_world.randomNumberGenerator().chooseYes(m_probability);
     //return m_world.randomNumberGenerator().randomlyChooseYesWithMetropolisAndCoupling(
     //        energyChange(site), m_world.parameters().inverseKT, m_rate);
 }
 
-double FluxAgent::energyChange(int site)
+double FluxAgent::energyChange(SiteID site)
 {
     return 0;
 }
@@ -9,6 +9,8 @@
 #include <QString>
 #include <QDebug>
 
+#include "parameters.h"
+
 namespace LangmuirCore
 {
 
@@ -64,28 +66,37 @@ public:
       \param site grid site id Agent occupies
       \param parent parent QObject
      */
-    Agent(Type type, World &world, int site = 0, QObject *parent = 0);
+    Agent(Type type, World &world, SiteID site = 0, QObject *parent = 0);
 
     //! Destroy Agent
     virtual ~Agent();
 
     //! Get Agent neighbor list
-    const QVector<int>& getNeighbors() const;
+    const QVector<SiteID>& getNeighbors() const;
 
     //! Set Agent neighbor list
-    void setNeighbors(QVector<int> neighbors);
+    void setNeighbors(QVector<SiteID> neighbors);
+
+    //! Get Agent neighbor stencil class
+    /*!
+      Only set for ChargeAgents; see Grid::neighborClass()
+     */
+    int getNeighborClass() const;
+
+    //! Set Agent neighbor stencil class
+    void setNeighborClass(int neighborClass);
 
     //! Get Agent current site
-    int getCurrentSite() const;
+    SiteID getCurrentSite() const;
 
     //! Get Agent future site
-    int getFutureSite() const;
+    SiteID getFutureSite() const;
 
     //! Set Agent current site
-    void setCurrentSite(int site);
+    void setCurrentSite(SiteID site);
 
     //! Set Agent future site
-    void setFutureSite(int site);
+    void setFutureSite(SiteID site);
 
     //! Get Agent::Type enum
     Type getType() const;
@@ -96,23 +107,26 @@ public:
 protected:
 
     //! Current site the Agent occupies
-    int m_site;
+    SiteID m_site;
 
     //! Future site the Agent \b will occupy
-    int m_fSite;
+    SiteID m_fSite;
 
     //! Reference to World object
     World &m_world;
 
     //! List fo neighboring site ids
-    QVector<int> m_neighbors;
+    QVector<SiteID> m_neighbors;
+
+    //! Neighbor stencil class of the current site (see Grid::neighborClass)
+    int m_neighborClass;
 
     //! Agent Type enum
     Type m_type;
 };
 
-inline Agent::Agent(Type type, World &world, int site, QObject *parent) : QObject(parent),
-    m_site(-1), m_fSite(site), m_world(world), m_type(type)
+inline Agent::Agent(Type type, World &world, SiteID site, QObject *parent) : QObject(parent),
+    m_site(-1), m_fSite(site), m_world(world), m_neighborClass(-1), m_type(type)
 {
 }
 
@@ -120,32 +134,42 @@ inline Agent::~Agent()
 {
 }
 
-inline void Agent::setNeighbors(QVector<int> neighbors)
+inline void Agent::setNeighbors(QVector<SiteID> neighbors)
 {
     m_neighbors = neighbors;
 }
 
-inline const QVector<int>& Agent::getNeighbors() const
+inline const QVector<SiteID>& Agent::getNeighbors() const
 {
     return m_neighbors;
 }
 
-inline int Agent::getCurrentSite() const
+inline int Agent::getNeighborClass() const
+{
+    return m_neighborClass;
+}
+
+inline void Agent::setNeighborClass(int neighborClass)
+{
+    m_neighborClass = neighborClass;
+}
+
+inline SiteID Agent::getCurrentSite() const
 {
     return m_site;
 }
 
-inline int Agent::getFutureSite() const
+inline SiteID Agent::getFutureSite() const
 {
     return m_fSite;
 }
 
-inline void Agent::setCurrentSite(int site)
+inline void Agent::setCurrentSite(SiteID site)
 {
     m_site = site;
 }
 
-inline void Agent::setFutureSite(int site)
+inline void Agent::setFutureSite(SiteID site)
 {
     m_fSite = site;
 }
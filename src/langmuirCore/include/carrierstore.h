@@ -0,0 +1,414 @@
+#ifndef CARRIERSTORE_H
+#define CARRIERSTORE_H
+
+#include "agent.h"
+
+#include <QVector>
+#include <QObject>
+
+namespace LangmuirCore
+{
+
+class World;
+class ChargeAgent;
+
+/**
+ * @brief A class to hold the per-carrier state of one carrier type in contiguous arrays
+ *
+ * Every carrier owns a slot; the site, future site, charge, lifetime, pathlength and
+ * Coulomb energy change of all carriers are stored in arrays indexed by slot.  Slots
+ * (and the ChargeAgent objects that own them) are recycled when carriers are removed,
+ * so injection and removal do not allocate once the store has grown to its working size.
+ *
+ * The x, y and z site IDs of the active carriers are also kept in packed arrays, for the
+ * vectorized Coulomb sums (see CoulombKernel).
+ *
+ * Active carriers are kept in the order they were created, which is the order the
+ * Simulation steps them in.
+ */
+class CarrierStore : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(CarrierStore)
+
+public:
+    /**
+     * @brief create an empty store
+     * @param type either Agent::Electron or Agent::Hole
+     * @param world reference to world object
+     * @param parent parent QObject
+     */
+    CarrierStore(Agent::Type type, World &world, QObject *parent = 0);
+
+    /**
+     * @brief deletes all ChargeAgents, including recycled ones
+     */
+    ~CarrierStore();
+
+    /**
+     * @brief place a new carrier at a site, reusing a free slot if there is one
+     * @param site the site id to place the carrier at
+     */
+    ChargeAgent* create(SiteID site);
+
+    /**
+     * @brief remove the carrier at an index and recycle its slot
+     * @param index index into the list of active carriers
+     *
+     * The carrier must have been unregistered from the Grid already (see ChargeAgent::completeTick)
+     */
+    void remove(int index);
+
+    /**
+     * @brief remove every carrier flagged by ChargeAgent::removed() in one pass and recycle their slots
+     *
+     * The remaining carriers keep their creation order, so the indices (and OpenCL IDs)
+     * handed out after the pass are the same as after removing the carriers one at a time.
+     * The carriers must have been unregistered from the Grid already (see ChargeAgent::completeTick)
+     */
+    void compact();
+
+    /**
+     * @brief reorder the active carriers along a Morton (Z-order) curve through their sites
+     *
+     * Carriers that are close on the Grid end up close in the packed arrays, so the Coulomb
+     * sums and neighbor lookups of consecutive carriers touch the same cache lines and pages.
+     * Ties keep their current order, so the result only depends on the carrier positions and order.
+     */
+    void sort();
+
+    /**
+     * @brief get the index of a slot in the list of active carriers
+     * @param slot the slot
+     * @return the index, or -1 if the slot is free
+     */
+    int indexOf(int slot) const;
+
+    /**
+     * @brief get the number of active carriers
+     */
+    int size() const;
+
+    /**
+     * @brief get the number of allocated slots (active and free)
+     */
+    int capacity() const;
+
+    /**
+     * @brief get the carrier at an index
+     * @param index index into the list of active carriers
+     */
+    ChargeAgent* at(int index) const;
+
+    /**
+     * @brief get the list of active carriers
+     */
+    QVector<ChargeAgent*>& agents();
+
+    /**
+     * @brief get the slot of the carrier at an index
+     * @param index index into the list of active carriers
+     */
+    int slot(int index) const;
+
+    /**
+     * @brief get the slots of the active carriers, in the same order as agents()
+     */
+    const QVector<int>& activeSlots() const;
+
+    /**
+     * @brief get the Agent::Type of the carriers in this store
+     */
+    Agent::Type type() const;
+
+    /**
+     * @brief get the charge every carrier in this store has (in units of e)
+     */
+    int unitCharge() const;
+
+    /**
+     * @brief get the x-site IDs of the active carriers, in the same order as agents()
+     */
+    const QVector<int>& activeX() const;
+
+    /**
+     * @brief get the y-site IDs of the active carriers, in the same order as agents()
+     */
+    const QVector<int>& activeY() const;
+
+    /**
+     * @brief get the z-site IDs of the active carriers, in the same order as agents()
+     */
+    const QVector<int>& activeZ() const;
+
+    /**
+     * @brief move the carrier in a slot to a site, keeping activeX(), activeY() and activeZ() up to date
+     */
+    void setSite(int slot, SiteID site);
+
+    /**
+     * @brief get the current site of the carrier in a slot
+     */
+    SiteID site(int slot) const;
+
+    /**
+     * @brief get the future site of the carrier in a slot
+     */
+    SiteID& futureSite(int slot);
+    SiteID futureSite(int slot) const;
+
+    /**
+     * @brief get the charge of the carrier in a slot (in units of e)
+     */
+    int& charge(int slot);
+    int charge(int slot) const;
+
+    /**
+     * @brief get the number of steps the carrier in a slot has existed
+     */
+    int& lifetime(int slot);
+    int lifetime(int slot) const;
+
+    /**
+     * @brief get the number of sites the carrier in a slot has traversed
+     */
+    int& pathlength(int slot);
+    int pathlength(int slot) const;
+
+    /**
+     * @brief get the Coulomb energy change of the carrier in a slot
+     */
+    double& de(int slot);
+    double de(int slot) const;
+
+    /**
+     * @brief get the site of the carrier in a slot when the space-charge potential was last solved, or -1
+     */
+    SiteID& poissonSite(int slot);
+    SiteID poissonSite(int slot) const;
+
+    /**
+     * @brief get the ChargeAgent that owns a slot
+     */
+    ChargeAgent* agent(int slot) const;
+
+private:
+    /**
+     * @brief the type of carrier held
+     */
+    Agent::Type m_type;
+
+    /**
+     * @brief reference to world object
+     */
+    World &m_world;
+
+    /**
+     * @brief current site, indexed by slot
+     */
+    QVector<SiteID> m_site;
+
+    /**
+     * @brief future site, indexed by slot
+     */
+    QVector<SiteID> m_futureSite;
+
+    /**
+     * @brief charge, indexed by slot
+     */
+    QVector<int> m_charge;
+
+    /**
+     * @brief lifetime, indexed by slot
+     */
+    QVector<int> m_lifetime;
+
+    /**
+     * @brief pathlength, indexed by slot
+     */
+    QVector<int> m_pathlength;
+
+    /**
+     * @brief Coulomb energy change, indexed by slot
+     */
+    QVector<double> m_de;
+
+    /**
+     * @brief site at the last Poisson solve (see Potential::poissonSelfEnergy()), indexed by slot
+     */
+    QVector<SiteID> m_poissonSite;
+
+    /**
+     * @brief the ChargeAgent owning each slot (kept alive while the slot is free)
+     */
+    QVector<ChargeAgent*> m_pool;
+
+    /**
+     * @brief slots available for reuse
+     */
+    QVector<int> m_free;
+
+    /**
+     * @brief active carriers, in creation order
+     */
+    QVector<ChargeAgent*> m_active;
+
+    /**
+     * @brief slots of the active carriers, in creation order
+     */
+    QVector<int> m_activeSlots;
+
+    /**
+     * @brief index of each slot in the list of active carriers, -1 if free
+     */
+    QVector<int> m_index;
+
+    /**
+     * @brief x-site IDs of the active carriers, in creation order
+     */
+    QVector<int> m_activeX;
+
+    /**
+     * @brief y-site IDs of the active carriers, in creation order
+     */
+    QVector<int> m_activeY;
+
+    /**
+     * @brief z-site IDs of the active carriers, in creation order
+     */
+    QVector<int> m_activeZ;
+};
+
+inline int CarrierStore::size() const
+{
+    return m_active.size();
+}
+
+inline int CarrierStore::capacity() const
+{
+    return m_pool.size();
+}
+
+inline ChargeAgent* CarrierStore::at(int index) const
+{
+    return m_active[index];
+}
+
+inline QVector<ChargeAgent*>& CarrierStore::agents()
+{
+    return m_active;
+}
+
+inline int CarrierStore::slot(int index) const
+{
+    return m_activeSlots[index];
+}
+
+inline int CarrierStore::indexOf(int slot) const
+{
+    return m_index[slot];
+}
+
+inline const QVector<int>& CarrierStore::activeSlots() const
+{
+    return m_activeSlots;
+}
+
+inline Agent::Type CarrierStore::type() const
+{
+    return m_type;
+}
+
+inline int CarrierStore::unitCharge() const
+{
+    return (m_type == Agent::Electron) ? -1 : +1;
+}
+
+inline const QVector<int>& CarrierStore::activeX() const
+{
+    return m_activeX;
+}
+
+inline const QVector<int>& CarrierStore::activeY() const
+{
+    return m_activeY;
+}
+
+inline const QVector<int>& CarrierStore::activeZ() const
+{
+    return m_activeZ;
+}
+
+inline SiteID CarrierStore::site(int slot) const
+{
+    return m_site[slot];
+}
+
+inline SiteID& CarrierStore::futureSite(int slot)
+{
+    return m_futureSite[slot];
+}
+
+inline SiteID CarrierStore::futureSite(int slot) const
+{
+    return m_futureSite[slot];
+}
+
+inline int& CarrierStore::charge(int slot)
+{
+    return m_charge[slot];
+}
+
+inline int CarrierStore::charge(int slot) const
+{
+    return m_charge[slot];
+}
+
+inline int& CarrierStore::lifetime(int slot)
+{
+    return m_lifetime[slot];
+}
+
+inline int CarrierStore::lifetime(int slot) const
+{
+    return m_lifetime[slot];
+}
+
+inline int& CarrierStore::pathlength(int slot)
+{
+    return m_pathlength[slot];
+}
+
+inline int CarrierStore::pathlength(int slot) const
+{
+    return m_pathlength[slot];
+}
+
+inline double& CarrierStore::de(int slot)
+{
+    return m_de[slot];
+}
+
+inline double CarrierStore::de(int slot) const
+{
+    return m_de[slot];
+}
+
+inline SiteID& CarrierStore::poissonSite(int slot)
+{
+    return m_poissonSite[slot];
+}
+
+inline SiteID CarrierStore::poissonSite(int slot) const
+{
+    return m_poissonSite[slot];
+}
+
+inline ChargeAgent* CarrierStore::agent(int slot) const
+{
+    return m_pool[slot];
+}
+
+}
+#endif
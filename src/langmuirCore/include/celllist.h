@@ -0,0 +1,136 @@
+#ifndef CELLLIST_H
+#define CELLLIST_H
+
+#include <QVector>
+
+namespace LangmuirCore
+{
+
+class CoulombKernel;
+
+/**
+ * @brief A class to bin carrier positions into cells at least as large as the Coulomb cutoff
+ *
+ * A carrier within the cutoff of a site is always in the cell of the site or in one of its
+ * neighboring cells, so a cutoff-limited sum only has to visit (at most) 27 cells instead of
+ * every carrier.  Each cell keeps packed x, y and z site IDs, so the sums still use the
+ * vectorized CoulombKernel.
+ *
+ * The order of carriers within a cell is not kept; removing a carrier moves the last one into
+ * its place.  The CoulombKernel sums are in fixed point, so the order does not change them.
+ */
+class CellList
+{
+public:
+    /**
+     * @brief create an empty list with no cells
+     */
+    CellList();
+
+    /**
+     * @brief make the cells and remove all carriers
+     * @param xSize number of sites along x
+     * @param ySize number of sites along y
+     * @param zSize number of sites along z
+     * @param cellSize the smallest size of a cell, usually the cutoff
+     * @param xPeriodic true if cells wrap around along x
+     * @param yPeriodic true if cells wrap around along y
+     * @param zPeriodic true if cells wrap around along z
+     */
+    void initialize(int xSize, int ySize, int zSize, int cellSize,
+                    bool xPeriodic, bool yPeriodic, bool zPeriodic);
+
+    /**
+     * @brief true if initialize() has been called
+     */
+    bool isOn() const;
+
+    /**
+     * @brief add a carrier
+     * @param x x-site ID of the carrier
+     * @param y y-site ID of the carrier
+     * @param z z-site ID of the carrier
+     */
+    void insert(int x, int y, int z);
+
+    /**
+     * @brief remove a carrier
+     * @param x x-site ID of the carrier
+     * @param y y-site ID of the carrier
+     * @param z z-site ID of the carrier
+     */
+    void remove(int x, int y, int z);
+
+    /**
+     * @brief sum a CoulombKernel over the carriers in the cells around a site
+     * @param kernel the kernel, with a cutoff no larger than the cell size
+     * @param xi x-site ID of the site to calculate the potential at
+     * @param yi y-site ID of the site to calculate the potential at
+     * @param zi z-site ID of the site to calculate the potential at
+     * @return the potential of unit charges at the carriers, in fixed point
+     */
+    qint64 sum(const CoulombKernel &kernel, int xi, int yi, int zi) const;
+
+private:
+    /**
+     * @brief the carriers in one cell
+     */
+    struct Cell
+    {
+        //! x-site IDs
+        QVector<int> x;
+
+        //! y-site IDs
+        QVector<int> y;
+
+        //! z-site IDs
+        QVector<int> z;
+    };
+
+    /**
+     * @brief get the cell index along one axis of a site ID
+     */
+    int cellIndex(int axis, int site) const;
+
+    /**
+     * @brief get the cell indices to visit along one axis, around a cell index
+     * @param axis 0, 1 or 2 for x, y or z
+     * @param c the cell index of the site
+     * @param cells filled with the cell indices, without duplicates
+     * @return the number of cell indices
+     */
+    int neighborCells(int axis, int c, int *cells) const;
+
+    /**
+     * @brief the number of sites along x, y and z
+     */
+    int m_size[3];
+
+    /**
+     * @brief the number of cells along x, y and z
+     */
+    int m_count[3];
+
+    /**
+     * @brief true if cells wrap around along x, y and z
+     */
+    bool m_periodic[3];
+
+    /**
+     * @brief the cells, indexed by cx + m_count[0] * (cy + m_count[1] * cz)
+     */
+    QVector<Cell> m_cells;
+};
+
+inline bool CellList::isOn() const
+{
+    return !m_cells.isEmpty();
+}
+
+inline int CellList::cellIndex(int axis, int site) const
+{
+    return (site * m_count[axis]) / m_size[axis];
+}
+
+}
+#endif
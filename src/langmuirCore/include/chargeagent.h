@@ -2,40 +2,105 @@
 #define CHARGEAGENT_H
 
 #include "agent.h"
+#include "rand.h"
 
 namespace LangmuirCore
 {
 
 class Grid;
+class CarrierStore;
 struct SimulationParameters;
 
 //! A class to represent moving charged particles
 class ChargeAgent : public Agent
 {
 public:
+    //! How coulombCPU() calculates the Coulomb energy change; fixed for a simulation
+    enum CoulombMode
+    {
+        //! Coulomb interactions are off
+        NoCoulomb,
+
+        //! Sum over point charges (Potential::coulombE(), Potential::coulombH())
+        PointCoulomb,
+
+        //! Sum over gaussian charges (Potential::gaussE(), Potential::gaussH())
+        GaussianCoulomb,
+
+        //! Look up the per-site carrier potential (Potential::carrierFieldE(), Potential::carrierFieldH())
+        CarrierFieldCoulomb
+    };
+
+    //! Get the CoulombMode a World uses
+    /*!
+      Depends upon SimulationParameters::coulombCarriers, SimulationParameters::coulombGaussianSigma
+      and Potential::carrierFieldIsOn(), so call it after the World is initialized
+     */
+    static CoulombMode coulombMode(World &world);
+
     //! Construct charge
     /*!
      * \brief ChargeAgent
      * \param getType Agent type; must be Agent::Electron or Agent::Hole
      * \param world reference to world
      * \param grid reference to grid
-     * \param site site id in grid
+     * \param store the CarrierStore holding the per-carrier state
+     * \param slot slot id in the CarrierStore
      * \param parent parent QObject
      */
-    ChargeAgent(Agent::Type getType, World &world, Grid &grid, int site, QObject *parent=0);
+    ChargeAgent(Agent::Type getType, World &world, Grid &grid, CarrierStore &store, int slot, QObject *parent=0);
 
     //! Destroy charge
     virtual ~ChargeAgent();
 
+    //! Put the charge on a site and reset its state
+    /*!
+      Called by CarrierStore::create() for new and for recycled charges
+     */
+    void place(SiteID site);
+
+    //! Get the slot of the ChargeAgent in its CarrierStore
+    int slot();
+
     //! Get the charge of the ChargeAgent
     int charge();
 
     //! Propose a random site to move to
-    void chooseFuture();
+    /*!
+      \param id carrier id used to key the counter-based random stream
+        (see SimulationParameters::randomCounter); the index of the charge in its CarrierStore
+     */
+    void chooseFuture(int id);
 
     //! Decide what should happen, called after chooseFuture
     void decideFuture();
 
+    //! Give up the proposed move and stay on the current site
+    void rejectFuture();
+
+    //! False if decideFuture() does not need the Coulomb energy change of the proposed move
+    /*!
+      Always true unless SimulationParameters::coulombLazy is set; then only moves to empty
+      sites whose uniform (drawn by chooseFuture()) is below the coupling constant need it.
+     */
+    bool needsCoulomb();
+
+    //! Set the future site to a move that is already accepted, then call completeTick
+    /*!
+      Used by the rejection-free algorithm (see SimulationParameters::rejectionFree),
+      which only picks moves decideFuture() would accept
+     */
+    void acceptFuture(SiteID site);
+
+    //! The probability that decideFuture() accepts a move to a site
+    /*!
+      The coupling constant times the Metropolis factor for empty sites, the rate of
+      the DrainAgent for drains, and zero otherwise.  The Coulomb energy change is
+      taken from the per-site carrier potential, so Potential::updateCarrierField()
+      must have been called.
+     */
+    double acceptanceProbability(SiteID site);
+
     //! Perform action, called after decideFuture
     void completeTick();
 
@@ -73,6 +138,13 @@ public:
      */
     void coulombCPU();
 
+    //! coulombCPU() for a known CoulombMode, without checking the parameters
+    /*!
+      Instantiated for every CoulombMode in chargeagent.cpp; NoCoulomb sets the energy change to zero
+     */
+    template <CoulombMode Mode>
+    void coulombKernel();
+
     //! \b Retrieve the Coulomb potential from the GPU
     /*!
       \note The result is stored in m_de
@@ -88,12 +160,36 @@ public:
     //! Get the grid this ChargeAgent exists in
     Grid& getGrid();
 
+    //! Get the counter-based random stream of this step (set by chooseFuture())
+    RandomStream& randomStream();
+
     //! Set the removed status of this ChargeAgent
     /*!
       \note Removed charges are not actually removed until completeTick() is called
      */
     void setRemoved(const bool &status = true);
 
+    //! True if TrapEscape is moving this charge through a trap basin
+    /*!
+      chooseFuture() and decideFuture() leave trapped charges alone (except for the lifetime)
+     */
+    bool trapped();
+
+    //! Set the trapped status of this ChargeAgent (see TrapEscape)
+    void setTrapped(bool status = true);
+
+    //! Move the charge to a site right away, without proposing the move
+    /*!
+      Used by TrapEscape to put a charge on the site it reached inside a trap basin
+     */
+    void jumpTo(SiteID site);
+
+    //! Move the charge to an empty site inside the Grid, as completeTick() does for an accepted move
+    /*!
+      Used by WalkerEngine, which decides the moves without setting the future site
+     */
+    void hopTo(SiteID site);
+
     //! Return the opposite ChargeAgent type relative to this ChargeAgent
     /*!
      * \return Agent::Hole if this ChargeAgent is an Agent::Electron
@@ -115,28 +211,43 @@ protected:
        - \f$+0.5\f$ eV if exciton
        - 0 otherwise
      */
-    virtual double bindingPotential(int site)= 0;
+    virtual double bindingPotential(SiteID site)= 0;
+
+    //! Set the current site (here and in the CarrierStore)
+    void setSite(SiteID site);
+
+    //! Set the future site (here and in the CarrierStore)
+    void setFuture(SiteID site);
 
-    //! Charge of ChargeAgent (in units of e)
-    int m_charge;
+    //! Get the coupling constant of the move to the future site
+    double futureCoupling();
 
     //! Removed status of ChargeAgent
     bool m_removed;
 
-    //! Number of steps ChargeAgent as been in existance
-    int m_lifetime;
-
-    //! Number of grid spaces ChargeAgent has moved
-    int m_pathlength;
+    //! Trapped status of ChargeAgent (see TrapEscape)
+    bool m_trapped;
 
     //! The Grid the ChargeAgent lives in
     Grid &m_grid;
 
+    //! The CarrierStore holding charge, lifetime, pathlength and Coulomb energy change
+    CarrierStore &m_store;
+
+    //! The slot of the ChargeAgent in the CarrierStore
+    int m_slot;
+
     //! The index of the Charge in the OpenCL vectors (see OpenClHelper)
     int m_openClID;
 
-    //! The difference in Coulomb potential between ChargeAgent::m_site and ChargeAgent::m_fSite
-    double m_de;
+    //! Random stream for this step, only used if SimulationParameters::randomCounter
+    RandomStream m_random;
+
+    //! The index of the future site in the neighbor stencil (set by chooseFuture()), or -1
+    int m_fIndex;
+
+    //! The uniform for the Metropolis test, drawn by chooseFuture() if SimulationParameters::coulombLazy, or -1
+    double m_uniform;
 };
 
 //! A class to represent moving negative charges
@@ -144,7 +255,7 @@ class ElectronAgent : public ChargeAgent
 {
 public:
     //! Construct ElectronAgent
-    ElectronAgent(World &world, int site, QObject *parent=0);
+    ElectronAgent(World &world, CarrierStore &store, int slot, QObject *parent=0);
 protected:
     //! Calculate Exciton Binding Energy
     /*!
@@ -153,7 +264,7 @@ protected:
        - \f$+0.5\f$ eV if exciton
        - 0 otherwise
      */
-    virtual double bindingPotential(int site);
+    virtual double bindingPotential(SiteID site);
 
     //! Return other Agent::Type
     /*!
@@ -173,7 +284,7 @@ class HoleAgent : public ChargeAgent
 {
 public:
     //! Construct HoleAgent
-    HoleAgent(World &world, int site, QObject *parent=0);
+    HoleAgent(World &world, CarrierStore &store, int slot, QObject *parent=0);
 protected:
     //! Calculate Exciton Binding Energy
     /*!
@@ -182,7 +293,7 @@ protected:
        - \f$-0.5\f$ eV if exciton
        - 0 otherwise
      */
-    virtual double bindingPotential(int site);
+    virtual double bindingPotential(SiteID site);
 
     //! Return other Agent::Type
     /*!
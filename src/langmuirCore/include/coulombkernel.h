@@ -0,0 +1,152 @@
+#ifndef COULOMBKERNEL_H
+#define COULOMBKERNEL_H
+
+#include <QVector>
+#include <QString>
+
+namespace LangmuirCore
+{
+
+/**
+ * @brief A class to sum the Coulomb potential of many carriers at one site
+ *
+ * The carriers are given as packed x, y and z coordinates (see CarrierStore::activeX()).
+ * For each carrier the offsets |dx|, |dy| and |dz| index a flattened cutoff table, which
+ * already holds the prefactor, 1/r, erf(r) (for gaussian charges) and the spherical cutoff,
+ * so the inner loop has no branches and no divisions.
+ *
+ * Offsets along periodic directions use the nearest image (see setPeriods()).
+ *
+ * The table holds fixed point integers, so the sum does not depend on the order of the
+ * carriers.  The AVX-512, AVX2 and scalar versions therefore give identical results.  The
+ * fastest version the CPU supports is picked at runtime.
+ */
+class CoulombKernel
+{
+public:
+    /**
+     * @brief the instruction sets the kernel is written for
+     */
+    enum InstructionSet
+    {
+        //! plain C++
+        Scalar,
+
+        //! 8 carriers at a time
+        AVX2,
+
+        //! 16 carriers at a time
+        AVX512
+    };
+
+    /**
+     * @brief create a kernel with an empty table, using the best instruction set of the CPU
+     */
+    CoulombKernel();
+
+    /**
+     * @brief set the table
+     * @param table the potential of a unit charge at offset (dx, dy, dz), in fixed point,
+     * stored at (dx * cutoff + dy) * cutoff + dz; zero outside of the cutoff sphere
+     * @param cutoff the size of the table in each direction
+     */
+    void setTable(const QVector<qint64> &table, int cutoff);
+
+    /**
+     * @brief use the nearest periodic image along some directions
+     * @param x period along x, or 0 if not periodic
+     * @param y period along y, or 0 if not periodic
+     * @param z period along z, or 0 if not periodic
+     */
+    void setPeriods(int x, int y, int z);
+
+    /**
+     * @brief sum the table over carriers
+     * @param x x-site IDs of the carriers
+     * @param y y-site IDs of the carriers
+     * @param z z-site IDs of the carriers
+     * @param count the number of carriers
+     * @param xi x-site ID of the site to calculate the potential at
+     * @param yi y-site ID of the site to calculate the potential at
+     * @param zi z-site ID of the site to calculate the potential at
+     * @return the potential of unit charges at the carriers, in fixed point
+     */
+    qint64 sum(const int *x, const int *y, const int *z, int count, int xi, int yi, int zi) const;
+
+    /**
+     * @brief get the instruction set in use
+     */
+    InstructionSet instructionSet() const;
+
+    /**
+     * @brief use a different instruction set (falls back to Scalar if the CPU does not support it)
+     */
+    void setInstructionSet(InstructionSet instructionSet);
+
+    /**
+     * @brief get the best instruction set the CPU supports
+     */
+    static InstructionSet detectInstructionSet();
+
+    /**
+     * @brief convert an InstructionSet to a QString
+     */
+    static QString toQString(InstructionSet instructionSet);
+
+private:
+    /**
+     * @brief the signature of the sum kernels
+     */
+    typedef qint64 (*SumFunction)(const qint64 *table, int cutoff,
+                                  const int *period,
+                                  const int *x, const int *y, const int *z, int count,
+                                  int xi, int yi, int zi);
+
+    /**
+     * @brief the flattened table
+     */
+    QVector<qint64> m_table;
+
+    /**
+     * @brief the size of the table in each direction
+     */
+    int m_cutoff;
+
+    /**
+     * @brief the period along x, y and z (NotPeriodic if not periodic)
+     */
+    int m_period[3];
+
+    /**
+     * @brief the period used for directions that are not periodic
+     */
+    static const int NotPeriodic = 1 << 29;
+
+    /**
+     * @brief the instruction set in use
+     */
+    InstructionSet m_instructionSet;
+
+    /**
+     * @brief the kernel for m_instructionSet
+     */
+    SumFunction m_sum;
+};
+
+inline qint64 CoulombKernel::sum(const int *x, const int *y, const int *z, int count,
+                                 int xi, int yi, int zi) const
+{
+    if (m_cutoff <= 0)
+    {
+        return 0;
+    }
+    return m_sum(m_table.constData(), m_cutoff, m_period, x, y, z, count, xi, yi, zi);
+}
+
+inline CoulombKernel::InstructionSet CoulombKernel::instructionSet() const
+{
+    return m_instructionSet;
+}
+
+}
+#endif
@@ -8,11 +8,23 @@
 #include <QString>
 #include <QObject>
 #include <QDebug>
+#include <QHash>
+#include <vector>
 
 namespace LangmuirCore
 {
 
 class World;
+class Random;
+
+/**
+ * @brief The type the Grid stores site potentials in (see the LANGMUIR_FLOAT_POTENTIAL build option)
+ */
+#ifdef LANGMUIR_FLOAT_POTENTIAL
+typedef float SitePotential;
+#else
+typedef double SitePotential;
+#endif
 
 /**
  * @brief A class to hold Agents, calculate their positions, and store the background potential
@@ -71,15 +83,30 @@ public:
     /**
      * @brief Create a grid
      * @param world reference to the world object
+     * @param shared another Grid to share the background potential with, or NULL to own it
      * @param parent QObject this belongs to
+     *
+     * The electron and hole grids always see the same background potential, so the hole
+     * grid uses the array of the electron grid; a write through either Grid changes both.
+     * It uses the packed site IDs of the shared Grid too.  The shared Grid must outlive this one.
+     *
+     * With grid.sparse, nothing is stored per site: occupied sites go in a hash, and
+     * the background potential is a ramp (see addRampPotential()) plus a hash of the
+     * sites that differ from it, such as traps.  Memory then scales with the number
+     * of carriers, defects and traps instead of the volume.
      */
-    Grid(World &world, QObject *parent = 0);
+    Grid(World &world, Grid *shared = 0, QObject *parent = 0);
 
     /**
      * @brief Destroy the grid
      */
     ~Grid();
 
+    /**
+     * @brief True if the Grid stores only occupied sites and the sites that differ from the ramp potential
+     */
+    bool isSparse();
+
     /**
      * @brief Get the number of sites along the x-direction
      */
@@ -103,35 +130,35 @@ public:
     /**
      * @brief Get the total number of sites
      */
-    int volume();
+    SiteID volume();
 
     /**
      * @brief Get the distance between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    double totalDistance(int site1, int site2);
+    double totalDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the distance along the x-direction between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    double xDistance(int site1, int site2);
+    double xDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the distance along the y-direction between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    double yDistance(int site1, int site2);
+    double yDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the distance along the z-direction between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    double zDistance(int site1, int site2);
+    double zDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the image distance along the x-direction between two sites
@@ -141,7 +168,7 @@ public:
      * The second site's x-position is taken to be the negative of its x-value
      * (i.e., the particle is reflected through the yz-plane).
      */
-    double xImageDistance(int site1, int site2);
+    double xImageDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the image distance along the y-direction between two sites
@@ -151,7 +178,7 @@ public:
      * The second site's y-position is taken to be the negative of its y-value
      * (i.e., the particle is reflected through the xz-plane).
      */
-    double yImageDistance(int site1, int site2);
+    double yImageDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the image distance along the z-direction between two sites
@@ -161,28 +188,28 @@ public:
      * The second site's z-position is taken to be the negative of its z-value
      * (i.e., the particle is reflected through the xy-plane).
      */
-    double zImageDistance(int site1, int site2);
+    double zImageDistance(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the \b integer distance along the x-direction between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    int xDistancei(int site1, int site2);
+    int xDistancei(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the \b integer distance along the y-direction between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    int yDistancei(int site1, int site2);
+    int yDistancei(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the \b integer distance along the z-direction between two sites
      * @param site1 the first site
      * @param site2 the second site
      */
-    int zDistancei(int site1, int site2);
+    int zDistancei(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the \b integer image distance along the x-direction between two sites
@@ -192,7 +219,7 @@ public:
      * The second site's x-position is taken to be the negative of its x-value
      * (i.e., the particle is reflected through the yz-plane).
      */
-    int xImageDistancei(int site1, int site2);
+    int xImageDistancei(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the \b integer image distance along the y-direction between two sites
@@ -202,7 +229,7 @@ public:
      * The second site's y-position is taken to be the negative of its y-value
      * (i.e., the particle is reflected through the xz-plane).
      */
-    int yImageDistancei(int site1, int site2);
+    int yImageDistancei(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the \b integer image distance along the z-direction between two sites
@@ -212,7 +239,7 @@ public:
      * The second site's z-position is taken to be the negative of its z-value
      * (i.e., the particle is reflected through the xy-plane).
      */
-    int zImageDistancei(int site1, int site2);
+    int zImageDistancei(SiteID site1, SiteID site2);
 
     /**
      * @brief Get the serial site ID
@@ -225,7 +252,7 @@ public:
      * the dimension of the grid, called the "serial site ID", the "s-site ID",
      * or just the "site".
      */
-    int getIndexS(int xIndex, int yIndex, int zIndex = 0);
+    SiteID getIndexS(int xIndex, int yIndex, int zIndex = 0);
 
     /**
      * @brief Get the "y-site ID" from the "s-site ID"
@@ -234,7 +261,7 @@ public:
      * The y-site ID can be thought of as the y-value of the cornor of a Grid site.
      * @see getIndexS
      */
-    int getIndexY(int site);
+    int getIndexY(SiteID site);
 
     /**
      * @brief Get the "x-site ID" from the "s-site ID"
@@ -243,7 +270,7 @@ public:
      * The y-site ID can be thought of as the x-value of the cornor of a Grid site.
      * @see getIndexS
      */
-    int getIndexX(int site);
+    int getIndexX(SiteID site);
 
     /**
      * @brief Get the "z-site ID" from the "s-site ID"
@@ -252,7 +279,7 @@ public:
      * The y-site ID can be thought of as the z-value of the cornor of a Grid site.
      * @see getIndexS
      */
-    int getIndexZ(int site);
+    int getIndexZ(SiteID site);
 
     /**
      * @brief Get the y-position from the "s-site ID"
@@ -262,7 +289,7 @@ public:
      * The y-position is therefore the "y-site ID" plus 0.5 in reduced
      * units.
      */
-    double getPositionY(int site);
+    double getPositionY(SiteID site);
 
     /**
      * @brief Get the x-position from the "s-site ID"
@@ -272,7 +299,7 @@ public:
      * The x-position is therefore the "x-site ID" plus 0.5 in reduced
      * units.
      */
-    double getPositionX(int site);
+    double getPositionX(SiteID site);
 
     /**
      * @brief Get the z-position from the "s-site ID"
@@ -282,54 +309,134 @@ public:
      * The z-position is therefore the "z-site ID" plus 0.5 in reduced
      * units.
      */
-    double getPositionZ(int site);
+    double getPositionZ(SiteID site);
 
     /**
      * @brief Get a pointer to the Agent at a site
      * @param site the "s-site ID"
      * @warning may be NULL if there is no Agent
      */
-    Agent * agentAddress(int site);
+    Agent * agentAddress(SiteID site);
 
     /**
      * @brief Get the type of Agent at a site
      * @param site the "s-site ID"
      * @warning if there is no Agent, it should be Agent::Empty
      */
-    Agent::Type agentType(int site);
+    Agent::Type agentType(SiteID site);
+
+    /**
+     * @brief Get the number of sites that are Agent::Empty
+     *
+     * Only sites inside the volume count; the locations of special Agents do not.
+     */
+    SiteID freeSiteCount();
+
+    /**
+     * @brief Get a uniform random Agent::Empty site, or -1 if there are none
+     * @param random the generator to draw from
+     *
+     * A dense Grid picks the n-th free site from its free-site counts (see m_freeBlocks)
+     * in O(log volume), with one random number.  A sparse Grid draws sites until it finds
+     * an empty one, which takes 1 / (1 - occupied fraction) draws on average.
+     */
+    SiteID randomFreeSite(Random &random);
 
     /**
      * @brief Add some value to the background potential at a site
      * @param site the "s-site ID"
      * @param potential the value to add
      */
-    void addToPotential(int site, double potential);
+    void addToPotential(SiteID site, double potential);
 
     /**
      * @brief Set the background potential at a site to some value
      * @param site the "s-site ID"
      * @param potential the value to set
      */
-    void setPotential(int site, double potential);
+    void setPotential(SiteID site, double potential);
 
     /**
      * @brief Get the background potential at some site
      * @param site the "s-site ID"
      */
-    double potential(int site);
+    double potential(SiteID site);
+
+    /**
+     * @brief Set the background potential to zero everywhere
+     */
+    void clearPotential();
+
+    /**
+     * @brief Add offset + slopeX * (x + 0.5) + slopeZ * (z + 0.5) to the background potential of every site in the volume
+     * @param offset the value at the corner of the Grid
+     * @param slopeX the change per site along x
+     * @param slopeZ the change per site along z
+     *
+     * A sparse Grid only stores the coefficients.
+     */
+    void addRampPotential(double offset, double slopeX, double slopeZ);
 
     /**
      * @brief Calculate the neighboring sites of a given site
      * @param site the "s-site ID"
      * @param hoppingRange the number of adjacent sites to consider in the calculation
      */
-    QVector<int> neighborsSite(int site, int hoppingRange = 1);
+    QVector<SiteID> neighborsSite(SiteID site, int hoppingRange = 1);
+
+    /**
+     * @brief Get the neighbor stencil class of a site
+     * @param site the "s-site ID"
+     * @param hoppingRange the number of adjacent sites to consider in the calculation
+     *
+     * Sites that are the same distance from the edges of the Grid (up to hoppingRange)
+     * have the same neighbors, shifted by a constant offset.  Each group of such
+     * sites is a class, and the neighbors of every class are calculated once.
+     * Use neighborCount() and neighbor() to get the neighbors without building a list.
+     */
+    int neighborClass(SiteID site, int hoppingRange);
+
+    /**
+     * @brief Get the number of neighbors of a stencil class
+     * @param neighborClass the class returned by neighborClass()
+     * @param hoppingRange the number of adjacent sites to consider in the calculation
+     */
+    int neighborCount(int neighborClass, int hoppingRange);
+
+    /**
+     * @brief Get the number of neighbor stencil classes
+     * @param hoppingRange the number of adjacent sites to consider in the calculation
+     *
+     * The classes returned by neighborClass() run from 0 to neighborClassCount() - 1.
+     */
+    int neighborClassCount(int hoppingRange);
+
+    /**
+     * @brief Get a neighbor of a site
+     * @param site the "s-site ID"
+     * @param neighborClass the class returned by neighborClass(site, hoppingRange)
+     * @param index which neighbor, from 0 to neighborCount() - 1
+     * @param hoppingRange the number of adjacent sites to consider in the calculation
+     *
+     * The neighbors are in the same order as the list returned by neighborsSite().
+     */
+    SiteID neighbor(SiteID site, int neighborClass, int index, int hoppingRange);
+
+    /**
+     * @brief Get the coupling constant of a hop to a neighbor
+     * @param neighborClass the class returned by neighborClass(site, hoppingRange)
+     * @param index which neighbor, from 0 to neighborCount() - 1 (not a drain)
+     * @param hoppingRange the number of adjacent sites to consider in the calculation
+     *
+     * Looks up World::couplingConstants() without calculating the distances between the sites.
+     */
+    double neighborCoupling(int neighborClass, int index, int hoppingRange);
 
     /**
      * @brief Calculate the neighboring sites of a given face of the Grid
      * @param cubeFace the face of the Grid to consider
      */
-    QVector<int> neighborsFace(Grid::CubeFace cubeFace);
+    QVector<SiteID> neighborsFace(Grid::CubeFace cubeFace);
 
     /**
      * @brief Calculate the list of sites occupying a given range
@@ -340,7 +447,7 @@ public:
      * @param zi starting z-site ID
      * @param zf stopping z-site ID
      */
-    QVector<int> sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf);
+    QVector<SiteID> sliceIndex(int xi, int xf, int yi, int yf, int zi, int zf);
 
     /**
      * @brief Assign an Agent to a site in the Grid
@@ -349,7 +456,8 @@ public:
      * @warning site must be Agent::Empty
      *
      * Makes sure the site is empty first.  After assigning the Agent to the site,
-     * calculates and assigns the neighbors to the Agent.
+     * assigns the neighbor stencil class to ChargeAgents (and adds them to the
+     * Potential cell lists), or calculates and assigns the neighbors to other Agents.
      */
     void registerAgent(Agent *agent);
 
@@ -366,9 +474,23 @@ public:
     /**
      * @brief Remove an Agent from the Grid
      * @param agent a pointer to the Agent
+     *
+     * ChargeAgents are also removed from the Potential cell lists.
      */
     void unregisterAgent(Agent *agent);
 
+    /**
+     * @brief Move the carrier at a site to an empty site inside the Grid
+     * @param from the "s-site ID" of the carrier
+     * @param to the "s-site ID" to move to
+     * @warning to must be Agent::Empty
+     *
+     * The same as unregisterAgent() and registerAgent(), except the free-site counts
+     * are only touched if the sites are in different blocks (see m_freeBlocks).  The
+     * caller updates the site and neighbor stencil class of the ChargeAgent.
+     */
+    void moveCarrier(SiteID from, SiteID to);
+
     /**
      * @brief Remove an Agent from the special list of Agents in the Grid
      * @param agent a pointer to the Agent
@@ -380,13 +502,13 @@ public:
      * @brief Remove a defect from the Grid
      * @param site the "s-site ID"
      */
-    void unregisterDefect(int site);
+    void unregisterDefect(SiteID site);
 
     /**
      * @brief Assign a site to be Agent::Defect.
      * @param site
      */
-    void registerDefect(int site);
+    void registerDefect(SiteID site);
 
     /**
      * @brief The total number of special Agents
@@ -399,37 +521,233 @@ public:
      */
     QList<Agent *>& getSpecialAgentList(Grid::CubeFace cubeFace);
 
+    /**
+     * @brief Count a site that became Agent::Empty as free
+     * @param site the "s-site ID"; sites outside the volume are ignored
+     */
+    void addFreeSite(SiteID site);
+
+    /**
+     * @brief Stop counting a site that is no longer Agent::Empty as free
+     * @param site the "s-site ID"; sites outside the volume are ignored
+     */
+    void removeFreeSite(SiteID site);
+
+    /**
+     * @brief Stop (or start again) updating the free sites in registerAgent() and unregisterAgent()
+     * @param deferred true while carriers move in parallel (see parallel.step)
+     *
+     * The free-site counts are not thread safe, so the caller applies the updates itself
+     * afterwards with addFreeSite() and removeFreeSite().
+     */
+    void setFreeSitesDeferred(bool deferred);
+
 protected:
+
+    /**
+     * @brief Get the stored type of a site in a sparse Grid
+     * @param site the "s-site ID"
+     */
+    Agent::Type sparseAgentType(SiteID site);
+
+    /**
+     * @brief Get the background potential of a site in a sparse Grid
+     * @param site the "s-site ID"
+     */
+    double sparsePotential(SiteID site);
+
+    /**
+     * @brief Get the lookup index stored at a site (see m_agentIndex)
+     * @param site the "s-site ID"
+     */
+    qint32 siteIndex(SiteID site);
+
+    /**
+     * @brief Store a type and lookup index at a site, in the dense arrays or the sparse hash
+     * @param site the "s-site ID"
+     * @param type the Agent::Type; a sparse Grid forgets Agent::Empty sites
+     * @param index the lookup index (see m_agentIndex)
+     */
+    void storeSite(SiteID site, Agent::Type type, qint32 index);
+
+    /**
+     * @brief Store the type and lookup index of an Agent at a site
+     * @param site the "s-site ID"
+     * @param agent the Agent, a carrier with a CarrierStore slot or a FluxAgent
+     */
+    void setAgent(SiteID site, Agent *agent);
+
+    /**
+     * @brief Make a site Agent::Empty, forgetting its Agent
+     * @param site the "s-site ID"
+     */
+    void clearAgent(SiteID site);
+
+    /**
+     * @brief Calculate the neighbor stencils for a hopping range
+     * @param hoppingRange the number of adjacent sites to consider in the calculation
+     */
+    void buildNeighborStencil(int hoppingRange);
+
+    /**
+     * @brief Recalculate the drains that neighbor each stencil class
+     *
+     * Called when special Agents are registered or unregistered.
+     */
+    void updateNeighborStencilDrains();
+
+    /**
+     * @brief The neighbors of every site, grouped by distance from the edges of the Grid
+     */
+    struct NeighborStencil
+    {
+        //! The class of each x-site ID
+        QVector<int> xClass;
+
+        //! The class of each y-site ID
+        QVector<int> yClass;
+
+        //! The class of each z-site ID
+        QVector<int> zClass;
+
+        //! The number of x classes
+        int xClasses;
+
+        //! The number of y classes
+        int yClasses;
+
+        //! For each class, the offsets from the site to its neighbors
+        QVector< QVector<int> > offsets;
+
+        //! For each class, the index of each offset into World::couplingConstants() (as a flat array)
+        QVector< QVector<int> > couplings;
+
+        //! For each class, the drains that neighbor the site
+        QVector< QVector<SiteID> > drains;
+    };
+
     /**
      * @brief Reference to the World object
      */
     World &m_world;
 
     /**
-     * @brief 1D list of Agent pointers, the size of which is the volume of the Grid + the max number of special Agents.
-     * @warning some of these may be NULL
+     * @brief The neighbor stencils, indexed by hopping range (empty if not used)
+     */
+    QVector<NeighborStencil> m_neighborStencils;
+
+    /**
+     * @brief 1D list of Agent lookup indices, the size of which is the volume of the Grid + the max number of special Agents.
      *
-     * Each position in the list is mapped to a position in the Grid.  Use getIndexS()
-     * to calculate the serial site ID needed to index this list.
+     * For carriers this is the slot in the CarrierStore of their type; for other Agents it is the
+     * position in m_otherAgents; for Agent::Empty and Agent::Defect sites it is -1.
+     * Use agentAddress() to get the Agent.
+     */
+    std::vector<qint32> m_agentIndex;
+
+    /**
+     * @brief The Agents that are not carriers (sources and drains), indexed by m_agentIndex
+     * @warning some of these may be NULL, after the Agent was unregistered
      */
-    QVector<Agent *> m_agents;
+    QVector<Agent *> m_otherAgents;
 
     /**
      * @brief 1D list of site potentials, the size of which is the volume of the Grid + the max number of special Agents.
      *
+     * Only filled if this Grid owns the potential (see Grid()).
+     */
+    std::vector<SitePotential> m_ownPotentials;
+
+    /**
+     * @brief The site potentials, either m_ownPotentials or those of the shared Grid (NULL if sparse)
+     *
      * Each position in the list is mapped to a position in the Grid.  Use getIndexS()
      * to calculate the serial site ID needed to index this list.
      */
-    QVector<double> m_potentials;
+    SitePotential *m_potentials;
 
     /**
-     * @brief 1D list of Agent types, the size of which is the volume of the Grid + the max number of special Agents.
+     * @brief 1D list of Agent types (one byte each), the size of which is the volume of the Grid + the max number of special Agents.
      * @warning some of these may be Agent::Empty
      *
      * Each position in the list is mapped to a position in the Grid.  Use getIndexS()
      * to calculate the serial site ID needed to index this list.
      */
-    QVector<Agent::Type> m_agentType;
+    std::vector<quint8> m_agentType;
+
+    /**
+     * @brief The number of sites in each block of FreeBlockSize sites, as a Fenwick tree (empty if sparse)
+     *
+     * Entry i (counting from 1) holds the free sites of the blocks i - (i & -i) + 1 to i, so
+     * randomFreeSite() finds the block of the n-th free site in O(log volume), and then looks
+     * for it among the site types of the block.  It takes 1 / FreeBlockSize words per site.
+     */
+    std::vector<SiteID> m_freeBlocks;
+
+    /**
+     * @brief The number of sites in a block of m_freeBlocks
+     */
+    enum { FreeBlockSize = 64 };
+
+    /**
+     * @brief The type and lookup index of an occupied site in a sparse Grid
+     */
+    struct SparseSite
+    {
+        //! the Agent::Type
+        quint8 type;
+
+        //! the lookup index (see m_agentIndex)
+        qint32 index;
+    };
+
+    /**
+     * @brief The background potential of a sparse Grid
+     */
+    struct SparsePotential
+    {
+        //! the ramp value at the corner of the Grid (see addRampPotential())
+        double offset;
+
+        //! the ramp slope along x
+        double slopeX;
+
+        //! the ramp slope along z
+        double slopeZ;
+
+        //! the sites that differ from the ramp, and by how much (the special sites have no ramp)
+        QHash<SiteID, SitePotential> sites;
+    };
+
+    /**
+     * @brief True if grid.sparse is on, and the per-site arrays are empty
+     */
+    bool m_sparse;
+
+    /**
+     * @brief The sites that are not Agent::Empty, in a sparse Grid
+     */
+    QHash<SiteID, SparseSite> m_sparseSites;
+
+    /**
+     * @brief The number of sites inside the volume that are not Agent::Empty
+     */
+    SiteID m_occupied;
+
+    /**
+     * @brief The background potential, if this sparse Grid owns it (see Grid())
+     */
+    SparsePotential m_ownSparsePotential;
+
+    /**
+     * @brief The background potential of a sparse Grid, either m_ownSparsePotential or that of the shared Grid
+     */
+    SparsePotential *m_sparsePotential;
+
+    /**
+     * @brief True while registerAgent() and unregisterAgent() leave the free sites alone (see setFreeSitesDeferred())
+     */
+    bool m_freeSitesDeferred;
 
     /**
      * @brief A list of lists of special agents, where each sub-list is for a different Grid::CubeFace
@@ -479,9 +797,78 @@ protected:
     /**
      * @brief The total number of sites
      */
-    int m_volume;
+    SiteID m_volume;
+
+    /**
+     * @brief The x-, y- and z-site IDs of every site, packed into 4 bytes
+     *
+     * Only filled if this Grid owns the site IDs (see Grid()).
+     */
+    std::vector<quint32> m_ownPackedSites;
+
+    /**
+     * @brief The packed site IDs, either m_ownPackedSites or those of the shared Grid (NULL if sparse, or if they do not fit)
+     */
+    const quint32 *m_packedSites;
+
+    /**
+     * @brief The bit of m_packedSites the y-site ID starts at
+     */
+    int m_shiftY;
+
+    /**
+     * @brief The bit of m_packedSites the z-site ID starts at
+     */
+    int m_shiftZ;
+
+    /**
+     * @brief The bits of m_packedSites that hold the x-site ID
+     */
+    quint32 m_maskX;
+
+    /**
+     * @brief The bits of m_packedSites that hold the y-site ID, after shifting by m_shiftY
+     */
+    quint32 m_maskY;
 };
 
+inline int Grid::getIndexX(SiteID site)
+{
+    if (!m_packedSites)
+    {
+        return int(site % m_xSize);
+    }
+    return int(m_packedSites[site] & m_maskX);
+}
+
+inline int Grid::getIndexY(SiteID site)
+{
+    if (!m_packedSites)
+    {
+        return int((site / m_xSize) % m_ySize);
+    }
+    return int((m_packedSites[site] >> m_shiftY) & m_maskY);
+}
+
+inline int Grid::getIndexZ(SiteID site)
+{
+    if (!m_packedSites)
+    {
+        return int(site / m_xyPlaneArea);
+    }
+    return int(m_packedSites[site] >> m_shiftZ);
+}
+
+inline Agent::Type Grid::agentType(SiteID site)
+{
+    return m_sparse ? sparseAgentType(site) : Agent::Type(m_agentType[site]);
+}
+
+inline double Grid::potential(SiteID site)
+{
+    return m_sparse ? sparsePotential(site) : m_potentials[site];
+}
+
 /**
  * @brief Overload QTextStream for the Grid::CubeFace Enum
  */
@@ -28,6 +28,14 @@ public:
      * @brief accept charge with constant probability
      */
     virtual bool tryToAccept(ChargeAgent *charge);
+
+    /**
+     * @brief count a charge moved into the drain by the rejection-free algorithm
+     *
+     * Rejected moves are never simulated in that case, so the move counts as one
+     * attempt and one success.
+     */
+    void countAccepted();
 };
 
 /**
@@ -39,7 +47,7 @@ public:
     /**
      * @brief create an ElectronDrainAgent at a specific site
      */
-    ElectronDrainAgent(World &world, int site, QObject *parent = 0);
+    ElectronDrainAgent(World &world, SiteID site, QObject *parent = 0);
 
     /**
      * @brief create a ElectronDrainAgent at a specific Grid::CubeFace
@@ -53,7 +61,7 @@ protected:
      * which is to use a simple constant probability, has not been reimplemented
      * for DrainAgents.
      */
-    virtual double energyChange(int fSite);
+    virtual double energyChange(SiteID fSite);
 };
 
 /**
@@ -65,7 +73,7 @@ public:
     /**
      * @brief create an HoleDrainAgent at a specific site
      */
-    HoleDrainAgent(World &world, int site, QObject *parent = 0);
+    HoleDrainAgent(World &world, SiteID site, QObject *parent = 0);
 
     /**
      * @brief create a HoleDrainAgent at a specific Grid::CubeFace
@@ -79,7 +87,7 @@ protected:
      * which is to use a simple constant probability, has not been reimplemented
      * for DrainAgents.
      */
-    virtual double energyChange(int fSite);
+    virtual double energyChange(SiteID fSite);
 };
 
 /**
@@ -112,7 +120,7 @@ private:
     /**
      * @brief currently implemented as zero and not really used
      */
-    virtual double energyChange(int fSite);
+    virtual double energyChange(SiteID fSite);
 };
 
 }
@@ -159,7 +159,7 @@ protected:
      * @brief assign the FluxAgent to a specific site in the grid
      * @param site the site in the grid
      */
-    void initializeSite(int site);
+    void initializeSite(SiteID site);
 
     /**
      * @brief assign the FluxAgent to a specific Grid::CubeFace
@@ -180,14 +180,14 @@ protected:
      * decision.  However, classes derived from FluxAgent can reimplement this function.  For
      * example, one might want to use a Metropolis criterion to make this decision.
      */
-    virtual bool shouldTransport(int site);
+    virtual bool shouldTransport(SiteID site);
 
     /**
      * @brief The energy change associated with moving a carrier from the FluxAgent to a site
      * @param site the site involved
      * @return the energy change
      */
-    virtual double energyChange(int site);
+    virtual double energyChange(SiteID site);
 
     /**
      * @brief convert the Grid::CubeFace to a single letter
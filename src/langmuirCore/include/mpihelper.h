@@ -0,0 +1,314 @@
+#ifndef MPIHELPER_H
+#define MPIHELPER_H
+
+#include "parameters.h"
+
+#include <QObject>
+#include <QVector>
+#include <QList>
+
+namespace LangmuirCore
+{
+
+class World;
+class CarrierStore;
+
+/**
+ * @brief A class to split a simulation into slabs along x over MPI ranks
+ *
+ * Every rank builds the same World and keeps the carriers in its own slab
+ * [xBegin(), xEnd()).  A step is done in two phases: first the carriers in the
+ * left half of every slab move, then the carriers in the right half.  Slabs are
+ * at least four hopping ranges wide, so the carriers moving in one phase can never
+ * reach the same site from two ranks; each rank only needs the occupancy of the
+ * hopping range next to the half that moves (the halo), which it gets from its
+ * neighbor before the phase.  Carriers that hop out of the slab are handed over to
+ * the neighbor after the phase.
+ *
+ * Without LANGMUIR_MPI, or when MPI was not initialized, there is a single rank and
+ * isOn() is false.
+ */
+class MpiHelper : public QObject
+{
+private:
+    Q_OBJECT
+    Q_DISABLE_COPY(MpiHelper)
+
+public:
+    /**
+     * @brief Create \b THE MpiHelper; don't make more than one.
+     * @param world reference to World Object
+     * @param parent QObject this belongs to
+     * @warning initializeSlab() must be called seperately
+     */
+    MpiHelper(World &world, QObject *parent=0);
+
+    /**
+     * @brief initialize MPI, call this first thing in main (does nothing without LANGMUIR_MPI)
+     */
+    static void initialize(int *argc, char ***argv);
+
+    /**
+     * @brief finalize MPI, call this last thing in main (does nothing without LANGMUIR_MPI)
+     */
+    static void finalize();
+
+    /**
+     * @brief get the rank of this process
+     */
+    int rank() const;
+
+    /**
+     * @brief get the number of ranks
+     */
+    int size() const;
+
+    /**
+     * @brief true if the grid is split over more than one rank
+     */
+    bool isOn() const;
+
+    /**
+     * @brief true on the rank that writes the output
+     */
+    bool isRoot() const;
+
+    /**
+     * @brief get the first x-site ID of this slab
+     */
+    int xBegin() const;
+
+    /**
+     * @brief get the first x-site ID of the right half of this slab
+     */
+    int xMiddle() const;
+
+    /**
+     * @brief get the x-site ID after the end of this slab
+     */
+    int xEnd() const;
+
+    /**
+     * @brief true if an x-site ID is inside this slab
+     */
+    bool ownsX(int x) const;
+
+    /**
+     * @brief compute the slab of this rank and drop the carriers outside of it
+     *
+     * Called once at the end of World::initialize(), after every rank has built the
+     * same World.  The random number generators of the ranks are reseeded to differ,
+     * the flux counters of all but the root are zeroed, and the output is turned off
+     * on all but the root.
+     */
+    void initializeSlab();
+
+    /**
+     * @brief forget which carriers have moved, call at the start of every step
+     */
+    void beginStep();
+
+    /**
+     * @brief register the carriers of the neighbor next to the half of the slab moving in a phase
+     * @param phase 0 when the left halves move, 1 when the right halves move
+     *
+     * The carriers of the neighbor are registered as defects on the carrier grids, so
+     * ChargeAgent::decideFuture() rejects moves onto them.
+     */
+    void exchangeGhosts(int phase);
+
+    /**
+     * @brief remove the carriers registered by exchangeGhosts()
+     */
+    void clearGhosts();
+
+    /**
+     * @brief true if the carrier at an index moves in a phase
+     * @param charges the carriers
+     * @param index index into the list of active carriers
+     * @param phase 0 when the left halves move, 1 when the right halves move
+     */
+    bool isActive(const CarrierStore &charges, int index, int phase) const;
+
+    /**
+     * @brief remember that the carrier at an index has moved this step
+     */
+    void markDone(const CarrierStore &charges, int index);
+
+    /**
+     * @brief hand the carriers that left the slab over to the neighbors
+     */
+    void migrateCarriers();
+
+    /**
+     * @brief update remoteElectrons() and remoteHoles()
+     */
+    void countCarriers();
+
+    /**
+     * @brief get the number of electrons on the other ranks (as of the last countCarriers())
+     */
+    int remoteElectrons() const;
+
+    /**
+     * @brief get the number of holes on the other ranks (as of the last countCarriers())
+     */
+    int remoteHoles() const;
+
+    /**
+     * @brief collect the flux counters and carrier sites on the root, so it can write the output
+     *
+     * The root holds the sum of all flux counters afterwards, and the other ranks start
+     * counting from zero again.  All ranks have to call this.
+     */
+    void synchronize();
+
+    /**
+     * @brief get the sites of the electrons on the other ranks (as of the last synchronize(), root only)
+     */
+    const QList<SiteID>& remoteElectronSites() const;
+
+    /**
+     * @brief get the sites of the holes on the other ranks (as of the last synchronize(), root only)
+     */
+    const QList<SiteID>& remoteHoleSites() const;
+
+private:
+    /**
+     * @brief check that the simulation can be split into slabs
+     */
+    void checkParameters();
+
+    /**
+     * @brief unregister and recycle the carriers outside of the slab
+     */
+    void dropCarriers(CarrierStore &charges);
+
+    /**
+     * @brief get the index of a carrier type in m_done (0 for electrons, 1 for holes)
+     */
+    static int typeIndex(const CarrierStore &charges);
+
+    /**
+     * @brief reference to world object
+     */
+    World &m_world;
+
+    /**
+     * @brief rank of this process
+     */
+    int m_rank;
+
+    /**
+     * @brief number of ranks
+     */
+    int m_size;
+
+    /**
+     * @brief first x-site ID of this slab
+     */
+    int m_xBegin;
+
+    /**
+     * @brief first x-site ID of the right half of this slab
+     */
+    int m_xMiddle;
+
+    /**
+     * @brief x-site ID after the end of this slab
+     */
+    int m_xEnd;
+
+    /**
+     * @brief electrons on the other ranks
+     */
+    int m_remoteElectrons;
+
+    /**
+     * @brief holes on the other ranks
+     */
+    int m_remoteHoles;
+
+    /**
+     * @brief 1 for the slots of the carriers that moved this step, for electrons and holes
+     */
+    QVector<char> m_done[2];
+
+    /**
+     * @brief sites registered by exchangeGhosts(), for electrons and holes
+     */
+    QVector<SiteID> m_ghosts[2];
+
+    /**
+     * @brief sites of the electrons on the other ranks
+     */
+    QList<SiteID> m_remoteElectronSites;
+
+    /**
+     * @brief sites of the holes on the other ranks
+     */
+    QList<SiteID> m_remoteHoleSites;
+};
+
+inline int MpiHelper::rank() const
+{
+    return m_rank;
+}
+
+inline int MpiHelper::size() const
+{
+    return m_size;
+}
+
+inline bool MpiHelper::isOn() const
+{
+    return m_size > 1;
+}
+
+inline bool MpiHelper::isRoot() const
+{
+    return m_rank == 0;
+}
+
+inline int MpiHelper::xBegin() const
+{
+    return m_xBegin;
+}
+
+inline int MpiHelper::xMiddle() const
+{
+    return m_xMiddle;
+}
+
+inline int MpiHelper::xEnd() const
+{
+    return m_xEnd;
+}
+
+inline bool MpiHelper::ownsX(int x) const
+{
+    return x >= m_xBegin && x < m_xEnd;
+}
+
+inline int MpiHelper::remoteElectrons() const
+{
+    return m_remoteElectrons;
+}
+
+inline int MpiHelper::remoteHoles() const
+{
+    return m_remoteHoles;
+}
+
+inline const QList<SiteID>& MpiHelper::remoteElectronSites() const
+{
+    return m_remoteElectronSites;
+}
+
+inline const QList<SiteID>& MpiHelper::remoteHoleSites() const
+{
+    return m_remoteHoleSites;
+}
+
+}
+#endif
@@ -97,6 +97,7 @@ public:
      * @return The on/off status
      *
      * For example, don't allow one to turn OpenCL on if OpenCL can't be used on this platform.
+     * Calls initializeOpenCL() the first time OpenCL is turned on, with opencl.device.id.
      */
     bool toggleOpenCL(bool on);
 
@@ -106,6 +107,11 @@ private:
      */
     World &m_world;
 
+    /**
+     * @brief True once initializeOpenCL() has been called
+     */
+    bool m_initialized;
+
 #ifdef LANGMUIR_OPEN_CL
     /**
      * @brief An OpenCL platform is the vendor (Intel, NVIDIA, AMD, etc)
@@ -250,8 +256,8 @@ template <> inline QVariant OpenClHelper::toQVariant<std::string>(std::string &v
     return QVariant(QString::fromStdString(value));
 }
 
-}
-
 #endif // LANGMUIR_OPEN_CL
 
+}
+
 #endif // OPENCLHELPER_H
@@ -5,25 +5,37 @@
 #include <QFileInfo>
 #include <QDebug>
 #include <cmath>
+#include <limits>
 #include <QDir>
 
 namespace LangmuirCore
 {
 
+//! The type of a serial site ID (see Grid::getIndexS)
+/*!
+  32 bits by default; build with LANGMUIR_64BIT_SITES for grids with more
+  than 2^31 sites.  Coordinates (x, y and z site IDs) are always int.
+ */
+#ifdef LANGMUIR_64BIT_SITES
+typedef qint64 SiteID;
+#else
+typedef qint32 SiteID;
+#endif
+
 //! A struct to temporarily store site IDs
 struct ConfigurationInfo
 {
     //! a list of current electron site IDs
-    QList<qint32> electrons;
+    QList<SiteID> electrons;
 
     //! a list of current holes site IDs
-    QList<qint32> holes;
+    QList<SiteID> holes;
 
     //! a list of current defects site IDs
-    QList<qint32> defects;
+    QList<SiteID> defects;
 
     //! a list of current traps site IDs
-    QList<qint32> traps;
+    QList<SiteID> traps;
 
     //! a list of current traps site IDs
     QList<qreal> trapPotentials;
@@ -51,6 +63,24 @@ struct SimulationParameters
     //! seed the random number generator, if negative, uses the current time (making seperate runs random)
     quint64 randomSeed;
 
+    //! the random number generator: mt19937 (the original stream) or xoshiro256 (buffered, faster)
+    QString randomGenerator;
+
+    //! use counter-based random streams keyed by seed, step and carrier for carrier moves (independent of the thread count)
+    bool randomCounter;
+
+    //! propose, accept and complete carrier moves on all threads; collisions go to the lowest carrier index (needs random.counter)
+    bool parallelStep;
+
+    //! pick one accepted move per event from a tree of hop rates (n-fold way) instead of proposing and rejecting moves
+    bool rejectionFree;
+
+    //! re-sort the carriers along a Morton curve through their sites every n steps, for memory locality (if n == 0, never)
+    qint32 carriersSort;
+
+    //! step all carriers in batches, drawing their random numbers in SIMD lanes (needs random.counter and coulomb.carriers = false)
+    bool carriersBatched;
+
     //! the number of sites per layer, at least one
     qint32 gridZ;
 
@@ -60,12 +90,36 @@ struct SimulationParameters
     //! the number of sites along the device length, at least one
     qint32 gridX;
 
+    //! store only occupied sites, traps and a potential ramp instead of per-site arrays, for huge grids at low density
+    bool gridSparse;
+
     //! turn on Coulomb interactions between ChargeAgents
     bool coulombCarriers;
 
     //! multiply Coulomb terms by erf[r/(sigma sqrt[2])]; nothing happens if its zero
     qreal coulombGaussianSigma;
 
+    //! keep a per-site Coulomb potential for carriers that is updated only when carriers move, instead of summing over all carriers
+    bool coulombIncremental;
+
+    //! draw the Metropolis uniform when a move is proposed, and only compute the Coulomb energy change of moves it does not already decide
+    bool coulombLazy;
+
+    //! split the carrier Coulomb interaction into a real-space part and an FFT part on the Grid: off, periodic or slab
+    QString coulombMesh;
+
+    //! the real-space cutoff of SimulationParameters::coulombMesh; the rest of the interaction is handled by the FFT part
+    qint32 coulombMeshCutoff;
+
+    //! add the mean-field space-charge potential of the carriers to the Grid, solved from Poisson's equation with multigrid
+    bool poissonMultigrid;
+
+    //! re-solve SimulationParameters::poissonMultigrid every n steps (if n == 0, only at the start)
+    qint32 poissonUpdate;
+
+    //! the relative residual SimulationParameters::poissonMultigrid is solved to
+    qreal poissonTolerance;
+
     //! the charge of defect sites
     qint32 defectsCharge;
 
@@ -153,6 +207,9 @@ struct SimulationParameters
     //! the percent of the traps to be placed and grown upon to form islands
     qreal seedPercentage;
 
+    //! sample the escape of carriers from trap basins whose mean exit time is at least n steps (if n == 0, never)
+    qint32 trapEscape;
+
     //! the potential on the right side of the grid, used in setting up an electric field
     qreal voltageRight;
 
@@ -286,13 +343,27 @@ struct SimulationParameters
 
         simulationType         ("transistor"),
         randomSeed             (0),
+        randomGenerator        ("mt19937"),
+        randomCounter          (false),
+        parallelStep           (false),
+        rejectionFree          (false),
+        carriersSort           (0),
+        carriersBatched        (false),
 
         gridZ                  (1),
         gridY                  (128),
         gridX                  (128),
+        gridSparse             (false),
 
         coulombCarriers        (false),
         coulombGaussianSigma   (0.0),
+        coulombIncremental     (false),
+        coulombLazy            (false),
+        coulombMesh            ("off"),
+        coulombMeshCutoff      (8),
+        poissonMultigrid       (false),
+        poissonUpdate          (10),
+        poissonTolerance       (1e-6),
         defectsCharge          (0),
 
         outputXyz              (0),
@@ -327,6 +398,7 @@ struct SimulationParameters
         trapPotential          (0.10),
         gaussianStdev          (0.00),
         seedPercentage         (1.0),
+        trapEscape             (0),
 
         voltageRight           (0.00),
         voltageLeft            (0.00),
@@ -413,6 +485,39 @@ inline void checkSimulationParameters(SimulationParameters& par)
         qFatal("langmuir: grid.z(%d) >= 1",par.gridZ);
     }
 
+    // site IDs (the drain and source sites are numbered after the volume)
+    qint64 volume = qint64(par.gridX) * par.gridY * par.gridZ;
+    qint64 maxInt = std::numeric_limits<qint32>::max() - 64;
+    if (volume > qint64(std::numeric_limits<SiteID>::max()) - 64)
+    {
+        qFatal("langmuir: grid.x * grid.y * grid.z(%lld) is too many sites for 32-bit site IDs; "
+               "rebuild with LANGMUIR_64BIT_SITES", volume);
+    }
+    if (qint64(par.gridX) * par.gridY > maxInt)
+    {
+        qFatal("langmuir: grid.x * grid.y(%lld) is too many sites for one plane",
+               qint64(par.gridX) * par.gridY);
+    }
+    if (par.gridSparse)
+    {
+        if (par.parallelStep || par.coulombIncremental || par.poissonMultigrid ||
+            par.coulombMesh != "off" || par.defectsCharge != 0 || par.useOpenCL || par.outputCoulomb != 0)
+        {
+            qFatal("langmuir: grid.sparse = true, yet parallel.step, coulomb.incremental, coulomb.mesh, "
+                   "poisson.multigrid, defects.charge, use.opencl or output.coulomb is on; they store per-site arrays");
+        }
+    }
+    if (volume > maxInt)
+    {
+        if (par.parallelStep || par.coulombIncremental || par.poissonMultigrid ||
+            par.coulombMesh != "off" || par.defectsCharge != 0 || par.useOpenCL)
+        {
+            qFatal("langmuir: grid.x * grid.y * grid.z(%lld) is too many sites for parallel.step, "
+                   "coulomb.incremental, coulomb.mesh, poisson.multigrid, defects.charge or use.opencl",
+                   volume);
+        }
+    }
+
     // output
     if (par.iterationsPrint <= 0 )
     {
@@ -453,6 +558,21 @@ inline void checkSimulationParameters(SimulationParameters& par)
         qFatal("langmuir: seed.pecentage(%f) < 0 || > 1.0",par.seedPercentage);
     }
 
+    if (par.trapEscape < 0)
+    {
+        qFatal("langmuir: trap.escape(%d) < 0",par.trapEscape);
+    }
+
+    if (par.trapEscape > 0)
+    {
+        if (par.simulationType != "transistor" || par.coulombCarriers || par.poissonMultigrid ||
+            par.parallelStep || par.rejectionFree)
+        {
+            qFatal("langmuir: trap.escape > 0, yet simulation.type is not transistor or coulomb.carriers, "
+                   "poisson.multigrid, parallel.step or rejection.free is on");
+        }
+    }
+
     if (par.defectPercentage > 1.00 - par.trapPercentage)
     {
         qFatal("langmuir: trap.percentage(%f) > 1.0 - trap.percentage(%f)",par.defectPercentage,par.trapPercentage);
@@ -560,9 +680,115 @@ inline void checkSimulationParameters(SimulationParameters& par)
         qFatal("langmuir: defects.charge != 0 && coulomb.carriers = false");
     }
 
-    if (par.hoppingRange < 0 || par.hoppingRange > 2)
+    if (par.coulombIncremental && ! par.coulombCarriers)
+    {
+        qFatal("langmuir: coulomb.incremental = true, yet coulomb.carriers = false");
+    }
+
+    if (par.coulombIncremental && par.useOpenCL)
+    {
+        qFatal("langmuir: coulomb.incremental = true, yet use.opencl = true");
+    }
+
+    if (!(QStringList()<<"mt19937"<<"xoshiro256").contains(par.randomGenerator))
+    {
+        qFatal("langmuir: random.generator(%s) must be mt19937 or xoshiro256",qPrintable(par.randomGenerator));
+    }
+
+    if (!(QStringList()<<"off"<<"periodic"<<"slab").contains(par.coulombMesh))
+    {
+        qFatal("langmuir: coulomb.mesh(%s) must be off, periodic or slab",qPrintable(par.coulombMesh));
+    }
+
+    if (par.coulombMesh != "off")
+    {
+        if (!par.coulombCarriers)
+        {
+            qFatal("langmuir: coulomb.mesh = %s, yet coulomb.carriers = false",qPrintable(par.coulombMesh));
+        }
+        if (par.coulombIncremental)
+        {
+            qFatal("langmuir: coulomb.mesh = %s, yet coulomb.incremental = true",qPrintable(par.coulombMesh));
+        }
+        if (par.useOpenCL)
+        {
+            qFatal("langmuir: coulomb.mesh = %s, yet use.opencl = true",qPrintable(par.coulombMesh));
+        }
+        if (par.coulombMeshCutoff < 3)
+        {
+            qFatal("langmuir: coulomb.mesh.cutoff(%d) < 3",par.coulombMeshCutoff);
+        }
+        // The real-space part only sees the nearest image (slab is open along x, and along z for one layer)
+        if (2 * par.coulombMeshCutoff > par.gridY ||
+            (par.coulombMesh == "periodic" && 2 * par.coulombMeshCutoff > par.gridX) ||
+            ((par.coulombMesh == "periodic" || par.gridZ > 1) && 2 * par.coulombMeshCutoff > par.gridZ))
+        {
+            qFatal("langmuir: coulomb.mesh.cutoff(%d) is more than half the periodic grid size",
+                   par.coulombMeshCutoff);
+        }
+    }
+
+    if (par.poissonMultigrid)
+    {
+        // The mean field already holds the carrier interactions and their images
+        if (par.coulombCarriers)
+        {
+            qFatal("langmuir: poisson.multigrid = true, yet coulomb.carriers = true");
+        }
+        // A single layer is a two-dimensional Poisson problem, with a logarithmic pair potential
+        if (par.gridZ < 2)
+        {
+            qFatal("langmuir: poisson.multigrid = true, yet grid.z(%d) < 2", par.gridZ);
+        }
+        if (par.poissonUpdate < 0)
+        {
+            qFatal("langmuir: poisson.update(%d) < 0",par.poissonUpdate);
+        }
+        if (par.poissonTolerance <= 0)
+        {
+            qFatal("langmuir: poisson.tolerance(%g) <= 0",par.poissonTolerance);
+        }
+    }
+
+    if (par.carriersSort < 0)
+    {
+        qFatal("langmuir: carriers.sort(%d) < 0",par.carriersSort);
+    }
+
+    if (par.carriersBatched)
+    {
+        if (!par.randomCounter || par.simulationType != "transistor" || par.coulombCarriers ||
+            par.poissonMultigrid || par.parallelStep || par.rejectionFree || par.trapEscape > 0)
+        {
+            qFatal("langmuir: carriers.batched = true, yet random.counter is off, simulation.type is not "
+                   "transistor or coulomb.carriers, poisson.multigrid, parallel.step, rejection.free or trap.escape is on");
+        }
+    }
+
+    if (par.parallelStep && !par.randomCounter)
+    {
+        qFatal("langmuir: parallel.step = true, yet random.counter = false");
+    }
+
+    if (par.rejectionFree && par.parallelStep)
+    {
+        qFatal("langmuir: rejection.free = true, yet parallel.step = true");
+    }
+
+    if (par.rejectionFree && par.coulombCarriers && !par.coulombIncremental)
+    {
+        qFatal("langmuir: rejection.free = true and coulomb.carriers = true, yet coulomb.incremental = false");
+    }
+
+    if (par.hoppingRange < 1)
+    {
+        qFatal("langmuir: hopping.range(%d) < 1",par.hoppingRange);
+    }
+
+    if (par.hoppingRange > par.electrostaticCutoff)
     {
-        qFatal("langmuir: hopping.range(%d) < 0 || > 2",par.hoppingRange);
+        qFatal("langmuir: hopping.range(%d) > electrostatic.cutoff(%d)",
+               par.hoppingRange,par.electrostaticCutoff);
     }
 
     if (!par.sourceMetropolis)
@@ -0,0 +1,208 @@
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+
+#include <QVector>
+#include <complex>
+
+namespace LangmuirCore
+{
+
+class CarrierStore;
+
+/**
+ * @brief A class to calculate the long-range (Ewald reciprocal space) Coulomb potential on a mesh
+ *
+ * The potential of a unit charge is split into a short-range part, erfc(alpha r) / r, which is
+ * summed directly within a small cutoff (see CoulombKernel), and a smooth long-range part,
+ * erf(alpha r) / r, which is calculated here for every site at once.  The charges already sit
+ * on the lattice sites, so the lattice itself is used as the mesh: the density is the site
+ * occupancy, and there is no charge assignment or interpolation error.
+ *
+ * The long-range potential is a convolution of the density with the lattice Green's function,
+ * done with fast Fourier transforms.  The electron density goes in the real part and the hole
+ * density in the imaginary part, so one forward and one inverse transform give both potentials.
+ *
+ * In Periodic mode the system is periodic along x, y and z (three dimensional Ewald sum).  In Slab
+ * mode the system is open along x, where the electrodes are, and periodic along y and z (two
+ * dimensional Ewald sum); the mesh is padded along x so that the convolution along x is not
+ * circular.  A Slab grid with a single layer is open along z as well (one dimensional Ewald sum).
+ */
+class ParticleMesh
+{
+public:
+    /**
+     * @brief the boundary conditions
+     */
+    enum Boundary
+    {
+        //! periodic along x, y and z
+        Periodic,
+
+        //! open along x, periodic along y and z (or only y if there is a single layer)
+        Slab
+    };
+
+    /**
+     * @brief create an empty mesh
+     */
+    ParticleMesh();
+
+    /**
+     * @brief build the mesh and the Green's function
+     * @param xSize number of sites along x
+     * @param ySize number of sites along y
+     * @param zSize number of sites along z
+     * @param boundary the boundary conditions
+     * @param alpha the splitting parameter, in inverse sites
+     * @param prefactor the electrostatic prefactor
+     */
+    void initialize(int xSize, int ySize, int zSize, Boundary boundary, double alpha, double prefactor);
+
+    /**
+     * @brief true if initialize() has been called
+     */
+    bool isOn() const;
+
+    /**
+     * @brief recalculate the long-range potential from the current carriers
+     * @param electrons the electrons
+     * @param holes the holes
+     */
+    void update(const CarrierStore &electrons, const CarrierStore &holes);
+
+    /**
+     * @brief get the long-range potential from electrons at a site
+     * @param site the site of interest, inside the grid volume
+     *
+     * Includes the long-range part of a carrier at the site itself (see selfPotential()).
+     */
+    double electronPotential(int site) const;
+
+    /**
+     * @brief get the long-range potential from holes at a site
+     * @param site the site of interest, inside the grid volume
+     *
+     * Includes the long-range part of a carrier at the site itself (see selfPotential()).
+     */
+    double holePotential(int site) const;
+
+    /**
+     * @brief get the long-range potential of a unit charge at its own site (prefactor 2 alpha / sqrt(pi))
+     */
+    double selfPotential() const;
+
+private:
+    typedef std::complex<double> Complex;
+
+    /**
+     * @brief Fourier transform the mesh along one axis, splitting the lines over threads
+     * @param axis 0, 1 or 2 for x, y or z
+     * @param inverse true for the inverse transform (not normalized)
+     */
+    void transform(int axis, bool inverse);
+
+    /**
+     * @brief Fourier transform a range of lines along one axis
+     * @param axis 0, 1 or 2 for x, y or z
+     * @param inverse true for the inverse transform (not normalized)
+     * @param begin the first line
+     * @param end one past the last line
+     */
+    void transformLines(int axis, bool inverse, int begin, int end);
+
+    /**
+     * @brief Fourier transform one contiguous line in place
+     * @param data the line
+     * @param n the length of the line
+     * @param twiddles exp(-2 pi i k / n) for k in [0, n)
+     * @param inverse true for the inverse transform (not normalized)
+     * @param scratch room for n values, used when n is not a power of two
+     */
+    static void transformLine(Complex *data, int n, const Complex *twiddles, bool inverse,
+                              Complex *scratch);
+
+    /**
+     * @brief calculate the lattice Green's function of the long-range part
+     */
+    void initializeGreensFunction();
+
+    /**
+     * @brief the Fourier transform of erf(alpha r) / r summed over the y and z lattice images,
+     * at a wavevector in the yz-plane and an x-offset (Slab mode)
+     * @param ky y-component of the wavevector
+     * @param kz z-component of the wavevector
+     * @param dx the x-offset
+     */
+    double slabGreensFunction(double ky, double kz, int dx) const;
+
+    /**
+     * @brief the Fourier transform of erf(alpha r) / r summed over the y lattice images,
+     * at a wavevector along y and an x-offset (Slab mode with a single layer)
+     * @param ky the wavevector
+     * @param dx the x-offset
+     */
+    double wireGreensFunction(double ky, int dx) const;
+
+    /**
+     * @brief the number of grid sites along x, y and z
+     */
+    int m_size[3];
+
+    /**
+     * @brief the number of mesh points along x, y and z (x is padded in Slab mode)
+     */
+    int m_mesh[3];
+
+    /**
+     * @brief the boundary conditions
+     */
+    Boundary m_boundary;
+
+    /**
+     * @brief the splitting parameter
+     */
+    double m_alpha;
+
+    /**
+     * @brief the electrostatic prefactor
+     */
+    double m_prefactor;
+
+    /**
+     * @brief true if initialize() has been called
+     */
+    bool m_on;
+
+    /**
+     * @brief the density, then its transform, then the potential (packed like the grid sites)
+     */
+    QVector<Complex> m_data;
+
+    /**
+     * @brief the Green's function in reciprocal space, including the prefactor and normalization
+     */
+    QVector<double> m_green;
+
+    /**
+     * @brief the twiddle factors along x, y and z
+     */
+    QVector<Complex> m_twiddles[3];
+};
+
+inline bool ParticleMesh::isOn() const
+{
+    return m_on;
+}
+
+inline double ParticleMesh::electronPotential(int site) const
+{
+    return m_data[site].real();
+}
+
+inline double ParticleMesh::holePotential(int site) const
+{
+    return m_data[site].imag();
+}
+
+}
+#endif
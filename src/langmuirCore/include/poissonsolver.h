@@ -0,0 +1,157 @@
+#ifndef POISSONSOLVER_H
+#define POISSONSOLVER_H
+
+#include <QVector>
+
+namespace LangmuirCore
+{
+
+/**
+ * @brief A class to solve Poisson's equation on the grid with multigrid
+ *
+ * Solves -laplacian(phi) = b for cell-centered values, with the sites as cells of unit
+ * size and the index x + xSize * (y + ySize * z), like the Grid.  Each face of the box is
+ * an electrode (phi = 0 half a site outside of the box) or insulating (zero field), or the
+ * box wraps around along a direction (both of its faces periodic).
+ *
+ * The solver is conjugate gradients, preconditioned with one multigrid V-cycle.  Coarse
+ * levels halve every direction that is at least 4 sites long; the smoother is red-black
+ * Gauss-Seidel, run in parallel over rows.
+ */
+class PoissonSolver
+{
+public:
+    /**
+     * @brief the boundary conditions of a face
+     */
+    enum Boundary
+    {
+        //! phi = 0 at the face
+        Electrode,
+
+        //! zero field through the face
+        Insulating,
+
+        //! the box wraps around to the opposite face, which must be periodic too
+        Periodic
+    };
+
+    /**
+     * @brief create an empty solver
+     */
+    PoissonSolver();
+
+    /**
+     * @brief build the levels
+     * @param xSize number of sites along x
+     * @param ySize number of sites along y
+     * @param zSize number of sites along z
+     * @param low boundary conditions of the x = 0, y = 0 and z = 0 faces
+     * @param high boundary conditions of the x = xSize, y = ySize and z = zSize faces
+     */
+    void initialize(int xSize, int ySize, int zSize, const Boundary low[3], const Boundary high[3]);
+
+    /**
+     * @brief true if initialize() has been called
+     */
+    bool isOn() const;
+
+    /**
+     * @brief solve for phi
+     * @param b the right hand side, one value per site
+     * @param phi the initial guess (for example the last solution), replaced with the solution
+     * @param tolerance stop when the residual is this small relative to b
+     * @return the number of iterations
+     */
+    int solve(const QVector<double> &b, QVector<double> &phi, double tolerance);
+
+private:
+    /**
+     * @brief one level of the multigrid hierarchy
+     */
+    struct Level
+    {
+        //! number of cells along x, y and z
+        int n[3];
+
+        //! 1 / h^2 along x, y and z
+        double ih2[3];
+
+        //! the solution
+        QVector<double> phi;
+
+        //! the right hand side
+        QVector<double> b;
+
+        //! the residual
+        QVector<double> r;
+    };
+
+    /**
+     * @brief calculate out = -laplacian(in) on a level
+     */
+    void apply(const Level &level, const QVector<double> &in, QVector<double> &out) const;
+
+    /**
+     * @brief true if a periodic direction of a level has an odd number of cells
+     *
+     * Then the cells on both sides of the wrap have the same color, so the rows of a half
+     * sweep are not independent.
+     */
+    bool oddPeriodic(const Level &level) const;
+
+    /**
+     * @brief one red-black Gauss-Seidel half sweep on a level, split over threads
+     * @param l the level
+     * @param color 0 for the cells with even x + y + z, 1 for odd
+     */
+    void smooth(int l, int color);
+
+    /**
+     * @brief one red-black Gauss-Seidel half sweep on a range of rows
+     * @param l the level
+     * @param color 0 for the cells with even x + y + z, 1 for odd
+     * @param begin the first row (y + ySize * z)
+     * @param end one past the last row
+     */
+    void smoothRows(int l, int color, int begin, int end);
+
+    /**
+     * @brief one V-cycle starting at a level, from phi = 0
+     * @param l the level; uses its b, sets its phi
+     */
+    void vcycle(int l);
+
+    /**
+     * @brief apply the V-cycle preconditioner, z = M r
+     */
+    void precondition(const QVector<double> &r, QVector<double> &z);
+
+    /**
+     * @brief the levels, finest first
+     */
+    QVector<Level> m_levels;
+
+    /**
+     * @brief boundary conditions of the low faces along x, y and z
+     */
+    Boundary m_low[3];
+
+    /**
+     * @brief boundary conditions of the high faces along x, y and z
+     */
+    Boundary m_high[3];
+
+    /**
+     * @brief Gauss-Seidel sweeps before and after the coarse correction
+     */
+    int m_sweeps;
+};
+
+inline bool PoissonSolver::isOn() const
+{
+    return !m_levels.isEmpty();
+}
+
+}
+#endif
@@ -3,6 +3,14 @@
 #define BOOST_DISABLE_ASSERTS
 
 #include <QObject>
+#include <QVector>
+#include <QMutex>
+
+#include "coulombkernel.h"
+#include "particlemesh.h"
+#include "celllist.h"
+#include "poissonsolver.h"
+#include "agent.h"
 
 #ifndef Q_MOC_RUN
 
@@ -24,6 +32,8 @@ namespace LangmuirCore
 
 class World;
 class Grid;
+class CarrierStore;
+class RandomStream;
 
 /**
  * @brief A class to calculate the potential
@@ -63,7 +73,7 @@ public:
      * @param trapPotentials list of shifts
      */
     void setPotentialTraps(
-        const QList<int>& trapIDs = QList<int>(),
+        const QList<SiteID>& trapIDs = QList<SiteID>(),
         const QList<double>& trapPotentials = QList<double>()
         );
 
@@ -81,79 +91,418 @@ public:
      * @brief calculates Coulomb potential from electrons at specific grid site
      * @param site_i the site of interest
      */
-    double coulombE(int site_i);
+    double coulombE(SiteID site_i);
 
     /**
      * @brief calculates Coulomb image-potential from electrons at specific grid site
      * @param site_i the site of interest
      */
-    double coulombImageE(int site_i);
+    double coulombImageE(SiteID site_i);
 
     /**
      * @brief calculates Coulomb potential from electrons at specific grid site, assuming gaussians
      * @param site_i the site of interest
      */
-    double gaussE(int site_i);
+    double gaussE(SiteID site_i);
 
     /**
      * @brief calculates Coulomb image-potential from electrons at specific grid site, assuming gaussians
      * @param site_i the site of interest
      */
-    double gaussImageE(int site_i);
+    double gaussImageE(SiteID site_i);
 
     /**
      * @brief calculates Coulomb potential from holes at specific grid site
      * @param site_i the site of interest
      */
-    double coulombH(int site_i);
+    double coulombH(SiteID site_i);
 
     /**
      * @brief calculates Coulomb image-potential from holes at specific grid site
      * @param site_i the site of interest
      */
-    double coulombImageH(int site_i);
+    double coulombImageH(SiteID site_i);
 
     /**
      * @brief calculates Coulomb potential from holes at specific grid site, assuming gaussians
      * @param site the site of interest
      */
-    double gaussH(int site);
+    double gaussH(SiteID site);
 
     /**
      * @brief calculates Coulomb image-potential from holes at specific grid site, assuming gaussians
      * @param site the site of interest
      */
-    double gaussImageH(int site);
+    double gaussImageH(SiteID site);
 
     /**
      * @brief calculates Coulomb potential from charged defects at specific grid site
      * @param site_i the site of interest
      */
-    double coulombD(int site_i);
+    double coulombD(SiteID site_i);
 
     /**
      * @brief calculates Coulomb image-potential from charged defects at specific grid site
      * @param site_i the site of interest
      */
-    double coulombImageD(int site_i);
+    double coulombImageD(SiteID site_i);
 
     /**
      * @brief calculates Coulomb potential from charged defects at specific grid site, assuming gaussians
      * @param site_i the site of interest
      */
-    double gaussD(int site_i);
+    double gaussD(SiteID site_i);
 
     /**
      * @brief calculates Coulomb image-potential from charged defects at specific grid site, assuming gaussians
      * @param site_i the site of interest
      */
-    double gaussImageD(int site_i);
+    double gaussImageD(SiteID site_i);
+
+    /**
+     * @brief pre-calculates the Coulomb potential of the charged defects at every site
+     *
+     * Defects never move, so this is done once, in parallel, after precalculateArrays().
+     * Does nothing if defects.charge is zero.
+     */
+    void initializeDefectPotential();
+
+    /**
+     * @brief get the Coulomb potential from charged defects at a site
+     * @param site the site of interest
+     *
+     * Equal to coulombD() (or gaussD() if coulomb.gaussian.sigma > 0).
+     * Returns zero for special agent sites, which lie outside the grid volume.
+     */
+    double defectPotential(SiteID site);
+
+    /**
+     * @brief get the Coulomb and image potential from charged defects at a site, as seen by sources
+     * @param site the site of interest
+     *
+     * Equal to coulombD() + coulombImageD().  Only available if source.coulomb is on.
+     */
+    double defectSourcePotential(SiteID site);
+
+    /**
+     * @brief builds the per-site carrier Coulomb potential from the current carriers
+     *
+     * Does nothing unless coulomb.incremental is on.  Must be called after
+     * precalculateArrays(), because the stencil is built from R1, iR and eR.
+     */
+    void initializeCarrierField();
+
+    /**
+     * @brief record that a carrier now occupies a site
+     * @param site the site of the carrier
+     * @param charge the charge of the carrier (-1 for electrons, +1 for holes)
+     *
+     * The change is queued and applied by updateCarrierField().
+     */
+    void addToCarrierField(SiteID site, int charge);
+
+    /**
+     * @brief record that a carrier no longer occupies a site
+     * @param site the site of the carrier
+     * @param charge the charge of the carrier (-1 for electrons, +1 for holes)
+     *
+     * The change is queued and applied by updateCarrierField().
+     */
+    void removeFromCarrierField(SiteID site, int charge);
+
+    /**
+     * @brief apply the queued carrier changes to the per-site carrier potential
+     *
+     * The grid is split into slabs along x, and each slab is updated in a
+     * separate thread.  Must be called before carrierFieldE() or carrierFieldH()
+     * are used.
+     */
+    void updateCarrierField();
+
+    /**
+     * @brief true if the per-site carrier potential is being maintained
+     */
+    bool carrierFieldIsOn();
+
+    /**
+     * @brief get the Coulomb potential from electrons at a site, using the per-site carrier potential
+     * @param site the site of interest
+     *
+     * Equal to coulombE() (or gaussE() if coulomb.gaussian.sigma > 0).
+     * Returns zero for special agent sites, which lie outside the grid volume.
+     */
+    double carrierFieldE(SiteID site);
+
+    /**
+     * @brief get the Coulomb potential from holes at a site, using the per-site carrier potential
+     * @param site the site of interest
+     *
+     * Equal to coulombH() (or gaussH() if coulomb.gaussian.sigma > 0).
+     * Returns zero for special agent sites, which lie outside the grid volume.
+     */
+    double carrierFieldH(SiteID site);
+
+    /**
+     * @brief recalculate the long-range Coulomb potential from the current carriers
+     *
+     * Does nothing unless coulomb.mesh is on.  Must be called before coulombE(), coulombH(),
+     * gaussE() or gaussH() are used, after the carriers have moved.
+     */
+    void updateParticleMesh();
+
+    /**
+     * @brief build the multigrid Poisson solver and solve for the initial carriers
+     *
+     * Does nothing unless poisson.multigrid is on.  Must be called after the carriers are placed.
+     */
+    void initializePoisson();
+
+    /**
+     * @brief solve Poisson's equation for the current carriers and update the grid potentials
+     *
+     * The change since the last solution is added to the potential of both grids, so the
+     * linear, gate and trap potentials are kept.  Does nothing unless poisson.multigrid is on.
+     */
+    void updatePoissonPotential();
+
+    /**
+     * @brief get the energy change a carrier sees from its own space-charge potential, for a move
+     * @param charges the CarrierStore of the carrier
+     * @param slot the slot of the carrier
+     * @param site the site the carrier moves to
+     *
+     * The solved potential includes the charge of every carrier, so without this a carrier
+     * would be pushed away from where it was at the last solve.  Subtract the result from the
+     * energy change of the move.  Uses the potential of a unit charge at the center of the grid,
+     * shifted to where the carrier was; this ignores the images in the electrodes, which only
+     * matter within a few sites of them.  Returns zero unless poisson.multigrid is on.
+     */
+    double poissonSelfEnergy(const CarrierStore &charges, int slot, SiteID site);
+
+    /**
+     * @brief record that a carrier now occupies a site, in the cell list of its type
+     * @param site the site of the carrier
+     * @param type either Agent::Electron or Agent::Hole
+     *
+     * Called by Grid::registerAgent().  Does nothing before precalculateArrays().
+     */
+    void registerCarrier(SiteID site, Agent::Type type);
+
+    /**
+     * @brief record that a carrier no longer occupies a site, in the cell list of its type
+     * @param site the site of the carrier
+     * @param type either Agent::Electron or Agent::Hole
+     *
+     * Called by Grid::unregisterAgent().  Does nothing before precalculateArrays().
+     */
+    void unregisterCarrier(SiteID site, Agent::Type type);
 
 private:
+    /**
+     * @brief apply the queued carrier changes to the sites with x-site IDs in [xBegin, xEnd)
+     * @param xBegin first x-site ID of the slab
+     * @param xEnd one past the last x-site ID of the slab
+     */
+    void updateCarrierFieldSlab(int xBegin, int xEnd);
+
+    /**
+     * @brief build the flattened Coulomb and gaussian tables of m_coulombKernel and m_gaussKernel
+     */
+    void initializeCoulombKernels();
+
+    /**
+     * @brief build the short-range tables of m_coulombKernel and m_gaussKernel, and m_particleMesh
+     */
+    void initializeParticleMesh();
+
+    /**
+     * @brief make the cell lists and fill them with the current carriers
+     * @param cellSize the smallest size of a cell (the cutoff of m_coulombKernel)
+     * @param xPeriodic true if the CoulombKernel uses the nearest image along x
+     * @param yzPeriodic true if the CoulombKernel uses the nearest image along y and z
+     */
+    void initializeCellLists(int cellSize, bool xPeriodic, bool yzPeriodic);
+
+    /**
+     * @brief sum the Coulomb potential of a CarrierStore at a site with a CoulombKernel
+     * @param kernel m_coulombKernel or m_gaussKernel
+     * @param charges the carriers
+     * @param site the site of interest
+     *
+     * Only the carriers in the cells around the site are visited (see m_electronCells).
+     */
+    double coulombKernelSum(const CoulombKernel &kernel, const CarrierStore &charges, SiteID site);
+
+    /**
+     * @brief get the long-range Coulomb potential of a CarrierStore at a site from m_particleMesh
+     * @param charges the carriers
+     * @param site the site of interest
+     *
+     * Returns zero if coulomb.mesh is off, or for special agent sites.
+     */
+    double particleMeshSum(const CarrierStore &charges, SiteID site);
+
+    /**
+     * @brief draw random site IDs for trap seeds (see setPotentialTraps())
+     * @param stream the random stream of this chunk of seeds
+     * @param count the number of sites to draw
+     * @param sites filled with the sites; duplicates and existing traps are removed later
+     */
+    void drawTrapCandidates(RandomStream stream, int count, QVector<SiteID> *sites);
+
+    /**
+     * @brief calculate the defect potentials for the sites with x-site IDs in [xBegin, xEnd)
+     * @param xBegin first x-site ID of the slab
+     * @param xEnd one past the last x-site ID of the slab
+     */
+    void initializeDefectPotentialSlab(int xBegin, int xEnd);
+
+    /**
+     * @brief a carrier that was added to or removed from a site
+     */
+    struct CarrierFieldChange
+    {
+        //! x-site ID of the carrier
+        int x;
+
+        //! y-site ID of the carrier
+        int y;
+
+        //! z-site ID of the carrier
+        int z;
+
+        //! charge of the carrier, negated when the carrier is removed
+        int delta;
+
+        //! true if the change is to the electron field, false for the hole field
+        bool electron;
+    };
+
+    /**
+     * @brief one entry of the Coulomb stencil, for a fixed x-offset
+     */
+    struct CarrierFieldStencil
+    {
+        //! y-offset
+        int dy;
+
+        //! z-offset
+        int dz;
+
+        //! the potential of a unit charge, in fixed point (see m_carrierFieldScale)
+        qint64 value;
+    };
+
     /**
      * @brief reference to the World
      */
     World &m_world;
+
+    /**
+     * @brief the per-site Coulomb potential from charged defects (see defectPotential())
+     */
+    QVector<double> m_defectPotential;
+
+    /**
+     * @brief the per-site Coulomb and image potential from charged defects (see defectSourcePotential())
+     */
+    QVector<double> m_defectSourcePotential;
+
+    /**
+     * @brief true if the per-site carrier potential is being maintained
+     */
+    bool m_carrierFieldOn;
+
+    /**
+     * @brief conversion from the fixed point carrier potential to eV
+     *
+     * The carrier potential is accumulated as integers so that adding and
+     * removing the same carrier cancels exactly, and the field never drifts
+     * from the direct sum.  The CoulombKernel tables use the same scale.
+     */
+    double m_carrierFieldScale;
+
+    /**
+     * @brief the per-site Coulomb potential from electrons, in fixed point
+     */
+    QVector<qint64> m_carrierFieldE;
+
+    /**
+     * @brief the per-site Coulomb potential from holes, in fixed point
+     */
+    QVector<qint64> m_carrierFieldH;
+
+    /**
+     * @brief the Coulomb stencil, indexed by the absolute x-offset
+     */
+    QVector< QVector<CarrierFieldStencil> > m_carrierFieldStencil;
+
+    /**
+     * @brief carrier changes not yet applied to the per-site carrier potential
+     */
+    QVector<CarrierFieldChange> m_carrierFieldChanges;
+
+    /**
+     * @brief guards m_carrierFieldChanges when carriers move in parallel (see parallel.step)
+     */
+    QMutex m_carrierFieldMutex;
+
+    /**
+     * @brief sums 1/r within the cutoff, used by coulombE() and coulombH()
+     */
+    CoulombKernel m_coulombKernel;
+
+    /**
+     * @brief sums erf(r)/r within the cutoff, used by gaussE() and gaussH()
+     */
+    CoulombKernel m_gaussKernel;
+
+    /**
+     * @brief the long-range part of the Coulomb potential if coulomb.mesh is on
+     *
+     * m_coulombKernel and m_gaussKernel then only hold the short-range part, within coulomb.mesh.cutoff
+     */
+    ParticleMesh m_particleMesh;
+
+    /**
+     * @brief the electrons binned into cells of the size of the cutoff
+     */
+    CellList m_electronCells;
+
+    /**
+     * @brief the holes binned into cells of the size of the cutoff
+     */
+    CellList m_holeCells;
+
+    /**
+     * @brief guards m_electronCells and m_holeCells when carriers move in parallel (see parallel.step)
+     */
+    QMutex m_cellListMutex;
+
+    /**
+     * @brief solves for the space-charge potential if poisson.multigrid is on
+     */
+    PoissonSolver m_poissonSolver;
+
+    /**
+     * @brief the space-charge potential last added to the grids, per site
+     */
+    QVector<double> m_poissonPotential;
+
+    /**
+     * @brief the space-charge potential of a unit charge at m_poissonCenter, per site
+     */
+    QVector<double> m_poissonResponse;
+
+    /**
+     * @brief the x-, y- and z-site IDs of the charge m_poissonResponse was solved for
+     */
+    int m_poissonCenter[3];
+
+    /**
+     * @brief true if the Poisson solve has an electrode at z = 0, so z does not wrap around
+     */
+    bool m_poissonGate;
 };
 
 }
@@ -25,8 +25,104 @@
 namespace LangmuirCore
 {
 
+/**
+ * @brief A counter-based random number stream (Philox4x32-10)
+ *
+ * Each number is a pure function of the key and the counter, so a stream can be
+ * recreated anywhere from (seed, step, stream, id) without any shared state.
+ * Streams with different counters are independent, which lets carriers draw
+ * from any thread and still give results that do not depend on the thread count.
+ */
+class RandomStream
+{
+public:
+    /**
+     * @brief create a stream with zero key and counter
+     */
+    RandomStream();
+
+    /**
+     * @brief create a stream
+     * @param key usually the random seed
+     * @param step the simulation step
+     * @param stream identifies the kind of object drawing (for example the Agent::Type)
+     * @param id identifies the object drawing within its kind
+     */
+    RandomStream(quint64 key, quint32 step, quint32 stream, quint32 id);
+
+    /**
+     * @brief Generate a random 32-bit integer
+     */
+    quint32 next();
+
+    /**
+     * @brief Generate a random double from the uniform distribution [0, 1)
+     */
+    double random();
+
+    /**
+     * @brief Generate a random int from the uniform distribution [low, high]
+     */
+    int integer(const int low=0, const int high=1);
+
+    /**
+     * @brief same as Random::metropolisWithCoupling()
+     */
+    bool metropolisWithCoupling(double energyChange, double inversekT, double coupling);
+
+    /**
+     * @brief same as Random::chooseYes()
+     */
+    bool chooseYes(double percent);
+
+    /**
+     * @brief compute the first block of the streams of many objects of one kind at once
+     * @param key usually the random seed
+     * @param step the simulation step
+     * @param stream identifies the kind of object drawing
+     * @param count the number of objects, with ids 0 to count - 1
+     * @param block receives the block of object id at block[id], block[count + id],
+     * block[2 * count + id] and block[3 * count + id]
+     *
+     * These are the first four numbers next() returns for RandomStream(key, step, stream, id).
+     * With AVX2 the streams are computed eight at a time, one per lane.
+     */
+    static void firstBlocks(quint64 key, quint32 step, quint32 stream, int count, quint32 *block);
+
+private:
+    /**
+     * @brief compute the next block of four numbers and advance the counter
+     */
+    void generate();
+
+    /**
+     * @brief key (from the seed)
+     */
+    quint32 m_key[2];
+
+    /**
+     * @brief counter; word 0 counts blocks, the others hold id, step and stream
+     */
+    quint32 m_counter[4];
+
+    /**
+     * @brief the current block of output
+     */
+    quint32 m_block[4];
+
+    /**
+     * @brief the number of values used from the current block
+     */
+    int m_used;
+};
+
 /**
  * @brief A class to generate random numbers
+ *
+ * Random either uses boost::mt19937 (the original stream), or four interleaved
+ * xoshiro256++ generators that fill a buffer at a time; the lanes are independent,
+ * so the compiler can vectorize the fill.  The xoshiro generator draws bounded
+ * integers with Lemire's method, which only divides on the rare rejections.
  */
 class Random : public QObject
 {
@@ -35,6 +131,15 @@ private:
     Q_DISABLE_COPY(Random)
 
 public:
+    /**
+     * @brief The algorithms Random can use
+     */
+    enum Generator
+    {
+        MersenneTwister, //!< boost::mt19937, the original stream
+        Xoshiro          //!< four interleaved xoshiro256++ generators, filling a buffer
+    };
+
     /**
      * @brief Random
      * @param seed makes the generator deterministic
@@ -61,6 +166,27 @@ public:
      */
     void seed(quint64 seed);
 
+    /**
+     * @brief Switch to another generator, started from seed() (does nothing if it is already used)
+     * @param name mt19937 or xoshiro256 (see SimulationParameters::randomGenerator)
+     */
+    void setGenerator(const QString &name);
+
+    /**
+     * @brief Get the generator in use
+     */
+    Generator generator() const;
+
+    /**
+     * @brief Get a counter-based stream keyed by the seed
+     * @param step the simulation step
+     * @param stream identifies the kind of object drawing (for example the Agent::Type)
+     * @param id identifies the object drawing within its kind
+     *
+     * The stream only depends on the seed and its arguments, and not on the state of this generator.
+     */
+    RandomStream stream(quint32 step, quint32 stream, quint32 id);
+
     /**
      * @brief Generate a random double from the uniform distribution [0, 1]
      */
@@ -100,6 +226,15 @@ public:
      */
     bool metropolisWithCoupling(double energyChange, double inversekT, double coupling);
 
+    /**
+     * @brief metropolisWithCoupling() with a uniform random number that was drawn already
+     * @param energyChange change in energy when going from initial to final state
+     * @param inversekT decay constant in exponential
+     * @param coupling alters acceptance probability
+     * @param randNumber a random double from the uniform distribution [0, 1)
+     */
+    static bool metropolisWithCoupling(double energyChange, double inversekT, double coupling, double randNumber);
+
     /**
      * @brief Randomly choose yes a percent of the time
      */
@@ -145,6 +280,51 @@ public:
     friend std::istream& operator>>(std::istream& stream, Random& random);
 
 private:
+    /**
+     * @brief The number of interleaved xoshiro generators, and the size of their buffer
+     */
+    enum { Lanes = 4, BufferSize = 64 };
+
+    /**
+     * @brief Get the next 64 random bits from the xoshiro buffer
+     */
+    quint64 next64();
+
+    /**
+     * @brief Refill the xoshiro buffer
+     */
+    void fill();
+
+    /**
+     * @brief Start the xoshiro lanes from m_seed, each 2^128 numbers apart
+     */
+    void seedXoshiro();
+
+    /**
+     * @brief The generator in use
+     */
+    Generator m_generator;
+
+    /**
+     * @brief The xoshiro state, indexed by word and lane
+     */
+    quint64 m_state[4][Lanes];
+
+    /**
+     * @brief The xoshiro state before the last fill(), saved in checkpoints
+     */
+    quint64 m_fillState[4][Lanes];
+
+    /**
+     * @brief The xoshiro output
+     */
+    quint64 m_buffer[BufferSize];
+
+    /**
+     * @brief The number of values used from m_buffer
+     */
+    int m_used;
+
     /**
      * @brief The underlying random number generator
      */
@@ -161,5 +341,55 @@ private:
     quint64 m_seed;
 };
 
+inline Random::Generator Random::generator() const
+{
+    return m_generator;
+}
+
+inline quint64 Random::next64()
+{
+    if (m_used >= BufferSize)
+    {
+        fill();
+    }
+    return m_buffer[m_used++];
+}
+
+inline double Random::random()
+{
+    if (m_generator == MersenneTwister)
+    {
+        return(*generator01)();
+    }
+
+    // 53 random bits
+    return double(next64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline int Random::integer(const int low, const int high)
+{
+    if (m_generator == MersenneTwister)
+    {
+        boost::uniform_int < int > distribution(low, high);
+        boost::variate_generator < boost::mt19937 &, boost::uniform_int < int > >generator(*twister, distribution);
+        return generator();
+    }
+
+    // Lemire's method: the high word of x * range is uniform on [0, range) once the
+    // low words below (2^32 - range) % range are rejected, so it only divides when
+    // the low word is smaller than range
+    quint64 range = quint64(qint64(high) - qint64(low) + 1);
+    quint64 product = (next64() >> 32) * range;
+    if (quint32(product) < range)
+    {
+        quint32 threshold = quint32((Q_UINT64_C(0x100000000) - range) % range);
+        while (quint32(product) < threshold)
+        {
+            product = (next64() >> 32) * range;
+        }
+    }
+    return int(qint64(low) + qint64(product >> 32));
+}
+
 }
 #endif
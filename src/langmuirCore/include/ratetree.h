@@ -0,0 +1,96 @@
+#ifndef RATETREE_H
+#define RATETREE_H
+
+#include <QVector>
+
+namespace LangmuirCore
+{
+
+/**
+ * @brief A binary tree of partial sums of rates, used by the rejection-free algorithm
+ *
+ * Each leaf holds the rate of one item (for example the total hop rate of the carrier in
+ * a CarrierStore slot), and each node holds the sum of its two children.  Setting a rate
+ * and finding the item that a point in [0, total()) falls into both take O(log n).
+ */
+class RateTree
+{
+public:
+    /**
+     * @brief create an empty tree
+     */
+    RateTree();
+
+    /**
+     * @brief set all rates to zero and make room for a number of items
+     * @param size the number of items
+     */
+    void clear(int size);
+
+    /**
+     * @brief make room for at least a number of items, keeping the current rates
+     * @param size the number of items
+     */
+    void reserve(int size);
+
+    /**
+     * @brief get the number of items the tree has room for
+     */
+    int size() const;
+
+    /**
+     * @brief set the rate of an item and update the sums above it
+     * @param index the item
+     * @param rate the new rate, must not be negative
+     */
+    void set(int index, double rate);
+
+    /**
+     * @brief get the rate of an item
+     * @param index the item
+     */
+    double rate(int index) const;
+
+    /**
+     * @brief get the sum of all rates
+     */
+    double total() const;
+
+    /**
+     * @brief find the item whose share of the total contains a value
+     * @param value a number in [0, total())
+     *
+     * Items with zero rate are never returned, even if round-off puts the value on their edge.
+     */
+    int find(double value) const;
+
+private:
+    /**
+     * @brief the number of leaves, a power of two
+     */
+    int m_leaves;
+
+    /**
+     * @brief the tree; node 1 is the root, the children of node i are 2i and 2i+1,
+     * and the leaves start at m_leaves
+     */
+    QVector<double> m_nodes;
+};
+
+inline int RateTree::size() const
+{
+    return m_leaves;
+}
+
+inline double RateTree::rate(int index) const
+{
+    return m_nodes[m_leaves + index];
+}
+
+inline double RateTree::total() const
+{
+    return m_nodes[1];
+}
+
+}
+#endif
@@ -2,6 +2,13 @@
 #define SIMULATION_H
 
 #include <QObject>
+#include <QVector>
+#include <QAtomicInt>
+
+#include "chargeagent.h"
+#include "ratetree.h"
+#include "trapescape.h"
+#include "walkerengine.h"
 
 namespace LangmuirCore
 {
@@ -12,7 +19,7 @@ class Agent;
 class Potential;
 class DrainAgent;
 class SourceAgent;
-class ChargeAgent;
+class CarrierStore;
 struct SimulationParameters;
 
 /**
@@ -43,18 +50,79 @@ public:
      */
     virtual void performIterations(int nIterations);
 
+    /**
+     * @brief Pick the specialization of the step loop that matches the parameters
+     *
+     * Called by the constructor.  Call it again after changing SimulationParameters::coulombCarriers,
+     * SimulationParameters::coulombGaussianSigma, SimulationParameters::simulationType or
+     * SimulationParameters::outputIdsOnDelete.
+     */
+    void selectStepKernel();
+
+    /**
+     * @brief Get the number of carrier steps skipped in trap basins (see SimulationParameters::trapEscape)
+     */
+    qint64 acceleratedSteps() const;
+
+    /**
+     * @brief Get the number of escapes from trap basins that were sampled (see SimulationParameters::trapEscape)
+     */
+    qint64 trapEscapes() const;
+
+    /**
+     * @brief Get the number of whole steps skipped because every carrier was trapped (see SimulationParameters::trapEscape)
+     */
+    qint64 skippedSteps() const;
+
 protected:
+    /**
+     * @brief Set m_stepKernel to the specialization for a CoulombMode and the other parameters
+     */
+    template <ChargeAgent::CoulombMode Coulomb>
+    void selectStepKernel();
+
+    /**
+     * @brief The step loop, specialized so the per-step and per-charge parameter checks compile away
+     * @param nIterations the number of steps to simulate
+     *
+     * Coulomb selects how ChargeAgent::coulombKernel() works, SolarCell stands for
+     * SimulationParameters::simulationType == "solarcell", and OutputIds for
+     * SimulationParameters::outputIdsOnDelete.
+     */
+    template <ChargeAgent::CoulombMode Coulomb, bool SolarCell, bool OutputIds>
+    void stepKernel(int nIterations);
+
+    /**
+     * @brief The step of an MPI run, where every rank owns a slab of the grid (see MpiHelper)
+     *
+     * The left halves of all slabs move first, then the right halves; each carrier
+     * moves once per step.  Only transistor simulations without Coulomb interactions
+     * are supported (see MpiHelper::initializeSlab()).
+     */
+    void performSlabStep();
 
     /**
      * @brief Recombine holes and electrons (in solarcell simulations only)
      */
     void performRecombinations();
 
+    /**
+     * @brief performRecombinations() with the simulation type known
+     */
+    template <bool SolarCell>
+    void performRecombinations();
+
     /**
      * @brief Tell sources to inject charges
      */
     void performInjections();
 
+    /**
+     * @brief performInjections() with the simulation type known
+     */
+    template <bool SolarCell>
+    void performInjections();
+
     /**
      * @brief \b Try to use the sources to keep the number of ChargeAgents balanced
      */
@@ -70,9 +138,126 @@ protected:
     void nextTick();
 
     /**
-     * @brief A method needed to call ChargeAgent::coulombCPU() in parallel
+     * @brief nextTick() with output.id.on.delete known
+     */
+    template <bool OutputIds>
+    void nextTick();
+
+    /**
+     * @brief Let every charge propose a future site (ChargeAgent::chooseFuture())
+     *
+     * Runs on all threads if parallel.step is set.
+     */
+    void chooseFutures();
+
+    /**
+     * @brief Let every charge accept or reject its future site (ChargeAgent::decideFuture())
+     *
+     * Runs on all threads if parallel.step is set, except for moves into drains.
+     */
+    void decideFutures();
+
+    /**
+     * @brief Split a CarrierStore into one index range per thread and run a method on each range
+     * @param method the method to run, called as method(&charges, begin, end)
+     * @param charges the carriers to split up
+     */
+    void runParallel(void (Simulation::*method)(CarrierStore*, int, int), CarrierStore &charges);
+
+    /**
+     * @brief Call ChargeAgent::chooseFuture() for the charges in [begin, end)
+     */
+    void chooseFutureRange(CarrierStore *charges, int begin, int end);
+
+    /**
+     * @brief Call ChargeAgent::decideFuture() for the charges in [begin, end)
+     */
+    void decideFutureRange(CarrierStore *charges, int begin, int end);
+
+    /**
+     * @brief Claim the future sites of the charges in [begin, end), keeping the lowest index per site
+     */
+    void claimFutureRange(CarrierStore *charges, int begin, int end);
+
+    /**
+     * @brief Reject the moves of charges in [begin, end) that lost their claim
+     */
+    void resolveFutureRange(CarrierStore *charges, int begin, int end);
+
+    /**
+     * @brief Call ChargeAgent::completeTick() for the charges in [begin, end) and clear their claims
+     */
+    void completeTickRange(CarrierStore *charges, int begin, int end);
+
+    /**
+     * @brief Sort the carriers along a Morton curve if carriers.sort steps have passed
      */
-    static void chargeAgentCoulombInteractionQtConcurrentCPU(ChargeAgent * chargeAgent);
+    void sortCarriers();
+
+    /**
+     * @brief Skip the steps until the next exit from a trap basin, if every carrier is trapped and no source can inject
+     * @param stepsLeft the number of steps left in this run, the most that are skipped
+     * @return the number of steps skipped
+     */
+    int skipTrappedSteps(int stepsLeft);
+
+    /**
+     * @brief Solve for the space-charge potential again if poisson.update steps have passed
+     * @return true if the grid potential changed
+     */
+    bool updatePoissonPotential();
+
+    /**
+     * @brief Simulate one step with the rejection-free algorithm (see SimulationParameters::rejectionFree)
+     *
+     * Accepted moves are picked from the hop rates until the waiting times add up to one step,
+     * then charges recombine and are injected as in a normal step.
+     */
+    void performRejectionFreeStep();
+
+    /**
+     * @brief Pick one accepted move from the hop rates and perform it
+     * @param total the sum of the hop rates of electrons and holes
+     */
+    void performRejectionFreeEvent(double total);
+
+    /**
+     * @brief Calculate the hop rates of all charges from scratch
+     */
+    void initializeRates();
+
+    /**
+     * @brief Calculate the hop rate of one charge
+     * @param charges the CarrierStore of the charge
+     * @param slot the slot of the charge in the CarrierStore
+     *
+     * The hop rate is the sum over neighbors of ChargeAgent::acceptanceProbability(), divided by
+     * the number of neighbors, which is the chance per step of an accepted move.
+     */
+    void updateRate(CarrierStore &charges, int slot);
+
+    /**
+     * @brief Recalculate the hop rates of the charges a change at one or two sites affects
+     * @param charges the CarrierStore of the charge that changed
+     * @param site a site that was left or entered
+     * @param other another site that was left or entered, or -1
+     *
+     * Without Coulomb interactions, only charges of the same type that can hop to the sites
+     * are affected.  With Coulomb interactions, every charge within the electrostatic cutoff
+     * (plus the hopping range) is affected.
+     */
+    void updateRatesNear(CarrierStore &charges, SiteID site, SiteID other = -1);
+
+    /**
+     * @brief Get the hop rates of a CarrierStore
+     */
+    RateTree& rates(CarrierStore &charges);
+
+    /**
+     * @brief A method needed to call ChargeAgent::coulombKernel() in parallel
+     */
+    template <ChargeAgent::CoulombMode Coulomb>
+    static void coulombKernelQtConcurrentCPU(ChargeAgent * chargeAgent);
 
     /**
      * @brief A method needed to call ChargeAgent::coulombGPU() in parallel
@@ -87,6 +272,61 @@ protected:
      * @brief Reference to World object
      */
     World &m_world;
+
+    /**
+     * @brief The step loop picked by selectStepKernel()
+     */
+    void (Simulation::*m_stepKernel)(int);
+
+    /**
+     * @brief SimulationParameters::simulationType == "solarcell", checked once by selectStepKernel()
+     */
+    bool m_solarCell;
+
+    /**
+     * @brief SimulationParameters::outputIdsOnDelete, checked once by selectStepKernel()
+     */
+    bool m_outputIds;
+
+    /**
+     * @brief Lowest index of a charge moving to each site, used by the parallel nextTick()
+     */
+    QVector<QAtomicInt> m_claims;
+
+    /**
+     * @brief The site each charge left in the parallel nextTick(), or -1, indexed like CarrierStore::agents()
+     */
+    QVector<SiteID> m_leftSites;
+
+    /**
+     * @brief The site each charge entered in the parallel nextTick(), or -1, indexed like CarrierStore::agents()
+     */
+    QVector<SiteID> m_enteredSites;
+
+    /**
+     * @brief Hop rates of the electrons, indexed by slot, used by the rejection-free algorithm
+     */
+    RateTree m_electronRates;
+
+    /**
+     * @brief Hop rates of the holes, indexed by slot, used by the rejection-free algorithm
+     */
+    RateTree m_holeRates;
+
+    /**
+     * @brief Acceptance probabilities of the neighbors of the charge picked by performRejectionFreeEvent()
+     */
+    QVector<double> m_neighborRates;
+
+    /**
+     * @brief Samples the escapes of carriers from trap basins, used if SimulationParameters::trapEscape
+     */
+    TrapEscape m_trapEscape;
+
+    /**
+     * @brief Steps the carriers in batches, used if SimulationParameters::carriersBatched
+     */
+    WalkerEngine m_walkers;
 };
 
 }
@@ -36,7 +36,7 @@ public:
      * placing charges at specific places.  For example, when sometimes the checkpoint
      * file has information on where charges are/were, and these need to be placed.
      */
-    bool tryToSeed(int site);
+    bool tryToSeed(SiteID site);
 
     /**
      * @brief attempt to inject a carrier
@@ -47,6 +47,11 @@ public:
      */
     bool tryToInject();
 
+    /**
+     * @brief check if an injection can succeed at all (the carrier limit is not reached and the rate is positive)
+     */
+    virtual bool canInject()= 0;
+
 protected:
     /**
      * @brief choose a site to inject to
@@ -55,15 +60,16 @@ protected:
      * The Grid::CubeFace used to construct the SourceAgent determines the
      * neighborlist.
      */
-    virtual int chooseSite();
+    virtual SiteID chooseSite();
 
     /**
      * @brief checks to see if a carrier can actually be injected at the requested site
      *
      * For example, if the site contains a defect, or a carrier is already present at the
-     * site, then it is not valid to inject the carrier at this site.
+     * site, then it is not valid to inject the carrier at this site.  Defects are registered
+     * with the Grid as Agent::Defect, so checking the Agent::Type covers them.
      */
-    virtual bool validToInject(int site)= 0;
+    virtual bool validToInject(SiteID site)= 0;
 
     /**
      * @brief actually injects carrier.
@@ -72,7 +78,7 @@ protected:
      * Creates a new carrier.  Does not perform checks.  Forcefully injects charge.
      * Don't call this function unless you know what you are doing.
      */
-    virtual void inject(int site)= 0;
+    virtual void inject(SiteID site)= 0;
 
     /**
      * @brief decides if charge should be injected using a constant probability
@@ -81,19 +87,19 @@ protected:
      * If SimulationParameters::sourceMetropolis is true, then use the metropolis
      * criterion with an energy change to decide if charge should be injected.
      */
-    virtual bool shouldTransport(int site);
+    virtual bool shouldTransport(SiteID site);
 
     /**
      * @brief choose a random site ID
      *
-     * It can be any possible site in the grid.
+     * It can be any Agent::Empty site in the grid (see Grid::randomFreeSite()), or -1 if there are none.
      */
-    int randomSiteID();
+    SiteID randomSiteID();
 
     /**
      * @brief choose a random site ID from the neighborlist.
      */
-    int randomNeighborSiteID();
+    SiteID randomNeighborSiteID();
 };
 
 /**
@@ -105,27 +111,33 @@ public:
     /**
      * @brief create an ElectronSourceAgent at a specific site
      */
-    ElectronSourceAgent(World &world, int site, QObject *parent = 0);
+    ElectronSourceAgent(World &world, SiteID site, QObject *parent = 0);
 
     /**
      * @brief create an ElectronSourceAgent at a specific Grid::CubeFace
      */
     ElectronSourceAgent(World &world, Grid::CubeFace cubeFace, QObject *parent = 0);
+
+    /**
+     * @brief same as SourceAgent::canInject(), but specialized for ElectronAgents.
+     */
+    virtual bool canInject();
+
 protected:
     /**
      * @brief same as SourceAgent::validToInject(), but specialized for ElectronAgents.
      */
-    virtual bool validToInject(int site);
+    virtual bool validToInject(SiteID site);
 
     /**
      * @brief same as FluxAgent::energyChange(), but specialized for ElectronAgents.
      */
-    virtual double energyChange(int site);
+    virtual double energyChange(SiteID site);
 
     /**
      * @brief same as SourceAgent::inject(), but specialized for ElectronAgents.
      */
-    virtual void inject(int site);
+    virtual void inject(SiteID site);
 };
 
 /**
@@ -137,27 +149,33 @@ public:
     /**
      * @brief create a HoleSourceAgent at a specific site
      */
-    HoleSourceAgent(World &world, int site, QObject *parent = 0);
+    HoleSourceAgent(World &world, SiteID site, QObject *parent = 0);
 
     /**
      * @brief create a HoleSourceAgent at a specific Grid::CubeFace
      */
     HoleSourceAgent(World &world, Grid::CubeFace cubeFace, QObject *parent = 0);
+
+    /**
+     * @brief same as SourceAgent::canInject(), but specialized for HoleAgents.
+     */
+    virtual bool canInject();
+
 protected:
     /**
      * @brief same as SourceAgent::validToInject(), but specialized for HoleAgents.
      */
-    virtual bool validToInject(int site);
+    virtual bool validToInject(SiteID site);
 
     /**
      * @brief same as FluxAgent::energyChange(), but specialized for HoleAgents.
      */
-    virtual double energyChange(int site);
+    virtual double energyChange(SiteID site);
 
     /**
      * @brief same as SourceAgent::inject(), but specialized for HoleAgents.
      */
-    virtual void inject(int site);
+    virtual void inject(SiteID site);
 };
 
 /**
@@ -170,33 +188,39 @@ public:
      * @brief create an ExcitonSourceAgent
      */
     ExcitonSourceAgent(World &world, QObject *parent = 0);
+
+    /**
+     * @brief same as SourceAgent::canInject(), but specialized for an ElectronAgent and a HoleAgent.
+     */
+    virtual bool canInject();
+
 protected:
     /**
      * @brief checks both grids if its ok to inject charges
      */
-    virtual bool validToInject(int site);
+    virtual bool validToInject(SiteID site);
 
     /**
      * @brief currently implemented as zero and not really used
      */
-    virtual double energyChange(int site);
+    virtual double energyChange(SiteID site);
 
     /**
      * @brief uses the simple constant probability method
      */
-    virtual bool shouldTransport(int site);
+    virtual bool shouldTransport(SiteID site);
 
     /**
      * @brief choose a site to inject to
      *
      * reimplemented to chose a site at any grid site
      */
-    virtual int chooseSite();
+    virtual SiteID chooseSite();
 
     /**
      * @brief similar to SourceAgent::inject(), but injects both a HoleAgent and an ElectronAgent
      */
-    virtual void inject(int site);
+    virtual void inject(SiteID site);
 };
 
 }
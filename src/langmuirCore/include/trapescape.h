@@ -0,0 +1,321 @@
+#ifndef TRAPESCAPE_H
+#define TRAPESCAPE_H
+
+#include "parameters.h"
+#include "agent.h"
+#include "rand.h"
+
+#include <QVector>
+#include <QHash>
+
+namespace LangmuirCore
+{
+
+class World;
+class Grid;
+class CarrierStore;
+class ChargeAgent;
+
+/**
+ * @brief A class to skip the steps carriers spend alone in deep trap basins (see SimulationParameters::trapEscape)
+ *
+ * A basin is a connected island of trap sites (World::trapSiteIDs()), where sites are connected
+ * if a carrier can hop between them.  A carrier alone in a basin and the sites it can hop to
+ * (the zone of the basin) moves as an absorbing Markov chain: every step it hops to another
+ * basin site, stays, or leaves the basin.  The chain only depends on the grid potential and
+ * the coupling constants, so its step matrix is calculated once per basin.
+ *
+ * When a carrier is alone in the zone of a basin, its exit step and exit site are sampled from
+ * the powers of the step matrix, and the carrier is trapped (see ChargeAgent::trapped()) until
+ * then.  If another carrier enters the zone first, or the run of steps ends, the carrier is
+ * put on the site the chain reached instead, sampled given that it has not left yet.  Either
+ * way the carrier ends up where the step by step simulation would have put it, in distribution.
+ *
+ * A trapped carrier only saves its own ChargeAgent::chooseFuture() and ChargeAgent::decideFuture();
+ * the steps still run for everything else.  Only when every carrier is trapped, and no source can
+ * inject, does nothing happen until the next exit, and whole steps are skipped (see stepsUntilExit()).
+ */
+class TrapEscape
+{
+public:
+    /**
+     * @brief create an engine for a world
+     * @param world reference to world object
+     */
+    TrapEscape(World &world);
+
+    /**
+     * @brief find the basins and calculate their step matrices, the first time it is called
+     */
+    void initialize();
+
+    /**
+     * @brief move the trapped carriers whose exit step has come, call before choosing futures
+     */
+    void beginStep();
+
+    /**
+     * @brief release the carriers that left, wake the carriers that got company, and trap carriers
+     * @param stepsLeft the number of steps left in this run, carriers are only trapped that long
+     */
+    void endStep(int stepsLeft);
+
+    /**
+     * @brief wake all trapped carriers, call at the end of a run of steps
+     */
+    void wakeAll();
+
+    /**
+     * @brief get the number of steps until the next exit, if every carrier is trapped (otherwise zero)
+     * @param stepsLeft the number of steps left in this run, the most that is returned
+     */
+    int stepsUntilExit(int stepsLeft) const;
+
+    /**
+     * @brief age the trapped carriers by a number of steps that are not simulated, see stepsUntilExit()
+     * @param steps the number of steps
+     */
+    void skipSteps(int steps);
+
+    /**
+     * @brief get the number of carrier steps that were skipped
+     */
+    qint64 acceleratedSteps() const;
+
+    /**
+     * @brief get the number of whole steps that were skipped (see skipSteps())
+     */
+    qint64 skippedSteps() const;
+
+    /**
+     * @brief get the number of escapes that were sampled
+     */
+    qint64 escapes() const;
+
+private:
+    /**
+     * @brief a number per site, in an array for a dense Grid and in a hash for a sparse one (see Grid::isSparse())
+     */
+    struct SiteTable
+    {
+        //! The numbers of a dense Grid, indexed by site
+        QVector<qint32> dense;
+
+        //! The numbers of a sparse Grid; sites that are not in the hash are zero
+        QHash<SiteID, qint32> sparse;
+
+        //! True if the Grid is sparse
+        bool isSparse;
+
+        //! Set every site to zero
+        void reset(Grid &grid);
+
+        //! Get the number of a site
+        qint32 value(SiteID site) const;
+
+        //! Add to the number of a site
+        void add(SiteID site, qint32 amount);
+    };
+
+    /**
+     * @brief the absorbing Markov chain of a carrier in a trap basin
+     */
+    struct Basin
+    {
+        //! The sites of the basin
+        QVector<SiteID> sites;
+
+        //! The basin sites and the sites a carrier can hop to from them
+        QVector<SiteID> zone;
+
+        //! The chance per step of leaving from each basin site
+        QVector<double> exitProbability;
+
+        //! The sites outside of the basin a carrier can leave to, for each basin site
+        QVector< QVector<SiteID> > exitSites;
+
+        //! The chance per step of leaving to each exit site, for each basin site
+        QVector< QVector<double> > exitRates;
+
+        //! The mean number of steps until a carrier leaves, from each basin site
+        QVector<double> meanExit;
+
+        //! The step matrix raised to the powers 1, 2, 4, 8..., row-major
+        QVector< QVector<double> > powers;
+    };
+
+    /**
+     * @brief the basins of one carrier type
+     */
+    struct Landscape
+    {
+        //! The carriers
+        CarrierStore *charges;
+
+        //! The Grid of the carriers
+        Grid *grid;
+
+        //! The basins
+        QVector<Basin> basins;
+
+        //! One more than the basin each trap site belongs to, or zero (only basins that can be used)
+        SiteTable basinOf;
+
+        //! The number of trapped carriers whose zone contains a site
+        SiteTable watched;
+
+        //! The number of trapped carriers
+        int trapped;
+    };
+
+    /**
+     * @brief a trapped carrier
+     */
+    struct Trapped
+    {
+        //! The carrier
+        ChargeAgent *charge;
+
+        //! The Landscape of the carrier
+        Landscape *landscape;
+
+        //! The basin the carrier is in
+        int basin;
+
+        //! The basin site the carrier was trapped on (index into Basin::sites)
+        int start;
+
+        //! The number of steps since the carrier was trapped
+        int elapsed;
+
+        //! The number of steps before the exit step, or -1 if it is after this run
+        int exitAfter;
+
+        //! The site the carrier leaves from
+        SiteID exitFrom;
+
+        //! The site the carrier leaves to
+        SiteID exitTo;
+
+        //! True during the exit step
+        bool exiting;
+    };
+
+    /**
+     * @brief find the basins of a carrier type
+     * @param landscape the landscape to fill in
+     * @param sources the sites next to a source or drain
+     */
+    void findBasins(Landscape &landscape, const QHash<SiteID, int> &sources);
+
+    /**
+     * @brief calculate the step matrix, exit rates and mean exit times of a basin
+     * @return false if the basin can not be used
+     */
+    bool buildBasin(Landscape &landscape, Basin &basin);
+
+    /**
+     * @brief calculate the powers of the step matrix of a basin up to 2^power
+     */
+    void ensurePowers(Basin &basin, int power);
+
+    /**
+     * @brief trap a carrier, and sample its exit step and exit site
+     * @return false if the carrier is not alone in the zone of its basin
+     */
+    bool trap(Landscape &landscape, ChargeAgent *charge, int basin, int stepsLeft);
+
+    /**
+     * @brief put a trapped carrier on the site it reached, and let it go
+     */
+    void wake(Trapped &trapped);
+
+    /**
+     * @brief stop watching the zone of a trapped carrier and let it go
+     */
+    void release(Trapped &trapped);
+
+    /**
+     * @brief multiply a row vector by the step matrix of a basin raised to 2^power
+     */
+    void multiply(Basin &basin, int power, QVector<double> &row);
+
+    /**
+     * @brief pick an index at random, with chances proportional to weights
+     */
+    int pick(const QVector<double> &weights);
+
+    /**
+     * @brief start the counter-based random stream of a carrier, if SimulationParameters::randomCounter
+     * @param stream TrapStream or WakeStream
+     */
+    void seed(Landscape &landscape, ChargeAgent *charge, quint32 stream);
+
+    /**
+     * @brief draw a uniform random number, from the stream of seed() if SimulationParameters::randomCounter
+     */
+    double uniform();
+
+    /**
+     * @brief reference to world object
+     */
+    World &m_world;
+
+    /**
+     * @brief true once initialize() found the basins
+     */
+    bool m_initialized;
+
+    /**
+     * @brief the basins of the electrons and of the holes
+     */
+    Landscape m_landscapes[2];
+
+    /**
+     * @brief the trapped carriers
+     */
+    QVector<Trapped> m_trapped;
+
+    /**
+     * @brief scratch row vector for multiply()
+     */
+    QVector<double> m_scratch;
+
+    /**
+     * @brief the random stream of the carrier being trapped or woken
+     */
+    RandomStream m_stream;
+
+    /**
+     * @brief the number of carrier steps that were skipped
+     */
+    qint64 m_acceleratedSteps;
+
+    /**
+     * @brief the number of escapes that were sampled
+     */
+    qint64 m_escapes;
+
+    /**
+     * @brief the number of whole steps that were skipped
+     */
+    qint64 m_skippedSteps;
+};
+
+inline qint64 TrapEscape::acceleratedSteps() const
+{
+    return m_acceleratedSteps;
+}
+
+inline qint64 TrapEscape::escapes() const
+{
+    return m_escapes;
+}
+
+inline qint64 TrapEscape::skippedSteps() const
+{
+    return m_skippedSteps;
+}
+
+}
+#endif
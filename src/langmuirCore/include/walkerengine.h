@@ -0,0 +1,117 @@
+#ifndef WALKERENGINE_H
+#define WALKERENGINE_H
+
+#include "parameters.h"
+
+#include <QVector>
+
+namespace LangmuirCore
+{
+
+class World;
+class Grid;
+class CarrierStore;
+
+/**
+ * @brief A class to step all carriers in batches, when they do not interact (see SimulationParameters::carriersBatched)
+ *
+ * Without Coulomb interactions a move only depends on the grid potential, the coupling constant
+ * and whether the future site is empty.  With random.counter every carrier draws from its own
+ * stream, so the first block of every stream is computed up front, eight carriers at a time in
+ * the lanes of AVX2 registers (see RandomStream::firstBlocks()).  That block picks the neighbor
+ * and holds the Metropolis uniform, so one pass over the carrier list proposes and decides every
+ * move against the occupancy of the Grid (its per-site type bytes) at the start of the step, and a
+ * second pass applies the accepted moves in list order with Grid::moveCarrier().  The first carrier
+ * to reach a site gets it, as in Simulation::nextTick().
+ *
+ * Moves into drains, and the rare picks that need a second number (see RandomStream::integer()),
+ * go through ChargeAgent::chooseFuture(), ChargeAgent::decideFuture() and ChargeAgent::completeTick()
+ * in the same passes, so the results are identical to the carrier by carrier step.
+ */
+class WalkerEngine
+{
+public:
+    /**
+     * @brief create an engine for a world
+     * @param world reference to world object
+     */
+    WalkerEngine(World &world);
+
+    /**
+     * @brief copy the neighbor stencils of the carrier grids, call before a run of steps
+     *
+     * The stencils only change when drains are added or removed, or the hopping range changes.
+     */
+    void initialize();
+
+    /**
+     * @brief choose, decide and complete the moves of every charge, electrons first
+     * @param outputIds report the charges that leave through a drain (see SimulationParameters::outputIdsOnDelete)
+     *
+     * Replaces Simulation::chooseFutures(), Simulation::decideFutures() and Simulation::nextTick().
+     */
+    void step(bool outputIds);
+
+private:
+    /**
+     * @brief the neighbors of every stencil class of a Grid, in flat arrays
+     */
+    struct Stencil
+    {
+        //! For each class, the index of its first neighbor
+        QVector<int> begin;
+
+        //! For each class, the number of neighbors
+        QVector<quint32> count;
+
+        //! For each class, the first number RandomStream::integer() draws again
+        QVector<quint64> limit;
+
+        //! For each neighbor, the offset from the site (zero for drains)
+        QVector<int> offset;
+
+        //! For each neighbor, true if it is a drain
+        QVector<bool> drain;
+
+        //! For each neighbor, the coupling constant (zero for drains)
+        QVector<double> coupling;
+    };
+
+    /**
+     * @brief copy the neighbor stencils of a Grid
+     */
+    void copyStencil(Grid &grid, Stencil &stencil);
+
+    /**
+     * @brief step the charges in a CarrierStore
+     */
+    void step(CarrierStore &charges, Grid &grid, const Stencil &stencil, bool outputIds);
+
+    /**
+     * @brief reference to world object
+     */
+    World &m_world;
+
+    /**
+     * @brief the neighbor stencils of World::electronGrid()
+     */
+    Stencil m_electronStencil;
+
+    /**
+     * @brief the neighbor stencils of World::holeGrid()
+     */
+    Stencil m_holeStencil;
+
+    /**
+     * @brief the first block of the random stream of every charge (see RandomStream::firstBlocks())
+     */
+    QVector<quint32> m_blocks;
+
+    /**
+     * @brief the accepted move of every charge, or one of the values in walkerengine.cpp
+     */
+    QVector<SiteID> m_targets;
+};
+
+}
+#endif
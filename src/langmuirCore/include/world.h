@@ -20,6 +20,8 @@
 
 #endif
 
+#include "parameters.h"
+
 namespace LangmuirCore
 {
 
@@ -36,12 +38,14 @@ class ElectronDrainAgent;
 class RecombinationAgent;
 class Simulation;
 class ChargeAgent;
+class CarrierStore;
 class SourceAgent;
 class HoleSourceAgent;
 class ExcitonSourceAgent;
 class ElectronSourceAgent;
 class CheckPointer;
 class OpenClHelper;
+class MpiHelper;
 struct SimulationParameters;
 struct ConfigurationInfo;
 
@@ -118,6 +122,11 @@ public:
      */
     OpenClHelper& opencl();
 
+    /**
+     * @brief get the MpiHelper, used for splitting the grid over MPI ranks
+     */
+    MpiHelper& mpi();
+
     /**
      * @brief get a list of all SourceAgents
      */
@@ -214,24 +223,24 @@ public:
     RecombinationAgent& recombinationAgent();
 
     /**
-     * @brief get a list of all ElectronAgents
+     * @brief get the CarrierStore holding all ElectronAgents
      */
-    QList<ChargeAgent*>& electrons();
+    CarrierStore& electrons();
 
     /**
-     * @brief get a list of all HoleAgents
+     * @brief get the CarrierStore holding all HoleAgents
      */
-    QList<ChargeAgent*>& holes();
+    CarrierStore& holes();
 
     /**
      * @brief get a list of all defect sites
      */
-    QList<int>& defectSiteIDs();
+    QList<SiteID>& defectSiteIDs();
 
     /**
      * @brief get a list of all trap sites
      */
-    QList<int>& trapSiteIDs();
+    QList<SiteID>& trapSiteIDs();
 
     /**
      * @brief get a list of all trap potentials
@@ -369,12 +378,12 @@ public:
     double percentElectronAgents();
 
     /**
-     * @brief check if the maximum number of electrons has been reached
+     * @brief check if the maximum number of electrons has been reached (on all MPI ranks)
      */
     bool atMaxElectrons();
 
     /**
-     * @brief check if the maximum number of holes has been reached
+     * @brief check if the maximum number of holes has been reached (on all MPI ranks)
      */
     bool atMaxHoles();
 
@@ -525,24 +534,29 @@ private:
     OpenClHelper *m_ocl;
 
     /**
-     * @brief list of electrons
+     * @brief pointer to MpiHelper, used for MPI runs
+     */
+    MpiHelper *m_mpi;
+
+    /**
+     * @brief pointer to electron CarrierStore
      */
-    QList<ChargeAgent*> m_electrons;
+    CarrierStore *m_electrons;
 
     /**
-     * @brief list of holes
+     * @brief pointer to hole CarrierStore
      */
-    QList<ChargeAgent*> m_holes;
+    CarrierStore *m_holes;
 
     /**
      * @brief list of defect sites
      */
-    QList<int> m_defectSiteIDs;
+    QList<SiteID> m_defectSiteIDs;
 
     /**
      * @brief list of trap sites
      */
-    QList<int> m_trapSiteIDs;
+    QList<SiteID> m_trapSiteIDs;
 
     /**
      * @brief list of trap potentials
@@ -620,7 +634,7 @@ private:
      * more need placing (according to SimulationParameters::seedCharges),
      * then they are placed randomly.
      */
-    void placeDefects(const QList<int>& siteIDs = QList<int>());
+    void placeDefects(const QList<SiteID>& siteIDs = QList<SiteID>());
 
     /**
      * @brief places electrons
@@ -630,7 +644,7 @@ private:
      * more need placing (according to SimulationParameters::seedCharges),
      * then they are placed randomly.
      */
-    void placeElectrons(const QList<int>& siteIDs = QList<int>());
+    void placeElectrons(const QList<SiteID>& siteIDs = QList<SiteID>());
 
     /**
      * @brief places holes
@@ -640,7 +654,7 @@ private:
      * more need placing (according to SimulationParameters::seedCharges),
      * then they are placed randomly.
      */
-    void placeHoles(const QList<int>& siteIDs = QList<int>());
+    void placeHoles(const QList<SiteID>& siteIDs = QList<SiteID>());
 
     /**
      * @brief create SourceAgents
@@ -12,6 +12,7 @@ namespace LangmuirCore
 {
 
 class ChargeAgent;
+class CarrierStore;
 class FluxAgent;
 class World;
 class Grid;
@@ -120,7 +121,7 @@ public:
       \param color The color of the points
       \param layer Which layer are we drawing? its a 2D image
       */
-    void drawSites(QList<int> &sites, QColor color, int layer);
+    void drawSites(QList<SiteID> &sites, QColor color, int layer);
 
     //! draw some sites
     /*!
@@ -130,7 +131,7 @@ public:
       \param color The color of the points
       \param layer Which layer are we drawing? its a 2D image
       */
-    void drawCharges(QList<ChargeAgent *> &charges, QColor color, int layer);
+    void drawCharges(CarrierStore &charges, QColor color, int layer);
 
     //! save the image to a file
     /*!
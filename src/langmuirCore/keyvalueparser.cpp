@@ -16,10 +16,17 @@ KeyValueParser::KeyValueParser(World &world, QObject *parent) :
     registerVariable("current.step", m_parameters.currentStep);
     registerVariable("iterations.real", m_parameters.iterationsReal);
     registerVariable("random.seed", m_parameters.randomSeed);
+    registerVariable("random.generator", m_parameters.randomGenerator);
+    registerVariable("random.counter", m_parameters.randomCounter);
+    registerVariable("parallel.step", m_parameters.parallelStep);
+    registerVariable("rejection.free", m_parameters.rejectionFree);
+    registerVariable("carriers.sort", m_parameters.carriersSort);
+    registerVariable("carriers.batched", m_parameters.carriersBatched);
 
     registerVariable("grid.z", m_parameters.gridZ);
     registerVariable("grid.y", m_parameters.gridY);
     registerVariable("grid.x", m_parameters.gridX);
+    registerVariable("grid.sparse", m_parameters.gridSparse);
     registerVariable("hopping.range", m_parameters.hoppingRange);
 
     registerVariable("output.is.on", m_parameters.outputIsOn);
@@ -54,12 +61,20 @@ KeyValueParser::KeyValueParser(World &world, QObject *parent) :
     registerVariable("trap.potential", m_parameters.trapPotential);
     registerVariable("gaussian.stdev", m_parameters.gaussianStdev);
     registerVariable("seed.percentage", m_parameters.seedPercentage);
+    registerVariable("trap.escape", m_parameters.trapEscape);
 
     registerVariable("voltage.right", m_parameters.voltageRight);
     registerVariable("voltage.left", m_parameters.voltageLeft);
     registerVariable("slope.z", m_parameters.slopeZ);
     registerVariable("coulomb.carriers", m_parameters.coulombCarriers);
     registerVariable("coulomb.gaussian.sigma", m_parameters.coulombGaussianSigma);
+    registerVariable("coulomb.incremental", m_parameters.coulombIncremental);
+    registerVariable("coulomb.lazy", m_parameters.coulombLazy);
+    registerVariable("coulomb.mesh", m_parameters.coulombMesh);
+    registerVariable("coulomb.mesh.cutoff", m_parameters.coulombMeshCutoff);
+    registerVariable("poisson.multigrid", m_parameters.poissonMultigrid);
+    registerVariable("poisson.update", m_parameters.poissonUpdate);
+    registerVariable("poisson.tolerance", m_parameters.poissonTolerance);
     registerVariable("defects.charge", m_parameters.defectsCharge);
     registerVariable("exciton.binding", m_parameters.excitonBinding);
     registerVariable("temperature.kelvin", m_parameters.temperatureKelvin);
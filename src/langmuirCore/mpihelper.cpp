@@ -0,0 +1,423 @@
+#include "mpihelper.h"
+#include "chargeagent.h"
+#include "carrierstore.h"
+#include "fluxagent.h"
+#include "parameters.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#ifdef LANGMUIR_MPI
+#include <mpi.h>
+#endif
+
+#include <QStringList>
+
+namespace LangmuirCore
+{
+
+// The counter-based stream that seeds the ranks, past the streams of the Agent::Types and the traps
+static const quint32 RankStream = Agent::SIZE + 1;
+
+#ifdef LANGMUIR_MPI
+/**
+ * @brief send data to one rank while receiving from another (either may be MPI_PROC_NULL)
+ */
+static QVector<qint64> sendReceive(const QVector<qint64> &data, int dest, int source)
+{
+    int sendCount = data.size();
+    int recvCount = 0;
+    MPI_Sendrecv(&sendCount, 1, MPI_INT, dest, 0,
+                 &recvCount, 1, MPI_INT, source, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+    QVector<qint64> result(recvCount);
+    MPI_Sendrecv(const_cast<qint64*>(data.constData()), sendCount, MPI_LONG_LONG, dest, 1,
+                 result.data(), recvCount, MPI_LONG_LONG, source, 1,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    return result;
+}
+#endif
+
+MpiHelper::MpiHelper(World &world, QObject *parent):
+    QObject(parent), m_world(world), m_rank(0), m_size(1), m_xBegin(0), m_xMiddle(0), m_xEnd(0),
+    m_remoteElectrons(0), m_remoteHoles(0)
+{
+#ifdef LANGMUIR_MPI
+    int initialized = 0;
+    MPI_Initialized(&initialized);
+    if (initialized)
+    {
+        MPI_Comm_rank(MPI_COMM_WORLD, &m_rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &m_size);
+    }
+#endif
+    m_xEnd = m_world.parameters().gridX;
+    m_xMiddle = m_xEnd / 2;
+}
+
+void MpiHelper::initialize(int *argc, char ***argv)
+{
+#ifdef LANGMUIR_MPI
+    MPI_Init(argc, argv);
+#else
+    Q_UNUSED(argc);
+    Q_UNUSED(argv);
+#endif
+}
+
+void MpiHelper::finalize()
+{
+#ifdef LANGMUIR_MPI
+    int finalized = 0;
+    MPI_Finalized(&finalized);
+    if (!finalized)
+    {
+        MPI_Finalize();
+    }
+#endif
+}
+
+void MpiHelper::checkParameters()
+{
+    SimulationParameters &par = m_world.parameters();
+
+    if (par.simulationType != "transistor")
+    {
+        qFatal("langmuir: MPI runs need simulation.type = transistor");
+    }
+
+    // Anything that needs every carrier (or every site) on one rank
+    QStringList unsupported;
+    if (par.coulombCarriers)        { unsupported << "coulomb.carriers";        }
+    if (par.defectsCharge != 0)     { unsupported << "defects.charge";          }
+    if (par.sourceCoulomb)          { unsupported << "source.coulomb";          }
+    if (par.poissonMultigrid)       { unsupported << "poisson.multigrid";       }
+    if (par.rejectionFree)          { unsupported << "rejection.free";          }
+    if (par.parallelStep)           { unsupported << "parallel.step";           }
+    if (par.trapEscape > 0)         { unsupported << "trap.escape";             }
+    if (par.carriersBatched)        { unsupported << "carriers.batched";        }
+    if (par.useOpenCL)              { unsupported << "use.opencl";              }
+    if (par.outputXyz > 0)          { unsupported << "output.xyz";              }
+    if (par.imageCarriers > 0)      { unsupported << "image.carriers";          }
+    if (par.outputCoulomb > 0)      { unsupported << "output.coulomb";          }
+    if (par.outputIdsOnDelete)      { unsupported << "output.ids.on.delete";    }
+    if (par.outputIdsOnEncounter)   { unsupported << "output.ids.on.encounter"; }
+
+    if (!unsupported.isEmpty())
+    {
+        qFatal("langmuir: %s can not be used with MPI", qPrintable(unsupported.join(", ")));
+    }
+}
+
+void MpiHelper::initializeSlab()
+{
+    if (!isOn())
+    {
+        return;
+    }
+
+    checkParameters();
+
+    SimulationParameters &par = m_world.parameters();
+
+    // Split x as evenly as possible
+    m_xBegin = int(qint64(par.gridX) * m_rank / m_size);
+    m_xEnd = int(qint64(par.gridX) * (m_rank + 1) / m_size);
+    m_xMiddle = (m_xBegin + m_xEnd) / 2;
+
+    // The halves moving in a phase have to be two hopping ranges apart
+    int range = par.hoppingRange;
+    if (m_xMiddle - m_xBegin < 2 * range || m_xEnd - m_xMiddle < 2 * range)
+    {
+        qFatal("langmuir: grid.x = %d is too small to split over %d ranks (slabs need %d sites, have %d)",
+               par.gridX, m_size, 4 * range, m_xEnd - m_xBegin);
+    }
+    qDebug("langmuir: MPI rank %d of %d owns x in [%d, %d)", m_rank, m_size, m_xBegin, m_xEnd);
+
+    // Every rank placed the same carriers; keep our own
+    dropCarriers(m_world.electrons());
+    dropCarriers(m_world.holes());
+
+    if (!isRoot())
+    {
+        // Different random numbers on every rank (the root keeps the state from the checkpoint).
+        // Only the root's state is saved, so the seed depends on the step too; a run resumed
+        // from a checkpoint would otherwise replay the numbers these ranks drew from the start.
+        RandomStream stream(par.randomSeed, quint32(par.currentStep), RankStream, quint32(m_rank));
+        m_world.randomNumberGenerator().seed(stream.next());
+
+        // The root holds the fluxes loaded from the checkpoint, the others count from zero
+        foreach (FluxAgent *flux, m_world.fluxes())
+        {
+            flux->setAttempts(0);
+            flux->setSuccesses(0);
+        }
+
+        // Only the root writes output
+        par.outputIsOn = false;
+    }
+
+    countCarriers();
+}
+
+void MpiHelper::dropCarriers(CarrierStore &charges)
+{
+    bool dropped = false;
+    for (int i = 0; i < charges.size(); i++)
+    {
+        if (!ownsX(charges.activeX()[i]))
+        {
+            ChargeAgent *charge = charges.at(i);
+            charge->getGrid().unregisterAgent(charge);
+            charge->setRemoved(true);
+            dropped = true;
+        }
+    }
+    if (dropped)
+    {
+        charges.compact();
+    }
+}
+
+int MpiHelper::typeIndex(const CarrierStore &charges)
+{
+    return (charges.type() == Agent::Electron) ? 0 : 1;
+}
+
+void MpiHelper::beginStep()
+{
+    m_done[0].fill(0);
+    m_done[1].fill(0);
+}
+
+bool MpiHelper::isActive(const CarrierStore &charges, int index, int phase) const
+{
+    int x = charges.activeX()[index];
+    if (phase == 0)
+    {
+        return x < m_xMiddle;
+    }
+
+    const QVector<char> &done = m_done[typeIndex(charges)];
+    int slot = charges.slot(index);
+    return x >= m_xMiddle && !(slot < done.size() && done[slot]);
+}
+
+void MpiHelper::markDone(const CarrierStore &charges, int index)
+{
+    QVector<char> &done = m_done[typeIndex(charges)];
+    if (done.size() < charges.capacity())
+    {
+        done.resize(charges.capacity());
+    }
+    done[charges.slot(index)] = 1;
+}
+
+void MpiHelper::exchangeGhosts(int phase)
+{
+#ifdef LANGMUIR_MPI
+    clearGhosts();
+
+    int left = (m_rank > 0) ? m_rank - 1 : MPI_PROC_NULL;
+    int right = (m_rank < m_size - 1) ? m_rank + 1 : MPI_PROC_NULL;
+    int range = m_world.parameters().hoppingRange;
+
+    // Left halves move: the right neighbor needs our right edge, we need the left neighbor's
+    int begin = m_xEnd - range;
+    int end = m_xEnd;
+    int dest = right;
+    int source = left;
+
+    // Right halves move: the left neighbor needs our left edge, we need the right neighbor's
+    if (phase != 0)
+    {
+        begin = m_xBegin;
+        end = m_xBegin + range;
+        dest = left;
+        source = right;
+    }
+
+    // Sites are sent as 2 * site + type index
+    CarrierStore *stores[2] = { &m_world.electrons(), &m_world.holes() };
+    QVector<qint64> edge;
+    for (int j = 0; j < 2; j++)
+    {
+        CarrierStore &charges = *stores[j];
+        for (int i = 0; i < charges.size(); i++)
+        {
+            int x = charges.activeX()[i];
+            if (x >= begin && x < end)
+            {
+                edge.push_back(qint64(charges.site(charges.slot(i))) * 2 + j);
+            }
+        }
+    }
+
+    QVector<qint64> ghosts = sendReceive(edge, dest, source);
+
+    Grid *grids[2] = { &m_world.electronGrid(), &m_world.holeGrid() };
+    for (int k = 0; k < ghosts.size(); k++)
+    {
+        int j = int(ghosts[k] % 2);
+        SiteID site = SiteID(ghosts[k] / 2);
+        grids[j]->registerDefect(site);
+        m_ghosts[j].push_back(site);
+    }
+#else
+    Q_UNUSED(phase);
+#endif
+}
+
+void MpiHelper::clearGhosts()
+{
+    Grid *grids[2] = { &m_world.electronGrid(), &m_world.holeGrid() };
+    for (int j = 0; j < 2; j++)
+    {
+        for (int k = 0; k < m_ghosts[j].size(); k++)
+        {
+            grids[j]->unregisterDefect(m_ghosts[j][k]);
+        }
+        m_ghosts[j].clear();
+    }
+}
+
+void MpiHelper::migrateCarriers()
+{
+#ifdef LANGMUIR_MPI
+    int left = (m_rank > 0) ? m_rank - 1 : MPI_PROC_NULL;
+    int right = (m_rank < m_size - 1) ? m_rank + 1 : MPI_PROC_NULL;
+
+    // Carriers are sent as (2 * site + type index, lifetime, pathlength)
+    CarrierStore *stores[2] = { &m_world.electrons(), &m_world.holes() };
+    QVector<qint64> toLeft;
+    QVector<qint64> toRight;
+    for (int j = 0; j < 2; j++)
+    {
+        CarrierStore &charges = *stores[j];
+        bool migrated = false;
+        for (int i = 0; i < charges.size(); i++)
+        {
+            int x = charges.activeX()[i];
+            if (ownsX(x))
+            {
+                continue;
+            }
+
+            // A hop is shorter than half a slab, so it can only end up with a neighbor
+            QVector<qint64> &out = (x < m_xBegin) ? toLeft : toRight;
+            int slot = charges.slot(i);
+            out.push_back(qint64(charges.site(slot)) * 2 + j);
+            out.push_back(charges.lifetime(slot));
+            out.push_back(charges.pathlength(slot));
+
+            ChargeAgent *charge = charges.at(i);
+            charge->getGrid().unregisterAgent(charge);
+            charge->setRemoved(true);
+            migrated = true;
+        }
+        if (migrated)
+        {
+            charges.compact();
+        }
+    }
+
+    QVector<qint64> fromRight = sendReceive(toLeft, left, right);
+    QVector<qint64> fromLeft = sendReceive(toRight, right, left);
+
+    QVector<qint64> *incoming[2] = { &fromRight, &fromLeft };
+    for (int n = 0; n < 2; n++)
+    {
+        const QVector<qint64> &in = *incoming[n];
+        for (int k = 0; k + 2 < in.size(); k += 3)
+        {
+            CarrierStore &charges = *stores[in[k] % 2];
+            ChargeAgent *charge = charges.create(SiteID(in[k] / 2));
+            charges.lifetime(charge->slot()) = int(in[k + 1]);
+            charges.pathlength(charge->slot()) = int(in[k + 2]);
+
+            // It already moved this step on the other rank
+            markDone(charges, charges.size() - 1);
+        }
+    }
+#endif
+}
+
+void MpiHelper::countCarriers()
+{
+#ifdef LANGMUIR_MPI
+    int local[2] = { m_world.numElectronAgents(), m_world.numHoleAgents() };
+    int total[2] = { 0, 0 };
+    MPI_Allreduce(local, total, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    m_remoteElectrons = total[0] - local[0];
+    m_remoteHoles = total[1] - local[1];
+#endif
+}
+
+void MpiHelper::synchronize()
+{
+#ifdef LANGMUIR_MPI
+    if (!isOn())
+    {
+        return;
+    }
+
+    // Sum the flux counters on the root
+    QList<FluxAgent*> &fluxes = m_world.fluxes();
+    QVector<unsigned long long> local(2 * fluxes.size());
+    QVector<unsigned long long> total(2 * fluxes.size());
+    for (int i = 0; i < fluxes.size(); i++)
+    {
+        local[2 * i] = fluxes[i]->attempts();
+        local[2 * i + 1] = fluxes[i]->successes();
+    }
+    MPI_Reduce(local.data(), total.data(), local.size(), MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    for (int i = 0; i < fluxes.size(); i++)
+    {
+        fluxes[i]->setAttempts(isRoot() ? total[2 * i] : 0);
+        fluxes[i]->setSuccesses(isRoot() ? total[2 * i + 1] : 0);
+    }
+
+    countCarriers();
+
+    // Gather the carrier sites of the other ranks on the root, as 2 * site + type index
+    QVector<qint64> sites;
+    if (!isRoot())
+    {
+        CarrierStore *stores[2] = { &m_world.electrons(), &m_world.holes() };
+        for (int j = 0; j < 2; j++)
+        {
+            for (int i = 0; i < stores[j]->size(); i++)
+            {
+                sites.push_back(qint64(stores[j]->site(stores[j]->slot(i))) * 2 + j);
+            }
+        }
+    }
+
+    int count = sites.size();
+    QVector<int> counts(isRoot() ? m_size : 0);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    QVector<int> offsets(counts.size());
+    int size = 0;
+    for (int i = 0; i < counts.size(); i++)
+    {
+        offsets[i] = size;
+        size += counts[i];
+    }
+
+    QVector<qint64> all(size);
+    MPI_Gatherv(sites.data(), count, MPI_LONG_LONG,
+                all.data(), counts.data(), offsets.data(), MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    m_remoteElectronSites.clear();
+    m_remoteHoleSites.clear();
+    for (int k = 0; k < all.size(); k++)
+    {
+        QList<SiteID> &list = (all[k] % 2 == 0) ? m_remoteElectronSites : m_remoteHoleSites;
+        list.push_back(SiteID(all[k] / 2));
+    }
+#endif
+}
+
+}
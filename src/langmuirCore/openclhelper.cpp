@@ -1,6 +1,7 @@
 #include <QTextStream>
 #include "openclhelper.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "parameters.h"
 #include "cubicgrid.h"
 #include "potential.h"
@@ -10,13 +11,14 @@ namespace LangmuirCore
 {
 
 OpenClHelper::OpenClHelper(World &world, QObject *parent):
-    QObject(parent), m_world(world)
+    QObject(parent), m_world(world), m_initialized(false)
 {
 }
 
 void OpenClHelper::initializeOpenCL(int gpuID)
 {
     qDebug("langmuir: initializing OpenCL");
+    m_initialized = true;
 
     //can't use openCL yet
     m_world.parameters().okCL = false;
@@ -191,10 +193,11 @@ bool OpenClHelper::toggleOpenCL(bool on)
 {
     if(on)
     {
-        if(!(m_world.parameters().okCL))
+        // The buffers cover the whole volume, which a sparse grid does not store
+        if(m_world.parameters().gridSparse)
         {
             m_world.parameters().useOpenCL = false;
-            qDebug("langmuir: can not use openCL");
+            qDebug("langmuir: grid.sparse is on");
             qDebug("langmuir: openCL is off");
             return false;
         }
@@ -205,6 +208,17 @@ bool OpenClHelper::toggleOpenCL(bool on)
             qDebug("langmuir: openCL is off");
             return false;
         }
+        if(!m_initialized)
+        {
+            initializeOpenCL(m_world.parameters().openclDeviceID);
+        }
+        if(!(m_world.parameters().okCL))
+        {
+            m_world.parameters().useOpenCL = false;
+            qDebug("langmuir: can not use openCL");
+            qDebug("langmuir: openCL is off");
+            return false;
+        }
         m_world.parameters().useOpenCL = true;
         qDebug("langmuir: openCL is on");
         return true;
@@ -225,22 +239,26 @@ void OpenClHelper::launchCoulombKernel1()
         int totalCharges = 0;
 
         //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        CarrierStore &electrons = m_world.electrons();
+        for(int i = 0; i < electrons.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
+            int slot = electrons.slot(i);
+            m_sHost[i+totalCharges] = electrons.site(slot);
+            m_qHost[i+totalCharges] = electrons.charge(slot);
+            electrons.at(i)->setOpenCLID(i);
         }
-        totalCharges += m_world.electrons().size();
+        totalCharges += electrons.size();
 
         //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        CarrierStore &holes = m_world.holes();
+        for(int i = 0; i < holes.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            int slot = holes.slot(i);
+            m_sHost[i+totalCharges] = holes.site(slot);
+            m_qHost[i+totalCharges] = holes.charge(slot);
+            holes.at(i)->setOpenCLID(i + totalCharges);
         }
-        totalCharges += m_world.holes().size();
+        totalCharges += holes.size();
 
         //copy defects
         if(m_world.parameters().defectsCharge != 0)
@@ -301,22 +319,26 @@ void OpenClHelper::launchGaussKernel1()
         int totalCharges = 0;
 
         //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        CarrierStore &electrons = m_world.electrons();
+        for(int i = 0; i < electrons.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
+            int slot = electrons.slot(i);
+            m_sHost[i+totalCharges] = electrons.site(slot);
+            m_qHost[i+totalCharges] = electrons.charge(slot);
+            electrons.at(i)->setOpenCLID(i);
         }
-        totalCharges += m_world.electrons().size();
+        totalCharges += electrons.size();
 
         //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        CarrierStore &holes = m_world.holes();
+        for(int i = 0; i < holes.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            int slot = holes.slot(i);
+            m_sHost[i+totalCharges] = holes.site(slot);
+            m_qHost[i+totalCharges] = holes.charge(slot);
+            holes.at(i)->setOpenCLID(i + totalCharges);
         }
-        totalCharges += m_world.holes().size();
+        totalCharges += holes.size();
 
         //copy defects
         if(m_world.parameters().defectsCharge != 0)
@@ -377,51 +399,48 @@ void OpenClHelper::launchCoulombKernel2()
         int totalCharges = 0;
 
         //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        CarrierStore &electrons = m_world.electrons();
+        for(int i = 0; i < electrons.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
+            int slot = electrons.slot(i);
+            m_sHost[i+totalCharges] = electrons.site(slot);
+            m_qHost[i+totalCharges] = electrons.charge(slot);
+            electrons.at(i)->setOpenCLID(i);
         }
-        totalCharges += m_world.electrons().size();
+        totalCharges += electrons.size();
 
         //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        CarrierStore &holes = m_world.holes();
+        for(int i = 0; i < holes.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            int slot = holes.slot(i);
+            m_sHost[i+totalCharges] = holes.site(slot);
+            m_qHost[i+totalCharges] = holes.charge(slot);
+            holes.at(i)->setOpenCLID(i + totalCharges);
         }
-        totalCharges += m_world.holes().size();
+        totalCharges += holes.size();
 
-        //copy defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            for(int i = 0; i < m_world.defectSiteIDs().size(); i++)
-            {
-                m_sHost[i+totalCharges] = m_world.defectSiteIDs()[i];
-                m_qHost[i+totalCharges] = m_world.parameters().defectsCharge;
-            }
-            totalCharges += m_world.defectSiteIDs().size();
-        }
+        //charged defects are precalculated (see Potential::defectPotential)
         m_offset = totalCharges;
         m_coulomb2K.setArg(3, totalCharges);
 
         //copy electrons (future)
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        for(int i = 0; i < electrons.size(); i++)
         {
-            m_sHost[i + totalCharges] = m_world.electrons()[i]->getFutureSite();
-            m_qHost[i + totalCharges] = m_world.electrons()[i]->charge();
+            int slot = electrons.slot(i);
+            m_sHost[i + totalCharges] = electrons.futureSite(slot);
+            m_qHost[i + totalCharges] = electrons.charge(slot);
         }
-        totalCharges += m_world.electrons().size();
+        totalCharges += electrons.size();
 
         //copy holes (future)
-        for(int i = 0; i < m_world.holes().size(); i++)
+        for(int i = 0; i < holes.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getFutureSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
+            int slot = holes.slot(i);
+            m_sHost[i+totalCharges] = holes.futureSite(slot);
+            m_qHost[i+totalCharges] = holes.charge(slot);
         }
-        totalCharges += m_world.holes().size();
+        totalCharges += holes.size();
 
         //calculate memory sizes
         size_t sSize = totalCharges*sizeof(int);
@@ -464,51 +483,48 @@ void OpenClHelper::launchGaussKernel2()
         int totalCharges = 0;
 
         //copy electrons
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        CarrierStore &electrons = m_world.electrons();
+        for(int i = 0; i < electrons.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.electrons()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.electrons()[i]->charge();
-            m_world.electrons()[i]->setOpenCLID(i);
+            int slot = electrons.slot(i);
+            m_sHost[i+totalCharges] = electrons.site(slot);
+            m_qHost[i+totalCharges] = electrons.charge(slot);
+            electrons.at(i)->setOpenCLID(i);
         }
-        totalCharges += m_world.electrons().size();
+        totalCharges += electrons.size();
 
         //copy holes
-        for(int i = 0; i < m_world.holes().size(); i++)
+        CarrierStore &holes = m_world.holes();
+        for(int i = 0; i < holes.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getCurrentSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
-            m_world.holes()[i]->setOpenCLID(i + totalCharges);
+            int slot = holes.slot(i);
+            m_sHost[i+totalCharges] = holes.site(slot);
+            m_qHost[i+totalCharges] = holes.charge(slot);
+            holes.at(i)->setOpenCLID(i + totalCharges);
         }
-        totalCharges += m_world.holes().size();
+        totalCharges += holes.size();
 
-        //copy defects
-        if(m_world.parameters().defectsCharge != 0)
-        {
-            for(int i = 0; i < m_world.defectSiteIDs().size(); i++)
-            {
-                m_sHost[i+totalCharges] = m_world.defectSiteIDs()[i];
-                m_qHost[i+totalCharges] = m_world.parameters().defectsCharge;
-            }
-            totalCharges += m_world.defectSiteIDs().size();
-        }
+        //charged defects are precalculated (see Potential::defectPotential)
         m_offset = totalCharges;
         m_guass2K.setArg(3, totalCharges);
 
         //copy electrons (future)
-        for(int i = 0; i < m_world.electrons().size(); i++)
+        for(int i = 0; i < electrons.size(); i++)
         {
-            m_sHost[i + totalCharges] = m_world.electrons()[i]->getFutureSite();
-            m_qHost[i + totalCharges] = m_world.electrons()[i]->charge();
+            int slot = electrons.slot(i);
+            m_sHost[i + totalCharges] = electrons.futureSite(slot);
+            m_qHost[i + totalCharges] = electrons.charge(slot);
         }
-        totalCharges += m_world.electrons().size();
+        totalCharges += electrons.size();
 
         //copy holes (future)
-        for(int i = 0; i < m_world.holes().size(); i++)
+        for(int i = 0; i < holes.size(); i++)
         {
-            m_sHost[i+totalCharges] = m_world.holes()[i]->getFutureSite();
-            m_qHost[i+totalCharges] = m_world.holes()[i]->charge();
+            int slot = holes.slot(i);
+            m_sHost[i+totalCharges] = holes.futureSite(slot);
+            m_qHost[i+totalCharges] = holes.charge(slot);
         }
-        totalCharges += m_world.holes().size();
+        totalCharges += holes.size();
 
         //calculate memory sizes
         size_t sSize = totalCharges*sizeof(int);
@@ -546,11 +562,11 @@ void OpenClHelper::launchGaussKernel2()
 void OpenClHelper::compareHostAndDeviceForAllCarriers()
 {
 #ifdef LANGMUIR_OPEN_CL
-    foreach(ChargeAgent *charge, m_world.electrons())
+    foreach(ChargeAgent *charge, m_world.electrons().agents())
     {
         charge->compareCoulomb();
     }
-    foreach(ChargeAgent *charge, m_world.holes())
+    foreach(ChargeAgent *charge, m_world.holes().agents())
     {
         charge->compareCoulomb();
     }
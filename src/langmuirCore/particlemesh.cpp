@@ -0,0 +1,407 @@
+#include "particlemesh.h"
+#include "carrierstore.h"
+#include <cmath>
+#include <algorithm>
+
+#ifdef LANGMUIR_USING_QT5
+#include <QtConcurrent/QtConcurrent>
+#else
+#include <QtCore>
+#endif
+
+namespace LangmuirCore
+{
+
+// Terms of the Green's function smaller than exp(-GreensFunctionDecay) are dropped
+static const double GreensFunctionDecay = 40.0;
+
+// Lattice images (aliases) of each wavevector summed along x, y and z
+static const int GreensFunctionAliases = 2;
+
+// Step of the integral in wireGreensFunction()
+static const double WireIntegrationStep = 0.02;
+
+ParticleMesh::ParticleMesh() : m_boundary(Periodic), m_alpha(0), m_prefactor(0), m_on(false)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        m_size[i] = 0;
+        m_mesh[i] = 0;
+    }
+}
+
+void ParticleMesh::initialize(int xSize, int ySize, int zSize, Boundary boundary, double alpha,
+                              double prefactor)
+{
+    m_size[0] = xSize;
+    m_size[1] = ySize;
+    m_size[2] = zSize;
+    m_boundary = boundary;
+    m_alpha = alpha;
+    m_prefactor = prefactor;
+
+    m_mesh[0] = xSize;
+    m_mesh[1] = ySize;
+    m_mesh[2] = zSize;
+    if (m_boundary == Slab && xSize > 1)
+    {
+        // Offsets along x span [-(xSize - 1), xSize - 1], which must not wrap around
+        m_mesh[0] = 2 * xSize;
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        int n = m_mesh[axis];
+        m_twiddles[axis].resize(n);
+        for (int k = 0; k < n; k++)
+        {
+            double angle = -2.0 * M_PI * k / n;
+            m_twiddles[axis][k] = Complex(cos(angle), sin(angle));
+        }
+    }
+
+    m_data.fill(Complex(0, 0), m_mesh[0] * m_mesh[1] * m_mesh[2]);
+    initializeGreensFunction();
+    m_on = true;
+
+    qDebug("langmuir: particle mesh is %d x %d x %d, alpha = %f",
+           m_mesh[0], m_mesh[1], m_mesh[2], m_alpha);
+}
+
+double ParticleMesh::selfPotential() const
+{
+    return m_prefactor * 2.0 * m_alpha / sqrt(M_PI);
+}
+
+void ParticleMesh::update(const CarrierStore &electrons, const CarrierStore &holes)
+{
+    if (!m_on)
+    {
+        return;
+    }
+
+    // Electron density in the real part, hole density in the imaginary part
+    m_data.fill(Complex(0, 0));
+    int stride = m_mesh[0] * m_mesh[1];
+    for (int i = 0; i < electrons.size(); i++)
+    {
+        int s = electrons.activeX()[i] + m_mesh[0] * electrons.activeY()[i] +
+                stride * electrons.activeZ()[i];
+        m_data[s] += Complex(electrons.unitCharge(), 0);
+    }
+    for (int i = 0; i < holes.size(); i++)
+    {
+        int s = holes.activeX()[i] + m_mesh[0] * holes.activeY()[i] +
+                stride * holes.activeZ()[i];
+        m_data[s] += Complex(0, holes.unitCharge());
+    }
+
+    transform(0, false);
+    transform(1, false);
+    transform(2, false);
+
+    // The Green's function is real, so the two densities stay in separate parts
+    for (int i = 0; i < m_data.size(); i++)
+    {
+        m_data[i] *= m_green[i];
+    }
+
+    transform(0, true);
+    transform(1, true);
+    transform(2, true);
+
+    // Pack the rows of the padded mesh like the grid sites; every row moves to a lower index
+    if (m_mesh[0] != m_size[0])
+    {
+        int rows = m_mesh[1] * m_mesh[2];
+        for (int r = 0; r < rows; r++)
+        {
+            for (int x = 0; x < m_size[0]; x++)
+            {
+                m_data[x + m_size[0] * r] = m_data[x + m_mesh[0] * r];
+            }
+        }
+    }
+}
+
+void ParticleMesh::transform(int axis, bool inverse)
+{
+    if (m_mesh[axis] <= 1)
+    {
+        return;
+    }
+
+    int lines = m_data.size() / m_mesh[axis];
+    int chunks = qMin(lines, qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < chunks; i++)
+    {
+        int begin = (i * lines) / chunks;
+        int end = ((i + 1) * lines) / chunks;
+        sync.addFuture(QtConcurrent::run(this, &ParticleMesh::transformLines, axis, inverse, begin, end));
+    }
+    sync.waitForFinished();
+}
+
+void ParticleMesh::transformLines(int axis, bool inverse, int begin, int end)
+{
+    int n = m_mesh[axis];
+    QVector<Complex> line(n);
+    QVector<Complex> scratch(n);
+
+    // Distance between neighboring points of a line, and between the starts of
+    // neighboring lines (lines along y start at x + nx * ny * z)
+    int stride = 1;
+    for (int i = 0; i < axis; i++)
+    {
+        stride *= m_mesh[i];
+    }
+
+    for (int l = begin; l < end; l++)
+    {
+        int offset = (l % stride) + (l / stride) * stride * n;
+
+        for (int i = 0; i < n; i++)
+        {
+            line[i] = m_data[offset + i * stride];
+        }
+        transformLine(line.data(), n, m_twiddles[axis].constData(), inverse, scratch.data());
+        for (int i = 0; i < n; i++)
+        {
+            m_data[offset + i * stride] = line[i];
+        }
+    }
+}
+
+void ParticleMesh::transformLine(Complex *data, int n, const Complex *twiddles, bool inverse,
+                                 Complex *scratch)
+{
+    if ((n & (n - 1)) != 0)
+    {
+        // Not a power of two; direct transform
+        for (int k = 0; k < n; k++)
+        {
+            Complex sum(0, 0);
+            for (int j = 0; j < n; j++)
+            {
+                Complex w = twiddles[(qint64(j) * k) % n];
+                sum += data[j] * (inverse ? std::conj(w) : w);
+            }
+            scratch[k] = sum;
+        }
+        for (int k = 0; k < n; k++)
+        {
+            data[k] = scratch[k];
+        }
+        return;
+    }
+
+    // Iterative radix-2; bit reversal first
+    for (int i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+        {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j)
+        {
+            std::swap(data[i], data[j]);
+        }
+    }
+
+    for (int length = 2; length <= n; length *= 2)
+    {
+        int step = n / length;
+        for (int i = 0; i < n; i += length)
+        {
+            for (int j = 0; j < length / 2; j++)
+            {
+                Complex w = twiddles[j * step];
+                if (inverse)
+                {
+                    w = std::conj(w);
+                }
+                Complex u = data[i + j];
+                Complex v = data[i + j + length / 2] * w;
+                data[i + j] = u + v;
+                data[i + j + length / 2] = u - v;
+            }
+        }
+    }
+}
+
+double ParticleMesh::slabGreensFunction(double ky, double kz, int dx) const
+{
+    double x = abs(dx);
+    double sum = 0;
+
+    for (int ny = -GreensFunctionAliases; ny <= GreensFunctionAliases; ny++)
+    {
+        for (int nz = -GreensFunctionAliases; nz <= GreensFunctionAliases; nz++)
+        {
+            double qy = ky + 2.0 * M_PI * ny;
+            double qz = kz + 2.0 * M_PI * nz;
+            double q2 = qy * qy + qz * qz;
+
+            if (q2 == 0)
+            {
+                // The uniform sheet; defined up to a constant
+                sum -= 2.0 * M_PI * (x * erf(m_alpha * x) +
+                                     exp(-m_alpha * m_alpha * x * x) / (m_alpha * sqrt(M_PI)));
+                continue;
+            }
+            if (q2 > 4.0 * m_alpha * m_alpha * GreensFunctionDecay)
+            {
+                continue;
+            }
+
+            double q = sqrt(q2);
+            double a = q / (2.0 * m_alpha);
+
+            // exp(q x) erfc(a + alpha x) is negligible (and overflows) when its argument is large
+            double term = exp(-q * x) * erfc(a - m_alpha * x);
+            if (a + m_alpha * x < 26.0)
+            {
+                term += exp(q * x) * erfc(a + m_alpha * x);
+            }
+            sum += M_PI / q * term;
+        }
+    }
+    return sum;
+}
+
+double ParticleMesh::wireGreensFunction(double ky, int dx) const
+{
+    // With t = alpha exp(-s), the transform is 2 int_0^inf exp(-(alpha x)^2 e^-2s - (q / 2 alpha)^2 e^2s) ds
+    double a2 = m_alpha * m_alpha * double(dx) * dx;
+    double sum = 0;
+
+    for (int ny = -GreensFunctionAliases; ny <= GreensFunctionAliases; ny++)
+    {
+        double qy = ky + 2.0 * M_PI * ny;
+        double b2 = qy * qy / (4.0 * m_alpha * m_alpha);
+
+        // The uniform line; the divergent constant is dropped, so that it is zero at x = 0
+        double end = 0;
+        if (b2 == 0)
+        {
+            if (a2 == 0)
+            {
+                continue;
+            }
+            end = 0.5 * log(a2 * 1e17);
+        }
+        else if (b2 > GreensFunctionDecay)
+        {
+            continue;
+        }
+        else
+        {
+            end = 0.5 * log(GreensFunctionDecay / b2);
+        }
+
+        // Simpson's rule; the integrand is smooth in s
+        int n = 2 * qMax(1, int(ceil(end / (2.0 * WireIntegrationStep))));
+        double h = end / n;
+        double integral = 0;
+        for (int i = 0; i <= n; i++)
+        {
+            double s = i * h;
+            double f = exp(-a2 * exp(-2.0 * s) - b2 * exp(2.0 * s));
+            if (b2 == 0)
+            {
+                f -= 1.0;
+            }
+            integral += ((i == 0 || i == n) ? 1.0 : ((i % 2) ? 4.0 : 2.0)) * f;
+        }
+        sum += 2.0 * integral * h / 3.0;
+    }
+    return sum;
+}
+
+void ParticleMesh::initializeGreensFunction()
+{
+    int mx = m_mesh[0];
+    int my = m_mesh[1];
+    int mz = m_mesh[2];
+    m_green.fill(0, mx * my * mz);
+
+    // The inverse transforms are not normalized
+    double scale = m_prefactor / (double(mx) * my * mz);
+
+    if (m_boundary == Slab)
+    {
+        // Mixed representation along x, then a cosine transform of the offsets
+        QVector<double> slab(m_size[0]);
+        QVector<double> cosines(mx);
+        for (int i = 0; i < mx; i++)
+        {
+            cosines[i] = cos(2.0 * M_PI * i / mx);
+        }
+        for (int iz = 0; iz < mz; iz++)
+        {
+            double kz = 2.0 * M_PI * ((iz < (mz + 1) / 2) ? iz : iz - mz) / mz;
+            for (int iy = 0; iy < my; iy++)
+            {
+                double ky = 2.0 * M_PI * ((iy < (my + 1) / 2) ? iy : iy - my) / my;
+                for (int dx = 0; dx < m_size[0]; dx++)
+                {
+                    // A single layer is open along z as well
+                    slab[dx] = (m_size[2] > 1) ? slabGreensFunction(ky, kz, dx) : wireGreensFunction(ky, dx);
+                }
+                for (int ix = 0; ix < mx; ix++)
+                {
+                    double value = slab[0];
+                    for (int dx = 1; dx < m_size[0]; dx++)
+                    {
+                        value += 2.0 * slab[dx] * cosines[(ix * dx) % mx];
+                    }
+                    m_green[ix + mx * (iy + my * iz)] = scale * value;
+                }
+            }
+        }
+        return;
+    }
+
+    for (int iy = 0; iy < my; iy++)
+    {
+        // Wavevectors in [-pi, pi)
+        double ky = 2.0 * M_PI * ((iy < (my + 1) / 2) ? iy : iy - my) / my;
+        for (int ix = 0; ix < mx; ix++)
+        {
+            double kx = 2.0 * M_PI * ((ix < (mx + 1) / 2) ? ix : ix - mx) / mx;
+
+            for (int iz = 0; iz < mz; iz++)
+            {
+                double kz = 2.0 * M_PI * ((iz < (mz + 1) / 2) ? iz : iz - mz) / mz;
+                double value = 0;
+                for (int nx = -GreensFunctionAliases; nx <= GreensFunctionAliases; nx++)
+                {
+                    for (int ny = -GreensFunctionAliases; ny <= GreensFunctionAliases; ny++)
+                    {
+                        for (int nz = -GreensFunctionAliases; nz <= GreensFunctionAliases; nz++)
+                        {
+                            double qx = kx + 2.0 * M_PI * nx;
+                            double qy = ky + 2.0 * M_PI * ny;
+                            double qz = kz + 2.0 * M_PI * nz;
+                            double q2 = qx * qx + qy * qy + qz * qz;
+
+                            // The k = 0 term is cancelled by the neutralizing background
+                            if (q2 == 0 || q2 > 4.0 * m_alpha * m_alpha * GreensFunctionDecay)
+                            {
+                                continue;
+                            }
+                            value += 4.0 * M_PI / q2 * exp(-q2 / (4.0 * m_alpha * m_alpha));
+                        }
+                    }
+                }
+                m_green[ix + mx * (iy + my * iz)] = scale * value;
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,385 @@
+#include "poissonsolver.h"
+#include <cmath>
+
+#ifdef LANGMUIR_USING_QT5
+#include <QtConcurrent/QtConcurrent>
+#else
+#include <QtCore>
+#endif
+
+namespace LangmuirCore
+{
+
+// Levels smaller than this are smoothed in one thread
+static const int SerialCells = 4096;
+
+// Gauss-Seidel sweeps on the coarsest level
+static const int CoarseSweeps = 32;
+
+// Give up after this many conjugate gradient iterations
+static const int MaxIterations = 200;
+
+PoissonSolver::PoissonSolver() : m_sweeps(2)
+{
+    for (int a = 0; a < 3; a++)
+    {
+        m_low[a] = Insulating;
+        m_high[a] = Insulating;
+    }
+}
+
+void PoissonSolver::initialize(int xSize, int ySize, int zSize,
+                               const Boundary low[3], const Boundary high[3])
+{
+    for (int a = 0; a < 3; a++)
+    {
+        if ((low[a] == Periodic) != (high[a] == Periodic))
+        {
+            qFatal("langmuir: Poisson solver needs both faces of a periodic direction periodic");
+        }
+        m_low[a] = low[a];
+        m_high[a] = high[a];
+    }
+
+    m_levels.clear();
+
+    Level level;
+    level.n[0] = xSize;
+    level.n[1] = ySize;
+    level.n[2] = zSize;
+    for (int a = 0; a < 3; a++)
+    {
+        level.ih2[a] = 1.0;
+    }
+
+    while (true)
+    {
+        int cells = level.n[0] * level.n[1] * level.n[2];
+        level.phi.fill(0, cells);
+        level.b.fill(0, cells);
+        level.r.fill(0, cells);
+        m_levels.push_back(level);
+
+        bool coarsened = false;
+        for (int a = 0; a < 3; a++)
+        {
+            if (level.n[a] >= 4)
+            {
+                // Halving with constant interpolation makes the Galerkin operator use h^2 * 2
+                level.n[a] = (level.n[a] + 1) / 2;
+                level.ih2[a] /= 2.0;
+                coarsened = true;
+            }
+        }
+        if (!coarsened)
+        {
+            break;
+        }
+    }
+
+    qDebug("langmuir: Poisson solver has %d levels", m_levels.size());
+}
+
+void PoissonSolver::apply(const Level &level, const QVector<double> &in, QVector<double> &out) const
+{
+    const int *n = level.n;
+    const double *ih2 = level.ih2;
+    int stride[3] = { 1, n[0], n[0] * n[1] };
+
+    for (int k = 0; k < n[2]; k++)
+    {
+        for (int j = 0; j < n[1]; j++)
+        {
+            for (int i = 0; i < n[0]; i++)
+            {
+                int s = i + n[0] * (j + n[1] * k);
+                int c[3] = { i, j, k };
+                double diag = 0;
+                double sum = 0;
+                for (int a = 0; a < 3; a++)
+                {
+                    if (c[a] > 0)
+                    {
+                        diag += ih2[a];
+                        sum += ih2[a] * in[s - stride[a]];
+                    }
+                    else if (m_low[a] == Electrode)
+                    {
+                        diag += 2.0 * ih2[a];
+                    }
+                    else if (m_low[a] == Periodic && n[a] > 1)
+                    {
+                        diag += ih2[a];
+                        sum += ih2[a] * in[s + (n[a] - 1) * stride[a]];
+                    }
+                    if (c[a] < n[a] - 1)
+                    {
+                        diag += ih2[a];
+                        sum += ih2[a] * in[s + stride[a]];
+                    }
+                    else if (m_high[a] == Electrode)
+                    {
+                        diag += 2.0 * ih2[a];
+                    }
+                    else if (m_high[a] == Periodic && n[a] > 1)
+                    {
+                        diag += ih2[a];
+                        sum += ih2[a] * in[s - (n[a] - 1) * stride[a]];
+                    }
+                }
+                out[s] = diag * in[s] - sum;
+            }
+        }
+    }
+}
+
+bool PoissonSolver::oddPeriodic(const Level &level) const
+{
+    for (int a = 0; a < 3; a++)
+    {
+        if (m_low[a] == Periodic && level.n[a] > 1 && level.n[a] % 2 == 1)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PoissonSolver::smooth(int l, int color)
+{
+    const Level &level = m_levels[l];
+    int rows = level.n[1] * level.n[2];
+    if (level.n[0] * rows < SerialCells || oddPeriodic(level))
+    {
+        smoothRows(l, color, 0, rows);
+        return;
+    }
+
+    // Cells of one color only read cells of the other color, so rows are independent
+    int chunks = qMin(rows, qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < chunks; i++)
+    {
+        int begin = (i * rows) / chunks;
+        int end = ((i + 1) * rows) / chunks;
+        sync.addFuture(QtConcurrent::run(this, &PoissonSolver::smoothRows, l, color, begin, end));
+    }
+    sync.waitForFinished();
+}
+
+void PoissonSolver::smoothRows(int l, int color, int begin, int end)
+{
+    Level &level = m_levels[l];
+    const int *n = level.n;
+    const double *ih2 = level.ih2;
+    int stride[3] = { 1, n[0], n[0] * n[1] };
+    double *phi = level.phi.data();
+    const double *b = level.b.constData();
+
+    for (int row = begin; row < end; row++)
+    {
+        int j = row % n[1];
+        int k = row / n[1];
+        for (int i = (color + j + k) & 1; i < n[0]; i += 2)
+        {
+            int s = i + n[0] * row;
+            int c[3] = { i, j, k };
+            double diag = 0;
+            double sum = b[s];
+            for (int a = 0; a < 3; a++)
+            {
+                if (c[a] > 0)
+                {
+                    diag += ih2[a];
+                    sum += ih2[a] * phi[s - stride[a]];
+                }
+                else if (m_low[a] == Electrode)
+                {
+                    diag += 2.0 * ih2[a];
+                }
+                else if (m_low[a] == Periodic && n[a] > 1)
+                {
+                    diag += ih2[a];
+                    sum += ih2[a] * phi[s + (n[a] - 1) * stride[a]];
+                }
+                if (c[a] < n[a] - 1)
+                {
+                    diag += ih2[a];
+                    sum += ih2[a] * phi[s + stride[a]];
+                }
+                else if (m_high[a] == Electrode)
+                {
+                    diag += 2.0 * ih2[a];
+                }
+                else if (m_high[a] == Periodic && n[a] > 1)
+                {
+                    diag += ih2[a];
+                    sum += ih2[a] * phi[s - (n[a] - 1) * stride[a]];
+                }
+            }
+            if (diag > 0)
+            {
+                phi[s] = sum / diag;
+            }
+        }
+    }
+}
+
+void PoissonSolver::vcycle(int l)
+{
+    Level &fine = m_levels[l];
+    fine.phi.fill(0);
+
+    // The sweeps after the correction run in reverse color order, so the cycle is symmetric
+    if (l == m_levels.size() - 1)
+    {
+        for (int s = 0; s < CoarseSweeps; s++)
+        {
+            smooth(l, 0);
+            smooth(l, 1);
+            smooth(l, 1);
+            smooth(l, 0);
+        }
+        return;
+    }
+
+    for (int s = 0; s < m_sweeps; s++)
+    {
+        smooth(l, 0);
+        smooth(l, 1);
+    }
+
+    apply(fine, fine.phi, fine.r);
+    for (int s = 0; s < fine.r.size(); s++)
+    {
+        fine.r[s] = fine.b[s] - fine.r[s];
+    }
+
+    // Restrict the residual (average of the children)
+    Level &coarse = m_levels[l + 1];
+    int shift[3];
+    int children = 1;
+    for (int a = 0; a < 3; a++)
+    {
+        shift[a] = (coarse.n[a] != fine.n[a]) ? 1 : 0;
+        children <<= shift[a];
+    }
+
+    coarse.b.fill(0);
+    for (int k = 0; k < fine.n[2]; k++)
+    {
+        for (int j = 0; j < fine.n[1]; j++)
+        {
+            for (int i = 0; i < fine.n[0]; i++)
+            {
+                int sc = (i >> shift[0]) + coarse.n[0] * ((j >> shift[1]) + coarse.n[1] * (k >> shift[2]));
+                coarse.b[sc] += fine.r[i + fine.n[0] * (j + fine.n[1] * k)] / children;
+            }
+        }
+    }
+
+    vcycle(l + 1);
+
+    // Prolong the correction (constant over the children)
+    for (int k = 0; k < fine.n[2]; k++)
+    {
+        for (int j = 0; j < fine.n[1]; j++)
+        {
+            for (int i = 0; i < fine.n[0]; i++)
+            {
+                int sc = (i >> shift[0]) + coarse.n[0] * ((j >> shift[1]) + coarse.n[1] * (k >> shift[2]));
+                fine.phi[i + fine.n[0] * (j + fine.n[1] * k)] += coarse.phi[sc];
+            }
+        }
+    }
+
+    for (int s = 0; s < m_sweeps; s++)
+    {
+        smooth(l, 1);
+        smooth(l, 0);
+    }
+}
+
+void PoissonSolver::precondition(const QVector<double> &r, QVector<double> &z)
+{
+    m_levels[0].b = r;
+    vcycle(0);
+    z = m_levels[0].phi;
+}
+
+static double dot(const QVector<double> &a, const QVector<double> &b)
+{
+    double sum = 0;
+    for (int i = 0; i < a.size(); i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+int PoissonSolver::solve(const QVector<double> &b, QVector<double> &phi, double tolerance)
+{
+    if (!isOn())
+    {
+        qFatal("langmuir: Poisson solver used before it was initialized");
+    }
+
+    int size = b.size();
+    if (phi.size() != size)
+    {
+        phi.fill(0, size);
+    }
+
+    double bnorm = sqrt(dot(b, b));
+    if (bnorm == 0)
+    {
+        phi.fill(0);
+        return 0;
+    }
+
+    QVector<double> r(size);
+    QVector<double> z(size);
+    QVector<double> p(size);
+    QVector<double> q(size);
+
+    apply(m_levels[0], phi, q);
+    for (int i = 0; i < size; i++)
+    {
+        r[i] = b[i] - q[i];
+    }
+
+    precondition(r, z);
+    p = z;
+    double rz = dot(r, z);
+
+    int iteration = 0;
+    while (sqrt(dot(r, r)) > tolerance * bnorm)
+    {
+        if (iteration == MaxIterations)
+        {
+            qWarning("langmuir: Poisson solver did not converge in %d iterations", MaxIterations);
+            break;
+        }
+        iteration++;
+
+        apply(m_levels[0], p, q);
+        double alpha = rz / dot(p, q);
+        for (int i = 0; i < size; i++)
+        {
+            phi[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+
+        precondition(r, z);
+        double rzNew = dot(r, z);
+        double beta = rzNew / rz;
+        rz = rzNew;
+        for (int i = 0; i < size; i++)
+        {
+            p[i] = z[i] + beta * p[i];
+        }
+    }
+    return iteration;
+}
+
+}
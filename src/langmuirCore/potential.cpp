@@ -1,27 +1,76 @@
 #include "potential.h"
 #include "parameters.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "cubicgrid.h"
+#include "coulombkernel.h"
+#include "celllist.h"
+#include "poissonsolver.h"
 #include "world.h"
 #include "rand.h"
 #include <cmath>
+#include <climits>
+#include <vector>
+#include <QSet>
+
+#ifdef LANGMUIR_USING_QT5
+#include <QtConcurrent/QtConcurrent>
+#else
+#include <QtCore>
+#endif
 
 namespace LangmuirCore
 {
 
+// RandomStream kind for trap placement; carriers use their Agent::Type
+static const quint32 TrapStream = Agent::SIZE;
+
+//! The sites that are traps while placing them; a bitmap on dense Grids, a set on sparse ones
+class TrapMarks
+{
+public:
+    TrapMarks(Grid &grid) : m_sparse(grid.isSparse())
+    {
+        if (!m_sparse)
+        {
+            m_bits.assign(grid.volume(), false);
+        }
+    }
+
+    bool contains(SiteID site) const
+    {
+        return m_sparse ? m_set.contains(site) : m_bits[site];
+    }
+
+    void insert(SiteID site)
+    {
+        if (m_sparse)
+        {
+            m_set.insert(site);
+        }
+        else
+        {
+            m_bits[site] = true;
+        }
+    }
+
+private:
+    bool m_sparse;
+    std::vector<bool> m_bits;
+    QSet<SiteID> m_set;
+};
+
 Potential::Potential(World &world, QObject *parent)
-    : QObject(parent), m_world(world)
+    : QObject(parent), m_world(world), m_carrierFieldOn(false),
+      m_carrierFieldScale(1.0 / 1099511627776.0), m_poissonGate(false)
 {
 }
 
 void Potential::setPotentialZero()
 {
+    // The hole grid shares the background potential of the electron grid
     qDebug("langmuir: setting potential to zero");
-    for(int i = 0; i < m_world.electronGrid().volume(); i++)
-    {
-        m_world.electronGrid().setPotential(i, 0);
-        m_world.holeGrid().setPotential(i, 0);
-    }
+    m_world.electronGrid().clearPotential();
 }
 
 void Potential::setPotentialLinear()
@@ -33,19 +82,7 @@ void Potential::setPotentialLinear()
     double b  = VL;
 
     qDebug("langmuir: adding a linear potential with slope %.3g V/nm", m);
-    for(int i = 0; i < m_world.electronGrid().xSize(); i++)
-    {
-        for(int j = 0; j < m_world.electronGrid().ySize(); j++)
-        {
-            for(int k = 0; k < m_world.electronGrid().zSize(); k++)
-            {
-                int s = m_world.electronGrid().getIndexS(i, j, k);
-                double v = m *(i + 0.5)+ b;
-                m_world.electronGrid().addToPotential(s, v);
-                m_world.holeGrid().addToPotential(s, v);
-            }
-        }
-    }
+    m_world.electronGrid().addRampPotential(b, m, 0);
 }
 
 void Potential::setPotentialGate()
@@ -56,22 +93,10 @@ void Potential::setPotentialGate()
     }
 
     qDebug("langmuir: adding gate potential with slope %.3g", m_world.parameters().slopeZ);
-    for(int i = 0; i < m_world.electronGrid().xSize(); i++)
-    {
-        for(int j = 0; j < m_world.electronGrid().ySize(); j++)
-        {
-            for(int k = 0; k < m_world.electronGrid().zSize(); k++)
-            {
-                int s = m_world.electronGrid().getIndexS(i, j, k);
-                double v = m_world.parameters().slopeZ *(k + 0.5);
-                m_world.electronGrid().addToPotential(s, v);
-                m_world.holeGrid().addToPotential(s, v);
-            }
-        }
-    }
+    m_world.electronGrid().addRampPotential(0, 0, m_world.parameters().slopeZ);
 }
 
-void Potential::setPotentialTraps(const QList<int> &trapIDs,
+void Potential::setPotentialTraps(const QList<SiteID> &trapIDs,
                                   const QList<double> &trapPotentials)
 {
     qDebug("langmuir: Potential::setPotentialTraps");
@@ -129,7 +154,9 @@ void Potential::setPotentialTraps(const QList<int> &trapIDs,
 
     // We do not alter the grid potential until we are done
     QList<double> potentials;
-    QList<int>         traps;
+    QList<SiteID>      traps;
+    potentials.reserve(toBePlacedTotal);
+    traps.reserve(toBePlacedTotal);
 
     // First, place the forced traps
     if (toBePlacedForced > 0)
@@ -153,9 +180,17 @@ void Potential::setPotentialTraps(const QList<int> &trapIDs,
         }
     }
 
-    // Now place traps randomly
+    // Now place traps randomly; isTrap marks every trap placed so far
+    Grid &grid = m_world.electronGrid();
+    TrapMarks isTrap(grid);
+    for (int i = 0; i < traps.size(); i++)
+    {
+        isTrap.insert(traps.at(i));
+    }
+
     QList<double> randomPotentials;
-    QList<int> randomIDs;
+    QVector<SiteID> randomIDs;
+    randomIDs.reserve(toBePlacedRandomly);
 
     // Place homogeneous traps
     if (toBePlacedRandomly > 0)
@@ -164,16 +199,36 @@ void Potential::setPotentialTraps(const QList<int> &trapIDs,
         if (toBePlacedSeeds > 0)
         {
             qDebug("langmuir: placing %d seeds", toBePlacedSeeds);
-            int progress = 0;
-            while (progress < toBePlacedSeeds)
+
+            // Candidates are drawn in parallel from counter-based streams, and merged in chunk
+            // order; a fixed number of chunks keeps the traps independent of the thread count
+            const int chunks = 64;
+            QVector< QVector<SiteID> > candidates(chunks);
+            for (int round = 0; randomIDs.size() < toBePlacedSeeds; round++)
             {
-                int s = m_world.randomNumberGenerator().integer(0,
-                            m_world.electronGrid().volume() - 1);
-                if ( ! randomIDs.contains(s) && ! traps.contains(s) )
+                int needed = toBePlacedSeeds - randomIDs.size();
+
+                QFutureSynchronizer<void> sync;
+                for (int c = 0; c < chunks; c++)
                 {
-                    randomIDs.push_back(s);
-                    randomPotentials.push_back(m_world.parameters().trapPotential);
-                    ++progress;
+                    int count = (qint64(needed) * (c + 1)) / chunks - (qint64(needed) * c) / chunks;
+                    RandomStream stream = m_world.randomNumberGenerator().stream(round, TrapStream, c);
+                    sync.addFuture(QtConcurrent::run(this, &Potential::drawTrapCandidates,
+                                                     stream, count, &candidates[c]));
+                }
+                sync.waitForFinished();
+
+                for (int c = 0; c < chunks; c++)
+                {
+                    for (int i = 0; i < candidates[c].size(); i++)
+                    {
+                        SiteID site = candidates[c][i];
+                        if (!isTrap.contains(site))
+                        {
+                            isTrap.insert(site);
+                            randomIDs.push_back(site);
+                        }
+                    }
                 }
             }
         }
@@ -183,31 +238,49 @@ void Potential::setPotentialTraps(const QList<int> &trapIDs,
         {
             qDebug("langmuir: growing %d traps", toBePlacedGrown);
             int progress = 0;
+            SiteID neighbors[6];
             while (progress < toBePlacedGrown)
             {
                 int trapSeedIndex = m_world.randomNumberGenerator().integer(0,
                                         randomIDs.size() - 1);
-                int trapSeedSite = randomIDs.at(trapSeedIndex);
-                QVector<int> trapSeedNeighbors = m_world.electronGrid().neighborsSite(
-                                        trapSeedSite, 1);
+                SiteID trapSeedSite = randomIDs.at(trapSeedIndex);
+
+                // The nearest neighbors inside the grid (see Grid::neighborsSite)
+                int x = grid.getIndexX(trapSeedSite);
+                int y = grid.getIndexY(trapSeedSite);
+                int z = grid.getIndexZ(trapSeedSite);
+                int count = 0;
+                if (x > 0)                  neighbors[count++] = grid.getIndexS(x - 1, y, z);
+                if (x < grid.xSize() - 1)   neighbors[count++] = grid.getIndexS(x + 1, y, z);
+                if (y > 0)                  neighbors[count++] = grid.getIndexS(x, y - 1, z);
+                if (y < grid.ySize() - 1)   neighbors[count++] = grid.getIndexS(x, y + 1, z);
+                if (z > 0)                  neighbors[count++] = grid.getIndexS(x, y, z - 1);
+                if (z < grid.zSize() - 1)   neighbors[count++] = grid.getIndexS(x, y, z + 1);
+                if (count == 0)
+                {
+                    qFatal("langmuir: can not grow traps; sites have no neighbors");
+                }
 
-                int newTrapIndex = m_world.randomNumberGenerator().integer(0,
-                                        trapSeedNeighbors.size() - 1);
-                int newTrapSite = trapSeedNeighbors[newTrapIndex];
+                int newTrapIndex = m_world.randomNumberGenerator().integer(0, count - 1);
+                SiteID newTrapSite = neighbors[newTrapIndex];
                 if(m_world.electronGrid().agentType(newTrapSite)!= Agent::Source &&
                    m_world.electronGrid().agentType(newTrapSite)!= Agent::Drain &&
                    m_world.holeGrid().agentType(newTrapSite)!= Agent::Source &&
                    m_world.holeGrid().agentType(newTrapSite)!= Agent::Drain &&
-                   !randomIDs.contains(newTrapSite) &&
-                   !traps.contains(newTrapSite))
+                   !isTrap.contains(newTrapSite))
                 {
+                    isTrap.insert(newTrapSite);
                     randomIDs.push_back(newTrapSite);
-                    randomPotentials.push_back(m_world.parameters().trapPotential);
                     ++progress;
                 }
             }
         }
 
+        for (int i = 0; i < randomIDs.size(); i++)
+        {
+            randomPotentials.push_back(m_world.parameters().trapPotential);
+        }
+
         // Apply a deviation to the trap energies (only the randomly generated ones)
         if(abs(m_world.parameters().gaussianStdev) > 0)
         {
@@ -236,10 +309,28 @@ void Potential::setPotentialTraps(const QList<int> &trapIDs,
     qDebug("langmuir: updating grid with trap info");
     for (int i = 0; i < traps.size(); i++)
     {
-        int s = traps.at(i);
+        SiteID s = traps.at(i);
         double v = potentials.at(i);
         m_world.electronGrid().addToPotential(s,v);
-        m_world.holeGrid().addToPotential(s,v);
+    }
+}
+
+void Potential::drawTrapCandidates(RandomStream stream, int count, QVector<SiteID> *sites)
+{
+    SiteID volume = m_world.electronGrid().volume();
+    sites->resize(count);
+    if (volume > SiteID(INT_MAX))
+    {
+        // Too many sites for a 32-bit draw (only with LANGMUIR_64BIT_SITES)
+        for (int i = 0; i < count; i++)
+        {
+            (*sites)[i] = qMin(volume - 1, SiteID(stream.random() * volume));
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        (*sites)[i] = stream.integer(0, int(volume - 1));
     }
 }
 
@@ -321,183 +412,363 @@ void Potential::precalculateArrays()
             }
         }
     }
+
+    initializeCoulombKernels();
 }
 
-void Potential::updateCouplingConstants()
+void Potential::initializeCoulombKernels()
 {
-    //These values are used for moving between sites
-    boost::multi_array<double, 3>& constants = m_world.couplingConstants();
-    int max_h = m_world.parameters().hoppingRange + 1;
-    constants.resize(boost::extents[max_h][max_h][max_h]);
+    if (m_world.parameters().coulombMesh != "off")
+    {
+        initializeParticleMesh();
+        return;
+    }
 
-    //Assuming coupling(r=1) is 1/3 and coupling(r=2) is 1/27
-    double c1 = 1.0 /  3.0;
-    double c2 = 1.0 / 27.0;
-    for (int dx = 0; dx < max_h; dx++)
+    qint32 cutoff = m_world.parameters().electrostaticCutoff;
+    boost::multi_array<double, 3>& R1 = m_world.R1();
+    boost::multi_array<double, 3>& iR = m_world.iR();
+    boost::multi_array<double, 3>& eR = m_world.eR();
+    double prefactor = m_world.parameters().electrostaticPrefactor;
+
+    // Index (dx * cutoff + dy) * cutoff + dz; zero outside of the cutoff sphere
+    QVector<qint64> coulomb(cutoff * cutoff * cutoff, 0);
+    QVector<qint64> gauss(cutoff * cutoff * cutoff, 0);
+    for (int dx = 0; dx < cutoff; dx++)
     {
-        for (int dy = 0; dy < max_h; dy++)
+        for (int dy = 0; dy < cutoff; dy++)
         {
-            for (int dz = 0; dz < max_h; dz++)
+            for (int dz = 0; dz < cutoff; dz++)
             {
-                double r = sqrt(dx*dx + dy*dy + dz*dz);
-                double c = c1 * pow(3.0, r - 1) * pow(c2, r - 1);
-                constants[dx][dy][dz] = c;
+                if (R1[dx][dy][dz] < cutoff)
+                {
+                    int index = (dx * cutoff + dy) * cutoff + dz;
+                    coulomb[index] = qRound64(prefactor * iR[dx][dy][dz] / m_carrierFieldScale);
+                    gauss[index] = qRound64(prefactor * iR[dx][dy][dz] * eR[dx][dy][dz] /
+                                            m_carrierFieldScale);
+                }
             }
         }
     }
-    constants[0][0][0] = 0;
+    m_coulombKernel.setTable(coulomb, cutoff);
+    m_gaussKernel.setTable(gauss, cutoff);
+    initializeCellLists(cutoff, false, false);
+
+    qDebug("langmuir: Coulomb sums use %s",
+           qPrintable(CoulombKernel::toQString(m_coulombKernel.instructionSet())));
 }
 
-double Potential::coulombE(int site_i)
+void Potential::initializeParticleMesh()
 {
-    qint32 cutoff = m_world.parameters().electrostaticCutoff;
-    boost::multi_array<double, 3>& R1 = m_world.R1();
-    boost::multi_array<double, 3>& iR = m_world.iR();
-    //boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.electrons();
+    const SimulationParameters &par = m_world.parameters();
     Grid &grid = m_world.electronGrid();
-
-    double potential = 0.0;
-
-    for (int i = 0; i < charges.size(); i++)
+    qint32 cutoff = par.coulombMeshCutoff;
+    double prefactor = par.electrostaticPrefactor;
+
+    // The long-range part must be smooth on the lattice; erfc(alpha r) ~ 1e-4 at the cutoff.
+    // Gaussian charges are already smooth beyond beta = 1 / (sqrt(2) sigma).
+    double alpha = 3.0 / cutoff;
+    double beta = 0.0;
+    if (par.coulombGaussianSigma > 0.0)
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
-
-        int dx = grid.xDistancei(site_i, site_j);
-        int dy = grid.yDistancei(site_i, site_j);
-        int dz = grid.zDistancei(site_i, site_j);
+        beta = 1.0 / (sqrt(2.0) * par.coulombGaussianSigma);
+        alpha = qMin(alpha, beta);
+    }
 
-        if ((dx < cutoff) && (dy < cutoff) && (dz < cutoff))
+    // The short-range part: erfc(alpha r) / r, or (erf(beta r) - erf(alpha r)) / r
+    QVector<qint64> coulomb(cutoff * cutoff * cutoff, 0);
+    QVector<qint64> gauss(cutoff * cutoff * cutoff, 0);
+    for (int dx = 0; dx < cutoff; dx++)
+    {
+        for (int dy = 0; dy < cutoff; dy++)
         {
-            if (R1[dx][dy][dz] < cutoff)
+            for (int dz = 0; dz < cutoff; dz++)
             {
-                potential += (iR[dx][dy][dz] * charge.charge());
+                double r = sqrt(double(dx * dx + dy * dy + dz * dz));
+                if (r > 0 && r < cutoff)
+                {
+                    int index = (dx * cutoff + dy) * cutoff + dz;
+                    coulomb[index] = qRound64(prefactor * erfc(alpha * r) / r / m_carrierFieldScale);
+                    if (beta > 0)
+                    {
+                        gauss[index] = qRound64(prefactor * (erf(beta * r) - erf(alpha * r)) / r /
+                                                m_carrierFieldScale);
+                    }
+                }
             }
         }
     }
+    m_coulombKernel.setTable(coulomb, cutoff);
+    m_gaussKernel.setTable(gauss, cutoff);
 
-    return (potential * m_world.parameters().electrostaticPrefactor);
+    if (par.coulombMesh == "periodic")
+    {
+        m_coulombKernel.setPeriods(grid.xSize(), grid.ySize(), grid.zSize());
+        m_gaussKernel.setPeriods(grid.xSize(), grid.ySize(), grid.zSize());
+        m_particleMesh.initialize(grid.xSize(), grid.ySize(), grid.zSize(),
+                                  ParticleMesh::Periodic, alpha, prefactor);
+        initializeCellLists(cutoff, true, true);
+    }
+    else
+    {
+        // Open along x, between the electrodes; a single layer is open along z too,
+        // which the nearest image of a zero offset already is
+        m_coulombKernel.setPeriods(0, grid.ySize(), grid.zSize());
+        m_gaussKernel.setPeriods(0, grid.ySize(), grid.zSize());
+        m_particleMesh.initialize(grid.xSize(), grid.ySize(), grid.zSize(),
+                                  ParticleMesh::Slab, alpha, prefactor);
+        initializeCellLists(cutoff, false, true);
+    }
+
+    qDebug("langmuir: Coulomb sums use %s and a %s particle mesh",
+           qPrintable(CoulombKernel::toQString(m_coulombKernel.instructionSet())),
+           qPrintable(par.coulombMesh));
 }
 
-double Potential::coulombImageE(int site_i)
+void Potential::initializeCellLists(int cellSize, bool xPeriodic, bool yzPeriodic)
 {
-    qint32 cutoff = m_world.parameters().electrostaticCutoff;
-    boost::multi_array<double, 3>& R1 = m_world.R1();
-    boost::multi_array<double, 3>& iR = m_world.iR();
-    //boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.electrons();
     Grid &grid = m_world.electronGrid();
+    CellList *cells[2] = { &m_electronCells, &m_holeCells };
+    const CarrierStore *stores[2] = { &m_world.electrons(), &m_world.holes() };
 
-    double potential = 0.0;
+    // Carriers placed before now (from the checkpoint) were not seen by registerCarrier()
+    for (int j = 0; j < 2; j++)
+    {
+        cells[j]->initialize(grid.xSize(), grid.ySize(), grid.zSize(), cellSize,
+                             xPeriodic, yzPeriodic, yzPeriodic);
+        const CarrierStore &charges = *stores[j];
+        for (int i = 0; i < charges.size(); i++)
+        {
+            cells[j]->insert(charges.activeX()[i], charges.activeY()[i], charges.activeZ()[i]);
+        }
+    }
+}
 
-    for (int i = 0; i < charges.size(); i++)
+void Potential::registerCarrier(SiteID site, Agent::Type type)
+{
+    CellList &cells = (type == Agent::Electron) ? m_electronCells : m_holeCells;
+    if (!cells.isOn())
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        return;
+    }
 
-        int dx = grid.xImageDistancei(site_i, site_j);
-        int dy = grid.yDistancei(site_i, site_j);
-        int dz = grid.zDistancei(site_i, site_j);
+    Grid &grid = m_world.electronGrid();
+    QMutexLocker locker(&m_cellListMutex);
+    cells.insert(grid.getIndexX(site), grid.getIndexY(site), grid.getIndexZ(site));
+}
 
-        if ((dx < cutoff) && (dy < cutoff) && (dz < cutoff))
-        {
-            if (R1[dx][dy][dz] < cutoff)
-            {
-                potential -= (iR[dx][dy][dz] * charge.charge());
-            }
-        }
+void Potential::unregisterCarrier(SiteID site, Agent::Type type)
+{
+    CellList &cells = (type == Agent::Electron) ? m_electronCells : m_holeCells;
+    if (!cells.isOn())
+    {
+        return;
     }
 
-    return (potential * m_world.parameters().electrostaticPrefactor);
+    Grid &grid = m_world.electronGrid();
+    QMutexLocker locker(&m_cellListMutex);
+    cells.remove(grid.getIndexX(site), grid.getIndexY(site), grid.getIndexZ(site));
 }
 
-double Potential::gaussE(int site_i)
+double Potential::coulombKernelSum(const CoulombKernel &kernel, const CarrierStore &charges, SiteID site)
 {
-    qint32 cutoff = m_world.parameters().electrostaticCutoff;
-    boost::multi_array<double, 3>& R1 = m_world.R1();
-    boost::multi_array<double, 3>& iR = m_world.iR();
-    boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.electrons();
     Grid &grid = m_world.electronGrid();
+    const CellList &cells = (charges.type() == Agent::Electron) ? m_electronCells : m_holeCells;
+    qint64 sum = cells.sum(kernel,
+                           grid.getIndexX(site),
+                           grid.getIndexY(site),
+                           grid.getIndexZ(site));
+    return sum * charges.unitCharge() * m_carrierFieldScale;
+}
 
-    double potential = 0.0;
+void Potential::initializePoisson()
+{
+    const SimulationParameters &par = m_world.parameters();
+    if (!par.poissonMultigrid)
+    {
+        return;
+    }
 
-    for (int i = 0; i < charges.size(); i++)
+    // The electrodes sit half a site outside of the grid, where setPotentialLinear()
+    // reaches voltage.left and voltage.right (and setPotentialGate() reaches zero);
+    // y and z wrap around like the Coulomb sums, except for z under a gate
+    PoissonSolver::Boundary low[3] = { PoissonSolver::Electrode,
+                                       PoissonSolver::Periodic,
+                                       PoissonSolver::Periodic };
+    PoissonSolver::Boundary high[3] = { PoissonSolver::Electrode,
+                                        PoissonSolver::Periodic,
+                                        PoissonSolver::Periodic };
+    if (par.gridZ > 1 && par.slopeZ != 0)
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        low[2] = PoissonSolver::Electrode;
+        high[2] = PoissonSolver::Insulating;
+    }
 
-        int dx = grid.xDistancei(site_i, site_j);
-        int dy = grid.yDistancei(site_i, site_j);
-        int dz = grid.zDistancei(site_i, site_j);
+    Grid &grid = m_world.electronGrid();
+    m_poissonSolver.initialize(grid.xSize(), grid.ySize(), grid.zSize(), low, high);
+    m_poissonGate = (low[2] == PoissonSolver::Electrode);
+    m_poissonPotential.fill(0, int(grid.volume()));
+
+    // The potential of a lone unit charge, which poissonSelfEnergy() shifts to each carrier
+    m_poissonCenter[0] = grid.xSize() / 2;
+    m_poissonCenter[1] = grid.ySize() / 2;
+    m_poissonCenter[2] = grid.zSize() / 2;
+    QVector<double> rho(int(grid.volume()), 0);
+    rho[grid.getIndexS(m_poissonCenter[0], m_poissonCenter[1], m_poissonCenter[2])] =
+            4.0 * M_PI * par.electrostaticPrefactor;
+    m_poissonResponse.fill(0, int(grid.volume()));
+    m_poissonSolver.solve(rho, m_poissonResponse, par.poissonTolerance);
+
+    updatePoissonPotential();
+}
 
-        if ((dx < cutoff) && (dy < cutoff) && (dz < cutoff))
+void Potential::updatePoissonPotential()
+{
+    if (!m_poissonSolver.isOn())
+    {
+        return;
+    }
+
+    // -laplacian(phi) = 4 pi prefactor rho, so a lone charge far from the faces gives prefactor / r
+    // (grid.z > 1 is required; on a single layer the solve would be two-dimensional)
+    Grid &grid = m_world.electronGrid();
+    double scale = 4.0 * M_PI * m_world.parameters().electrostaticPrefactor;
+    QVector<double> rho(int(grid.volume()), 0);
+    CarrierStore *stores[2] = { &m_world.electrons(), &m_world.holes() };
+    for (int j = 0; j < 2; j++)
+    {
+        CarrierStore &charges = *stores[j];
+        for (int i = 0; i < charges.size(); i++)
         {
-            if (R1[dx][dy][dz] < cutoff)
-            {
-                potential += (iR[dx][dy][dz] * charge.charge() * eR[dx][dy][dz]);
-            }
+            SiteID site = grid.getIndexS(charges.activeX()[i], charges.activeY()[i], charges.activeZ()[i]);
+            rho[site] += scale * charges.unitCharge();
+
+            // Remember where the carrier's own share of phi is centered
+            charges.poissonSite(charges.activeSlots()[i]) = site;
         }
     }
 
-    return (potential * m_world.parameters().electrostaticPrefactor);
+    // Start from the last solution; the carriers have not moved far
+    QVector<double> phi = m_poissonPotential;
+    m_poissonSolver.solve(rho, phi, m_world.parameters().poissonTolerance);
+
+    for (SiteID site = 0; site < grid.volume(); site++)
+    {
+        double delta = phi[site] - m_poissonPotential[site];
+        m_world.electronGrid().addToPotential(site, delta);
+    }
+    m_poissonPotential = phi;
 }
 
-double Potential::gaussImageE(int site_i)
+double Potential::poissonSelfEnergy(const CarrierStore &charges, int slot, SiteID site)
 {
-    qint32 cutoff = m_world.parameters().electrostaticCutoff;
-    boost::multi_array<double, 3>& R1 = m_world.R1();
-    boost::multi_array<double, 3>& iR = m_world.iR();
-    boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.electrons();
+    // Carriers injected since the last solve are not in the potential yet
+    SiteID origin = charges.poissonSite(slot);
+    if (m_poissonResponse.isEmpty() || origin < 0)
+    {
+        return 0;
+    }
+
     Grid &grid = m_world.electronGrid();
+    SiteID sites[2] = { charges.site(slot), site };
+    double self[2] = { 0, 0 };
+    for (int j = 0; j < 2; j++)
+    {
+        // Special agents (drains) live past the end of the grid
+        if (sites[j] >= grid.volume())
+        {
+            continue;
+        }
+        // Shifting along a periodic direction is exact; along x (and z under a gate) it
+        // misses how the faces change the response, and the far side is cut off
+        int x = m_poissonCenter[0] + grid.getIndexX(sites[j]) - grid.getIndexX(origin);
+        int y = m_poissonCenter[1] + grid.getIndexY(sites[j]) - grid.getIndexY(origin);
+        int z = m_poissonCenter[2] + grid.getIndexZ(sites[j]) - grid.getIndexZ(origin);
+        y = (y + grid.ySize()) % grid.ySize();
+        if (!m_poissonGate)
+        {
+            z = (z + grid.zSize()) % grid.zSize();
+        }
+        if (x >= 0 && x < grid.xSize() && z >= 0 && z < grid.zSize())
+        {
+            self[j] = m_poissonResponse[int(grid.getIndexS(x, y, z))];
+        }
+    }
+    return charges.charge(slot) * charges.unitCharge() * (self[1] - self[0]);
+}
 
-    double potential = 0.0;
+double Potential::particleMeshSum(const CarrierStore &charges, SiteID site)
+{
+    // Special agents (drains) live past the end of the grid
+    if (!m_particleMesh.isOn() || site >= m_world.electronGrid().volume())
+    {
+        return 0;
+    }
 
-    for (int i = 0; i < charges.size(); i++)
+    // The mesh includes a carrier at the site itself; the direct sums never do
+    double potential = (charges.type() == Agent::Electron) ? m_particleMesh.electronPotential(site)
+                                                           : m_particleMesh.holePotential(site);
+    Grid &grid = (charges.type() == Agent::Electron) ? m_world.electronGrid() : m_world.holeGrid();
+    if (grid.agentType(site) == charges.type())
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        potential -= charges.unitCharge() * m_particleMesh.selfPotential();
+    }
+    return potential;
+}
 
-        int dx = grid.xImageDistancei(site_i, site_j);
-        int dy = grid.yDistancei(site_i, site_j);
-        int dz = grid.zDistancei(site_i, site_j);
+void Potential::updateParticleMesh()
+{
+    m_particleMesh.update(m_world.electrons(), m_world.holes());
+}
 
-        if ((dx < cutoff) && (dy < cutoff) && (dz < cutoff))
+void Potential::updateCouplingConstants()
+{
+    //These values are used for moving between sites
+    boost::multi_array<double, 3>& constants = m_world.couplingConstants();
+    int max_h = m_world.parameters().hoppingRange + 1;
+    constants.resize(boost::extents[max_h][max_h][max_h]);
+
+    //Assuming coupling(r=1) is 1/3 and coupling(r=2) is 1/27
+    double c1 = 1.0 /  3.0;
+    double c2 = 1.0 / 27.0;
+    for (int dx = 0; dx < max_h; dx++)
+    {
+        for (int dy = 0; dy < max_h; dy++)
         {
-            if (R1[dx][dy][dz] < cutoff)
+            for (int dz = 0; dz < max_h; dz++)
             {
-                potential -= (iR[dx][dy][dz] * charge.charge() * eR[dx][dy][dz]);
+                double r = sqrt(dx*dx + dy*dy + dz*dz);
+                double c = c1 * pow(3.0, r - 1) * pow(c2, r - 1);
+                constants[dx][dy][dz] = c;
             }
         }
     }
+    constants[0][0][0] = 0;
+}
 
-    return (potential * m_world.parameters().electrostaticPrefactor);
+double Potential::coulombE(SiteID site_i)
+{
+    return coulombKernelSum(m_coulombKernel, m_world.electrons(), site_i) +
+           particleMeshSum(m_world.electrons(), site_i);
 }
 
-double Potential::coulombH(int site_i)
+double Potential::coulombImageE(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     boost::multi_array<double, 3>& R1 = m_world.R1();
     boost::multi_array<double, 3>& iR = m_world.iR();
     //boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.holes();
-    Grid &grid = m_world.holeGrid();
+    const CarrierStore& charges = m_world.electrons();
+    const QVector<int>& slots_j = charges.activeSlots();
+    Grid &grid = m_world.electronGrid();
 
     double potential = 0.0;
 
-    for (int i = 0; i < charges.size(); i++)
+    for (int i = 0; i < slots_j.size(); i++)
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        int slot_j = slots_j[i];
+        SiteID site_j = charges.site(slot_j);
 
-        int dx = grid.xDistancei(site_i, site_j);
+        int dx = grid.xImageDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
         int dz = grid.zDistancei(site_i, site_j);
 
@@ -505,7 +776,7 @@ double Potential::coulombH(int site_i)
         {
             if (R1[dx][dy][dz] < cutoff)
             {
-                potential += (iR[dx][dy][dz] * charge.charge());
+                potential -= (iR[dx][dy][dz] * charges.charge(slot_j));
             }
         }
     }
@@ -513,22 +784,28 @@ double Potential::coulombH(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::coulombImageH(int site_i)
+double Potential::gaussE(SiteID site_i)
+{
+    return coulombKernelSum(m_gaussKernel, m_world.electrons(), site_i) +
+           particleMeshSum(m_world.electrons(), site_i);
+}
+
+double Potential::gaussImageE(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     boost::multi_array<double, 3>& R1 = m_world.R1();
     boost::multi_array<double, 3>& iR = m_world.iR();
-    //boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.holes();
-    Grid &grid = m_world.holeGrid();
+    boost::multi_array<double, 3>& eR = m_world.eR();
+    const CarrierStore& charges = m_world.electrons();
+    const QVector<int>& slots_j = charges.activeSlots();
+    Grid &grid = m_world.electronGrid();
 
     double potential = 0.0;
 
-    for (int i = 0; i < charges.size(); i++)
+    for (int i = 0; i < slots_j.size(); i++)
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        int slot_j = slots_j[i];
+        SiteID site_j = charges.site(slot_j);
 
         int dx = grid.xImageDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
@@ -538,7 +815,7 @@ double Potential::coulombImageH(int site_i)
         {
             if (R1[dx][dy][dz] < cutoff)
             {
-                potential -= (iR[dx][dy][dz] * charge.charge());
+                potential -= (iR[dx][dy][dz] * charges.charge(slot_j) * eR[dx][dy][dz]);
             }
         }
     }
@@ -546,24 +823,30 @@ double Potential::coulombImageH(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::gaussH(int site_i)
+double Potential::coulombH(SiteID site_i)
+{
+    return coulombKernelSum(m_coulombKernel, m_world.holes(), site_i) +
+           particleMeshSum(m_world.holes(), site_i);
+}
+
+double Potential::coulombImageH(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     boost::multi_array<double, 3>& R1 = m_world.R1();
     boost::multi_array<double, 3>& iR = m_world.iR();
-    boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.holes();
+    //boost::multi_array<double, 3>& eR = m_world.eR();
+    const CarrierStore& charges = m_world.holes();
+    const QVector<int>& slots_j = charges.activeSlots();
     Grid &grid = m_world.holeGrid();
 
     double potential = 0.0;
 
-    for (int i = 0; i < charges.size(); i++)
+    for (int i = 0; i < slots_j.size(); i++)
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        int slot_j = slots_j[i];
+        SiteID site_j = charges.site(slot_j);
 
-        int dx = grid.xDistancei(site_i, site_j);
+        int dx = grid.xImageDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
         int dz = grid.zDistancei(site_i, site_j);
 
@@ -571,7 +854,7 @@ double Potential::gaussH(int site_i)
         {
             if (R1[dx][dy][dz] < cutoff)
             {
-                potential += (iR[dx][dy][dz] * charge.charge() * eR[dx][dy][dz]);
+                potential -= (iR[dx][dy][dz] * charges.charge(slot_j));
             }
         }
     }
@@ -579,22 +862,28 @@ double Potential::gaussH(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::gaussImageH(int site_i)
+double Potential::gaussH(SiteID site_i)
+{
+    return coulombKernelSum(m_gaussKernel, m_world.holes(), site_i) +
+           particleMeshSum(m_world.holes(), site_i);
+}
+
+double Potential::gaussImageH(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     boost::multi_array<double, 3>& R1 = m_world.R1();
     boost::multi_array<double, 3>& iR = m_world.iR();
     boost::multi_array<double, 3>& eR = m_world.eR();
-    QList<ChargeAgent*>& charges = m_world.holes();
+    const CarrierStore& charges = m_world.holes();
+    const QVector<int>& slots_j = charges.activeSlots();
     Grid &grid = m_world.holeGrid();
 
     double potential = 0.0;
 
-    for (int i = 0; i < charges.size(); i++)
+    for (int i = 0; i < slots_j.size(); i++)
     {
-        //Q_CHECK_PTR(charges[i]);
-        ChargeAgent& charge = *charges[i];
-        int site_j = charge.getCurrentSite();
+        int slot_j = slots_j[i];
+        SiteID site_j = charges.site(slot_j);
 
         int dx = grid.xImageDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
@@ -604,7 +893,7 @@ double Potential::gaussImageH(int site_i)
         {
             if (R1[dx][dy][dz] < cutoff)
             {
-                potential -= (iR[dx][dy][dz] * charge.charge() * eR[dx][dy][dz]);
+                potential -= (iR[dx][dy][dz] * charges.charge(slot_j) * eR[dx][dy][dz]);
             }
         }
     }
@@ -612,7 +901,7 @@ double Potential::gaussImageH(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::coulombD(int site_i)
+double Potential::coulombD(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     qint32 charge = m_world.parameters().defectsCharge;
@@ -629,7 +918,7 @@ double Potential::coulombD(int site_i)
 
     for (int i = 0; i < m_world.defectSiteIDs().size(); i++)
     {
-        int site_j = m_world.defectSiteIDs()[i];
+        SiteID site_j = m_world.defectSiteIDs()[i];
 
         int dx = grid.xDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
@@ -647,7 +936,7 @@ double Potential::coulombD(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::coulombImageD(int site_i)
+double Potential::coulombImageD(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     qint32 charge = m_world.parameters().defectsCharge;
@@ -664,7 +953,7 @@ double Potential::coulombImageD(int site_i)
 
     for (int i = 0; i < m_world.defectSiteIDs().size(); i++)
     {
-        int site_j = m_world.defectSiteIDs()[i];
+        SiteID site_j = m_world.defectSiteIDs()[i];
 
         int dx = grid.xImageDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
@@ -682,7 +971,7 @@ double Potential::coulombImageD(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::gaussD(int site_i)
+double Potential::gaussD(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     qint32 charge = m_world.parameters().defectsCharge;
@@ -699,7 +988,7 @@ double Potential::gaussD(int site_i)
 
     for (int i = 0; i < m_world.defectSiteIDs().size(); i++)
     {
-        int site_j = m_world.defectSiteIDs()[i];
+        SiteID site_j = m_world.defectSiteIDs()[i];
 
         int dx = grid.xDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
@@ -717,7 +1006,7 @@ double Potential::gaussD(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
-double Potential::gaussImageD(int site_i)
+double Potential::gaussImageD(SiteID site_i)
 {
     qint32 cutoff = m_world.parameters().electrostaticCutoff;
     qint32 charge = m_world.parameters().defectsCharge;
@@ -734,7 +1023,7 @@ double Potential::gaussImageD(int site_i)
 
     for (int i = 0; i < m_world.defectSiteIDs().size(); i++)
     {
-        int site_j = m_world.defectSiteIDs()[i];
+        SiteID site_j = m_world.defectSiteIDs()[i];
 
         int dx = grid.xImageDistancei(site_i, site_j);
         int dy = grid.yDistancei(site_i, site_j);
@@ -752,4 +1041,311 @@ double Potential::gaussImageD(int site_i)
     return (potential * m_world.parameters().electrostaticPrefactor);
 }
 
+void Potential::initializeDefectPotential()
+{
+    m_defectPotential.clear();
+    m_defectSourcePotential.clear();
+
+    if (m_world.parameters().defectsCharge == 0 || m_world.numDefects() == 0)
+    {
+        return;
+    }
+
+    qDebug("langmuir: precalculating potential of %d charged defects", m_world.numDefects());
+
+    int volume = int(m_world.electronGrid().volume());
+    m_defectPotential.fill(0.0, volume);
+    if (m_world.parameters().sourceCoulomb)
+    {
+        m_defectSourcePotential.fill(0.0, volume);
+    }
+
+    // Each thread owns a slab of x-planes, so no two threads write the same site
+    int xSize = m_world.electronGrid().xSize();
+    int slabs = qMin(xSize, qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < slabs; i++)
+    {
+        int xBegin = (i * xSize) / slabs;
+        int xEnd = ((i + 1) * xSize) / slabs;
+        sync.addFuture(QtConcurrent::run(this, &Potential::initializeDefectPotentialSlab, xBegin, xEnd));
+    }
+    sync.waitForFinished();
+}
+
+void Potential::initializeDefectPotentialSlab(int xBegin, int xEnd)
+{
+    qint32 cutoff = m_world.parameters().electrostaticCutoff;
+    qint32 charge = m_world.parameters().defectsCharge;
+    double prefactor = m_world.parameters().electrostaticPrefactor;
+    bool gauss = m_world.parameters().coulombGaussianSigma > 0;
+    bool images = !m_defectSourcePotential.isEmpty();
+    boost::multi_array<double, 3>& R1 = m_world.R1();
+    boost::multi_array<double, 3>& iR = m_world.iR();
+    boost::multi_array<double, 3>& eR = m_world.eR();
+    Grid &grid = m_world.electronGrid();
+    QList<SiteID> &defects = m_world.defectSiteIDs();
+
+    double *direct = m_defectPotential.data();
+    double *source = images ? m_defectSourcePotential.data() : 0;
+
+    for (int i = 0; i < defects.size(); i++)
+    {
+        int xj = grid.getIndexX(defects[i]);
+        int yj = grid.getIndexY(defects[i]);
+        int zj = grid.getIndexZ(defects[i]);
+
+        // The image charge sits at -xj - 1, so it never reaches past xj + cutoff
+        int x0 = qMax(xBegin, xj - cutoff + 1);
+        int x1 = qMin(xEnd, xj + cutoff);
+        int y0 = qMax(0, yj - cutoff + 1);
+        int y1 = qMin(grid.ySize(), yj + cutoff);
+        int z0 = qMax(0, zj - cutoff + 1);
+        int z1 = qMin(grid.zSize(), zj + cutoff);
+
+        for (int x = x0; x < x1; x++)
+        {
+            int dx = abs(x - xj);
+            int ix = x + xj + 1;
+            for (int y = y0; y < y1; y++)
+            {
+                int dy = abs(y - yj);
+                for (int z = z0; z < z1; z++)
+                {
+                    int dz = abs(z - zj);
+                    SiteID s = grid.getIndexS(x, y, z);
+
+                    if (dx < cutoff && R1[dx][dy][dz] < cutoff)
+                    {
+                        if (gauss)
+                        {
+                            direct[s] += prefactor * iR[dx][dy][dz] * charge * eR[dx][dy][dz];
+                        }
+                        else
+                        {
+                            direct[s] += prefactor * iR[dx][dy][dz] * charge;
+                        }
+                        if (images)
+                        {
+                            source[s] += prefactor * iR[dx][dy][dz] * charge;
+                        }
+                    }
+
+                    if (images && ix < cutoff && R1[ix][dy][dz] < cutoff)
+                    {
+                        source[s] -= prefactor * iR[ix][dy][dz] * charge;
+                    }
+                }
+            }
+        }
+    }
+}
+
+double Potential::defectPotential(SiteID site)
+{
+    // Special agents (drains) live past the end of the grid
+    if (site >= m_defectPotential.size())
+    {
+        return 0.0;
+    }
+    return m_defectPotential[site];
+}
+
+double Potential::defectSourcePotential(SiteID site)
+{
+    if (site >= m_defectSourcePotential.size())
+    {
+        return 0.0;
+    }
+    return m_defectSourcePotential[site];
+}
+
+void Potential::initializeCarrierField()
+{
+    if (!m_world.parameters().coulombIncremental)
+    {
+        return;
+    }
+
+    qDebug("langmuir: building per-site carrier potential");
+
+    qint32 cutoff = m_world.parameters().electrostaticCutoff;
+    boost::multi_array<double, 3>& R1 = m_world.R1();
+    boost::multi_array<double, 3>& iR = m_world.iR();
+    boost::multi_array<double, 3>& eR = m_world.eR();
+    Grid &grid = m_world.electronGrid();
+
+    // Offsets larger than the grid can never connect two sites
+    int max_x = qMin(cutoff, grid.xSize());
+    int max_y = qMin(cutoff, grid.ySize());
+    int max_z = qMin(cutoff, grid.zSize());
+
+    // note : eR[dx][dy][dz] = 1.0 if sigma was 0, so this covers coulomb and gauss
+    double prefactor = m_world.parameters().electrostaticPrefactor;
+    m_carrierFieldStencil.clear();
+    m_carrierFieldStencil.resize(max_x);
+    int stencilSize = 0;
+    for (int dx = 0; dx < max_x; dx++)
+    {
+        for (int dy = -max_y + 1; dy < max_y; dy++)
+        {
+            for (int dz = -max_z + 1; dz < max_z; dz++)
+            {
+                int ady = abs(dy);
+                int adz = abs(dz);
+                if (R1[dx][ady][adz] < cutoff && iR[dx][ady][adz] > 0)
+                {
+                    CarrierFieldStencil entry;
+                    entry.dy = dy;
+                    entry.dz = dz;
+                    entry.value = qRound64(prefactor * iR[dx][ady][adz] *
+                                           eR[dx][ady][adz] / m_carrierFieldScale);
+                    m_carrierFieldStencil[dx].push_back(entry);
+                    stencilSize += (dx == 0) ? 1 : 2;
+                }
+            }
+        }
+    }
+    qDebug("langmuir: carrier potential stencil has %d sites", stencilSize);
+
+    m_carrierFieldE.fill(0, int(grid.volume()));
+    m_carrierFieldH.fill(0, int(grid.volume()));
+    m_carrierFieldChanges.clear();
+    m_carrierFieldOn = true;
+
+    // Add the carriers that were placed before the field existed
+    const CarrierStore &electrons = m_world.electrons();
+    for (int i = 0; i < electrons.size(); i++)
+    {
+        int slot = electrons.slot(i);
+        addToCarrierField(electrons.site(slot), electrons.charge(slot));
+    }
+    const CarrierStore &holes = m_world.holes();
+    for (int i = 0; i < holes.size(); i++)
+    {
+        int slot = holes.slot(i);
+        addToCarrierField(holes.site(slot), holes.charge(slot));
+    }
+    updateCarrierField();
+}
+
+void Potential::addToCarrierField(SiteID site, int charge)
+{
+    if (!m_carrierFieldOn)
+    {
+        return;
+    }
+
+    Grid &grid = m_world.electronGrid();
+
+    CarrierFieldChange change;
+    change.x = grid.getIndexX(site);
+    change.y = grid.getIndexY(site);
+    change.z = grid.getIndexZ(site);
+    change.delta = charge;
+    change.electron = (charge < 0);
+
+    QMutexLocker locker(&m_carrierFieldMutex);
+    m_carrierFieldChanges.push_back(change);
+}
+
+void Potential::removeFromCarrierField(SiteID site, int charge)
+{
+    if (!m_carrierFieldOn)
+    {
+        return;
+    }
+
+    Grid &grid = m_world.electronGrid();
+
+    CarrierFieldChange change;
+    change.x = grid.getIndexX(site);
+    change.y = grid.getIndexY(site);
+    change.z = grid.getIndexZ(site);
+    change.delta = -charge;
+    change.electron = (charge < 0);
+
+    QMutexLocker locker(&m_carrierFieldMutex);
+    m_carrierFieldChanges.push_back(change);
+}
+
+void Potential::updateCarrierField()
+{
+    if (!m_carrierFieldOn || m_carrierFieldChanges.isEmpty())
+    {
+        return;
+    }
+
+    // Each thread owns a slab of x-planes, so no two threads write the same site
+    int xSize = m_world.electronGrid().xSize();
+    int slabs = qMin(xSize, qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < slabs; i++)
+    {
+        int xBegin = (i * xSize) / slabs;
+        int xEnd = ((i + 1) * xSize) / slabs;
+        sync.addFuture(QtConcurrent::run(this, &Potential::updateCarrierFieldSlab, xBegin, xEnd));
+    }
+    sync.waitForFinished();
+
+    m_carrierFieldChanges.clear();
+}
+
+void Potential::updateCarrierFieldSlab(int xBegin, int xEnd)
+{
+    Grid &grid = m_world.electronGrid();
+    int cutoff = m_carrierFieldStencil.size();
+    int ySize = grid.ySize();
+    int zSize = grid.zSize();
+
+    for (int i = 0; i < m_carrierFieldChanges.size(); i++)
+    {
+        const CarrierFieldChange &change = m_carrierFieldChanges[i];
+        qint64 *field = change.electron ? m_carrierFieldE.data() : m_carrierFieldH.data();
+
+        int x0 = qMax(xBegin, change.x - cutoff + 1);
+        int x1 = qMin(xEnd, change.x + cutoff);
+        for (int x = x0; x < x1; x++)
+        {
+            const QVector<CarrierFieldStencil> &row = m_carrierFieldStencil[abs(x - change.x)];
+            for (int j = 0; j < row.size(); j++)
+            {
+                int y = change.y + row[j].dy;
+                int z = change.z + row[j].dz;
+                if (y >= 0 && y < ySize && z >= 0 && z < zSize)
+                {
+                    field[grid.getIndexS(x, y, z)] += change.delta * row[j].value;
+                }
+            }
+        }
+    }
+}
+
+bool Potential::carrierFieldIsOn()
+{
+    return m_carrierFieldOn;
+}
+
+double Potential::carrierFieldE(SiteID site)
+{
+    // Special agents (drains) live past the end of the grid
+    if (site >= m_carrierFieldE.size())
+    {
+        return 0.0;
+    }
+    return m_carrierFieldE[site] * m_carrierFieldScale;
+}
+
+double Potential::carrierFieldH(SiteID site)
+{
+    // Special agents (drains) live past the end of the grid
+    if (site >= m_carrierFieldH.size())
+    {
+        return 0.0;
+    }
+    return m_carrierFieldH[site] * m_carrierFieldScale;
+}
+
 }
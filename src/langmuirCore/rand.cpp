@@ -1,11 +1,301 @@
 #include "rand.h"
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LANGMUIR_RANDOM_AVX2
+#include <immintrin.h>
+#endif
 
 namespace LangmuirCore
 {
 
-Random::Random(quint64 seed, QObject *parent) : QObject(parent)
+static inline quint64 rotl(quint64 x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * @brief advance one xoshiro256++ state and return its output
+ */
+static quint64 xoshiroNext(quint64 s[4])
+{
+    quint64 result = rotl(s[0] + s[3], 23) + s[0];
+    quint64 t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+/**
+ * @brief advance one xoshiro256++ state by 2^128 numbers
+ */
+static void xoshiroJump(quint64 s[4])
+{
+    static const quint64 jump[4] = {
+        Q_UINT64_C(0x180ec6d33cfd0aba), Q_UINT64_C(0xd5a61266f0c9392c),
+        Q_UINT64_C(0xa9582618e03fc9aa), Q_UINT64_C(0x39abdc4529b1661c)
+    };
+    quint64 t[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 4; i++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            if (jump[i] & (Q_UINT64_C(1) << b))
+            {
+                t[0] ^= s[0];
+                t[1] ^= s[1];
+                t[2] ^= s[2];
+                t[3] ^= s[3];
+            }
+            xoshiroNext(s);
+        }
+    }
+    s[0] = t[0];
+    s[1] = t[1];
+    s[2] = t[2];
+    s[3] = t[3];
+}
+
+/**
+ * @brief exp(-x) at x = k / Bins, to bound the Boltzmann factor in metropolisWithCoupling()
+ */
+class BoltzmannTable
+{
+public:
+    enum { Bins = 64, Size = 40 * Bins + 1 };
+
+    BoltzmannTable()
+    {
+        for (int k = 0; k < Size; k++)
+        {
+            values[k] = exp(-double(k) / Bins);
+        }
+    }
+
+    double values[Size];
+};
+
+static const BoltzmannTable boltzmannTable;
+
+/**
+ * @brief accept a move if randNumber < coupling * exp(-energyChange * inversekT), for energyChange > 0
+ *
+ * The table brackets the Boltzmann factor between two bin edges, which decides
+ * almost every move without calling exp().  When the random number falls between
+ * the bounds (or the energy is off the table) the factor is calculated exactly, so
+ * the result is the same as calculating it every time.
+ */
+static inline bool acceptUphill(double energyChange, double inversekT, double coupling, double randNumber)
+{
+    double x = energyChange * inversekT;
+    double scaled = x * BoltzmannTable::Bins;
+    if (scaled < BoltzmannTable::Size - 1)
+    {
+        int k = int(scaled);
+        double upper = coupling * boltzmannTable.values[k];
+        double lower = coupling * boltzmannTable.values[k + 1];
+
+        // The margins cover the rounding of exp() and of the products
+        if (randNumber < lower * (1.0 - 1e-12))
+        {
+            return true;
+        }
+        if (randNumber >= upper * (1.0 + 1e-12))
+        {
+            return false;
+        }
+    }
+    return coupling * exp(-energyChange * inversekT) > randNumber;
+}
+
+RandomStream::RandomStream() : m_used(4)
+{
+    m_key[0] = 0;
+    m_key[1] = 0;
+    m_counter[0] = 0;
+    m_counter[1] = 0;
+    m_counter[2] = 0;
+    m_counter[3] = 0;
+}
+
+RandomStream::RandomStream(quint64 key, quint32 step, quint32 stream, quint32 id) : m_used(4)
+{
+    m_key[0] = quint32(key);
+    m_key[1] = quint32(key >> 32);
+    m_counter[0] = 0;
+    m_counter[1] = id;
+    m_counter[2] = step;
+    m_counter[3] = stream;
+}
+
+void RandomStream::generate()
+{
+    quint32 c0 = m_counter[0];
+    quint32 c1 = m_counter[1];
+    quint32 c2 = m_counter[2];
+    quint32 c3 = m_counter[3];
+    quint32 k0 = m_key[0];
+    quint32 k1 = m_key[1];
+
+    // Ten Philox rounds, bumping the key between rounds
+    for (int round = 0; round < 10; round++)
+    {
+        quint64 p0 = quint64(0xD2511F53u) * c0;
+        quint64 p1 = quint64(0xCD9E8D57u) * c2;
+        quint32 n0 = quint32(p1 >> 32) ^ c1 ^ k0;
+        quint32 n1 = quint32(p1);
+        quint32 n2 = quint32(p0 >> 32) ^ c3 ^ k1;
+        quint32 n3 = quint32(p0);
+        c0 = n0;
+        c1 = n1;
+        c2 = n2;
+        c3 = n3;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+
+    m_block[0] = c0;
+    m_block[1] = c1;
+    m_block[2] = c2;
+    m_block[3] = c3;
+    m_used = 0;
+
+    m_counter[0] += 1;
+}
+
+quint32 RandomStream::next()
+{
+    if (m_used >= 4)
+    {
+        generate();
+    }
+    return m_block[m_used++];
+}
+
+double RandomStream::random()
+{
+    // 53 random bits
+    quint32 a = next() >> 5;
+    quint32 b = next() >> 6;
+    return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+}
+
+int RandomStream::integer(const int low, const int high)
+{
+    // Reject the top of the range so every value is equally likely
+    quint64 range = quint64(qint64(high) - qint64(low) + 1);
+    quint64 limit = Q_UINT64_C(0x100000000) - (Q_UINT64_C(0x100000000) % range);
+    quint64 value = next();
+    while (value >= limit)
+    {
+        value = next();
+    }
+    return int(qint64(low) + qint64(value % range));
+}
+
+bool RandomStream::metropolisWithCoupling(double energyChange, double inversekT, double coupling)
+{
+    return Random::metropolisWithCoupling(energyChange, inversekT, coupling, random());
+}
+
+bool RandomStream::chooseYes(double percent)
+{
+    if(percent > random())
+    {
+        return true;
+    }
+    return false;
+}
+
+static void firstBlocksScalar(quint64 key, quint32 step, quint32 stream, int begin, int count, quint32 *block)
+{
+    for (int id = begin; id < count; id++)
+    {
+        RandomStream random(key, step, stream, quint32(id));
+        block[id] = random.next();
+        block[count + id] = random.next();
+        block[2 * count + id] = random.next();
+        block[3 * count + id] = random.next();
+    }
+}
+
+#ifdef LANGMUIR_RANDOM_AVX2
+/**
+ * @brief the high and low halves of the 32 x 32 bit products of each lane with a constant
+ */
+__attribute__((target("avx2")))
+static inline void mulhilo(__m256i a, __m256i m, __m256i &hi, __m256i &lo)
+{
+    // The products of the even and the odd lanes, 64 bits each
+    __m256i even = _mm256_mul_epu32(a, m);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+}
+
+__attribute__((target("avx2")))
+static int firstBlocksAVX2(quint64 key, quint32 step, quint32 stream, int count, quint32 *block)
+{
+    const __m256i m0 = _mm256_set1_epi32(int(0xD2511F53u));
+    const __m256i m1 = _mm256_set1_epi32(int(0xCD9E8D57u));
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    int id = 0;
+    for (; id + 8 <= count; id += 8)
+    {
+        // The counters (0, id, step, stream) of eight streams, as in RandomStream::generate()
+        __m256i c0 = _mm256_setzero_si256();
+        __m256i c1 = _mm256_add_epi32(_mm256_set1_epi32(id), lanes);
+        __m256i c2 = _mm256_set1_epi32(int(step));
+        __m256i c3 = _mm256_set1_epi32(int(stream));
+        quint32 k0 = quint32(key);
+        quint32 k1 = quint32(key >> 32);
+
+        for (int round = 0; round < 10; round++)
+        {
+            __m256i hi0, lo0, hi1, lo1;
+            mulhilo(c0, m0, hi0, lo0);
+            mulhilo(c2, m1, hi1, lo1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(int(k0)));
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(int(k1)));
+            c3 = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(block + id), c0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(block + count + id), c1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(block + 2 * count + id), c2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(block + 3 * count + id), c3);
+    }
+    return id;
+}
+#endif
+
+void RandomStream::firstBlocks(quint64 key, quint32 step, quint32 stream, int count, quint32 *block)
+{
+    int done = 0;
+#ifdef LANGMUIR_RANDOM_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        done = firstBlocksAVX2(key, step, stream, count, block);
+    }
+#endif
+
+    // The last few streams
+    firstBlocksScalar(key, step, stream, done, count, block);
+}
+
+Random::Random(quint64 seed, QObject *parent) : QObject(parent), m_generator(MersenneTwister), m_used(BufferSize)
 {
     m_seed = 0;
     if(seed == 0)
@@ -20,6 +310,8 @@ Random::Random(quint64 seed, QObject *parent) : QObject(parent)
 
     boost::uniform_01< double > distribution;
     generator01 = new boost::variate_generator < boost::mt19937 &, boost::uniform_01 < double > >(*twister, distribution);
+
+    seedXoshiro();
 }
 
 Random::~Random()
@@ -44,15 +336,94 @@ void Random::seed(quint64 seed)
         m_seed = static_cast < unsigned int >(seed);
     }
     twister->seed(m_seed);
+    seedXoshiro();
+}
+
+void Random::setGenerator(const QString &name)
+{
+    Generator generator = MersenneTwister;
+    if (name == "xoshiro256")
+    {
+        generator = Xoshiro;
+    }
+    else if (name != "mt19937")
+    {
+        qFatal("langmuir: unknown random number generator: %s", qPrintable(name));
+    }
+
+    if (generator != m_generator)
+    {
+        m_generator = generator;
+        seed(m_seed);
+    }
+}
+
+void Random::seedXoshiro()
+{
+    // Expand the seed with splitmix64
+    quint64 x = m_seed;
+    quint64 s[4];
+    for (int k = 0; k < 4; k++)
+    {
+        x += Q_UINT64_C(0x9e3779b97f4a7c15);
+        quint64 z = x;
+        z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+        s[k] = z ^ (z >> 31);
+    }
+
+    // Every lane starts 2^128 numbers after the one before, so they never overlap
+    for (int j = 0; j < Lanes; j++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            m_state[k][j] = s[k];
+        }
+        xoshiroJump(s);
+    }
+    fill();
 }
 
-double Random::random()
+void Random::fill()
 {
-    return(*generator01)();
+    std::memcpy(m_fillState, m_state, sizeof(m_state));
+
+    // Word-major state so the lane loop works on contiguous values
+    for (int i = 0; i < BufferSize; i += Lanes)
+    {
+        for (int j = 0; j < Lanes; j++)
+        {
+            quint64 s0 = m_state[0][j];
+            quint64 s1 = m_state[1][j];
+            quint64 s2 = m_state[2][j];
+            quint64 s3 = m_state[3][j];
+            m_buffer[i + j] = rotl(s0 + s3, 23) + s0;
+            quint64 t = s1 << 17;
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+            s2 ^= t;
+            m_state[0][j] = s0;
+            m_state[1][j] = s1;
+            m_state[2][j] = s2;
+            m_state[3][j] = rotl(s3, 45);
+        }
+    }
+    m_used = 0;
+}
+
+RandomStream Random::stream(quint32 step, quint32 stream, quint32 id)
+{
+    return RandomStream(m_seed, step, stream, id);
 }
 
 double Random::range(const double low, const double high)
 {
+    if (m_generator != MersenneTwister)
+    {
+        return low + (high - low) * random();
+    }
     boost::uniform_real < double > distribution(low, high);
     boost::variate_generator < boost::mt19937 &, boost::uniform_real < double > >generator(*twister, distribution);
     return generator();
@@ -60,18 +431,18 @@ double Random::range(const double low, const double high)
 
 double Random::normal(const double mean, const double sigma)
 {
+    if (m_generator != MersenneTwister)
+    {
+        // Box-Muller, with u in (0, 1] so the log is finite
+        double u = 1.0 - random();
+        double v = random();
+        return mean + sigma * std::sqrt(-2.0 * std::log(u)) * std::cos(6.283185307179586 * v);
+    }
     boost::normal_distribution<double> distribution(mean, sigma);
     boost::variate_generator < boost::mt19937 &, boost::normal_distribution < double > >  generator(*twister, distribution);
     return generator();
 }
 
-int Random::integer(const int low, const int high)
-{
-    boost::uniform_int < int > distribution(low, high);
-    boost::variate_generator < boost::mt19937 &, boost::uniform_int < int > >generator(*twister, distribution);
-    return generator();
-}
-
 bool Random::metropolis(double energyChange, double inversekT)
 {
     if(energyChange > 0.0)
@@ -90,13 +461,14 @@ bool Random::metropolis(double energyChange, double inversekT)
 
 bool Random::metropolisWithCoupling(double energyChange, double inversekT, double coupling)
 {
-    double randNumber = this->random();
+    return metropolisWithCoupling(energyChange, inversekT, coupling, this->random());
+}
+
+bool Random::metropolisWithCoupling(double energyChange, double inversekT, double coupling, double randNumber)
+{
     if(energyChange > 0.0)
     {
-        if(coupling * exp(-energyChange * inversekT)> randNumber)
-        {
-            return true;
-        }
+        return acceptUphill(energyChange, inversekT, coupling, randNumber);
     }
     else if(coupling > randNumber)
     {
@@ -125,6 +497,10 @@ bool Random::chooseYes(double percent)
 
 QDataStream& operator<<(QDataStream& stream, Random& random)
 {
+    if (random.m_generator != Random::MersenneTwister)
+    {
+        qFatal("langmuir: can not save state of the xoshiro256 random number generator to QDataStream");
+    }
     std::stringstream sstream;
     sstream << *random.twister;
     if (sstream.fail() || sstream.bad())
@@ -152,6 +528,7 @@ QDataStream& operator<<(QDataStream& stream, Random& random)
 
 QDataStream& operator>>(QDataStream& stream, Random& random)
 {
+    random.m_generator = Random::MersenneTwister;
     stream >> random.m_seed;
     switch (stream.status())
     {
@@ -226,6 +603,10 @@ QDataStream& operator>>(QDataStream& stream, Random& random)
 
 QTextStream& operator<<(QTextStream& stream, Random& random)
 {
+    if (random.m_generator != Random::MersenneTwister)
+    {
+        qFatal("langmuir: can not save state of the xoshiro256 random number generator to QTextStream");
+    }
     std::stringstream sstream;
     sstream << *random.twister;
     if (sstream.fail() || sstream.bad())
@@ -257,6 +638,7 @@ QTextStream& operator<<(QTextStream& stream, Random& random)
 
 QTextStream& operator>>(QTextStream& stream, Random& random)
 {
+    random.m_generator = Random::MersenneTwister;
     stream >> random.m_seed;
     switch (stream.status())
     {
@@ -359,7 +741,22 @@ QTextStream& operator>>(QTextStream& stream, Random& random)
 std::ostream& operator<<(std::ostream& stream, Random& random)
 {
     stream << random.m_seed << ' ';
-    stream << *random.twister;
+    if (random.m_generator == Random::MersenneTwister)
+    {
+        stream << *random.twister;
+        return stream;
+    }
+
+    // The state the buffer was filled from, and how much of it was used
+    stream << "xoshiro256";
+    for (int k = 0; k < 4; k++)
+    {
+        for (int j = 0; j < Random::Lanes; j++)
+        {
+            stream << ' ' << random.m_fillState[k][j];
+        }
+    }
+    stream << ' ' << random.m_used;
     return stream;
 }
 
@@ -371,12 +768,45 @@ std::istream& operator>>(std::istream& stream, Random& random)
         qFatal("langmuir: can not load state of random number generator; random.m_seed\n"
                "std::ifstream has failed on write");
     }
-    stream >> *random.twister;
-    if (stream.fail() || stream.bad() || stream.eof())
+
+    // The mt19937 state is all numbers, the xoshiro256 state starts with its name
+    stream >> std::ws;
+    if (stream.peek() != 'x')
+    {
+        random.m_generator = Random::MersenneTwister;
+        stream >> *random.twister;
+        if (stream.fail() || stream.bad() || stream.eof())
+        {
+            qFatal("langmuir: can not load state of random number generator; twister\n"
+                   "std::ifstream has failed on write");
+        }
+        return stream;
+    }
+
+    std::string name;
+    stream >> name;
+    if (name != "xoshiro256")
+    {
+        qFatal("langmuir: can not load state of random number generator; unknown generator %s",
+               name.c_str());
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        for (int j = 0; j < Random::Lanes; j++)
+        {
+            stream >> random.m_state[k][j];
+        }
+    }
+    int used = 0;
+    stream >> used;
+    if (stream.fail() || stream.bad() || used < 0 || used > Random::BufferSize)
     {
-        qFatal("langmuir: can not load state of random number generator; twister\n"
+        qFatal("langmuir: can not load state of random number generator; xoshiro256\n"
                "std::ifstream has failed on write");
     }
+    random.m_generator = Random::Xoshiro;
+    random.fill();
+    random.m_used = used;
     return stream;
 }
 
@@ -0,0 +1,80 @@
+#include "ratetree.h"
+
+namespace LangmuirCore
+{
+
+RateTree::RateTree() : m_leaves(1)
+{
+    m_nodes.fill(0.0, 2);
+}
+
+void RateTree::clear(int size)
+{
+    m_leaves = 1;
+    while (m_leaves < size)
+    {
+        m_leaves *= 2;
+    }
+    m_nodes.fill(0.0, 2 * m_leaves);
+}
+
+void RateTree::reserve(int size)
+{
+    if (size <= m_leaves)
+    {
+        return;
+    }
+
+    QVector<double> rates(m_leaves);
+    for (int i = 0; i < m_leaves; i++)
+    {
+        rates[i] = rate(i);
+    }
+
+    clear(size);
+
+    // Copy the old leaves and rebuild the sums bottom up
+    for (int i = 0; i < rates.size(); i++)
+    {
+        m_nodes[m_leaves + i] = rates[i];
+    }
+    for (int node = m_leaves - 1; node > 0; node--)
+    {
+        m_nodes[node] = m_nodes[2 * node] + m_nodes[2 * node + 1];
+    }
+}
+
+void RateTree::set(int index, double rate)
+{
+    int node = m_leaves + index;
+    m_nodes[node] = rate;
+
+    // Sum the children instead of adding the difference, so round-off does not build up
+    node /= 2;
+    while (node > 0)
+    {
+        m_nodes[node] = m_nodes[2 * node] + m_nodes[2 * node + 1];
+        node /= 2;
+    }
+}
+
+int RateTree::find(double value) const
+{
+    int node = 1;
+    while (node < m_leaves)
+    {
+        int left = 2 * node;
+        if (value < m_nodes[left] || m_nodes[left + 1] <= 0)
+        {
+            node = left;
+        }
+        else
+        {
+            value -= m_nodes[left];
+            node = left + 1;
+        }
+    }
+    return node - m_leaves;
+}
+
+}
@@ -1,7 +1,9 @@
 #include "simulation.h"
 #include "openclhelper.h"
+#include "mpihelper.h"
 #include "parameters.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "sourceagent.h"
 #include "drainagent.h"
 #include "potential.h"
@@ -15,48 +17,114 @@
 #include <QtConcurrent/QtConcurrent>
 #endif
 
+#include <climits>
+#include <cmath>
+
 namespace LangmuirCore
 {
 
-Simulation::Simulation(World &world, QObject *parent):  QObject(parent), m_world(world)
+//! Value of Simulation::m_claims for sites no charge is moving to
+static const int Unclaimed = INT_MAX;
+
+Simulation::Simulation(World &world, QObject *parent):  QObject(parent), m_world(world), m_trapEscape(world), m_walkers(world)
 {
+    selectStepKernel();
 }
 
 Simulation::~Simulation()
 {
 }
 
-void Simulation::performIterations(int nIterations)
+void Simulation::selectStepKernel()
 {
-    // Do some parallel stuff if using Coulomb interactions
-    if (m_world.parameters().coulombCarriers)
+    m_solarCell = (m_world.parameters().simulationType == "solarcell");
+    m_outputIds = m_world.parameters().outputIdsOnDelete;
+
+    switch (ChargeAgent::coulombMode(m_world))
     {
-        for(int i = 0; i < nIterations; ++i)
+    case ChargeAgent::PointCoulomb:
+        selectStepKernel<ChargeAgent::PointCoulomb>();
+        break;
+    case ChargeAgent::GaussianCoulomb:
+        selectStepKernel<ChargeAgent::GaussianCoulomb>();
+        break;
+    case ChargeAgent::CarrierFieldCoulomb:
+        selectStepKernel<ChargeAgent::CarrierFieldCoulomb>();
+        break;
+    default:
+        selectStepKernel<ChargeAgent::NoCoulomb>();
+        break;
+    }
+}
+
+template <ChargeAgent::CoulombMode Coulomb>
+void Simulation::selectStepKernel()
+{
+    if (m_solarCell)
+    {
+        m_stepKernel = m_outputIds ? &Simulation::stepKernel<Coulomb, true, true>
+                                   : &Simulation::stepKernel<Coulomb, true, false>;
+    }
+    else
+    {
+        m_stepKernel = m_outputIds ? &Simulation::stepKernel<Coulomb, false, true>
+                                   : &Simulation::stepKernel<Coulomb, false, false>;
+    }
+}
+
+template <ChargeAgent::CoulombMode Coulomb, bool SolarCell, bool OutputIds>
+void Simulation::stepKernel(int nIterations)
+{
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+
+    // Carriers alone in deep traps can skip ahead (see TrapEscape)
+    bool escape = (Coulomb == ChargeAgent::NoCoulomb && m_world.parameters().trapEscape > 0);
+    if (escape)
+    {
+        m_trapEscape.initialize();
+    }
+
+    // Without Coulomb interactions the carriers can be stepped in batches (see WalkerEngine)
+    bool batched = (Coulomb == ChargeAgent::NoCoulomb && m_world.parameters().carriersBatched);
+    if (batched)
+    {
+        // The drains may have changed since the last call (checkpoints, the viewer)
+        m_walkers.initialize();
+    }
+
+    for(int i = 0; i < nIterations; ++i)
+    {
+        //Store fluxAgent states
+        foreach (FluxAgent* flux, m_world.fluxes())
         {
-            //Store fluxAgent states
-            foreach (FluxAgent* flux, m_world.fluxes())
-            {
-                flux->storeLast();
-            }
+            flux->storeLast();
+        }
 
-            QList<ChargeAgent*> &electrons = m_world.electrons();
-            QList<ChargeAgent*> &holes = m_world.holes();
+        // Move the trapped carriers whose exit step has come
+        if (escape)
+        {
+            m_trapEscape.beginStep();
+        }
 
-            // Select future sites in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->chooseFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->chooseFuture();
-            }
+        // Select future sites
+        if (batched)
+        {
+            // Choose, decide and complete every move, so decideFutures() and nextTick() are skipped below
+            m_walkers.step(OutputIds);
+        }
+        else
+        {
+            chooseFutures();
+        }
 
-            // Calculate the coulomb interactions in parallel some way or another
+        // Calculate the coulomb interactions in parallel some way or another
+        if (Coulomb != ChargeAgent::NoCoulomb)
+        {
             if (m_world.parameters().useOpenCL && m_world.numChargeAgents() > m_world.parameters().openclThreshold)
             {
                 // Use OpenCL if there are a lot of charges
-                if (m_world.parameters().coulombGaussianSigma > 0)
+                if (Coulomb == ChargeAgent::GaussianCoulomb)
                 {
                     m_world.opencl().launchGaussKernel2();
                 }
@@ -75,95 +143,249 @@ void Simulation::performIterations(int nIterations)
                 // m_world.opencl().compareHostAndDeviceForAllCarriers();
 
                 QFutureSynchronizer<void> sync;
-                sync.addFuture(QtConcurrent::map(electrons, Simulation::chargeAgentCoulombInteractionQtConcurrentGPU));
-                sync.addFuture(QtConcurrent::map(holes, Simulation::chargeAgentCoulombInteractionQtConcurrentGPU));
+                sync.addFuture(QtConcurrent::map(electrons.agents(), Simulation::chargeAgentCoulombInteractionQtConcurrentGPU));
+                sync.addFuture(QtConcurrent::map(holes.agents(), Simulation::chargeAgentCoulombInteractionQtConcurrentGPU));
                 sync.waitForFinished();
             }
             else
             {
+                // Apply the carrier moves from the last step to the per-site carrier potential
+                if (Coulomb == ChargeAgent::CarrierFieldCoulomb)
+                {
+                    m_world.potential().updateCarrierField();
+                }
+                else
+                {
+                    // Recalculate the long-range potential (does nothing if coulomb.mesh is off)
+                    m_world.potential().updateParticleMesh();
+                }
+
                 // Use multi threaded CPU if there are not many charges or when we can not use OpenCL
                 QFutureSynchronizer<void> sync;
-                sync.addFuture(QtConcurrent::map(electrons, Simulation::chargeAgentCoulombInteractionQtConcurrentCPU));
-                sync.addFuture(QtConcurrent::map(holes, Simulation::chargeAgentCoulombInteractionQtConcurrentCPU));
+                sync.addFuture(QtConcurrent::map(electrons.agents(), &Simulation::coulombKernelQtConcurrentCPU<Coulomb>));
+                sync.addFuture(QtConcurrent::map(holes.agents(), &Simulation::coulombKernelQtConcurrentCPU<Coulomb>));
                 sync.waitForFinished();
             }
+        }
 
-            // Decide future in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->decideFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->decideFuture();
-            }
+        // Decide future
+        if (!batched)
+        {
+            decideFutures();
+        }
 
-            // Recombine holes and electrons
-            performRecombinations();
+        // Recombine holes and electrons
+        performRecombinations<SolarCell>();
 
-            // Now we are done with the charge movement, move them to the next tick!
-            nextTick();
+        // Now we are done with the charge movement, move them to the next tick!
+        if (!batched)
+        {
+            nextTick<OutputIds>();
+        }
+
+        // Perform charge injection at the source
+        performInjections<SolarCell>();
+
+        // Trap the carriers that are alone in a basin, and wake the ones that are not anymore
+        if (escape)
+        {
+            m_trapEscape.endStep(nIterations - i - 1);
+        }
+
+        m_world.parameters().currentStep += 1;
 
-            // Perform charge injection at the source
-            performInjections();
+        // Keep carriers that are close on the grid close in memory (does nothing if carriers.sort is 0)
+        sortCarriers();
 
-            m_world.parameters().currentStep += 1;
+        // Re-solve the mean-field space charge (does nothing if poisson.multigrid is off)
+        updatePoissonPotential();
+
+        // Jump to the next exit if nothing else can happen before it
+        if (escape)
+        {
+            i += skipTrappedSteps(nIterations - i - 1);
         }
     }
 
-    // Skip the parallel stuff if no Coulomb interactions
-    else
+    // Put the trapped carriers where they got to, for the output and checkpoints
+    if (escape)
     {
-        for(int i = 0; i < nIterations; ++i)
-        {
-            //Store fluxAgent states
-            foreach (FluxAgent* flux, m_world.fluxes())
-            {
-                flux->storeLast();
-            }
+        m_trapEscape.wakeAll();
+    }
+}
 
-            QList<ChargeAgent*> &electrons = m_world.electrons();
-            QList<ChargeAgent*> &holes = m_world.holes();
+void Simulation::performSlabStep()
+{
+    MpiHelper &mpi = m_world.mpi();
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+    CarrierStore *stores[2] = { &electrons, &holes };
 
-            // Select future sites in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
-            {
-                electrons.at(i)->chooseFuture();
-            }
-            for (int i = 0; i < holes.size(); i++)
-            {
-                holes.at(i)->chooseFuture();
-            }
+    //Store fluxAgent states
+    foreach (FluxAgent* flux, m_world.fluxes())
+    {
+        flux->storeLast();
+    }
 
-            // Decide future in serial (because random number generator is being used)
-            for (int i = 0; i < electrons.size(); i++)
+    mpi.beginStep();
+    for (int phase = 0; phase < 2; phase++)
+    {
+        // See the carriers of the neighbor next to the moving half of the slab
+        mpi.exchangeGhosts(phase);
+
+        // Select future sites (every index is used once per step, for random.counter)
+        for (int j = 0; j < 2; j++)
+        {
+            CarrierStore &charges = *stores[j];
+            for (int i = 0; i < charges.size(); i++)
             {
-                electrons.at(i)->decideFuture();
+                if (mpi.isActive(charges, i, phase))
+                {
+                    charges.at(i)->chooseFuture(2 * i + phase);
+                }
             }
-            for (int i = 0; i < holes.size(); i++)
+        }
+
+        // Decide future
+        for (int j = 0; j < 2; j++)
+        {
+            CarrierStore &charges = *stores[j];
+            for (int i = 0; i < charges.size(); i++)
             {
-                holes.at(i)->decideFuture();
+                if (mpi.isActive(charges, i, phase))
+                {
+                    charges.at(i)->decideFuture();
+                    mpi.markDone(charges, i);
+                }
             }
+        }
 
-            // Recombine holes and electrons
-            performRecombinations();
+        // The charges that did not move keep their site
+        nextTick<false>();
 
-            // Now we are done with the charge movement, move them to the next tick!
-            nextTick();
+        // Hand the charges that left the slab over to the neighbors
+        mpi.clearGhosts();
+        mpi.migrateCarriers();
+    }
+
+    // Perform charge injection at the sources this rank owns, limited by the carriers on all ranks
+    mpi.countCarriers();
+    int xLast = m_world.parameters().gridX - 1;
+    if (mpi.ownsX(0))     { m_world.electronSourceAgentLeft().tryToInject();  }
+    if (mpi.ownsX(xLast)) { m_world.electronSourceAgentRight().tryToInject(); }
+    if (mpi.ownsX(0))     { m_world.holeSourceAgentLeft().tryToInject();      }
+    if (mpi.ownsX(xLast)) { m_world.holeSourceAgentRight().tryToInject();     }
 
-            // Perform charge injection at the source
-            performInjections();
+    m_world.parameters().currentStep += 1;
 
-            m_world.parameters().currentStep += 1;
+    // Keep carriers that are close on the grid close in memory (does nothing if carriers.sort is 0)
+    sortCarriers();
+}
+
+qint64 Simulation::acceleratedSteps() const
+{
+    return m_trapEscape.acceleratedSteps();
+}
+
+qint64 Simulation::trapEscapes() const
+{
+    return m_trapEscape.escapes();
+}
+
+qint64 Simulation::skippedSteps() const
+{
+    return m_trapEscape.skippedSteps();
+}
+
+int Simulation::skipTrappedSteps(int stepsLeft)
+{
+    int steps = m_trapEscape.stepsUntilExit(stepsLeft);
+    if (steps <= 0)
+    {
+        return 0;
+    }
+
+    // The sources of performInjections() (trap.escape is only for transistors)
+    SourceAgent *sources[4] = { &m_world.electronSourceAgentLeft(), &m_world.electronSourceAgentRight(),
+                                &m_world.holeSourceAgentLeft(), &m_world.holeSourceAgentRight() };
+    for (int i = 0; i < 4; i++)
+    {
+        if (sources[i]->canInject())
+        {
+            return 0;
+        }
+    }
+
+    // Every source still attempts once a step, and fails
+    for (int i = 0; i < 4; i++)
+    {
+        sources[i]->setAttempts(sources[i]->attempts() + steps);
+    }
+    m_trapEscape.skipSteps(steps);
+    m_world.parameters().currentStep += steps;
+    return steps;
+}
+
+void Simulation::sortCarriers()
+{
+    const SimulationParameters &par = m_world.parameters();
+    if (par.carriersSort <= 0 || par.currentStep % par.carriersSort != 0)
+    {
+        return;
+    }
+    m_world.electrons().sort();
+    m_world.holes().sort();
+}
+
+bool Simulation::updatePoissonPotential()
+{
+    const SimulationParameters &par = m_world.parameters();
+    if (!par.poissonMultigrid || par.poissonUpdate <= 0 || par.currentStep % par.poissonUpdate != 0)
+    {
+        return false;
+    }
+    m_world.potential().updatePoissonPotential();
+    return true;
+}
+
+void Simulation::performIterations(int nIterations)
+{
+    // Pick accepted moves from hop rates instead of proposing and rejecting
+    if (m_world.parameters().rejectionFree)
+    {
+        // The world may have changed since the last call (checkpoints, the viewer)
+        initializeRates();
+
+        for(int i = 0; i < nIterations; ++i)
+        {
+            performRejectionFreeStep();
+        }
+    }
+
+    // Every MPI rank steps its own slab of the grid
+    else if (m_world.mpi().isOn())
+    {
+        for(int i = 0; i < nIterations; ++i)
+        {
+            performSlabStep();
         }
     }
 
+    // The step loop specialized for this simulation (see selectStepKernel())
+    else
+    {
+        (this->*m_stepKernel)(nIterations);
+    }
+
     // Update RecombinationAgent probability
     // if (m_world.parameters().simulationType == "solarcell")
     // {
     //    m_world.recombinationAgent().guessProbability();
     // }
 
+    // Collect the fluxes and carriers of all MPI ranks on the root (does nothing without MPI)
+    m_world.mpi().synchronize();
+
     // Save output
     if (m_world.parameters().outputIsOn)
     {
@@ -218,13 +440,23 @@ void Simulation::performIterations(int nIterations)
 
 void Simulation::performRecombinations()
 {
-    if (m_world.parameters().simulationType == "solarcell")
+    if (m_solarCell)
+    {
+        performRecombinations<true>();
+    }
+}
+
+template <bool SolarCell>
+void Simulation::performRecombinations()
+{
+    if (SolarCell)
     {
         if (m_world.parameters().recombinationRate > 0)
         {
-            foreach (ChargeAgent *charge, m_world.electrons())
+            CarrierStore &electrons = m_world.electrons();
+            for (int i = 0; i < electrons.size(); i++)
             {
-                m_world.recombinationAgent().tryToAccept(charge);
+                m_world.recombinationAgent().tryToAccept(electrons.at(i));
             }
         }
     }
@@ -232,7 +464,20 @@ void Simulation::performRecombinations()
 
 void Simulation::performInjections()
 {
-    if (m_world.parameters().simulationType == "solarcell")
+    if (m_solarCell)
+    {
+        performInjections<true>();
+    }
+    else
+    {
+        performInjections<false>();
+    }
+}
+
+template <bool SolarCell>
+void Simulation::performInjections()
+{
+    if (SolarCell)
     {
         m_world.excitonSourceAgent().tryToInject();
 
@@ -352,70 +597,569 @@ void Simulation::balanceCharges()
 //    }
 }
 
+void Simulation::chooseFutures()
+{
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+
+    if (m_world.parameters().parallelStep)
+    {
+        // Every charge has its own random stream, so the order does not matter
+        runParallel(&Simulation::chooseFutureRange, electrons);
+        runParallel(&Simulation::chooseFutureRange, holes);
+        return;
+    }
+
+    // Select future sites in serial (because random number generator is being used)
+    chooseFutureRange(&electrons, 0, electrons.size());
+    chooseFutureRange(&holes, 0, holes.size());
+}
+
+void Simulation::decideFutures()
+{
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+
+    if (m_world.parameters().parallelStep)
+    {
+        // Moves to empty sites only read shared state
+        runParallel(&Simulation::decideFutureRange, electrons);
+        runParallel(&Simulation::decideFutureRange, holes);
+
+        // Moves into drains update the drain counters, so they are decided here
+        CarrierStore *stores[2] = { &electrons, &holes };
+        for (int j = 0; j < 2; j++)
+        {
+            CarrierStore &charges = *stores[j];
+            for (int i = 0; i < charges.size(); i++)
+            {
+                ChargeAgent *charge = charges.at(i);
+                if (charge->getGrid().agentType(charge->getFutureSite()) == Agent::Drain)
+                {
+                    charge->decideFuture();
+                }
+            }
+        }
+        return;
+    }
+
+    // Decide future in serial (because random number generator is being used)
+    decideFutureRange(&electrons, 0, electrons.size());
+    decideFutureRange(&holes, 0, holes.size());
+}
+
+void Simulation::runParallel(void (Simulation::*method)(CarrierStore*, int, int), CarrierStore &charges)
+{
+    int size = charges.size();
+    int chunks = qMin(size, qMax(1, QThreadPool::globalInstance()->maxThreadCount()));
+
+    QFutureSynchronizer<void> sync;
+    for (int i = 0; i < chunks; i++)
+    {
+        int begin = (i * size) / chunks;
+        int end = ((i + 1) * size) / chunks;
+        sync.addFuture(QtConcurrent::run(this, method, &charges, begin, end));
+    }
+    sync.waitForFinished();
+}
+
+void Simulation::chooseFutureRange(CarrierStore *charges, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        charges->at(i)->chooseFuture(i);
+    }
+}
+
+void Simulation::decideFutureRange(CarrierStore *charges, int begin, int end)
+{
+    bool parallel = m_world.parameters().parallelStep;
+    for (int i = begin; i < end; i++)
+    {
+        ChargeAgent *charge = charges->at(i);
+        if (parallel && charge->getGrid().agentType(charge->getFutureSite()) == Agent::Drain)
+        {
+            // See decideFutures()
+            continue;
+        }
+        charge->decideFuture();
+    }
+}
+
+void Simulation::claimFutureRange(CarrierStore *charges, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        ChargeAgent *charge = charges->at(i);
+        SiteID site = charge->getCurrentSite();
+        SiteID fSite = charge->getFutureSite();
+        if (charge->removed() || fSite == site ||
+            charge->getGrid().agentType(fSite) != Agent::Empty)
+        {
+            continue;
+        }
+
+        // Atomic minimum: the lowest index moving to a site keeps the claim
+        QAtomicInt &claim = m_claims[fSite];
+        int current = claim.fetchAndAddOrdered(0);
+        while (i < current && !claim.testAndSetOrdered(current, i))
+        {
+            current = claim.fetchAndAddOrdered(0);
+        }
+    }
+}
+
+void Simulation::resolveFutureRange(CarrierStore *charges, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        ChargeAgent *charge = charges->at(i);
+        SiteID site = charge->getCurrentSite();
+        SiteID fSite = charge->getFutureSite();
+        if (charge->removed() || fSite == site ||
+            charge->getGrid().agentType(fSite) != Agent::Empty)
+        {
+            continue;
+        }
+
+        // A charge earlier in the list is moving there; this is what the serial step does too
+        if (m_claims[fSite].fetchAndAddOrdered(0) != i)
+        {
+            charge->rejectFuture();
+        }
+    }
+}
+
+void Simulation::completeTickRange(CarrierStore *charges, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        ChargeAgent *charge = charges->at(i);
+        SiteID site = charge->getCurrentSite();
+        SiteID fSite = charge->getFutureSite();
+        Agent::Type fType = charge->getGrid().agentType(fSite);
+        bool moving = !charge->removed() && fSite != site && fType == Agent::Empty;
+        bool leaving = charge->removed() || moving || (fSite != site && fType == Agent::Drain);
+
+        charge->completeTick();
+
+        // The free sites are updated afterwards, by one thread (see Grid::setFreeSitesDeferred())
+        m_leftSites[i] = leaving ? site : -1;
+        m_enteredSites[i] = moving ? fSite : -1;
+
+        // Only the winner of a claim gets here, so it resets it for the next step
+        if (moving)
+        {
+            m_claims[fSite].fetchAndStoreOrdered(Unclaimed);
+        }
+    }
+}
+
+void Simulation::nextTick()
+{
+    if (m_outputIds)
+    {
+        nextTick<true>();
+    }
+    else
+    {
+        nextTick<false>();
+    }
+}
+
+template <bool OutputIds>
 void Simulation::nextTick()
 {
     // Iterate over all sites to change their state
-    QList<ChargeAgent*> &electrons = m_world.electrons();
-    QList<ChargeAgent*> &holes = m_world.holes();
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+    CarrierStore *stores[2] = { &electrons, &holes };
 
-    if ( m_world.parameters().outputIdsOnDelete )
+    if (m_world.parameters().parallelStep)
     {
-        for(int i = 0; i < electrons.size(); ++i)
+        // Claims are indexed by site; both grids have the same size
+        SiteID volume = m_world.electronGrid().volume();
+        if (m_claims.size() != volume)
+        {
+            m_claims.fill(QAtomicInt(Unclaimed), int(volume));
+        }
+
+        for (int j = 0; j < 2; j++)
         {
-            electrons[i]->completeTick();
-            // Check if the charge was removed - then we should delete it
-            if(electrons[i]->removed())
+            CarrierStore &charges = *stores[j];
+            runParallel(&Simulation::claimFutureRange, charges);
+            runParallel(&Simulation::resolveFutureRange, charges);
+
+            // The free-site counts are not thread safe, so their updates wait
+            Grid &grid = (charges.type() == Agent::Electron) ? m_world.electronGrid() : m_world.holeGrid();
+            m_leftSites.resize(charges.size());
+            m_enteredSites.resize(charges.size());
+            grid.setFreeSitesDeferred(true);
+            runParallel(&Simulation::completeTickRange, charges);
+            grid.setFreeSitesDeferred(false);
+
+            // Leave and enter in the order the serial nextTick() does
+            for (int i = 0; i < charges.size(); i++)
+            {
+                if (m_leftSites[i] >= 0)
+                {
+                    grid.addFreeSite(m_leftSites[i]);
+                }
+                if (m_enteredSites[i] >= 0)
+                {
+                    grid.removeFreeSite(m_enteredSites[i]);
+                }
+            }
+
+            // Report removed charges in order, then recycle them all at once
+            if (OutputIds)
             {
-                m_world.logger().reportCarrier(*electrons[i]);
-                delete electrons[i];
-                electrons.removeAt(i);
-                --i;
+                for(int i = 0; i < charges.size(); ++i)
+                {
+                    if(charges.at(i)->removed())
+                    {
+                        m_world.logger().reportCarrier(*charges.at(i));
+                    }
+                }
             }
+            charges.compact();
         }
-        for(int i = 0; i < holes.size(); ++i)
+        return;
+    }
+
+    for (int j = 0; j < 2; j++)
+    {
+        CarrierStore &charges = *stores[j];
+        for(int i = 0; i < charges.size(); ++i)
         {
-            holes[i]->completeTick();
-            // Check if the charge was removed - then we should delete it
-            if(holes[i]->removed())
+            charges.at(i)->completeTick();
+            // Check if the charge was removed - then we should report it
+            if(OutputIds && charges.at(i)->removed())
             {
-                m_world.logger().reportCarrier(*holes[i]);
-                delete holes[i];
-                holes.removeAt(i);
-                --i;
+                m_world.logger().reportCarrier(*charges.at(i));
             }
         }
-        //m_world.logger().flush();
+
+        // Recycle the removed charges in one pass
+        charges.compact();
     }
-    else
+}
+
+void Simulation::performRejectionFreeStep()
+{
+    //Store fluxAgent states
+    foreach (FluxAgent* flux, m_world.fluxes())
+    {
+        flux->storeLast();
+    }
+
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+
+    // Every charge exists for one more step, as in ChargeAgent::decideFuture()
+    CarrierStore *stores[2] = { &electrons, &holes };
+    for (int j = 0; j < 2; j++)
+    {
+        CarrierStore &charges = *stores[j];
+        for (int i = 0; i < charges.size(); i++)
+        {
+            charges.lifetime(charges.slot(i)) += 1;
+        }
+    }
+
+    // Accepted moves until the waiting times add up to one step
+    double time = 0.0;
+    while (true)
+    {
+        double total = m_electronRates.total() + m_holeRates.total();
+        if (total <= 0)
+        {
+            break;
+        }
+
+        // Waiting time of the next move, exponentially distributed, in units of steps
+        time -= log(1.0 - m_world.randomNumberGenerator().random()) / total;
+        if (time >= 1.0)
+        {
+            // Waiting times are memoryless, so the rest of the wait is drawn again next step
+            break;
+        }
+
+        performRejectionFreeEvent(total);
+    }
+
+    // Recombine holes and electrons
+    if (m_solarCell && m_world.parameters().recombinationRate > 0)
+    {
+        // RecombinationAgent draws from the electrons' streams, which chooseFuture() seeds in the step loop
+        if (m_world.parameters().randomCounter)
+        {
+            Random &random = m_world.randomNumberGenerator();
+            quint32 step = m_world.parameters().currentStep;
+            for (int i = 0; i < electrons.size(); i++)
+            {
+                electrons.at(i)->randomStream() = random.stream(step, Agent::Electron, i);
+            }
+        }
+
+        performRecombinations();
+
+        // Remember where the recombined charges were before nextTick() recycles them
+        QVector<SiteID> sites[2];
+        for (int j = 0; j < 2; j++)
+        {
+            CarrierStore &charges = *stores[j];
+            for (int i = 0; i < charges.size(); i++)
+            {
+                if (charges.at(i)->removed())
+                {
+                    rates(charges).set(charges.slot(i), 0.0);
+                    sites[j].push_back(charges.at(i)->getCurrentSite());
+                }
+            }
+        }
+
+        if (!sites[0].isEmpty() || !sites[1].isEmpty())
+        {
+            nextTick();
+            m_world.potential().updateCarrierField();
+            for (int j = 0; j < 2; j++)
+            {
+                for (int i = 0; i < sites[j].size(); i++)
+                {
+                    updateRatesNear(*stores[j], sites[j][i]);
+                }
+            }
+        }
+    }
+
+    // Perform charge injection at the source; new charges are added at the end
+    int electronsBefore = electrons.size();
+    int holesBefore = holes.size();
+
+    performInjections();
+
+    m_world.potential().updateCarrierField();
+    m_electronRates.reserve(electrons.capacity());
+    m_holeRates.reserve(holes.capacity());
+    for (int i = electronsBefore; i < electrons.size(); i++)
+    {
+        updateRatesNear(electrons, electrons.site(electrons.slot(i)));
+    }
+    for (int i = holesBefore; i < holes.size(); i++)
+    {
+        updateRatesNear(holes, holes.site(holes.slot(i)));
+    }
+
+    m_world.parameters().currentStep += 1;
+
+    // Every hop rate depends on the grid potential
+    if (updatePoissonPotential())
+    {
+        initializeRates();
+    }
+}
+
+void Simulation::performRejectionFreeEvent(double total)
+{
+    // Pick a charge in proportion to its hop rate
+    double value = m_world.randomNumberGenerator().random() * total;
+    CarrierStore *charges = &m_world.electrons();
+    if (value >= m_electronRates.total() && m_holeRates.total() > 0)
+    {
+        value -= m_electronRates.total();
+        charges = &m_world.holes();
+    }
+    RateTree &tree = rates(*charges);
+    int slot = tree.find(qMin(value, tree.total()));
+    ChargeAgent *charge = charges->agent(slot);
+
+    // Pick a neighbor in proportion to its acceptance probability
+    Grid &grid = charge->getGrid();
+    int range = m_world.parameters().hoppingRange;
+    SiteID site = charge->getCurrentSite();
+    int neighborClass = charge->getNeighborClass();
+    int count = grid.neighborCount(neighborClass, range);
+
+    double sum = 0;
+    m_neighborRates.resize(count);
+    for (int k = 0; k < count; k++)
+    {
+        m_neighborRates[k] = charge->acceptanceProbability(grid.neighbor(site, neighborClass, k, range));
+        sum += m_neighborRates[k];
+    }
+
+    double pick = m_world.randomNumberGenerator().random() * sum;
+    int chosen = -1;
+    for (int k = 0; k < count; k++)
+    {
+        if (m_neighborRates[k] <= 0)
+        {
+            continue;
+        }
+        // Round-off can carry pick past the end; then the last possible neighbor is used
+        chosen = k;
+        if (pick < m_neighborRates[k])
+        {
+            break;
+        }
+        pick -= m_neighborRates[k];
+    }
+    if (chosen < 0)
+    {
+        qFatal("langmuir: rejection-free move picked a charge that can not move");
+    }
+    SiteID fSite = grid.neighbor(site, neighborClass, chosen, range);
+
+    // Perform the move
+    if (grid.agentType(fSite) == Agent::Drain)
     {
-        for(int i = 0; i < electrons.size(); ++i)
+        DrainAgent *drain = dynamic_cast<DrainAgent*>(grid.agentAddress(fSite));
+        if(!drain)
         {
-            electrons[i]->completeTick();
-            // Check if the charge was removed - then we should delete it
-            if(electrons[i]->removed())
+            qFatal("langmuir: can not cast pointer to DrainAgent");
+        }
+        drain->countAccepted();
+    }
+    charge->acceptFuture(fSite);
+    charge->completeTick();
+
+    // Charges that entered a drain are recycled right away
+    if (charge->removed())
+    {
+        tree.set(slot, 0.0);
+        if (m_outputIds)
+        {
+            m_world.logger().reportCarrier(*charge);
+        }
+        charges->remove(charges->indexOf(slot));
+        fSite = -1;
+    }
+
+    m_world.potential().updateCarrierField();
+    updateRatesNear(*charges, site, fSite);
+}
+
+void Simulation::initializeRates()
+{
+    CarrierStore &electrons = m_world.electrons();
+    CarrierStore &holes = m_world.holes();
+
+    m_world.potential().updateCarrierField();
+
+    m_electronRates.clear(electrons.capacity());
+    for (int i = 0; i < electrons.size(); i++)
+    {
+        updateRate(electrons, electrons.slot(i));
+    }
+
+    m_holeRates.clear(holes.capacity());
+    for (int i = 0; i < holes.size(); i++)
+    {
+        updateRate(holes, holes.slot(i));
+    }
+}
+
+void Simulation::updateRate(CarrierStore &charges, int slot)
+{
+    ChargeAgent *charge = charges.agent(slot);
+    Grid &grid = charge->getGrid();
+    int range = m_world.parameters().hoppingRange;
+    SiteID site = charge->getCurrentSite();
+    int neighborClass = charge->getNeighborClass();
+    int count = grid.neighborCount(neighborClass, range);
+
+    // A move is proposed to each neighbor with probability 1 / count
+    double rate = 0;
+    for (int k = 0; k < count; k++)
+    {
+        rate += charge->acceptanceProbability(grid.neighbor(site, neighborClass, k, range));
+    }
+    rates(charges).set(slot, rate / count);
+}
+
+void Simulation::updateRatesNear(CarrierStore &charges, SiteID site, SiteID other)
+{
+    Grid &grid = (charges.type() == Agent::Electron) ? m_world.electronGrid() : m_world.holeGrid();
+    SiteID volume = grid.volume();
+    int range = m_world.parameters().hoppingRange;
+
+    if (m_world.potential().carrierFieldIsOn())
+    {
+        // The carrier potential changed within the cutoff of the sites; a charge depends on
+        // the potential at its own site and the sites it can hop to
+        int reach = m_world.parameters().electrostaticCutoff + range;
+        SiteID sites[2] = { site, other };
+
+        CarrierStore *stores[2] = { &m_world.electrons(), &m_world.holes() };
+        for (int j = 0; j < 2; j++)
+        {
+            CarrierStore &nearby = *stores[j];
+            for (int i = 0; i < nearby.size(); i++)
             {
-                delete electrons[i];
-                electrons.removeAt(i);
-                --i;
+                int slot = nearby.slot(i);
+                SiteID s = nearby.site(slot);
+                for (int n = 0; n < 2; n++)
+                {
+                    if (sites[n] < 0 || sites[n] >= volume)
+                    {
+                        continue;
+                    }
+                    int dx = grid.xDistancei(s, sites[n]);
+                    int dy = grid.yDistancei(s, sites[n]);
+                    int dz = grid.zDistancei(s, sites[n]);
+                    if (dx * dx + dy * dy + dz * dz < reach * reach)
+                    {
+                        updateRate(nearby, slot);
+                        break;
+                    }
+                }
             }
         }
-        for(int i = 0; i < holes.size(); ++i)
+        return;
+    }
+
+    // Only the occupation changed, which matters to charges of the same type that can hop there
+    SiteID sites[2] = { site, other };
+    for (int n = 0; n < 2; n++)
+    {
+        SiteID s = sites[n];
+        if (s < 0 || s >= volume)
         {
-            holes[i]->completeTick();
-            // Check if the charge was removed - then we should delete it
-            if(holes[i]->removed())
+            continue;
+        }
+
+        if (grid.agentType(s) == charges.type())
+        {
+            updateRate(charges, static_cast<ChargeAgent*>(grid.agentAddress(s))->slot());
+        }
+
+        int neighborClass = grid.neighborClass(s, range);
+        int count = grid.neighborCount(neighborClass, range);
+        for (int k = 0; k < count; k++)
+        {
+            SiteID neighbor = grid.neighbor(s, neighborClass, k, range);
+            if (neighbor < volume && grid.agentType(neighbor) == charges.type())
             {
-                delete holes[i];
-                holes.removeAt(i);
-                --i;
+                updateRate(charges, static_cast<ChargeAgent*>(grid.agentAddress(neighbor))->slot());
             }
         }
     }
 }
 
-inline void Simulation::chargeAgentCoulombInteractionQtConcurrentCPU(ChargeAgent * chargeAgent)
+RateTree& Simulation::rates(CarrierStore &charges)
+{
+    if (charges.type() == Agent::Electron)
+    {
+        return m_electronRates;
+    }
+    return m_holeRates;
+}
+
+template <ChargeAgent::CoulombMode Coulomb>
+void Simulation::coulombKernelQtConcurrentCPU(ChargeAgent * chargeAgent)
 {
-    chargeAgent->coulombCPU();
+    chargeAgent->coulombKernel<Coulomb>();
 }
 
 inline void Simulation::chargeAgentCoulombInteractionQtConcurrentGPU(ChargeAgent * chargeAgent)
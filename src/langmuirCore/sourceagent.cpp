@@ -1,5 +1,6 @@
 #include "sourceagent.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "parameters.h"
 #include "potential.h"
 #include "world.h"
@@ -13,7 +14,7 @@ SourceAgent::SourceAgent(World &world, Grid& grid, QObject *parent)
 {
 }
 
-ElectronSourceAgent::ElectronSourceAgent(World &world, int site, QObject *parent)
+ElectronSourceAgent::ElectronSourceAgent(World &world, SiteID site, QObject *parent)
     : SourceAgent(world, world.electronGrid(), parent)
 {
     initializeSite(site);
@@ -35,7 +36,7 @@ ElectronSourceAgent::ElectronSourceAgent(World &world, Grid::CubeFace cubeFace,
     setObjectName(name);
 }
 
-HoleSourceAgent::HoleSourceAgent(World &world, int site, QObject *parent)
+HoleSourceAgent::HoleSourceAgent(World &world, SiteID site, QObject *parent)
     : SourceAgent(world, world.holeGrid(), parent)
 {
     initializeSite(site);
@@ -70,7 +71,7 @@ ExcitonSourceAgent::ExcitonSourceAgent(World &world, QObject *parent)
 
 bool SourceAgent::tryToSeed()
 {
-    int site = randomSiteID();
+    SiteID site = randomSiteID();
     if(validToInject(site))
     {
         inject(site);
@@ -79,7 +80,7 @@ bool SourceAgent::tryToSeed()
     return false;
 }
 
-bool SourceAgent::tryToSeed(int site)
+bool SourceAgent::tryToSeed(SiteID site)
 {
     if(validToInject(site))
     {
@@ -92,7 +93,7 @@ bool SourceAgent::tryToSeed(int site)
 bool SourceAgent::tryToInject()
 {
     m_attempts += 1;
-    int site = chooseSite();
+    SiteID site = chooseSite();
     if(validToInject(site)&& shouldTransport(site))
     {
         inject(site);
@@ -102,27 +103,27 @@ bool SourceAgent::tryToInject()
     return false;
 }
 
-int SourceAgent::randomSiteID()
+SiteID SourceAgent::randomSiteID()
 {
-    return m_world.randomNumberGenerator().integer(0, m_grid.volume()-1);
+    return m_grid.randomFreeSite(m_world.randomNumberGenerator());
 }
 
-int SourceAgent::randomNeighborSiteID()
+SiteID SourceAgent::randomNeighborSiteID()
 {
     return m_neighbors[m_world.randomNumberGenerator().integer(0, m_neighbors.size()-1)];
 }
 
-int SourceAgent::chooseSite()
+SiteID SourceAgent::chooseSite()
 {
     return randomNeighborSiteID();
 }
 
-int ExcitonSourceAgent::chooseSite()
+SiteID ExcitonSourceAgent::chooseSite()
 {
     return randomSiteID();
 }
 
-double ElectronSourceAgent::energyChange(int site)
+double ElectronSourceAgent::energyChange(SiteID site)
 {
     double p1 = m_potential;
     double p2 = m_grid.potential(site);
@@ -132,16 +133,12 @@ double ElectronSourceAgent::energyChange(int site)
         p2 += m_world.potential().coulombImageH(site);
         p2 += m_world.potential().coulombE(site);
         p2 += m_world.potential().coulombImageE(site);
-        if (m_world.parameters().defectsCharge != 0)
-        {
-            p2 += m_world.potential().coulombD(site);
-            p2 += m_world.potential().coulombImageD(site);
-        }
+        p2 += m_world.potential().defectSourcePotential(site);
     }
     return p1-p2; // its backwards because q=-1 and dE = q*(p2-p1)= p1-p2
 }
 
-double HoleSourceAgent::energyChange(int site)
+double HoleSourceAgent::energyChange(SiteID site)
 {
     double p1 = m_potential;
     double p2 = m_grid.potential(site);
@@ -151,21 +148,17 @@ double HoleSourceAgent::energyChange(int site)
         p2 += m_world.potential().coulombImageH(site);
         p2 += m_world.potential().coulombE(site);
         p2 += m_world.potential().coulombImageE(site);
-        if (m_world.parameters().defectsCharge != 0)
-        {
-            p2 += m_world.potential().coulombD(site);
-            p2 += m_world.potential().coulombImageD(site);
-        }
+        p2 += m_world.potential().defectSourcePotential(site);
     }
     return p2-p1;
 }
 
-double ExcitonSourceAgent::energyChange(int site)
+double ExcitonSourceAgent::energyChange(SiteID site)
 {
     return 0;
 }
 
-bool SourceAgent::shouldTransport(int site)
+bool SourceAgent::shouldTransport(SiteID site)
 {
     if (m_world.parameters().sourceMetropolis)
     {
@@ -175,74 +168,79 @@ bool SourceAgent::shouldTransport(int site)
     return m_world.randomNumberGenerator().chooseYes(m_probability);
 }
 
-bool ExcitonSourceAgent::shouldTransport(int site)
+bool ExcitonSourceAgent::shouldTransport(SiteID site)
 {
     return m_world.randomNumberGenerator().chooseYes(m_probability);
 }
 
-void ElectronSourceAgent::inject(int site)
+void ElectronSourceAgent::inject(SiteID site)
 {
-    ElectronAgent *electron = new ElectronAgent(m_world, site);
-    m_world.electrons().push_back(electron);
+    m_world.electrons().create(site);
 }
 
-void HoleSourceAgent::inject(int site)
+void HoleSourceAgent::inject(SiteID site)
 {
-    HoleAgent *hole = new HoleAgent(m_world, site);
-    m_world.holes().push_back(hole);
+    m_world.holes().create(site);
 }
 
-void ExcitonSourceAgent::inject(int site)
+void ExcitonSourceAgent::inject(SiteID site)
 {
-    ElectronAgent *electron = new ElectronAgent(m_world, site);
-    m_world.electrons().push_back(electron);
+    m_world.electrons().create(site);
+    m_world.holes().create(site);
+}
 
-    HoleAgent *hole = new HoleAgent(m_world, site);
-    m_world.holes().push_back(hole);
+bool ElectronSourceAgent::canInject()
+{
+    return !m_world.atMaxElectrons() && m_probability > 0;
 }
 
-bool ElectronSourceAgent::validToInject(int site)
+bool ElectronSourceAgent::validToInject(SiteID site)
 {
-    if( m_world.numElectronAgents() >= m_world.maxElectronAgents() ||
-        m_probability <= 0 ||
+    if( !canInject() ||
         site < 0 ||
         site >= m_grid.volume()||
         m_grid.agentType(site)!= Agent::Empty ||
-        m_grid.agentAddress(site)!= 0 ||
-        m_world.defectSiteIDs().contains(site))
+        m_grid.agentAddress(site)!= 0)
     {
         return false;
     }
     return true;
 }
 
-bool HoleSourceAgent::validToInject(int site)
+bool HoleSourceAgent::canInject()
+{
+    return !m_world.atMaxHoles() && m_probability > 0;
+}
+
+bool HoleSourceAgent::validToInject(SiteID site)
 {
-    if( m_world.numHoleAgents() >= m_world.maxHoleAgents() ||
-        m_probability <= 0 ||
+    if( !canInject() ||
         site < 0 ||
         site >= m_grid.volume()||
         m_grid.agentType(site)!= Agent::Empty ||
-        m_grid.agentAddress(site)!= 0 ||
-        m_world.defectSiteIDs().contains(site))
+        m_grid.agentAddress(site)!= 0)
     {
         return false;
     }
     return true;
 }
 
-bool ExcitonSourceAgent::validToInject(int site)
+bool ExcitonSourceAgent::canInject()
+{
+    return m_world.numElectronAgents() < m_world.maxElectronAgents() &&
+           m_world.numHoleAgents() < m_world.maxHoleAgents() &&
+           m_probability > 0;
+}
+
+bool ExcitonSourceAgent::validToInject(SiteID site)
 {
-    if( m_world.numElectronAgents() >= m_world.maxElectronAgents() ||
-        m_world.numHoleAgents() >= m_world.maxHoleAgents() ||
-        m_probability <= 0 ||
+    if( !canInject() ||
         site < 0 ||
         site >= m_world.electronGrid().volume()||
         m_world.electronGrid().agentType(site)!= Agent::Empty ||
         m_world.holeGrid().agentType(site)!= Agent::Empty ||
         m_world.electronGrid().agentAddress(site)!= 0 ||
-        m_world.holeGrid().agentAddress(site)!= 0 ||
-        m_world.defectSiteIDs().contains(site))
+        m_world.holeGrid().agentAddress(site)!= 0)
     {
         return false;
     }
@@ -0,0 +1,677 @@
+#include "trapescape.h"
+#include "carrierstore.h"
+#include "chargeagent.h"
+#include "fluxagent.h"
+#include "cubicgrid.h"
+#include "world.h"
+#include "rand.h"
+
+#include <cmath>
+
+namespace LangmuirCore
+{
+
+//! The largest basin used; the step matrix has one row and column per site
+static const int MaxBasinSites = 64;
+
+//! Counter-based random streams of the exits and wake ups (Potential and MpiHelper use Agent::SIZE and Agent::SIZE + 1)
+static const quint32 TrapStream = Agent::SIZE + 2;
+static const quint32 WakeStream = Agent::SIZE + 3;
+
+TrapEscape::TrapEscape(World &world) : m_world(world), m_initialized(false), m_acceleratedSteps(0), m_escapes(0),
+    m_skippedSteps(0)
+{
+    for (int j = 0; j < 2; j++)
+    {
+        m_landscapes[j].charges = 0;
+        m_landscapes[j].grid = 0;
+        m_landscapes[j].trapped = 0;
+    }
+}
+
+void TrapEscape::SiteTable::reset(Grid &grid)
+{
+    isSparse = grid.isSparse();
+    sparse.clear();
+    dense.clear();
+    if (!isSparse)
+    {
+        dense.fill(0, grid.volume());
+    }
+}
+
+qint32 TrapEscape::SiteTable::value(SiteID site) const
+{
+    return isSparse ? sparse.value(site, 0) : dense[site];
+}
+
+void TrapEscape::SiteTable::add(SiteID site, qint32 amount)
+{
+    if (!isSparse)
+    {
+        dense[site] += amount;
+        return;
+    }
+    qint32 &number = sparse[site];
+    number += amount;
+    if (number == 0)
+    {
+        sparse.remove(site);
+    }
+}
+
+void TrapEscape::initialize()
+{
+    if (m_initialized)
+    {
+        return;
+    }
+
+    // Carriers are injected onto and leave from these sites
+    QHash<SiteID, int> sources;
+    foreach (FluxAgent *flux, m_world.fluxes())
+    {
+        foreach (SiteID site, flux->getNeighbors())
+        {
+            sources.insert(site, 1);
+        }
+    }
+
+    m_landscapes[0].charges = &m_world.electrons();
+    m_landscapes[0].grid = &m_world.electronGrid();
+    m_landscapes[1].charges = &m_world.holes();
+    m_landscapes[1].grid = &m_world.holeGrid();
+    for (int j = 0; j < 2; j++)
+    {
+        m_landscapes[j].basinOf.reset(*m_landscapes[j].grid);
+        m_landscapes[j].watched.reset(*m_landscapes[j].grid);
+        findBasins(m_landscapes[j], sources);
+    }
+
+    m_initialized = true;
+}
+
+void TrapEscape::beginStep()
+{
+    for (int i = 0; i < m_trapped.size(); i++)
+    {
+        Trapped &trapped = m_trapped[i];
+        if (!trapped.exiting && trapped.exitAfter == trapped.elapsed)
+        {
+            // Make the exit move; Simulation::nextTick() completes it (or aborts it if the site was taken)
+            trapped.charge->jumpTo(trapped.exitFrom);
+            trapped.charge->acceptFuture(trapped.exitTo);
+            trapped.exiting = true;
+        }
+    }
+}
+
+void TrapEscape::endStep(int stepsLeft)
+{
+    // Let go of the carriers that left
+    for (int i = 0; i < m_trapped.size(); i++)
+    {
+        m_acceleratedSteps += 1;
+        if (m_trapped[i].exiting)
+        {
+            release(m_trapped[i]);
+            m_trapped.remove(i);
+            i--;
+        }
+        else
+        {
+            m_trapped[i].elapsed += 1;
+        }
+    }
+
+    for (int j = 0; j < 2; j++)
+    {
+        Landscape &landscape = m_landscapes[j];
+
+        // Wake the carriers whose zone another carrier entered
+        if (landscape.trapped > 0)
+        {
+            foreach (ChargeAgent *charge, landscape.charges->agents())
+            {
+                SiteID site = charge->getCurrentSite();
+                if (charge->trapped() || landscape.watched.value(site) == 0)
+                {
+                    continue;
+                }
+                for (int i = 0; i < m_trapped.size(); i++)
+                {
+                    Trapped &trapped = m_trapped[i];
+                    if (trapped.landscape == &landscape &&
+                        landscape.basins[trapped.basin].zone.contains(site))
+                    {
+                        wake(trapped);
+                        m_trapped.remove(i);
+                        i--;
+                    }
+                }
+            }
+        }
+
+        // Trap the carriers that are alone in a basin
+        if (stepsLeft > 0 && !landscape.basins.isEmpty())
+        {
+            foreach (ChargeAgent *charge, landscape.charges->agents())
+            {
+                if (charge->trapped())
+                {
+                    continue;
+                }
+                int basin = landscape.basinOf.value(charge->getCurrentSite()) - 1;
+                if (basin >= 0)
+                {
+                    trap(landscape, charge, basin, stepsLeft);
+                }
+            }
+        }
+    }
+}
+
+void TrapEscape::wakeAll()
+{
+    for (int i = 0; i < m_trapped.size(); i++)
+    {
+        if (m_trapped[i].exiting)
+        {
+            release(m_trapped[i]);
+        }
+        else
+        {
+            wake(m_trapped[i]);
+        }
+    }
+    m_trapped.clear();
+}
+
+int TrapEscape::stepsUntilExit(int stepsLeft) const
+{
+    if (m_trapped.isEmpty() || stepsLeft <= 0)
+    {
+        return 0;
+    }
+
+    // A carrier that is not trapped still moves every step
+    for (int j = 0; j < 2; j++)
+    {
+        if (m_landscapes[j].trapped != m_landscapes[j].charges->size())
+        {
+            return 0;
+        }
+    }
+
+    // The earliest exit move is made in beginStep() once elapsed reaches exitAfter
+    int steps = stepsLeft;
+    for (int i = 0; i < m_trapped.size(); i++)
+    {
+        const Trapped &trapped = m_trapped[i];
+        if (trapped.exiting)
+        {
+            return 0;
+        }
+        if (trapped.exitAfter >= 0)
+        {
+            steps = qMin(steps, trapped.exitAfter - trapped.elapsed);
+        }
+    }
+    return qMax(steps, 0);
+}
+
+void TrapEscape::skipSteps(int steps)
+{
+    for (int i = 0; i < m_trapped.size(); i++)
+    {
+        // Trapped carriers still age, as in ChargeAgent::decideFuture()
+        Trapped &trapped = m_trapped[i];
+        trapped.elapsed += steps;
+        trapped.landscape->charges->lifetime(trapped.charge->slot()) += steps;
+    }
+    m_acceleratedSteps += qint64(steps) * m_trapped.size();
+    m_skippedSteps += steps;
+}
+
+void TrapEscape::findBasins(Landscape &landscape, const QHash<SiteID, int> &sources)
+{
+    Grid &grid = *landscape.grid;
+    int range = m_world.parameters().hoppingRange;
+
+    QHash<SiteID, int> traps;
+    foreach (SiteID site, m_world.trapSiteIDs())
+    {
+        traps.insert(site, 1);
+    }
+
+    // Grow each basin from a trap site over the traps a carrier can hop to
+    QHash<SiteID, int> seen;
+    foreach (SiteID trap, m_world.trapSiteIDs())
+    {
+        if (seen.contains(trap))
+        {
+            continue;
+        }
+
+        Basin basin;
+        basin.sites.push_back(trap);
+        seen.insert(trap, 1);
+        for (int i = 0; i < basin.sites.size(); i++)
+        {
+            SiteID site = basin.sites[i];
+            int c = grid.neighborClass(site, range);
+            int count = grid.neighborCount(c, range);
+            for (int k = 0; k < count; k++)
+            {
+                SiteID neighbor = grid.neighbor(site, c, k, range);
+                if (traps.contains(neighbor) && !seen.contains(neighbor))
+                {
+                    basin.sites.push_back(neighbor);
+                    seen.insert(neighbor, 1);
+                }
+            }
+        }
+
+        if (basin.sites.size() > MaxBasinSites)
+        {
+            continue;
+        }
+
+        // Basins next to sources and drains exchange carriers with them
+        bool usable = true;
+        foreach (SiteID site, basin.sites)
+        {
+            if (sources.contains(site))
+            {
+                usable = false;
+            }
+        }
+        if (!usable || !buildBasin(landscape, basin))
+        {
+            continue;
+        }
+        foreach (SiteID site, basin.zone)
+        {
+            if (sources.contains(site))
+            {
+                usable = false;
+            }
+        }
+        if (!usable)
+        {
+            continue;
+        }
+
+        foreach (SiteID site, basin.sites)
+        {
+            landscape.basinOf.add(site, landscape.basins.size() + 1);
+        }
+        landscape.basins.push_back(basin);
+    }
+}
+
+bool TrapEscape::buildBasin(Landscape &landscape, Basin &basin)
+{
+    Grid &grid = *landscape.grid;
+    int range = m_world.parameters().hoppingRange;
+    double inverseKT = m_world.parameters().inverseKT;
+    int charge = landscape.charges->unitCharge();
+    int size = basin.sites.size();
+
+    QHash<SiteID, int> index;
+    for (int i = 0; i < size; i++)
+    {
+        index.insert(basin.sites[i], i);
+    }
+
+    QVector<double> matrix(size * size, 0.0);
+    QVector<double> leaving(size, 0.0);
+    basin.zone = basin.sites;
+    basin.exitProbability.fill(0.0, size);
+    basin.exitSites.resize(size);
+    basin.exitRates.resize(size);
+
+    // The chance per step of each move, as in ChargeAgent::chooseFuture() and ChargeAgent::decideFuture()
+    for (int i = 0; i < size; i++)
+    {
+        SiteID site = basin.sites[i];
+        int c = grid.neighborClass(site, range);
+        int count = grid.neighborCount(c, range);
+        for (int k = 0; k < count; k++)
+        {
+            SiteID neighbor = grid.neighbor(site, c, k, range);
+            if (neighbor >= grid.volume())
+            {
+                // A drain
+                return false;
+            }
+            if (!index.contains(neighbor) && !basin.zone.contains(neighbor))
+            {
+                basin.zone.push_back(neighbor);
+            }
+            if (grid.agentType(neighbor) == Agent::Defect)
+            {
+                continue;
+            }
+
+            double energy = (grid.potential(neighbor) - grid.potential(site)) * charge;
+            double coupling = grid.neighborCoupling(c, k, range);
+            double probability = (energy > 0.0) ? coupling * exp(-energy * inverseKT) : coupling;
+            probability = qMin(probability, 1.0) / count;
+
+            QHash<SiteID, int>::const_iterator j = index.constFind(neighbor);
+            if (j != index.constEnd())
+            {
+                matrix[i * size + j.value()] += probability;
+            }
+            else
+            {
+                basin.exitSites[i].push_back(neighbor);
+                basin.exitRates[i].push_back(probability);
+                basin.exitProbability[i] += probability;
+            }
+        }
+
+        // Rejected moves stay put
+        leaving[i] = basin.exitProbability[i];
+        for (int j = 0; j < size; j++)
+        {
+            leaving[i] += matrix[i * size + j];
+        }
+        matrix[i * size + i] = 1.0 - leaving[i];
+    }
+
+    // Solve (1 - matrix) * meanExit = 1 by Gaussian elimination with partial pivoting
+    // (the diagonal is taken from the moves that leave a site, so deep traps do not cancel out)
+    QVector<double> a(size * size);
+    basin.meanExit.fill(1.0, size);
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            a[i * size + j] = (i == j) ? leaving[i] : -matrix[i * size + j];
+        }
+    }
+    bool closed = false;
+    for (int col = 0; col < size; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < size; row++)
+        {
+            if (fabs(a[row * size + col]) > fabs(a[pivot * size + col]))
+            {
+                pivot = row;
+            }
+        }
+        if (fabs(a[pivot * size + col]) < 1e-300)
+        {
+            // Part of the basin has no way out
+            closed = true;
+            break;
+        }
+        if (pivot != col)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                qSwap(a[col * size + j], a[pivot * size + j]);
+            }
+            qSwap(basin.meanExit[col], basin.meanExit[pivot]);
+        }
+        for (int row = col + 1; row < size; row++)
+        {
+            double factor = a[row * size + col] / a[col * size + col];
+            for (int j = col; j < size; j++)
+            {
+                a[row * size + j] -= factor * a[col * size + j];
+            }
+            basin.meanExit[row] -= factor * basin.meanExit[col];
+        }
+    }
+    if (closed)
+    {
+        basin.meanExit.fill(HUGE_VAL, size);
+    }
+    else
+    {
+        for (int row = size - 1; row >= 0; row--)
+        {
+            double sum = basin.meanExit[row];
+            for (int j = row + 1; j < size; j++)
+            {
+                sum -= a[row * size + j] * basin.meanExit[j];
+            }
+            basin.meanExit[row] = sum / a[row * size + row];
+        }
+    }
+
+    basin.powers.clear();
+    basin.powers.push_back(matrix);
+    return true;
+}
+
+void TrapEscape::ensurePowers(Basin &basin, int power)
+{
+    int size = basin.sites.size();
+    while (basin.powers.size() <= power)
+    {
+        const QVector<double> &last = basin.powers.last();
+        QVector<double> square(size * size, 0.0);
+        for (int i = 0; i < size; i++)
+        {
+            for (int k = 0; k < size; k++)
+            {
+                double value = last[i * size + k];
+                if (value == 0.0)
+                {
+                    continue;
+                }
+                for (int j = 0; j < size; j++)
+                {
+                    square[i * size + j] += value * last[k * size + j];
+                }
+            }
+        }
+        basin.powers.push_back(square);
+    }
+}
+
+bool TrapEscape::trap(Landscape &landscape, ChargeAgent *charge, int basinIndex, int stepsLeft)
+{
+    Basin &basin = landscape.basins[basinIndex];
+    SiteID site = charge->getCurrentSite();
+    int start = basin.sites.indexOf(site);
+    if (basin.meanExit[start] < m_world.parameters().trapEscape)
+    {
+        return false;
+    }
+
+    // The chain is only right if no other carrier can get in the way
+    Agent::Type type = landscape.charges->type();
+    foreach (SiteID other, basin.zone)
+    {
+        if (other != site && landscape.grid->agentType(other) == type)
+        {
+            return false;
+        }
+    }
+
+    Trapped trapped;
+    trapped.charge = charge;
+    trapped.landscape = &landscape;
+    trapped.basin = basinIndex;
+    trapped.start = start;
+    trapped.elapsed = 0;
+    trapped.exitAfter = -1;
+    trapped.exitFrom = site;
+    trapped.exitTo = site;
+    trapped.exiting = false;
+
+    // Find the last step the carrier is still in the basin, or stepsLeft if it is still there after the run
+    int power = 0;
+    while ((2 << power) <= stepsLeft && power < 30)
+    {
+        power++;
+    }
+    ensurePowers(basin, power);
+
+    seed(landscape, charge, TrapStream);
+    double survival = uniform();
+    QVector<double> row(basin.sites.size(), 0.0);
+    row[start] = 1.0;
+    int steps = 0;
+    for (int p = power; p >= 0; p--)
+    {
+        if (steps + (1 << p) > stepsLeft)
+        {
+            continue;
+        }
+        QVector<double> next = row;
+        multiply(basin, p, next);
+        double total = 0.0;
+        foreach (double value, next)
+        {
+            total += value;
+        }
+        if (total > survival)
+        {
+            row = next;
+            steps += (1 << p);
+        }
+    }
+
+    // The carrier leaves in the step after that, from a site weighted by the chance of leaving from it
+    if (steps < stepsLeft)
+    {
+        QVector<double> weights(row.size());
+        double total = 0.0;
+        for (int i = 0; i < row.size(); i++)
+        {
+            weights[i] = row[i] * basin.exitProbability[i];
+            total += weights[i];
+        }
+        if (total > 0.0)
+        {
+            int from = pick(weights);
+            trapped.exitAfter = steps;
+            trapped.exitFrom = basin.sites[from];
+            trapped.exitTo = basin.exitSites[from][pick(basin.exitRates[from])];
+            m_escapes += 1;
+        }
+    }
+
+    charge->setTrapped(true);
+    foreach (SiteID other, basin.zone)
+    {
+        landscape.watched.add(other, 1);
+    }
+    landscape.trapped += 1;
+    m_trapped.push_back(trapped);
+    return true;
+}
+
+void TrapEscape::wake(Trapped &trapped)
+{
+    Basin &basin = trapped.landscape->basins[trapped.basin];
+
+    // Where the chain is after the elapsed steps, given that it has not left
+    QVector<double> row(basin.sites.size(), 0.0);
+    row[trapped.start] = 1.0;
+    for (int p = 0; (trapped.elapsed >> p) > 0; p++)
+    {
+        if ((trapped.elapsed >> p) & 1)
+        {
+            ensurePowers(basin, p);
+            multiply(basin, p, row);
+        }
+    }
+
+    double total = 0.0;
+    foreach (double value, row)
+    {
+        total += value;
+    }
+    if (total > 0.0)
+    {
+        seed(*trapped.landscape, trapped.charge, WakeStream);
+        trapped.charge->jumpTo(basin.sites[pick(row)]);
+    }
+    release(trapped);
+}
+
+void TrapEscape::release(Trapped &trapped)
+{
+    Landscape &landscape = *trapped.landscape;
+    trapped.charge->setTrapped(false);
+    foreach (SiteID site, landscape.basins[trapped.basin].zone)
+    {
+        landscape.watched.add(site, -1);
+    }
+    landscape.trapped -= 1;
+}
+
+void TrapEscape::multiply(Basin &basin, int power, QVector<double> &row)
+{
+    int size = basin.sites.size();
+    const QVector<double> &matrix = basin.powers[power];
+    m_scratch.fill(0.0, size);
+    for (int i = 0; i < size; i++)
+    {
+        double value = row[i];
+        if (value == 0.0)
+        {
+            continue;
+        }
+        for (int j = 0; j < size; j++)
+        {
+            m_scratch[j] += value * matrix[i * size + j];
+        }
+    }
+    qSwap(row, m_scratch);
+}
+
+int TrapEscape::pick(const QVector<double> &weights)
+{
+    double total = 0.0;
+    int last = 0;
+    for (int i = 0; i < weights.size(); i++)
+    {
+        total += weights[i];
+        if (weights[i] > 0.0)
+        {
+            last = i;
+        }
+    }
+
+    double value = uniform() * total;
+    for (int i = 0; i < weights.size(); i++)
+    {
+        value -= weights[i];
+        if (value < 0.0)
+        {
+            return i;
+        }
+    }
+    return last;
+}
+
+void TrapEscape::seed(Landscape &landscape, ChargeAgent *charge, quint32 stream)
+{
+    // Keyed by the step and the carrier, like ChargeAgent::chooseFuture(); slots are unique per type
+    const SimulationParameters &par = m_world.parameters();
+    if (par.randomCounter)
+    {
+        quint32 id = quint32(charge->slot()) * 2 + quint32(&landscape - m_landscapes);
+        m_stream = m_world.randomNumberGenerator().stream(par.currentStep, stream, id);
+    }
+}
+
+double TrapEscape::uniform()
+{
+    if (m_world.parameters().randomCounter)
+    {
+        return m_stream.random();
+    }
+    return m_world.randomNumberGenerator().random();
+}
+
+}
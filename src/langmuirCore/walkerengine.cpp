@@ -0,0 +1,143 @@
+#include "walkerengine.h"
+#include "carrierstore.h"
+#include "chargeagent.h"
+#include "cubicgrid.h"
+#include "writer.h"
+#include "world.h"
+#include "rand.h"
+
+namespace LangmuirCore
+{
+
+//! Value of WalkerEngine::m_targets for charges that stay where they are
+static const SiteID Staying = -1;
+
+//! Value of WalkerEngine::m_targets for charges the ChargeAgent decided itself
+static const SiteID Decided = -2;
+
+WalkerEngine::WalkerEngine(World &world) : m_world(world)
+{
+}
+
+void WalkerEngine::initialize()
+{
+    copyStencil(m_world.electronGrid(), m_electronStencil);
+    copyStencil(m_world.holeGrid(), m_holeStencil);
+}
+
+void WalkerEngine::step(bool outputIds)
+{
+    // Electrons first, as in Simulation::nextTick(); the grids of the two do not share sites
+    step(m_world.electrons(), m_world.electronGrid(), m_electronStencil, outputIds);
+    step(m_world.holes(), m_world.holeGrid(), m_holeStencil, outputIds);
+}
+
+void WalkerEngine::copyStencil(Grid &grid, Stencil &stencil)
+{
+    int range = m_world.parameters().hoppingRange;
+    int classes = grid.neighborClassCount(range);
+
+    stencil.begin.resize(classes);
+    stencil.count.resize(classes);
+    stencil.limit.resize(classes);
+    stencil.offset.clear();
+    stencil.drain.clear();
+    stencil.coupling.clear();
+
+    for (int c = 0; c < classes; c++)
+    {
+        int count = grid.neighborCount(c, range);
+        stencil.begin[c] = stencil.offset.size();
+        stencil.count[c] = quint32(count);
+        stencil.limit[c] = Q_UINT64_C(0x100000000) - (Q_UINT64_C(0x100000000) % quint64(count));
+        for (int k = 0; k < count; k++)
+        {
+            // The neighbor of site 0 is the offset, unless it is a drain (past the end of the grid)
+            SiteID neighbor = grid.neighbor(0, c, k, range);
+            bool drain = (neighbor >= grid.volume());
+            stencil.offset.push_back(drain ? 0 : int(neighbor));
+            stencil.drain.push_back(drain);
+            stencil.coupling.push_back(drain ? 0.0 : grid.neighborCoupling(c, k, range));
+        }
+    }
+}
+
+void WalkerEngine::step(CarrierStore &charges, Grid &grid, const Stencil &stencil, bool outputIds)
+{
+    int size = charges.size();
+    const QVector<ChargeAgent*> &agents = charges.agents();
+    const QVector<int> &activeSlots = charges.activeSlots();
+    double inverseKT = m_world.parameters().inverseKT;
+
+    // The first block of the stream of every charge, the same one ChargeAgent::chooseFuture() draws from
+    m_blocks.resize(4 * size);
+    RandomStream::firstBlocks(m_world.randomNumberGenerator().seed(), m_world.parameters().currentStep,
+                              charges.type(), size, m_blocks.data());
+    const quint32 *pick = m_blocks.constData();
+    const quint32 *high = pick + size;
+    const quint32 *low = high + size;
+
+    // Decide every move against the grid as it was at the start of the step
+    m_targets.resize(size);
+    for (int i = 0; i < size; i++)
+    {
+        ChargeAgent *charge = agents[i];
+        int c = charge->getNeighborClass();
+        int n = stencil.begin[c] + int(pick[i] % stencil.count[c]);
+        if (pick[i] >= stencil.limit[c] || stencil.drain[n])
+        {
+            // Drains keep their own counters, and a redrawn pick needs the rest of the stream
+            charge->chooseFuture(i);
+            charge->decideFuture();
+            m_targets[i] = Decided;
+            continue;
+        }
+
+        int slot = activeSlots[i];
+        charges.lifetime(slot) += 1;
+        m_targets[i] = Staying;
+
+        SiteID site = charges.site(slot);
+        SiteID target = site + stencil.offset[n];
+        if (grid.agentType(target) != Agent::Empty)
+        {
+            continue;
+        }
+
+        // The uniform RandomStream::random() makes from the next two numbers
+        double uniform = ((high[i] >> 5) * 67108864.0 + (low[i] >> 6)) * (1.0 / 9007199254740992.0);
+        double pd = (grid.potential(target) - grid.potential(site)) * charges.charge(slot);
+        if (Random::metropolisWithCoupling(pd, inverseKT, stencil.coupling[n], uniform))
+        {
+            charges.pathlength(slot) += 1;
+            m_targets[i] = target;
+        }
+    }
+
+    // Move in list order; a site taken by an earlier charge this step blocks the move
+    for (int i = 0; i < size; i++)
+    {
+        ChargeAgent *charge = agents[i];
+        SiteID target = m_targets[i];
+        if (target >= 0)
+        {
+            if (grid.agentType(target) == Agent::Empty)
+            {
+                charge->hopTo(target);
+            }
+        }
+        else if (target == Decided)
+        {
+            charge->completeTick();
+            if (outputIds && charge->removed())
+            {
+                m_world.logger().reportCarrier(*charge);
+            }
+        }
+    }
+
+    // Recycle the charges that left through a drain
+    charges.compact();
+}
+
+}
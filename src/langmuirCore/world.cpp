@@ -1,6 +1,8 @@
 #include "parameters.h"
 #include "openclhelper.h"
+#include "mpihelper.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "sourceagent.h"
 #include "drainagent.h"
 #include "potential.h"
@@ -38,6 +40,9 @@ World::World(const QString &fileName, int cores, int gpuID, QObject *parent)
       m_parameters(NULL),
       m_logger(NULL),
       m_ocl(NULL),
+      m_mpi(NULL),
+      m_electrons(NULL),
+      m_holes(NULL),
       m_maxElectrons(0),
       m_maxHoles(0),
       m_maxDefects(0),
@@ -67,6 +72,9 @@ World::World(SimulationParameters &parameters, int cores, int gpuID, QObject *pa
       m_parameters(NULL),
       m_logger(NULL),
       m_ocl(NULL),
+      m_mpi(NULL),
+      m_electrons(NULL),
+      m_holes(NULL),
       m_maxElectrons(0),
       m_maxHoles(0),
       m_maxDefects(0),
@@ -96,6 +104,9 @@ World::World(SimulationParameters &parameters, ConfigurationInfo &configInfo, in
       m_parameters(NULL),
       m_logger(NULL),
       m_ocl(NULL),
+      m_mpi(NULL),
+      m_electrons(NULL),
+      m_holes(NULL),
       m_maxElectrons(0),
       m_maxHoles(0),
       m_maxDefects(0),
@@ -118,17 +129,8 @@ World::~World()
     }
     m_drains.clear();
 
-    for(int i = 0; i < m_electrons.size(); i++)
-    {
-        delete m_electrons[i];
-    }
-    m_electrons.clear();
-
-    for(int i = 0; i < m_holes.size(); i++)
-    {
-        delete m_holes[i];
-    }
-    m_holes.clear();
+    delete m_electrons;
+    delete m_holes;
 
     delete m_rand;
     delete m_potential;
@@ -136,6 +138,7 @@ World::~World()
     delete m_holeGrid;
     delete m_logger;
     delete m_ocl;
+    delete m_mpi;
     delete m_keyValueParser;
     delete m_checkPointer;
 }
@@ -185,6 +188,11 @@ OpenClHelper& World::opencl()
     return *m_ocl;
 }
 
+MpiHelper& World::mpi()
+{
+    return *m_mpi;
+}
+
 QList<SourceAgent*>& World::sources()
 {
     return m_sources;
@@ -280,22 +288,22 @@ RecombinationAgent& World::recombinationAgent()
     return *m_recombinationAgent;
 }
 
-QList<ChargeAgent*>& World::electrons()
+CarrierStore& World::electrons()
 {
-    return m_electrons;
+    return *m_electrons;
 }
 
-QList<ChargeAgent*>& World::holes()
+CarrierStore& World::holes()
 {
-    return m_holes;
+    return *m_holes;
 }
 
-QList<int>& World::defectSiteIDs()
+QList<SiteID>& World::defectSiteIDs()
 {
     return m_defectSiteIDs;
 }
 
-QList<int>& World::trapSiteIDs()
+QList<SiteID>& World::trapSiteIDs()
 {
     return m_trapSiteIDs;
 }
@@ -371,12 +379,12 @@ int World::maxChargeAgentsAndChargedDefects()
 
 int World::numElectronAgents()
 {
-    return m_electrons.size();
+    return m_electrons->size();
 }
 
 int World::numHoleAgents()
 {
-    return m_holes.size();
+    return m_holes->size();
 }
 
 int World::numChargeAgents()
@@ -466,12 +474,12 @@ double World::percentElectronAgents()
 
 bool World::atMaxElectrons()
 {
-    return numElectronAgents() >= maxElectronAgents();
+    return numElectronAgents() + mpi().remoteElectrons() >= maxElectronAgents();
 }
 
 bool World::atMaxHoles()
 {
-    return numHoleAgents() >= maxHoleAgents();
+    return numHoleAgents() + mpi().remoteHoles() >= maxHoleAgents();
 }
 
 bool World::atMaxCharges()
@@ -564,6 +572,9 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
     }
     checkSimulationParameters(*m_parameters);
 
+    // Use the random number generator asked for (keeps a state loaded from a checkpoint for the same one)
+    m_rand->setGenerator(m_parameters->randomGenerator);
+
     // Change the number of threads
     NodeFileParser nfparser;
     QString hostName = nfparser.hostName();
@@ -586,10 +597,14 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
     qDebug() << "langmuir: random.seed is" << parameters().randomSeed;
 
     // Create Electron Grid
-    m_electronGrid = new Grid(refWorld, this);
+    m_electronGrid = new Grid(refWorld, 0, this);
 
-    // Create Hole Grid
-    m_holeGrid = new Grid(refWorld, this);
+    // Create Hole Grid (with the background potential of the electron grid)
+    m_holeGrid = new Grid(refWorld, m_electronGrid, this);
+
+    // Create Carrier Stores
+    m_electrons = new CarrierStore(Agent::Electron, refWorld, this);
+    m_holes = new CarrierStore(Agent::Hole, refWorld, this);
 
     // Calculate the max number of holes
     m_maxHoles = parameters().holePercentage*double(holeGrid().volume());
@@ -609,6 +624,9 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
     // Create OpenCL Objects
     m_ocl = new OpenClHelper(refWorld, this);
 
+    // Create MPI Objects
+    m_mpi = new MpiHelper(refWorld, this);
+
     // Create SourceAgents
     createSources();
 
@@ -648,15 +666,33 @@ void World::initialize(const QString &fileName, SimulationParameters *pparameter
     // precalculate and store coupling constants
     potential().updateCouplingConstants();
 
-    // Initialize OpenCL
-    opencl().initializeOpenCL(gpuID);
+    // precalculate and store the potential of charged defects
+    potential().initializeDefectPotential();
+
+    // build the per-site carrier potential (does nothing if coulomb.incremental is off)
+    potential().initializeCarrierField();
+
+    // calculate the long-range potential of the initial carriers (does nothing if coulomb.mesh is off)
+    potential().updateParticleMesh();
+
+    // solve for the space-charge potential of the initial carriers (does nothing if poisson.multigrid is off)
+    potential().initializePoisson();
+
+    // Initialize OpenCL only if it is used; its buffers cover the whole volume
+    if (!parameters().gridSparse && (parameters().useOpenCL || parameters().outputCoulomb != 0))
+    {
+        opencl().initializeOpenCL(gpuID);
+    }
     opencl().toggleOpenCL(parameters().useOpenCL);
 
+    // Keep the carriers of this MPI rank (does nothing without MPI)
+    mpi().initializeSlab();
+
     // Output parameters to terminal
     qDebug() << *m_keyValueParser;
 }
 
-void World::placeDefects(const QList<int>& siteIDs)
+void World::placeDefects(const QList<SiteID>& siteIDs)
 {
     qDebug("langmuir: World::placeDefects");
 
@@ -712,8 +748,8 @@ void World::placeDefects(const QList<int>& siteIDs)
         qDebug("langmuir: placing %d defects from checkpoint", toBePlacedIDs);
         for (int i = 0; i < toBePlacedIDs; i++)
         {
-            int site = siteIDs.at(i);
-            if (defectSiteIDs().contains(site) )
+            SiteID site = siteIDs.at(i);
+            if (electronGrid().agentType(site) == Agent::Defect)
             {
                 qDebug("langmuir: can not add defect");
                 qFatal("langmuir: defect already exists");
@@ -725,38 +761,27 @@ void World::placeDefects(const QList<int>& siteIDs)
         }
     }
 
-    // Place the rest of the defects randomly
+    // Place the rest of the defects randomly, drawing only from free sites
     if (toBeSeeded > 0)
     {
-        int tries = 0;
-        int maxTries = 10 * (electronGrid().volume());
-
         qDebug("langmuir: seeding %d defects", toBeSeeded);
-        for(int i = num; i < max;)
+        for(int i = num; i < max; i++)
         {
-            tries++;
-            int site = randomNumberGenerator().integer(0, electronGrid().volume() - 1);
-
-            if (!defectSiteIDs().contains(site))
+            SiteID site = electronGrid().randomFreeSite(randomNumberGenerator());
+            if (site < 0)
             {
-                electronGrid().registerDefect(site);
-                holeGrid().registerDefect(site);
-                defectSiteIDs().push_back(site);
-                num++;
-                i++;
-            }
-
-            if (tries > maxTries)
-            {
-                qDebug("langmuir: exceeded max tries (%d)", maxTries);
-                qFatal("langmuir: can not seed defects");
+                qFatal("langmuir: can not seed defects; no free sites");
             }
+            electronGrid().registerDefect(site);
+            holeGrid().registerDefect(site);
+            defectSiteIDs().push_back(site);
+            num++;
         }
     }
     qDebug("langmuir: placed %d defects", numDefects());
 }
 
-void World::placeElectrons(const QList<int>& siteIDs)
+void World::placeElectrons(const QList<SiteID>& siteIDs)
 {
     qDebug("langmuir: World::placeElectrons");
 
@@ -826,8 +851,8 @@ void World::placeElectrons(const QList<int>& siteIDs)
         {
             if (!source.tryToSeed(siteIDs[i]))
             {
-                qFatal("langmuir: can not inject electron at site %d",
-                       siteIDs[i]);
+                qFatal("langmuir: can not inject electron at site %lld",
+                       qint64(siteIDs[i]));
             }
         }
     }
@@ -838,8 +863,8 @@ void World::placeElectrons(const QList<int>& siteIDs)
         qDebug("langmuir: seeding %d electrons", toBeSeeded);
         if (parameters().seedCharges != 0)
         {
-            int tries = 0;
-            int maxTries = 10*(electronGrid().volume());
+            qint64 tries = 0;
+            qint64 maxTries = 10*qint64(electronGrid().volume());
             for(int i = numElectronAgents();
                 i < maxElectronAgents() * parameters().seedCharges;)
             {
@@ -848,7 +873,7 @@ void World::placeElectrons(const QList<int>& siteIDs)
                 if (tries > maxTries)
                 {
                     qDebug("langmuir: can not seed electrons");
-                    qFatal("exceeded max tries(%d)", maxTries);
+                    qFatal("exceeded max tries(%lld)", maxTries);
                 }
             }
         }
@@ -857,7 +882,7 @@ void World::placeElectrons(const QList<int>& siteIDs)
     qDebug("langmuir: placed %d electrons", numElectronAgents());
 }
 
-void World::placeHoles(const QList<int>& siteIDs)
+void World::placeHoles(const QList<SiteID>& siteIDs)
 {
     qDebug("langmuir: World::placeHoles");
 
@@ -927,8 +952,8 @@ void World::placeHoles(const QList<int>& siteIDs)
         {
             if (!source.tryToSeed(siteIDs[i]))
             {
-                qFatal("langmuir: can not inject hole at site %d",
-                       siteIDs[i]);
+                qFatal("langmuir: can not inject hole at site %lld",
+                       qint64(siteIDs[i]));
             }
         }
     }
@@ -939,8 +964,8 @@ void World::placeHoles(const QList<int>& siteIDs)
         qDebug("langmuir: seeding %d holes", toBeSeeded);
         if (parameters().seedCharges != 0)
         {
-            int tries = 0;
-            int maxTries = 10*(holeGrid().volume());
+            qint64 tries = 0;
+            qint64 maxTries = 10*qint64(holeGrid().volume());
             for(int i = numHoleAgents();
                 i < maxHoleAgents() * parameters().seedCharges;)
             {
@@ -949,7 +974,7 @@ void World::placeHoles(const QList<int>& siteIDs)
                 if (tries > maxTries)
                 {
                     qDebug("langmuir: can not seed electrons");
-                    qFatal("exceeded max tries(%d)", maxTries);
+                    qFatal("exceeded max tries(%lld)", maxTries);
                 }
             }
         }
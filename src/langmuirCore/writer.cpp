@@ -3,8 +3,10 @@
 #include "world.h"
 #include "cubicgrid.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "fluxagent.h"
 #include "openclhelper.h"
+#include "mpihelper.h"
 
 namespace LangmuirCore
 {
@@ -116,48 +118,48 @@ void XYZWriter::write()
         if (m_world.parameters().outputXyzE == true)
         {
             Grid &grid = m_world.electronGrid();
-            QList<ChargeAgent*> &charges = m_world.electrons();
-            foreach( ChargeAgent* pCharge, charges)
+            CarrierStore &charges = m_world.electrons();
+            for (int i = 0; i < charges.size(); i++)
             {
-                ChargeAgent &charge = *pCharge;
-                int site = charge.getCurrentSite();
-                m_stream << 'E'                  << ' '
-                         << grid.getIndexX(site) << ' '
-                         << grid.getIndexY(site) << ' '
-                         << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
-                         << &charge              << ' '
-                         << charge.lifetime()    << ' '
-                         << charge.pathlength()  << '\n';
+                int slot = charges.slot(i);
+                SiteID site = charges.site(slot);
+                m_stream << 'E'                       << ' '
+                         << grid.getIndexX(site)      << ' '
+                         << grid.getIndexY(site)      << ' '
+                         << grid.getIndexZ(site)      << ' '
+                         << site                      << ' '
+                         << charges.at(i)             << ' '
+                         << charges.lifetime(slot)    << ' '
+                         << charges.pathlength(slot)  << '\n';
             }
         }
 
         if (m_world.parameters().outputXyzH == true)
         {
             Grid &grid = m_world.holeGrid();
-            QList<ChargeAgent*> &charges = m_world.holes();
-            foreach( ChargeAgent* pCharge, charges)
+            CarrierStore &charges = m_world.holes();
+            for (int i = 0; i < charges.size(); i++)
             {
-                ChargeAgent &charge = *pCharge;
-                int site = charge.getCurrentSite();
-                m_stream << 'H'                  << ' '
-                         << grid.getIndexX(site) << ' '
-                         << grid.getIndexY(site) << ' '
-                         << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
-                         << &charge              << ' '
-                         << charge.lifetime()    << ' '
-                         << charge.pathlength()  << '\n';
+                int slot = charges.slot(i);
+                SiteID site = charges.site(slot);
+                m_stream << 'H'                       << ' '
+                         << grid.getIndexX(site)      << ' '
+                         << grid.getIndexY(site)      << ' '
+                         << grid.getIndexZ(site)      << ' '
+                         << site                      << ' '
+                         << charges.at(i)             << ' '
+                         << charges.lifetime(slot)    << ' '
+                         << charges.pathlength(slot)  << '\n';
             }
         }
 
         if (m_world.parameters().outputXyzD == true)
         {
             Grid &grid = m_world.electronGrid();
-            QList<int> &ids = m_world.defectSiteIDs();
+            QList<SiteID> &ids = m_world.defectSiteIDs();
             for (int i = 0; i < ids.size(); i++)
             {
-                int site = ids[i];
+                SiteID site = ids[i];
                 m_stream << 'D'                  << ' '
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
@@ -170,10 +172,10 @@ void XYZWriter::write()
         if (m_world.parameters().outputXyzT == true)
         {
             Grid &grid = m_world.electronGrid();
-            QList<int> &ids = m_world.trapSiteIDs();
+            QList<SiteID> &ids = m_world.trapSiteIDs();
             for (int i = 0; i < ids.size(); i++)
             {
-                int site = ids[i];
+                SiteID site = ids[i];
                 m_stream << 'T'                  << ' '
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
@@ -206,19 +208,19 @@ void XYZWriter::write()
         if (m_world.parameters().outputXyzE == true)
         {
             Grid &grid = m_world.electronGrid();
-            QList<ChargeAgent*> &charges = m_world.electrons();
-            foreach( ChargeAgent* pCharge, charges)
+            CarrierStore &charges = m_world.electrons();
+            for (int i = 0; i < charges.size(); i++)
             {
-                ChargeAgent &charge = *pCharge;
-                int site = charge.getCurrentSite();
-                m_stream << 'E'                  << ' '
-                         << grid.getIndexX(site) << ' '
-                         << grid.getIndexY(site) << ' '
-                         << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
-                         << &charge              << ' '
-                         << charge.lifetime()    << ' '
-                         << charge.pathlength()  << '\n';
+                int slot = charges.slot(i);
+                SiteID site = charges.site(slot);
+                m_stream << 'E'                       << ' '
+                         << grid.getIndexX(site)      << ' '
+                         << grid.getIndexY(site)      << ' '
+                         << grid.getIndexZ(site)      << ' '
+                         << site                      << ' '
+                         << charges.at(i)             << ' '
+                         << charges.lifetime(slot)    << ' '
+                         << charges.pathlength(slot)  << '\n';
             }
             for (int i = 0; i < m_world.maxElectronAgents() - m_world.numElectronAgents(); i++)
             {
@@ -236,19 +238,19 @@ void XYZWriter::write()
         if (m_world.parameters().outputXyzH == true)
         {
             Grid &grid = m_world.holeGrid();
-            QList<ChargeAgent*> &charges = m_world.holes();
-            foreach( ChargeAgent* pCharge, charges)
+            CarrierStore &charges = m_world.holes();
+            for (int i = 0; i < charges.size(); i++)
             {
-                ChargeAgent &charge = *pCharge;
-                int site = charge.getCurrentSite();
-                m_stream << 'H'                  << ' '
-                         << grid.getIndexX(site) << ' '
-                         << grid.getIndexY(site) << ' '
-                         << grid.getIndexZ(site) << ' '
-                         << site                 << ' '
-                         << &charge              << ' '
-                         << charge.lifetime()    << ' '
-                         << charge.pathlength()  << '\n';
+                int slot = charges.slot(i);
+                SiteID site = charges.site(slot);
+                m_stream << 'H'                       << ' '
+                         << grid.getIndexX(site)      << ' '
+                         << grid.getIndexY(site)      << ' '
+                         << grid.getIndexZ(site)      << ' '
+                         << site                      << ' '
+                         << charges.at(i)             << ' '
+                         << charges.lifetime(slot)    << ' '
+                         << charges.pathlength(slot)  << '\n';
             }
             for (int i = 0; i < m_world.maxHoleAgents() - m_world.numHoleAgents(); i++)
             {
@@ -266,10 +268,10 @@ void XYZWriter::write()
         if (m_world.parameters().outputXyzD == true)
         {
             Grid &grid = m_world.electronGrid();
-            QList<int> &ids = m_world.defectSiteIDs();
+            QList<SiteID> &ids = m_world.defectSiteIDs();
             for (int i = 0; i < ids.size(); i++)
             {
-                int site = ids[i];
+                SiteID site = ids[i];
                 m_stream << 'D'                  << ' '
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
@@ -292,10 +294,10 @@ void XYZWriter::write()
         if (m_world.parameters().outputXyzT == true)
         {
             Grid &grid = m_world.electronGrid();
-            QList<int> &ids = m_world.trapSiteIDs();
+            QList<SiteID> &ids = m_world.trapSiteIDs();
             for (int i = 0; i < ids.size(); i++)
             {
-                int site = ids[i];
+                SiteID site = ids[i];
                 m_stream << 'T'                  << ' '
                          << grid.getIndexX(site) << ' '
                          << grid.getIndexY(site) << ' '
@@ -367,10 +369,10 @@ void FluxWriter::write()
         m_stream << flux->attempts() << flux->successes();
         // << flux->successProbability() << flux->successRate();
     }
-    m_stream << m_world.numElectronAgents()
+    m_stream << m_world.numElectronAgents() + m_world.mpi().remoteElectrons()
              //<< m_world.percentElectronAgents()
              //<< m_world.reachedElectronAgents()
-             << m_world.numHoleAgents()
+             << m_world.numHoleAgents() + m_world.mpi().remoteHoles()
              //<< m_world.percentHoleAgents()
              //<< m_world.reachedHoleAgents()
              << m_world.parameters().simulationStart.msecsTo(now)
@@ -381,7 +383,7 @@ void FluxWriter::write()
 void CarrierWriter::write(ChargeAgent &charge)
 {
     Grid &grid = charge.getGrid();
-    int site = charge.getCurrentSite();
+    SiteID site = charge.getCurrentSite();
     m_stream << site << ' '
              << grid.getIndexX(site) << ' '
              << grid.getIndexY(site) << ' '
@@ -397,10 +399,10 @@ void CarrierWriter::write(ChargeAgent &charge)
 void ExcitonWriter::write(ChargeAgent &charge1, ChargeAgent &charge2, bool recombined)
 {
     Grid &grid1 = charge1.getGrid();
-    int site1 = charge1.getCurrentSite();
+    SiteID site1 = charge1.getCurrentSite();
 
     Grid &grid2 = charge2.getGrid();
-    int site2 = charge2.getCurrentSite();
+    SiteID site2 = charge2.getCurrentSite();
 
     m_stream << site1 << ' '
              << grid1.getIndexX(site1) << ' '
@@ -445,14 +447,14 @@ void GridImage::save(QString name, int scale)
     m_image.save(info.absoluteFilePath(),"png",100);
 }
 
-void GridImage::drawSites( QList<int> &sites, QColor color, int layer )
+void GridImage::drawSites( QList<SiteID> &sites, QColor color, int layer )
 {
     if (sites.size()<=0)return;
     Grid &grid = m_world.electronGrid();
     m_painter.setPen(color);
     for(int i = 0; i < sites.size(); i++)
     {
-        int ndx = sites[i];
+        SiteID ndx = sites[i];
         if(grid.getIndexZ(ndx)== layer)
         {
             m_painter.drawPoint(QPoint(grid.getIndexX(ndx),grid.getIndexY(ndx)));
@@ -460,14 +462,14 @@ void GridImage::drawSites( QList<int> &sites, QColor color, int layer )
     }
 }
 
-void GridImage::drawCharges( QList<ChargeAgent *> &charges,QColor color, int layer )
+void GridImage::drawCharges( CarrierStore &charges,QColor color, int layer )
 {
     if (charges.size()<=0)return;
     Grid &grid = m_world.electronGrid();
     m_painter.setPen(color);
     for(int i = 0; i < charges.size(); i++)
     {
-        int ndx = charges[i]->getCurrentSite();
+        SiteID ndx = charges.site(charges.slot(i));
         if(grid.getIndexZ(ndx)== layer)
         {
             m_painter.drawPoint(QPoint(grid.getIndexX(ndx),grid.getIndexY(ndx)));
@@ -528,7 +530,7 @@ void Logger::saveGridPotential(const QString& name)
         {
             for(int k = 0; k < m_world.electronGrid().zSize(); k++)
             {
-                int si = grid.getIndexS(i,j,k);
+                SiteID si = grid.getIndexS(i,j,k);
                 stream << si
                        << i
                        << j
@@ -568,7 +570,7 @@ void Logger::saveCoulombEnergy(const QString& name)
         {
             for(int k = 0; k < grid.zSize(); k++)
             {
-                int si = grid.getIndexS(i,j,k);
+                SiteID si = grid.getIndexS(i,j,k);
                 stream << si << ' '
                        << i  << ' '
                        << j  << ' '
@@ -603,7 +605,7 @@ void Logger::reportExciton(ChargeAgent &charge1, ChargeAgent &charge2, bool reco
 void Logger::saveTrapImage(const QString& name)
 {
     if (!m_world.parameters().outputIsOn) return;
-    QList<int>& siteIDs = m_world.trapSiteIDs();
+    QList<SiteID>& siteIDs = m_world.trapSiteIDs();
     if(siteIDs.size()==0)return;
     GridImage image(m_world,Qt::white,this);
     image.drawSites(siteIDs,Qt::green,0);
@@ -613,7 +615,7 @@ void Logger::saveTrapImage(const QString& name)
 void Logger::saveDefectImage(const QString& name)
 {
     if (!m_world.parameters().outputIsOn) return;
-    QList<int>& siteIDs = m_world.defectSiteIDs();
+    QList<SiteID>& siteIDs = m_world.defectSiteIDs();
     if(siteIDs.size()==0)return;
     GridImage image(m_world,Qt::white,this);
     image.drawSites(siteIDs,Qt::cyan,0);
@@ -623,7 +625,7 @@ void Logger::saveDefectImage(const QString& name)
 void Logger::saveElectronImage(const QString& name)
 {
     if (!m_world.parameters().outputIsOn) return;
-    QList<ChargeAgent*>& chargeIDs = m_world.electrons();
+    CarrierStore& chargeIDs = m_world.electrons();
     if(chargeIDs.size()==0)return;
     GridImage image(m_world,Qt::white,this);
     image.drawCharges(chargeIDs,Qt::red,0);
@@ -633,7 +635,7 @@ void Logger::saveElectronImage(const QString& name)
 void Logger::saveHoleImage(const QString& name)
 {
     if (!m_world.parameters().outputIsOn) return;
-    QList<ChargeAgent*>& chargeIDs = m_world.holes();
+    CarrierStore& chargeIDs = m_world.holes();
     if(chargeIDs.size()==0)return;
     GridImage image(m_world,Qt::white,this);
     image.drawCharges(chargeIDs,Qt::blue,0);
@@ -643,8 +645,8 @@ void Logger::saveHoleImage(const QString& name)
 void Logger::saveCarriersImage(const QString& name)
 {
     if (!m_world.parameters().outputIsOn) return;
-    QList<ChargeAgent*>& electrons = m_world.electrons();
-    QList<ChargeAgent*>& holes = m_world.holes();
+    CarrierStore& electrons = m_world.electrons();
+    CarrierStore& holes = m_world.holes();
     if((electrons.size() + holes.size())==0)return;
     GridImage image(m_world,Qt::white,this);
     image.drawCharges(electrons,Qt::red,0);
@@ -655,10 +657,10 @@ void Logger::saveCarriersImage(const QString& name)
 void Logger::saveImage(const QString& name)
 {
     if (!m_world.parameters().outputIsOn) return;
-    QList<int>& traps = m_world.trapSiteIDs();
-    QList<int>& defects = m_world.defectSiteIDs();
-    QList<ChargeAgent*>& electrons = m_world.electrons();
-    QList<ChargeAgent*>& holes = m_world.holes();
+    QList<SiteID>& traps = m_world.trapSiteIDs();
+    QList<SiteID>& defects = m_world.defectSiteIDs();
+    CarrierStore& electrons = m_world.electrons();
+    CarrierStore& holes = m_world.holes();
     GridImage image(m_world,Qt::white,this);
     if (traps.size()>0) { image.drawSites(traps,Qt::green,0); }
     if (defects.size()>0) { image.drawSites(defects,Qt::cyan,0); }
@@ -3,6 +3,7 @@
 #include "openclhelper.h"
 #include "checkpointer.h"
 #include "chargeagent.h"
+#include "carrierstore.h"
 #include "parameters.h"
 #include "simulation.h"
 #include "cubicgrid.h"
@@ -192,7 +193,7 @@ void LangmuirViewer::updateElectronCloud()
 
         int j = 0;
         for (int i = 0; i < m_world->numElectronAgents(); i++) {
-            int s = m_world->electrons().at(i)->getCurrentSite();
+            SiteID s = m_world->electrons().at(i)->getCurrentSite();
             m_electrons->vertices()[j + 0] = m_world->electronGrid().getIndexX(s) - m_gridHalfX + 0.5;
             m_electrons->vertices()[j + 1] = m_world->electronGrid().getIndexY(s) - m_gridHalfY + 0.5;
             m_electrons->vertices()[j + 2] = m_world->electronGrid().getIndexZ(s) - m_gridHalfZ + 0.5;
@@ -213,7 +214,7 @@ void LangmuirViewer::updateDefectCloud()
 
         int j = 0;
         for (int i = 0; i < m_world->numDefects(); i++) {
-            int s = m_world->defectSiteIDs().at(i);
+            SiteID s = m_world->defectSiteIDs().at(i);
             m_defects->vertices()[j + 0] = m_world->electronGrid().getIndexX(s) - m_gridHalfX + 0.5;
             m_defects->vertices()[j + 1] = m_world->electronGrid().getIndexY(s) - m_gridHalfY + 0.5;
             m_defects->vertices()[j + 2] = m_world->electronGrid().getIndexZ(s) - m_gridHalfZ + 0.5;
@@ -234,7 +235,7 @@ void LangmuirViewer::updateTrapCloud()
 
         int j = 0;
         for (int i = 0; i < m_world->numTraps(); i++) {
-            int s = m_world->trapSiteIDs().at(i);
+            SiteID s = m_world->trapSiteIDs().at(i);
             m_traps->vertices()[j + 0] = m_world->electronGrid().getIndexX(s) - m_gridHalfX + 0.5;
             m_traps->vertices()[j + 1] = m_world->electronGrid().getIndexY(s) - m_gridHalfY + 0.5;
             m_traps->vertices()[j + 2] = m_world->electronGrid().getIndexZ(s) - m_gridHalfZ + 0.5;
@@ -255,7 +256,7 @@ void LangmuirViewer::updateHoleCloud()
 
         int j = 0;
         for (int i = 0; i < m_world->numHoleAgents(); i++) {
-            int s = m_world->holes().at(i)->getCurrentSite();
+            SiteID s = m_world->holes().at(i)->getCurrentSite();
             m_holes->vertices()[j + 0] = m_world->holeGrid().getIndexX(s) - m_gridHalfX + 0.5;
             m_holes->vertices()[j + 1] = m_world->holeGrid().getIndexY(s) - m_gridHalfY + 0.5;
             m_holes->vertices()[j + 2] = m_world->holeGrid().getIndexZ(s) - m_gridHalfZ + 0.5;
@@ -442,7 +443,7 @@ void LangmuirViewer::generateIsoSurface(float value)
     MarchingCubes::scalar_field& scalar = m_isoSurface->createScalarField(xsize, ysize, zsize, 1.0);
     m_isoSurface->setIsoValue(value);
 
-    foreach (int site, m_world->trapSiteIDs())
+    foreach (SiteID site, m_world->trapSiteIDs())
     {
         int x = m_world->electronGrid().getIndexX(site);
         int y = m_world->electronGrid().getIndexY(site);
@@ -1292,6 +1293,11 @@ void LangmuirViewer::toggleCoulomb(bool on)
 
     m_world->parameters().coulombCarriers = on;
 
+    // The step loop is specialized for the Coulomb setting
+    if (m_simulation != NULL) {
+        m_simulation->selectStepKernel();
+    }
+
     emit isUsingCoulomb(m_world->parameters().coulombCarriers);
 
     if (on) {
@@ -1576,7 +1582,7 @@ void LangmuirViewer::drawTraps(QImage &image, QColor bcolor, QColor fcolor)
     painter.fillRect(QRect(0,0,xsize,ysize), bcolor);
     painter.setPen(fcolor);
 
-    foreach(int s, m_world->trapSiteIDs())
+    foreach(SiteID s, m_world->trapSiteIDs())
     {
         int z = m_world->electronGrid().getIndexZ(s);
 
@@ -0,0 +1,283 @@
+/**
+  * @file carrierstore.cpp
+  * @brief # Tests that CarrierStore::compact() and CarrierStore::sort() keep the store consistent.
+  */
+#include "check.h"
+#include "world.h"
+#include "carrierstore.h"
+#include "chargeagent.h"
+#include "cubicgrid.h"
+#include "parameters.h"
+
+#include <QCoreApplication>
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+/**
+ * @brief the parameters of a world with about 100 electrons seeded at random sites
+ */
+static SimulationParameters parameters()
+{
+    SimulationParameters par;
+    par.randomSeed = 17;
+    par.gridX = 16;
+    par.gridY = 16;
+    par.gridZ = 4;
+    par.electronPercentage = 0.1;
+    par.seedCharges = 1.0;
+    par.outputIsOn = false;
+    return par;
+}
+
+/**
+ * @brief check that the slots, indices, agents and packed coordinates of a store agree
+ */
+static void checkConsistent(CarrierStore &store, Grid &grid)
+{
+    int free = 0;
+    for (int slot = 0; slot < store.capacity(); slot++)
+    {
+        int index = store.indexOf(slot);
+        if (index < 0)
+        {
+            free += 1;
+            CHECK(store.site(slot) == -1);
+            continue;
+        }
+        CHECK(index < store.size());
+        CHECK(store.slot(index) == slot);
+    }
+    CHECK(free + store.size() == store.capacity());
+
+    CHECK(store.agents().size() == store.size());
+    CHECK(store.activeSlots().size() == store.size());
+    CHECK(store.activeX().size() == store.size());
+    CHECK(store.activeY().size() == store.size());
+    CHECK(store.activeZ().size() == store.size());
+    for (int i = 0; i < store.size(); i++)
+    {
+        int slot = store.slot(i);
+        CHECK(store.at(i) == store.agent(slot));
+        CHECK(store.at(i)->slot() == slot);
+        CHECK(store.at(i)->getCurrentSite() == store.site(slot));
+        CHECK(store.activeX()[i] == grid.getIndexX(store.site(slot)));
+        CHECK(store.activeY()[i] == grid.getIndexY(store.site(slot)));
+        CHECK(store.activeZ()[i] == grid.getIndexZ(store.site(slot)));
+        CHECK(grid.agentAddress(store.site(slot)) == store.at(i));
+    }
+}
+
+/**
+ * @brief flag a carrier for removal and take it off the grid, like a carrier that reached a drain
+ */
+static void flagRemoved(ChargeAgent *charge)
+{
+    charge->setRemoved(true);
+    charge->completeTick();
+}
+
+/**
+ * @brief the first empty site, from a starting site on
+ */
+static SiteID emptySite(Grid &grid, SiteID start)
+{
+    for (SiteID site = start; site < grid.volume(); site++)
+    {
+        if (grid.agentType(site) == Agent::Empty)
+        {
+            return site;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief compact() is the same as removing the flagged carriers one at a time, in order
+ *
+ * Both ways must leave the same carriers in the same order, free the same slots in the
+ * same order, and so hand out the same slots to new carriers.
+ */
+static void testCompact()
+{
+    SimulationParameters par1 = parameters();
+    SimulationParameters par2 = parameters();
+    ConfigurationInfo configInfo1;
+    ConfigurationInfo configInfo2;
+    World world1(par1, configInfo1, 1, 0);
+    World world2(par2, configInfo2, 1, 0);
+    CarrierStore &store1 = world1.electrons();
+    CarrierStore &store2 = world2.electrons();
+
+    int count = store1.size();
+    int capacity = store1.capacity();
+    CHECK(count > 50);
+    CHECK(store2.size() == count);
+    CHECK(store1.activeSlots() == store2.activeSlots());
+
+    // Remove the first, the last, and a run in the middle, as well as every third carrier
+    QVector<bool> flagged(count, false);
+    QVector<int> keptSlots;
+    for (int i = 0; i < count; i++)
+    {
+        flagged[i] = (i == 0 || i == count - 1 || (i >= 20 && i < 25) || i % 3 == 1);
+        if (!flagged[i])
+        {
+            keptSlots.push_back(store1.slot(i));
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (flagged[i])
+        {
+            flagRemoved(store1.at(i));
+        }
+    }
+    store1.compact();
+
+    for (int i = 0; i < count; i++)
+    {
+        if (flagged[i])
+        {
+            flagRemoved(store2.at(i));
+        }
+    }
+    for (int i = 0; i < store2.size(); )
+    {
+        if (store2.at(i)->removed())
+        {
+            store2.remove(i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    CHECK(store1.activeSlots() == keptSlots);
+    CHECK(store2.activeSlots() == keptSlots);
+    CHECK(store1.capacity() == capacity);
+    checkConsistent(store1, world1.electronGrid());
+    checkConsistent(store2, world2.electronGrid());
+
+    // New carriers reuse the freed slots, in the same order, without growing the store
+    SiteID site = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        site = emptySite(world1.electronGrid(), site);
+        CHECK(site >= 0 && emptySite(world2.electronGrid(), site) == site);
+        if (site < 0)
+        {
+            break;
+        }
+        ChargeAgent *charge1 = store1.create(site);
+        ChargeAgent *charge2 = store2.create(site);
+        CHECK(charge1->slot() == charge2->slot());
+        CHECK(store1.indexOf(charge1->slot()) == store1.size() - 1);
+    }
+    CHECK(store1.capacity() == capacity);
+    CHECK(store1.activeSlots() == store2.activeSlots());
+    checkConsistent(store1, world1.electronGrid());
+
+    // Compacting with nothing flagged changes nothing
+    QVector<int> active = store1.activeSlots();
+    store1.compact();
+    CHECK(store1.activeSlots() == active);
+
+    // Compacting everything empties the store
+    for (int i = 0; i < store1.size(); i++)
+    {
+        flagRemoved(store1.at(i));
+    }
+    store1.compact();
+    CHECK(store1.size() == 0);
+    checkConsistent(store1, world1.electronGrid());
+}
+
+/**
+ * @brief the Morton code of a site, one bit at a time
+ */
+static quint64 morton(int x, int y, int z)
+{
+    quint64 code = 0;
+    for (int bit = 0; bit < 21; bit++)
+    {
+        code |= quint64((x >> bit) & 1) << (3 * bit);
+        code |= quint64((y >> bit) & 1) << (3 * bit + 1);
+        code |= quint64((z >> bit) & 1) << (3 * bit + 2);
+    }
+    return code;
+}
+
+/**
+ * @brief sort() puts the carriers in Morton order, and keeps the store consistent
+ */
+static void testSort()
+{
+    SimulationParameters par = parameters();
+    ConfigurationInfo configInfo;
+    World world(par, configInfo, 1, 0);
+    CarrierStore &store = world.electrons();
+    Grid &grid = world.electronGrid();
+
+    // Sort after some carriers were removed, so there are free slots
+    for (int i = 0; i < store.size(); i += 4)
+    {
+        flagRemoved(store.at(i));
+    }
+    store.compact();
+
+    QVector<SiteID> before;
+    for (int i = 0; i < store.size(); i++)
+    {
+        before.push_back(store.site(store.slot(i)));
+    }
+    qSort(before);
+
+    store.sort();
+    checkConsistent(store, grid);
+
+    // The same carriers are at the same sites
+    QVector<SiteID> after;
+    for (int i = 0; i < store.size(); i++)
+    {
+        after.push_back(store.site(store.slot(i)));
+    }
+    qSort(after);
+    CHECK(before == after);
+
+    // Strictly increasing codes, since every carrier is on its own site
+    for (int i = 1; i < store.size(); i++)
+    {
+        CHECK(morton(store.activeX()[i - 1], store.activeY()[i - 1], store.activeZ()[i - 1]) <
+              morton(store.activeX()[i], store.activeY()[i], store.activeZ()[i]));
+    }
+
+    // Sorting again changes nothing
+    QVector<int> active = store.activeSlots();
+    store.sort();
+    CHECK(store.activeSlots() == active);
+
+    // New carriers go to the end, and compact() after sort() keeps the sorted order
+    SiteID site = emptySite(grid, 0);
+    CHECK(site >= 0);
+    if (site >= 0)
+    {
+        ChargeAgent *charge = store.create(site);
+        CHECK(store.at(store.size() - 1) == charge);
+    }
+    flagRemoved(store.at(1));
+    active.remove(1);
+    store.compact();
+    checkConsistent(store, grid);
+    CHECK(store.activeSlots().mid(0, active.size()) == active);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    testCompact();
+    testSort();
+    return checkResult();
+}
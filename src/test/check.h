@@ -0,0 +1,65 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <QDebug>
+#include <cmath>
+
+/**
+ * @file check.h
+ * @brief Minimal checks shared by the langmuir tests.
+ *
+ * A failed check prints the file, line and expression, and the test keeps going, so one run
+ * shows every failure.  Each test's main() ends with checkResult(), which ctest reads.
+ */
+namespace LangmuirTest
+{
+
+/**
+ * @brief the number of failed checks so far
+ */
+inline int& failures()
+{
+    static int count = 0;
+    return count;
+}
+
+/**
+ * @brief the exit code of a test: zero if every check passed
+ */
+inline int checkResult()
+{
+    if (failures() > 0)
+    {
+        qDebug("test: %d check(s) failed", failures());
+        return 1;
+    }
+    qDebug("test: all checks passed");
+    return 0;
+}
+
+}
+
+//! fail if a condition is false
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+        { \
+            qDebug("%s:%d: CHECK(%s) failed", __FILE__, __LINE__, #condition); \
+            LangmuirTest::failures() += 1; \
+        } \
+    } while (0)
+
+//! fail if two values differ by more than a tolerance
+#define CHECK_CLOSE(a, b, tolerance) \
+    do { \
+        double checkA = (a); \
+        double checkB = (b); \
+        if (!(std::fabs(checkA - checkB) <= (tolerance))) \
+        { \
+            qDebug("%s:%d: CHECK_CLOSE(%s, %s) failed: %.10g != %.10g", \
+                   __FILE__, __LINE__, #a, #b, checkA, checkB); \
+            LangmuirTest::failures() += 1; \
+        } \
+    } while (0)
+
+#endif
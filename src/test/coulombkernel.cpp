@@ -0,0 +1,136 @@
+/**
+  * @file coulombkernel.cpp
+  * @brief # Tests that every instruction set of the Coulomb kernel gives the scalar sum.
+  */
+#include "check.h"
+#include "coulombkernel.h"
+#include "rand.h"
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+//! the size of the table in each direction
+static const int Cutoff = 7;
+
+/**
+ * @brief sum the table over carriers one image at a time, without the tricks of the kernel
+ * @param period the period along x, y and z, or 0 if not periodic
+ */
+static qint64 directSum(const QVector<qint64> &table, const int period[3],
+                        const QVector<int> &x, const QVector<int> &y, const QVector<int> &z,
+                        int xi, int yi, int zi)
+{
+    qint64 sum = 0;
+    for (int j = 0; j < x.size(); j++)
+    {
+        int d[3] = { x[j] - xi, y[j] - yi, z[j] - zi };
+        for (int axis = 0; axis < 3; axis++)
+        {
+            d[axis] = abs(d[axis]);
+            if (period[axis] > 0 && period[axis] - d[axis] < d[axis])
+            {
+                d[axis] = period[axis] - d[axis];
+            }
+        }
+        if (d[0] < Cutoff && d[1] < Cutoff && d[2] < Cutoff)
+        {
+            sum += table[(d[0] * Cutoff + d[1]) * Cutoff + d[2]];
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief compare a kernel against the direct sum for many sites and carrier counts
+ * @param set the instruction set to use
+ * @param period the period along x, y and z, or 0 if not periodic
+ */
+static void compare(CoulombKernel::InstructionSet set, const int period[3])
+{
+    CoulombKernel kernel;
+    kernel.setInstructionSet(set);
+    if (kernel.instructionSet() != set)
+    {
+        qDebug("test: %s is not supported, skipped", qPrintable(CoulombKernel::toQString(set)));
+        CHECK(kernel.instructionSet() == CoulombKernel::Scalar);
+        return;
+    }
+    kernel.setPeriods(period[0], period[1], period[2]);
+
+    // Large values of both signs, so a lost or doubled term can not cancel out
+    Random random(3);
+    random.setGenerator("xoshiro256");
+    QVector<qint64> table(Cutoff * Cutoff * Cutoff);
+    for (int i = 0; i < table.size(); i++)
+    {
+        table[i] = (qint64(random.integer(-1000000000, 1000000000)) << 20) + random.integer(0, 1000);
+    }
+    kernel.setTable(table, Cutoff);
+
+    const int size[3] = { 24, 20, 16 };
+    int failures = 0;
+
+    // Every count up to a few vectors, so the tails of the vector loops are covered
+    for (int count = 0; count <= 70; count++)
+    {
+        QVector<int> x(count), y(count), z(count);
+        for (int j = 0; j < count; j++)
+        {
+            x[j] = random.integer(0, size[0] - 1);
+            y[j] = random.integer(0, size[1] - 1);
+            z[j] = random.integer(0, size[2] - 1);
+        }
+        for (int n = 0; n < 20; n++)
+        {
+            // Some sites sit on the edges, where the nearest image is on the other side
+            int xi = (n % 4 == 0) ? 0 : random.integer(0, size[0] - 1);
+            int yi = (n % 4 == 1) ? size[1] - 1 : random.integer(0, size[1] - 1);
+            int zi = random.integer(0, size[2] - 1);
+            qint64 expected = directSum(table, period, x, y, z, xi, yi, zi);
+            qint64 result = kernel.sum(x.constData(), y.constData(), z.constData(), count, xi, yi, zi);
+            if (result != expected)
+            {
+                failures += 1;
+            }
+        }
+    }
+    qDebug("test: %s with periods %d %d %d: %d wrong sums", qPrintable(CoulombKernel::toQString(set)),
+           period[0], period[1], period[2], failures);
+    CHECK(failures == 0);
+}
+
+/**
+ * @brief every instruction set, open and periodic
+ */
+static void testInstructionSets()
+{
+    const CoulombKernel::InstructionSet sets[3] = {
+        CoulombKernel::Scalar, CoulombKernel::AVX2, CoulombKernel::AVX512
+    };
+    const int open[3] = { 0, 0, 0 };
+    const int periodic[3] = { 24, 20, 16 };
+    const int slab[3] = { 0, 20, 16 };
+    for (int i = 0; i < 3; i++)
+    {
+        compare(sets[i], open);
+        compare(sets[i], periodic);
+        compare(sets[i], slab);
+    }
+}
+
+/**
+ * @brief a kernel without a table sums to zero
+ */
+static void testEmpty()
+{
+    CoulombKernel kernel;
+    int x[1] = { 0 };
+    CHECK(kernel.sum(x, x, x, 1, 0, 0, 0) == 0);
+}
+
+int main()
+{
+    testInstructionSets();
+    testEmpty();
+    return checkResult();
+}
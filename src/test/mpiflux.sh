@@ -0,0 +1,86 @@
+#!/bin/sh
+# Check that a run split over MPI ranks carries the same current as a serial run.
+#
+#   mpiflux.sh <langmuir> <mpiexec> [ranks] [mpiexec flags...]
+#
+# Runs a Coulomb-free transistor on 1 rank and on 4 ranks (or [ranks]), and compares
+# the electrons the right drain collected over the second half of the runs, once the
+# current is steady.  The counts should agree within counting noise.  The flags go
+# before -np, for example --oversubscribe when there are fewer cores than ranks.
+set -e
+
+langmuir=$1
+mpiexec=$2
+ranks=${3:-4}
+if [ -z "$langmuir" ] || [ -z "$mpiexec" ]; then
+    echo "usage: $0 <langmuir> <mpiexec> [ranks] [mpiexec flags...]"
+    exit 2
+fi
+shift $(( $# < 3 ? $# : 3 ))
+flags="$*"
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# run <ranks>: run the transistor in its own directory
+run()
+{
+    dir="$work/np$1"
+    mkdir -p "$dir"
+    cat > "$dir/sim.inp" <<INPUT
+[Parameters]
+simulation.type         = transistor
+random.seed             = 1
+
+grid.x                  = 128
+grid.y                  = 32
+grid.z                  = 1
+
+coulomb.carriers        = false
+use.opencl              = false
+
+output.is.on            = true
+output.step.chk         = 0
+iterations.print        = 1000
+iterations.real         = 20000
+
+electron.percentage     = 0.05
+hole.percentage         = 0.00
+
+voltage.right           = 2.00
+voltage.left            = 0.00
+source.rate             = 0.90
+drain.rate              = 0.90
+INPUT
+    (cd "$dir" && "$mpiexec" $flags -np "$1" "$langmuir" -n 1 sim.inp > log.txt 2>&1) || {
+        cat "$dir/log.txt"
+        echo "mpiflux: langmuir failed on $1 rank(s)"
+        exit 1
+    }
+}
+
+# collected <ranks>: right drain successes between the middle and the end of the run
+collected()
+{
+    awk 'NR == 1 { for (i = 1; i <= NF; i++) if ($i == "eDrainR:success") column = i; next }
+         $1 + 0 == 10000 { middle = $column }
+         { last = $column }
+         END { printf "%d\n", last - middle }' "$work/np$1/out.dat"
+}
+
+run 1
+run "$ranks"
+
+serial=$(collected 1)
+split=$(collected "$ranks")
+echo "mpiflux: right drain collected $serial electrons on 1 rank, $split on $ranks ranks"
+
+# Pass if the difference is within 5 standard deviations of counting noise
+awk -v a="$serial" -v b="$split" 'BEGIN {
+    if (a <= 0 || b <= 0) exit 1
+    d = a - b; if (d < 0) d = -d
+    exit (d <= 5.0 * sqrt(a + b)) ? 0 : 1
+}' || {
+    echo "mpiflux: the currents differ by more than the counting noise"
+    exit 1
+}
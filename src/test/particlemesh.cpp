@@ -0,0 +1,218 @@
+/**
+  * @file particlemesh.cpp
+  * @brief # Tests of the long-range Coulomb potential (coulomb.mesh) against direct Ewald sums.
+  */
+#include "check.h"
+#include "world.h"
+#include "carrierstore.h"
+#include "particlemesh.h"
+#include "parameters.h"
+
+#include <QCoreApplication>
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+//! the splitting parameter of the tests, in inverse sites
+static const double Alpha = 0.375;
+
+/**
+ * @brief a point charge on the grid
+ */
+struct Charge
+{
+    //! the position
+    int x, y, z;
+
+    //! the charge, in units of e
+    int q;
+};
+
+/**
+ * @brief collect the carriers of a world as point charges
+ */
+static QVector<Charge> charges(World &world)
+{
+    QVector<Charge> result;
+    CarrierStore *stores[2] = { &world.electrons(), &world.holes() };
+    for (int j = 0; j < 2; j++)
+    {
+        for (int i = 0; i < stores[j]->size(); i++)
+        {
+            Charge charge = { stores[j]->activeX()[i], stores[j]->activeY()[i], stores[j]->activeZ()[i],
+                              stores[j]->unitCharge() };
+            result.push_back(charge);
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief the long-range potential of periodic charges at a point, summed over the reciprocal lattice
+ */
+static double reciprocalSum(const QVector<Charge> &charges, int size[3], int x, int y, int z)
+{
+    double volume = double(size[0]) * size[1] * size[2];
+    double qMax = 2.0 * Alpha * sqrt(40.0);
+    int m[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        m[axis] = int(qMax * size[axis] / (2.0 * M_PI)) + 1;
+    }
+
+    double sum = 0;
+    for (int i = -m[0]; i <= m[0]; i++)
+    {
+        for (int j = -m[1]; j <= m[1]; j++)
+        {
+            for (int k = -m[2]; k <= m[2]; k++)
+            {
+                double kx = 2.0 * M_PI * i / size[0];
+                double ky = 2.0 * M_PI * j / size[1];
+                double kz = 2.0 * M_PI * k / size[2];
+                double k2 = kx * kx + ky * ky + kz * kz;
+                if (k2 == 0 || k2 > qMax * qMax)
+                {
+                    continue;
+                }
+                double structure = 0;
+                for (int c = 0; c < charges.size(); c++)
+                {
+                    structure += charges[c].q * cos(kx * (x - charges[c].x) + ky * (y - charges[c].y) +
+                                                    kz * (z - charges[c].z));
+                }
+                sum += 4.0 * M_PI / volume / k2 * exp(-k2 / (4.0 * Alpha * Alpha)) * structure;
+            }
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief the long-range potential of charges at a point, summed over the images along y (and z) in real space
+ * @param images the number of images on each side
+ * @param layer true to only repeat along y
+ */
+static double imageSum(const QVector<Charge> &charges, int size[3], int x, int y, int z, int images,
+                       bool layer)
+{
+    int zImages = layer ? 0 : images;
+    double sum = 0;
+    for (int c = 0; c < charges.size(); c++)
+    {
+        for (int j = -images; j <= images; j++)
+        {
+            for (int k = -zImages; k <= zImages; k++)
+            {
+                double dx = charges[c].x - x;
+                double dy = charges[c].y - y + j * size[1];
+                double dz = charges[c].z - z + k * size[2];
+                double r = sqrt(dx * dx + dy * dy + dz * dz);
+                sum += charges[c].q * ((r > 0) ? erf(Alpha * r) / r : 2.0 * Alpha / sqrt(M_PI));
+            }
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief make a world with two electrons and two holes, and the mesh of their long-range potential
+ */
+static void compare(int xSize, int ySize, int zSize, ParticleMesh::Boundary boundary, double tolerance)
+{
+    SimulationParameters par;
+    par.gridX = xSize;
+    par.gridY = ySize;
+    par.gridZ = zSize;
+    par.electronPercentage = 0.05;
+    par.holePercentage = 0.05;
+    par.hDrainRRate = par.drainRate;
+    par.outputIsOn = false;
+
+    int size[3] = { xSize, ySize, zSize };
+    int top = zSize - 1;
+
+    ConfigurationInfo configInfo;
+    configInfo.electrons.push_back(1 + xSize * (2 + ySize * 0));
+    configInfo.electrons.push_back(7 + xSize * (8 + ySize * qMin(2, top)));
+    configInfo.holes.push_back(4 + xSize * (5 + ySize * qMin(1, top)));
+    configInfo.holes.push_back((xSize - 3) + xSize * (5 + ySize * top));
+
+    World world(par, configInfo, 1, 0);
+    QVector<Charge> points = charges(world);
+    CHECK(points.size() == 4);
+
+    ParticleMesh mesh;
+    mesh.initialize(xSize, ySize, zSize, boundary, Alpha, 1.0);
+    mesh.update(world.electrons(), world.holes());
+
+    // The slab potential is defined up to a constant, so compare differences to the first site
+    double offset = 0;
+    double error = 0;
+    bool first = true;
+    for (int z = 0; z < zSize; z++)
+    {
+        for (int y = 0; y < ySize; y += 3)
+        {
+            for (int x = 0; x < xSize; x += 3)
+            {
+                int site = x + xSize * (y + ySize * z);
+                double potential = mesh.electronPotential(site) + mesh.holePotential(site);
+                double direct = 0;
+                if (boundary == ParticleMesh::Periodic)
+                {
+                    direct = reciprocalSum(points, size, x, y, z);
+                }
+                else
+                {
+                    // The dipole images fall off like 1 / images, which the extrapolation removes
+                    bool layer = (zSize == 1);
+                    int images = layer ? 2000 : 200;
+                    direct = 2.0 * imageSum(points, size, x, y, z, 2 * images, layer) -
+                             imageSum(points, size, x, y, z, images, layer);
+                }
+                if (first)
+                {
+                    offset = (boundary == ParticleMesh::Periodic) ? 0 : potential - direct;
+                    first = false;
+                }
+                error = qMax(error, fabs(potential - direct - offset));
+            }
+        }
+    }
+    qDebug("test: %d x %d x %d mesh differs from the direct sum by %g", xSize, ySize, zSize, error);
+    CHECK(error < tolerance);
+}
+
+/**
+ * @brief the periodic mesh is the reciprocal-space Ewald sum
+ */
+static void testPeriodic()
+{
+    compare(16, 12, 10, ParticleMesh::Periodic, 1e-9);
+}
+
+/**
+ * @brief the slab mesh is open along x and periodic along y and z
+ */
+static void testSlab()
+{
+    compare(16, 12, 6, ParticleMesh::Slab, 1e-4);
+}
+
+/**
+ * @brief a slab with a single layer is open along x and z and periodic along y
+ */
+static void testLayer()
+{
+    compare(16, 12, 1, ParticleMesh::Slab, 1e-6);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    testPeriodic();
+    testSlab();
+    testLayer();
+    return checkResult();
+}
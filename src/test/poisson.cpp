@@ -0,0 +1,110 @@
+/**
+  * @file poisson.cpp
+  * @brief # Tests of the mean-field space-charge potential (poisson.multigrid).
+  */
+#include "check.h"
+#include "world.h"
+#include "simulation.h"
+#include "carrierstore.h"
+#include "parameters.h"
+
+#include <QCoreApplication>
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+/**
+ * @brief move a lone electron from the middle of a grid in a uniform field, and return how far it went along x
+ * @param seed the random seed
+ * @param poisson turns on poisson.multigrid
+ * @param update poisson.update
+ * @param steps the number of steps to take
+ */
+static int drift(quint64 seed, bool poisson, int update, int steps)
+{
+    SimulationParameters par;
+    par.randomSeed = seed;
+    par.gridX = 128;
+    par.gridY = 16;
+    par.gridZ = 4;
+    par.voltageRight = 4.0;
+    par.outputIsOn = false;
+    par.iterationsPrint = steps;
+    par.iterationsReal = steps;
+    par.poissonMultigrid = poisson;
+    par.poissonUpdate = update;
+
+    // Room for just the one electron, so the source never injects; the drain is far away
+    par.electronPercentage = 1.0 / (par.gridX * par.gridY * par.gridZ);
+
+    // The middle of the grid, where Potential solves for the potential of a lone charge
+    ConfigurationInfo configInfo;
+    configInfo.electrons.push_back(64 + 128 * (8 + 16 * 2));
+
+    World world(par, configInfo, 1, 0);
+    Simulation simulation(world);
+    simulation.performIterations(steps);
+
+    CHECK(world.electrons().size() == 1);
+    if (world.electrons().size() != 1)
+    {
+        return 0;
+    }
+    return world.electrons().activeX()[0] - 64;
+}
+
+/**
+ * @brief a lone carrier does not push itself around
+ *
+ * The solved potential includes the carrier, which Potential::poissonSelfEnergy() takes out
+ * again.  Solved once at the start, the carrier's share is the potential of a lone charge at
+ * the middle, so the moves are decided exactly as without poisson.multigrid.
+ */
+static void testSelfInteraction()
+{
+    for (quint64 seed = 1; seed <= 20; seed++)
+    {
+        CHECK(drift(seed, false, 0, 100) == drift(seed, true, 0, 100));
+    }
+}
+
+/**
+ * @brief a lone carrier drifts the same with and without poisson.multigrid, solved every step
+ */
+static void testDrift()
+{
+    const int trials = 100;
+    double sum[2] = { 0, 0 };
+    double squares[2] = { 0, 0 };
+    for (int i = 0; i < trials; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            double dx = drift(quint64(1000 + i), j == 1, 1, 100);
+            sum[j] += dx;
+            squares[j] += dx * dx;
+        }
+    }
+
+    double mean[2];
+    double error[2];
+    for (int j = 0; j < 2; j++)
+    {
+        mean[j] = sum[j] / trials;
+        error[j] = std::sqrt((squares[j] / trials - mean[j] * mean[j]) / (trials - 1));
+    }
+    qDebug("test: drift %.2f +/- %.2f sites without poisson.multigrid, %.2f +/- %.2f with",
+           mean[0], error[0], mean[1], error[1]);
+
+    // The field moves electrons to the right; the carrier's own potential would wash that out
+    CHECK(mean[0] > 4.0 * error[0]);
+    CHECK(std::fabs(mean[1] - mean[0]) < 4.0 * std::sqrt(error[0] * error[0] + error[1] * error[1]));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    testSelfInteraction();
+    testDrift();
+    return checkResult();
+}
@@ -0,0 +1,184 @@
+/**
+  * @file random.cpp
+  * @brief # Known answer tests for the random number generators.
+  */
+#include "check.h"
+#include "rand.h"
+
+#include <QVector>
+#include <climits>
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+/**
+ * @brief check the next four numbers of a stream against a block
+ */
+static void checkBlock(RandomStream &stream, quint32 a, quint32 b, quint32 c, quint32 d)
+{
+    CHECK(stream.next() == a);
+    CHECK(stream.next() == b);
+    CHECK(stream.next() == c);
+    CHECK(stream.next() == d);
+}
+
+/**
+ * @brief Philox4x32-10 against the Random123 known answers
+ *
+ * RandomStream puts the block count, id, step and stream in counter words 0 to 3, and the
+ * seed in the key, so a zero stream is the Random123 vector with zero counter and key.  The
+ * other Random123 vectors need a nonzero block count, so the second stream is checked against
+ * values from the reference implementation instead.
+ */
+static void testPhilox()
+{
+    RandomStream zero(0, 0, 0, 0);
+    checkBlock(zero, 0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u);
+
+    RandomStream stream(0x89abcdefu, 1000, 2, 7);
+    checkBlock(stream, 0xadd47242u, 0x2af062c2u, 0xea5713e5u, 0x95043c34u);
+    checkBlock(stream, 0xa967e588u, 0xfee355bcu, 0x5afc29b3u, 0x37c05a6eu);
+
+    // A stream is a pure function of the seed and its arguments
+    Random random(0x89abcdefu);
+    RandomStream again = random.stream(1000, 2, 7);
+    checkBlock(again, 0xadd47242u, 0x2af062c2u, 0xea5713e5u, 0x95043c34u);
+
+    // Bounded integers stay in range
+    RandomStream bounded(12345, 0, 0, 0);
+    for (int i = 0; i < 10000; i++)
+    {
+        int value = bounded.integer(-3, 5);
+        CHECK(value >= -3 && value <= 5);
+        double uniform = bounded.random();
+        CHECK(uniform >= 0.0 && uniform < 1.0);
+    }
+
+    // The first blocks of many streams at once (a count that is not a multiple of the lanes)
+    const int count = 37;
+    QVector<quint32> blocks(4 * count);
+    RandomStream::firstBlocks(0x89abcdefu, 1000, 2, count, blocks.data());
+    CHECK(blocks[7] == 0xadd47242u && blocks[count + 7] == 0x2af062c2u);
+    CHECK(blocks[2 * count + 7] == 0xea5713e5u && blocks[3 * count + 7] == 0x95043c34u);
+    for (int id = 0; id < count; id++)
+    {
+        RandomStream single(0x89abcdefu, 1000, 2, id);
+        checkBlock(single, blocks[id], blocks[count + id], blocks[2 * count + id], blocks[3 * count + id]);
+    }
+}
+
+/**
+ * @brief the reference xoshiro256++ step, from the authors' C code
+ */
+static quint64 xoshiroReference(quint64 s[4])
+{
+    quint64 result = ((s[0] + s[3]) << 23 | (s[0] + s[3]) >> 41) + s[0];
+    quint64 t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/**
+ * @brief xoshiro256++ and its bounded integers against known answers
+ *
+ * The reference step is checked against the published outputs from the state {1, 2, 3, 4}.
+ * The first lane of the generator starts from the seed expanded with splitmix64, so every
+ * fourth number it draws is checked against the reference; the other lanes are jumped ahead
+ * 2^128 numbers, and are checked against values from the reference implementation.  Doubles
+ * carry the top 53 bits of a number, so they are compared exactly.
+ */
+static void testXoshiro()
+{
+    quint64 known[4] = { 1, 2, 3, 4 };
+    CHECK(xoshiroReference(known) == Q_UINT64_C(41943041));
+    CHECK(xoshiroReference(known) == Q_UINT64_C(58720359));
+    CHECK(xoshiroReference(known) == Q_UINT64_C(3588806011781223));
+    CHECK(xoshiroReference(known) == Q_UINT64_C(3591011842654386));
+    CHECK(xoshiroReference(known) == Q_UINT64_C(9228616714210784205));
+
+    const quint64 seed = 0x89abcdefu;
+    quint64 lane[4];
+    quint64 x = seed;
+    for (int k = 0; k < 4; k++)
+    {
+        x += Q_UINT64_C(0x9e3779b97f4a7c15);
+        quint64 z = x;
+        z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+        z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+        lane[k] = z ^ (z >> 31);
+    }
+
+    Random random(seed);
+    random.setGenerator("xoshiro256");
+    CHECK(random.generator() == Random::Xoshiro);
+
+    // The first block, from all four lanes
+    const quint64 block[4] = {
+        Q_UINT64_C(0x000074cc3730219a), Q_UINT64_C(0x00006b2b64bb5ca7),
+        Q_UINT64_C(0x001e360f81d21fdd), Q_UINT64_C(0x00036dd4dd4fb8b4)
+    };
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(quint64(random.random() * 9007199254740992.0) == block[i]);
+    }
+
+    // The first lane, across several buffer fills
+    CHECK(xoshiroReference(lane) >> 11 == block[0]);
+    for (int i = 4; i < 1000; i++)
+    {
+        quint64 value = quint64(random.random() * 9007199254740992.0);
+        if (i % 4 == 0)
+        {
+            CHECK(value == xoshiroReference(lane) >> 11);
+        }
+    }
+
+    // Lemire's bounded integers, from the same numbers after seeding again
+    random.seed(seed);
+    const int digits[8] = { 0, 0, 9, 1, 2, 4, 8, 2 };
+    for (int i = 0; i < 8; i++)
+    {
+        CHECK(random.integer(0, 9) == digits[i]);
+    }
+    const int wide[4] = { 640729, -797185, 40301, -249078 };
+    for (int i = 0; i < 4; i++)
+    {
+        CHECK(random.integer(-1000000, 1000000) == wide[i]);
+    }
+
+    // The full int range does not overflow the range computation
+    random.seed(seed);
+    CHECK(random.integer(INT_MIN, INT_MAX) == int(0x000074cc3730219aull >> 21) + INT_MIN);
+
+    // Bounded integers stay in range and are uniform (a chi-square test with 6 degrees of freedom)
+    const int draws = 70000;
+    int counts[7] = { 0, 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < draws; i++)
+    {
+        int value = random.integer(-3, 3);
+        CHECK(value >= -3 && value <= 3);
+        if (value >= -3 && value <= 3)
+        {
+            counts[value + 3] += 1;
+        }
+    }
+    double chi2 = 0;
+    for (int i = 0; i < 7; i++)
+    {
+        double expected = draws / 7.0;
+        chi2 += (counts[i] - expected) * (counts[i] - expected) / expected;
+    }
+    CHECK(chi2 < 6.0 + 5.0 * sqrt(12.0));
+}
+
+int main()
+{
+    testPhilox();
+    testXoshiro();
+    return checkResult();
+}
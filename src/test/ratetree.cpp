@@ -0,0 +1,164 @@
+/**
+  * @file ratetree.cpp
+  * @brief # Tests of the partial sums and sampling of the rejection-free rate tree.
+  */
+#include "check.h"
+#include "ratetree.h"
+#include "rand.h"
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+/**
+ * @brief the sum of the rates of a tree, one leaf at a time
+ */
+static double leafSum(const RateTree &tree)
+{
+    double sum = 0;
+    for (int i = 0; i < tree.size(); i++)
+    {
+        sum += tree.rate(i);
+    }
+    return sum;
+}
+
+/**
+ * @brief the total follows every set(), and reserve() and clear() keep or drop the rates
+ */
+static void testSums()
+{
+    RateTree tree;
+    CHECK(tree.size() == 1);
+    CHECK(tree.total() == 0);
+
+    // Rounded up to a power of two
+    tree.clear(5);
+    CHECK(tree.size() == 8);
+    CHECK(tree.total() == 0);
+
+    Random random(7);
+    random.setGenerator("xoshiro256");
+    QVector<double> rates(5, 0.0);
+    for (int n = 0; n < 1000; n++)
+    {
+        int index = random.integer(0, 4);
+        rates[index] = (random.random() < 0.2) ? 0.0 : random.range(0.0, 1e3);
+        tree.set(index, rates[index]);
+        CHECK(tree.rate(index) == rates[index]);
+        CHECK_CLOSE(tree.total(), leafSum(tree), 1e-9 * leafSum(tree));
+    }
+
+    // Growing keeps the rates and the sums
+    tree.reserve(100);
+    CHECK(tree.size() == 128);
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK(tree.rate(i) == rates[i]);
+    }
+    for (int i = 5; i < tree.size(); i++)
+    {
+        CHECK(tree.rate(i) == 0);
+    }
+    CHECK_CLOSE(tree.total(), leafSum(tree), 1e-9 * leafSum(tree));
+    tree.set(99, 2.5);
+    CHECK_CLOSE(tree.total(), leafSum(tree), 1e-9 * leafSum(tree));
+
+    // Asking for less room does nothing
+    tree.reserve(10);
+    CHECK(tree.size() == 128);
+    CHECK(tree.rate(99) == 2.5);
+
+    tree.clear(3);
+    CHECK(tree.size() == 4);
+    CHECK(tree.total() == 0);
+
+    // The sums are rebuilt from the children, so setting a rate back leaves no round-off behind
+    tree.set(0, 1.0);
+    tree.set(1, 1e17);
+    tree.set(1, 0.0);
+    CHECK(tree.total() == 1.0);
+}
+
+/**
+ * @brief find() splits [0, total()) into the shares of the items in order, and skips zero rates
+ */
+static void testFind()
+{
+    RateTree tree;
+    tree.clear(8);
+    const double rates[8] = { 1.0, 0.0, 2.0, 0.0, 0.0, 3.0, 0.0, 0.0 };
+    for (int i = 0; i < 8; i++)
+    {
+        tree.set(i, rates[i]);
+    }
+    CHECK(tree.total() == 6.0);
+
+    CHECK(tree.find(0.0) == 0);
+    CHECK(tree.find(0.999) == 0);
+    CHECK(tree.find(1.0) == 2);
+    CHECK(tree.find(2.999) == 2);
+    CHECK(tree.find(3.0) == 5);
+    CHECK(tree.find(5.999) == 5);
+
+    // A value pushed to the total by round-off still lands on an item with a rate
+    CHECK(tree.find(6.0) == 5);
+    CHECK(tree.find(6.0 + 1e-12) == 5);
+
+    // A lone item
+    tree.clear(8);
+    tree.set(6, 0.5);
+    CHECK(tree.find(0.0) == 6);
+    CHECK(tree.find(0.5) == 6);
+}
+
+/**
+ * @brief sampling with uniform values picks items in proportion to their rates (a chi-square test)
+ */
+static void testSampling()
+{
+    const int items = 37;
+    RateTree tree;
+    tree.clear(items);
+    Random random(11);
+    random.setGenerator("xoshiro256");
+    for (int i = 0; i < items; i++)
+    {
+        // Some items have no rate, and the rates span three orders of magnitude
+        tree.set(i, (i % 5 == 3) ? 0.0 : exp(random.range(0.0, 7.0)));
+    }
+
+    const int draws = 200000;
+    QVector<int> counts(items, 0);
+    for (int n = 0; n < draws; n++)
+    {
+        int index = tree.find(random.random() * tree.total());
+        CHECK(index >= 0 && index < items);
+        CHECK(tree.rate(index) > 0);
+        if (index >= 0 && index < items)
+        {
+            counts[index] += 1;
+        }
+    }
+
+    double chi2 = 0;
+    int dof = -1;
+    for (int i = 0; i < items; i++)
+    {
+        if (tree.rate(i) > 0)
+        {
+            double expected = draws * tree.rate(i) / tree.total();
+            chi2 += (counts[i] - expected) * (counts[i] - expected) / expected;
+            dof += 1;
+        }
+    }
+    qDebug("test: sampling %d items, chi2 = %.1f for %d dof", items, chi2, dof);
+    CHECK(chi2 < dof + 5.0 * sqrt(2.0 * dof));
+}
+
+int main()
+{
+    testSums();
+    testFind();
+    testSampling();
+    return checkResult();
+}
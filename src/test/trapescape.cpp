@@ -0,0 +1,137 @@
+/**
+  * @file trapescape.cpp
+  * @brief # Tests that trap.escape moves carriers out of trap basins like the step by step simulation.
+  */
+#include "check.h"
+#include "world.h"
+#include "simulation.h"
+#include "carrierstore.h"
+#include "parameters.h"
+
+#include <QCoreApplication>
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+//! the grid is gridX by gridY, with the basin in the middle, far from the electrodes
+static const int GridX = 32;
+static const int GridY = 2;
+
+//! the x of the first basin site
+static const int BasinX = 16;
+
+//! the histogram bins: the basin, then the x of the carrier from BasinX - 8 to BasinX + 8 (clipped)
+static const int Bins = 18;
+
+/**
+ * @brief run a lone electron from the first site of a basin, and return the histogram bin it ends up in
+ * @param seed the random seed
+ * @param sites the number of basin sites, along x
+ * @param escape turns on trap.escape (and random.counter, so the exits are drawn from the counter streams)
+ * @param steps the number of steps, in one run
+ */
+static int run(quint64 seed, int sites, bool escape, int steps)
+{
+    SimulationParameters par;
+    par.randomSeed = seed;
+    par.gridX = GridX;
+    par.gridY = GridY;
+    par.gridZ = 1;
+    // Room for just the one electron, so the source only injects once the drain took it
+    par.electronPercentage = 1.0 / (GridX * GridY);
+    par.trapPercentage = double(sites) / (GridX * GridY);
+    par.trapPotential = 0.1;
+    par.voltageRight = 0.5;
+    par.outputIsOn = false;
+    par.iterationsPrint = steps;
+    par.iterationsReal = steps;
+    par.trapEscape = escape ? 1 : 0;
+    par.randomCounter = escape;
+
+    ConfigurationInfo configInfo;
+    for (int i = 0; i < sites; i++)
+    {
+        configInfo.traps.push_back(BasinX + i);
+    }
+    configInfo.electrons.push_back(BasinX);
+
+    World world(par, configInfo, 1, 0);
+    Simulation simulation(world);
+    simulation.performIterations(steps);
+
+    CHECK(world.electrons().size() == 1);
+    if (world.electrons().size() != 1)
+    {
+        return 0;
+    }
+    int x = world.electrons().activeX()[0];
+    int y = world.electrons().activeY()[0];
+    if (y == 0 && x >= BasinX && x < BasinX + sites)
+    {
+        return 0;
+    }
+    return 1 + qBound(0, x - (BasinX - 8), Bins - 2);
+}
+
+/**
+ * @brief compare the histograms of trap.escape and step by step runs with a chi-square test
+ *
+ * The basin bin is the chance of not having left after the steps (the exit time), and the other
+ * bins show which way the carrier left and how far it got (the exit site).
+ */
+static void compare(int sites, int steps)
+{
+    const int trials = 1000;
+    QVector<int> exact(Bins, 0);
+    QVector<int> escaped(Bins, 0);
+    for (int i = 0; i < trials; i++)
+    {
+        exact[run(i + 1, sites, false, steps)] += 1;
+        escaped[run(trials + i + 1, sites, true, steps)] += 1;
+    }
+
+    // The two histograms have the same number of trials
+    double chi2 = 0;
+    int dof = -1;
+    for (int b = 0; b < Bins; b++)
+    {
+        int total = exact[b] + escaped[b];
+        if (total > 0)
+        {
+            chi2 += double(exact[b] - escaped[b]) * (exact[b] - escaped[b]) / total;
+            dof += 1;
+        }
+    }
+    qDebug("test: %d-site basin, %d steps: %d and %d still trapped, chi2 = %.1f for %d dof",
+           sites, steps, exact[0], escaped[0], chi2, dof);
+    CHECK(dof >= 1);
+    CHECK(chi2 < dof + 5.0 * sqrt(2.0 * dof));
+}
+
+/**
+ * @brief a lone trap site (the mean exit time is about 50 steps)
+ */
+static void testOneSite()
+{
+    compare(1, 10);
+    compare(1, 40);
+    compare(1, 160);
+}
+
+/**
+ * @brief two neighboring trap sites, where the carrier hops back and forth before it leaves
+ */
+static void testTwoSites()
+{
+    compare(2, 10);
+    compare(2, 40);
+    compare(2, 160);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    testOneSite();
+    testTwoSites();
+    return checkResult();
+}
@@ -0,0 +1,112 @@
+/**
+  * @file walkers.cpp
+  * @brief # Tests that carriers.batched moves every carrier exactly like the carrier by carrier step.
+  */
+#include "check.h"
+#include "world.h"
+#include "simulation.h"
+#include "carrierstore.h"
+#include "drainagent.h"
+#include "parameters.h"
+
+#include <QCoreApplication>
+
+using namespace LangmuirCore;
+using namespace LangmuirTest;
+
+/**
+ * @brief the state of every carrier after a run, in list order
+ */
+struct Carriers
+{
+    //! the sites, electrons then holes
+    QVector<SiteID> sites;
+
+    //! the lifetimes, electrons then holes
+    QVector<int> lifetimes;
+
+    //! the pathlengths, electrons then holes
+    QVector<int> pathlengths;
+
+    //! the carriers taken by the electron and hole drains
+    QVector<unsigned long> drained;
+};
+
+/**
+ * @brief run a device with electrons and holes and no Coulomb interactions
+ * @param batched turns on carriers.batched
+ * @param gridZ the number of layers
+ * @param range the hopping range
+ * @param sparse turns on grid.sparse
+ */
+static Carriers run(bool batched, int gridZ, int range, bool sparse)
+{
+    SimulationParameters par;
+    par.randomSeed = 11;
+    par.gridX = 16;
+    par.gridY = 24;
+    par.gridZ = gridZ;
+    par.gridSparse = sparse;
+    par.hoppingRange = range;
+    par.electronPercentage = 0.2;
+    par.holePercentage = 0.1;
+    par.trapPercentage = 0.05;
+    par.trapPotential = 0.1;
+    par.voltageRight = 1.0;
+    // Transistors only drain electrons by default; let the holes in on the right and out on the left
+    par.hSourceRRate = 0.9;
+    par.hDrainLRate = 0.9;
+    par.outputIsOn = false;
+    par.iterationsPrint = 500;
+    par.iterationsReal = 500;
+    par.randomCounter = true;
+    par.carriersBatched = batched;
+
+    ConfigurationInfo configInfo;
+    World world(par, configInfo, 1, 0);
+    Simulation simulation(world);
+    simulation.performIterations(500);
+
+    Carriers carriers;
+    CarrierStore *stores[2] = { &world.electrons(), &world.holes() };
+    for (int j = 0; j < 2; j++)
+    {
+        CarrierStore &charges = *stores[j];
+        for (int i = 0; i < charges.size(); i++)
+        {
+            int slot = charges.slot(i);
+            carriers.sites.push_back(charges.site(slot));
+            carriers.lifetimes.push_back(charges.lifetime(slot));
+            carriers.pathlengths.push_back(charges.pathlength(slot));
+        }
+    }
+    carriers.drained.push_back(world.electronDrainAgentRight().successes());
+    carriers.drained.push_back(world.holeDrainAgentLeft().successes());
+    return carriers;
+}
+
+/**
+ * @brief compare batched and carrier by carrier runs, carrier by carrier
+ */
+static void compare(int gridZ, int range, bool sparse)
+{
+    Carriers serial = run(false, gridZ, range, sparse);
+    Carriers batched = run(true, gridZ, range, sparse);
+    qDebug("test: grid.z = %d, hopping.range = %d, grid.sparse = %d: %d carriers, %lu and %lu drained",
+           gridZ, range, int(sparse), serial.sites.size(), serial.drained[0], serial.drained[1]);
+    CHECK(serial.drained[0] > 0);
+    CHECK(serial.sites == batched.sites);
+    CHECK(serial.lifetimes == batched.lifetimes);
+    CHECK(serial.pathlengths == batched.pathlengths);
+    CHECK(serial.drained == batched.drained);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    compare(1, 1, false);
+    compare(3, 1, false);
+    compare(1, 2, false);
+    compare(2, 1, true);
+    return checkResult();
+}